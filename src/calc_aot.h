@@ -0,0 +1,443 @@
+#ifndef ALGOVISU_CALC_AOT_H
+#define ALGOVISU_CALC_AOT_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <cerrno>
+    #include <dlfcn.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+    #define ALGOVISU_HAS_DLOPEN 1
+#endif
+
+#include "calc_ast.h"
+#include "calc_hash.h"
+#include "calc_register_vm.h"
+
+
+namespace algovisu
+{
+    // A kernel over the rows of the columns. It gives the rows evaluated to
+    // out, which are all of them, or the rows before the first one of a
+    // division by zero, as calc_column_vm.
+    using calc_column_kernel = std::size_t (*)(calc_value_t const * const * columns, std::size_t rows,
+                                               calc_value_t * out);
+
+    // An expression, with the literals bound to the columns.
+    struct calc_aot_expression
+    {
+        calc_ast ast;
+        std::vector<calc_column_binding> columns;
+    };
+
+    struct calc_aot_options
+    {
+        std::string compiler;           // $CXX, or c++ if it's empty. The words are split at the blanks.
+        std::string flags = "-O2";      // split at the blanks too, and no word is seen by the shell.
+        std::string cacheDirectory;     // $XDG_CACHE_HOME/algovisu_calc_aot, or ~/.cache's, if it's empty.
+    };
+
+    // Emits the C++ source of the kernels of a set of expressions.
+    //
+    // A kernel is a loop over the rows, with the expression inlined as a
+    // statement per an operator, in the unsigned arithmetic that wraps as
+    // calc_apply does. The literals are constants, so the compiler folds
+    // and specializes them, and the bound ones are the loads of the row.
+    //
+    // The shared object exports a single function, which gives the table
+    // of the kernels in the order of the expressions.
+    //
+    //  std::size_t algovisu_calc_kernels(calc_column_kernel const ** kernels)
+    inline void calc_aot_source(std::vector<calc_aot_expression> const& expressions, std::string & out)
+    {
+        auto operand = [&out](calc_ast const& ast, std::vector<std::uint32_t> const& column, std::uint32_t i) {
+            char buffer[32];
+            if (ast.nodes[i].op != calc_op::literal) {
+                std::snprintf(buffer, sizeof(buffer), "v%u", i);
+            } else if (column[i] != ~std::uint32_t(0)) {
+                std::snprintf(buffer, sizeof(buffer), "u64(c%u[row])", column[i]);
+            } else {
+                std::snprintf(buffer, sizeof(buffer), "0x%llxull",
+                              static_cast<unsigned long long>(static_cast<std::uint64_t>(ast.nodes[i].value)));
+            }
+            out += buffer;
+        };
+
+        out.clear();
+        out += "// Generated by algovisu calc_aot_source.\n"
+               "#include <cstddef>\n"
+               "#include <cstdint>\n\n"
+               "namespace\n{\n"
+               "    using u64 = std::uint64_t;\n"
+               "    using i64 = std::int64_t;\n"
+               "    using kernel_t = std::size_t (*)(i64 const * const *, std::size_t, i64 *);\n";
+        std::vector<std::uint32_t> column;
+        std::vector<bool> used;
+        char buffer[128];
+        for (std::size_t k = 0; k < expressions.size(); ++k) {
+            calc_ast const& ast = expressions[k].ast;
+            column.assign(ast.size(), ~std::uint32_t(0));
+            used.clear();
+            for (calc_column_binding const& b : expressions[k].columns) {
+                if (b.node < ast.size() && ast.nodes[b.node].op == calc_op::literal) {
+                    column[b.node] = b.column;
+                    if (used.size() <= b.column) {
+                        used.resize(b.column + 1);
+                    }
+                    used[b.column] = true;
+                }
+            }
+
+            std::snprintf(buffer, sizeof(buffer),
+                          "\n    std::size_t kernel%zu(i64 const * const * columns, std::size_t rows, i64 * out)\n    {\n", k);
+            out += buffer;
+            if (ast.empty()) {
+                out += "        return 0;\n    }\n";
+                continue;
+            }
+            for (std::size_t c = 0; c < used.size(); ++c) {
+                if (used[c]) {
+                    std::snprintf(buffer, sizeof(buffer), "        i64 const * const c%zu = columns[%zu];\n", c, c);
+                    out += buffer;
+                }
+            }
+            out += "        for (std::size_t row = 0; row < rows; ++row) {\n";
+            for (std::uint32_t i = 0; i < ast.size(); ++i) {
+                calc_node const& node = ast.nodes[i];
+                if (node.op == calc_op::literal) {
+                    continue;
+                }
+                if (node.op == calc_op::div) {
+                    // the checks of calc_apply.
+                    std::snprintf(buffer, sizeof(buffer), "            u64 const d%u = ", i);
+                    out += buffer;
+                    operand(ast, column, node.rhs);
+                    std::snprintf(buffer, sizeof(buffer), ";\n            if (d%u == 0) { return row; }\n"
+                                                          "            u64 const v%u = d%u == ~u64(0) ? 0 - ", i, i, i);
+                    out += buffer;
+                    operand(ast, column, node.lhs);
+                    out += " : u64(i64(";
+                    operand(ast, column, node.lhs);
+                    std::snprintf(buffer, sizeof(buffer), ") / i64(d%u));\n", i);
+                    out += buffer;
+                    continue;
+                }
+                std::snprintf(buffer, sizeof(buffer), "            u64 const v%u = ", i);
+                out += buffer;
+                operand(ast, column, node.lhs);
+                out += ' ';
+                out += to_char(node.op);
+                out += ' ';
+                operand(ast, column, node.rhs);
+                out += ";\n";
+            }
+            out += "            out[row] = i64(";
+            operand(ast, column, ast.root());
+            out += ");\n";
+            out += "        }\n"
+                   "        return rows;\n"
+                   "    }\n";
+        }
+        out += "} // namespace\n\n"
+               "extern \"C\" std::size_t algovisu_calc_kernels(kernel_t const ** kernels)\n{\n"
+               "    static kernel_t const table[] = {";
+        for (std::size_t k = 0; k < expressions.size(); ++k) {
+            std::snprintf(buffer, sizeof(buffer), "%s kernel%zu", k ? "," : "", k);
+            out += buffer;
+        }
+        std::snprintf(buffer, sizeof(buffer), "%s};\n    *kernels = table;\n    return %zu;\n}\n",
+                      expressions.empty() ? " nullptr " : " ", expressions.size());
+        out += buffer;
+    }
+
+#if defined(ALGOVISU_HAS_DLOPEN)
+    // The kernels of a loaded shared object.
+    class calc_aot_module
+    {
+    public:
+        calc_aot_module() = default;
+
+        calc_aot_module(calc_aot_module && other) noexcept
+            : handle_(std::exchange(other.handle_, nullptr))
+            , kernels_(std::move(other.kernels_))
+            , path_(std::move(other.path_))
+            , cached_(other.cached_)
+        { }
+
+        calc_aot_module & operator = (calc_aot_module && other) noexcept
+        {
+            if (this != &other) {
+                close();
+                handle_ = std::exchange(other.handle_, nullptr);
+                kernels_ = std::move(other.kernels_);
+                path_ = std::move(other.path_);
+                cached_ = other.cached_;
+            }
+            return *this;
+        }
+
+        ~calc_aot_module()
+        {
+            close();
+        }
+
+        bool is_open() const { return handle_ != nullptr; }
+        std::size_t size() const { return kernels_.size(); }
+        calc_column_kernel kernel(std::size_t i) const { return kernels_[i]; }
+
+        // The path of the shared object, and if it was in the cache already.
+        std::string const& path() const { return path_; }
+        bool cached() const { return cached_; }
+
+        std::size_t run(std::size_t i, calc_value_t const * const * columns, std::size_t rows, calc_value_t * out) const
+        {
+            return kernels_[i](columns, rows, out);
+        }
+
+        bool open(std::string const& path, bool cached)
+        {
+            close();
+            handle_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+            if (!handle_) {
+                return false;
+            }
+            using table_t = std::size_t (*)(calc_column_kernel const **);
+            table_t const table = reinterpret_cast<table_t>(dlsym(handle_, "algovisu_calc_kernels"));
+            if (!table) {
+                close();
+                return false;
+            }
+            calc_column_kernel const * kernels = nullptr;
+            std::size_t const count = table(&kernels);
+            kernels_.assign(kernels, kernels + count);
+            path_ = path;
+            cached_ = cached;
+            return true;
+        }
+
+        void close()
+        {
+            if (handle_) {
+                dlclose(handle_);
+                handle_ = nullptr;
+            }
+            kernels_.clear();
+            path_.clear();
+            cached_ = false;
+        }
+
+    private:
+        void * handle_ = nullptr;
+        std::vector<calc_column_kernel> kernels_;
+        std::string path_;
+        bool cached_ = false;
+    };
+
+    // Builds the kernels of a set of expressions into a shared object by
+    // the local compiler, and loads it.
+    //
+    // The shared objects are cached in a directory by the hash of their
+    // source and the compiler command, so a set of the same expressions
+    // is compiled once, and then loaded in a few microseconds by the next
+    // runs. The source and the log of the compiler are kept next to it.
+    //
+    // The cache directory is made with the mode 0700, and it must be a real
+    // directory of the user that the others can't write to, or build() fails.
+    // The names of the objects are predictable, so an other user able to
+    // write there could have any code loaded.
+    //
+    // NOTE: the processes may build the same set at once. Each one compiles
+    //          to its own temporary file, and renames it to the cached one,
+    //          which is atomic, so a reader never loads a partial one.
+    //
+    // ex.)
+    //  calc_aot_compiler compiler;
+    //  calc_aot_module module;
+    //  if (compiler.build(expressions, module)) {
+    //      std::size_t const done = module.run(0, columns, rows, out.data());
+    //  }
+    class calc_aot_compiler
+    {
+    public:
+        explicit calc_aot_compiler(calc_aot_options const& options = {})
+            : options_(options)
+        {
+            if (options_.compiler.empty()) {
+                char const * const cxx = std::getenv("CXX");
+                options_.compiler = cxx && *cxx ? cxx : "c++";
+            }
+            if (options_.cacheDirectory.empty()) {
+                // as the XDG base directories, a relative one is ignored.
+                char const * const cache = std::getenv("XDG_CACHE_HOME");
+                char const * const home = std::getenv("HOME");
+                if (cache && *cache == '/') {
+                    options_.cacheDirectory = std::string(cache) + "/algovisu_calc_aot";
+                } else if (home && *home) {
+                    options_.cacheDirectory = std::string(home) + "/.cache/algovisu_calc_aot";
+                }
+            }
+        }
+
+        calc_aot_options const& options() const { return options_; }
+
+        // false if the cache directory isn't private, the compiler fails,
+        // or the shared object can't be loaded.
+        bool build(std::vector<calc_aot_expression> const& expressions, calc_aot_module & module)
+        {
+            if (!make_directory()) {
+                return false;
+            }
+            calc_aot_source(expressions, source_);
+            std::string const base = cache_path();
+            std::string const library = base + ".so";
+            if (is_private(library, S_IFREG) && module.open(library, true)) {
+                return true;
+            }
+
+            std::string const source = base + ".cpp";
+            std::string sourceTemporary = source;
+            if (!create_temporary(sourceTemporary, source_)) {
+                return false;
+            }
+            if (std::rename(sourceTemporary.c_str(), source.c_str()) != 0) {
+                std::remove(sourceTemporary.c_str());
+                return false;
+            }
+            // the names are taken, and the compiler writes over the empty files.
+            std::string libraryTemporary = library;
+            if (!create_temporary(libraryTemporary, std::string())) {
+                return false;
+            }
+            std::string const log = base + ".log";
+            std::string logTemporary = log;
+            if (!create_temporary(logTemporary, std::string())) {
+                std::remove(libraryTemporary.c_str());
+                return false;
+            }
+            std::string const command = split_quote(options_.compiler) + " " + split_quote(options_.flags)
+                                      + " -shared -fPIC -o " + quote(libraryTemporary) + " " + quote(source)
+                                      + " > " + quote(logTemporary) + " 2>&1";
+            bool const compiled = std::system(command.c_str()) == 0;
+            // the log is kept for a failure too.
+            if (std::rename(logTemporary.c_str(), log.c_str()) != 0) {
+                std::remove(logTemporary.c_str());
+            }
+            if (!compiled || std::rename(libraryTemporary.c_str(), library.c_str()) != 0) {
+                std::remove(libraryTemporary.c_str());
+                return false;
+            }
+            return module.open(library, false);
+        }
+
+    private:
+        std::string cache_path() const
+        {
+            std::string key = options_.compiler + '\n' + options_.flags + '\n' + source_;
+            calc_hash128 const hash = calc_text_hash(key.data(), key.size());
+            char name[48];
+            std::snprintf(name, sizeof(name), "/calc_%016llx%016llx",
+                          static_cast<unsigned long long>(hash.hi), static_cast<unsigned long long>(hash.lo));
+            return options_.cacheDirectory + name;
+        }
+
+        // Makes the cache directory, and ~/.cache if it's not there yet. An
+        // existing one is used only if it's private.
+        bool make_directory() const
+        {
+            std::string const& directory = options_.cacheDirectory;
+            if (directory.empty()) {
+                return false;
+            }
+            if (mkdir(directory.c_str(), 0700) != 0 && errno == ENOENT) {
+                std::string::size_type const slash = directory.rfind('/');
+                if (slash != 0 && slash != std::string::npos) {
+                    mkdir(directory.substr(0, slash).c_str(), 0700);
+                }
+                mkdir(directory.c_str(), 0700);
+            }
+            return is_private(directory, S_IFDIR);
+        }
+
+        // Not a symbolic link, of the user, and not writable by the others.
+        static bool is_private(std::string const& path, mode_t type)
+        {
+            struct stat s;
+            return lstat(path.c_str(), &s) == 0 && (s.st_mode & S_IFMT) == type && s.st_uid == geteuid()
+                && (s.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+        }
+
+        // Writes a new file of a unique name beginning with path, which is
+        // set to the name. mkstemp() creates it exclusively, with the mode
+        // 0600, and never through a symbolic link.
+        static bool create_temporary(std::string & path, std::string const& text)
+        {
+            std::string name = path + ".XXXXXX";
+            int const fd = mkstemp(&name[0]);
+            if (fd < 0) {
+                return false;
+            }
+            std::size_t written = 0;
+            while (written < text.size()) {
+                ssize_t const n = ::write(fd, text.data() + written, text.size() - written);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                written += static_cast<std::size_t>(n);
+            }
+            if (::close(fd) != 0 || written != text.size()) {
+                std::remove(name.c_str());
+                return false;
+            }
+            path = name;
+            return true;
+        }
+
+        // The words of a command as CXX="ccache g++", or of the flags, each one quoted.
+        static std::string split_quote(std::string const& words)
+        {
+            std::string out;
+            std::string::size_type i = 0;
+            while ((i = words.find_first_not_of(" \t", i)) != std::string::npos) {
+                std::string::size_type const end = words.find_first_of(" \t", i);
+                if (!out.empty()) {
+                    out += ' ';
+                }
+                out += quote(words.substr(i, end - i));
+                i = end;
+            }
+            return out;
+        }
+
+        // For the shell, in the single quotes.
+        static std::string quote(std::string const& s)
+        {
+            std::string q = "'";
+            for (char c : s) {
+                if (c == '\'') {
+                    q += "'\\''";
+                } else {
+                    q += c;
+                }
+            }
+            return q + "'";
+        }
+
+        calc_aot_options options_;
+        std::string source_;
+    };
+#endif
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_AOT_H
@@ -0,0 +1,84 @@
+#ifndef ALGOVISU_CALC_AST_H
+#define ALGOVISU_CALC_AST_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace algovisu
+{
+    // NOTE: the arithmetic wraps around on overflow like the unsigned one.
+    using calc_value_t = std::int64_t;
+
+    enum class calc_op : std::uint8_t
+    {
+        literal,
+        add,
+        sub,
+        mul,
+        div
+    };
+
+    inline char to_char(calc_op op)
+    {
+        switch (op) {
+            case calc_op::add: return '+';
+            case calc_op::sub: return '-';
+            case calc_op::mul: return '*';
+            case calc_op::div: return '/';
+            default: return '#';
+        }
+    }
+
+    struct calc_node
+    {
+        calc_op op;
+        std::uint32_t lhs;      // the left operand node, for the operators.
+        std::uint32_t rhs;      // the right operand node, for the operators.
+        calc_value_t value;     // for the literal.
+    };
+
+    // A flat calc expression tree.
+    //
+    // NOTE: the nodes are stored in post-order. The operands of a node
+    //          always come before the node itself, and the root is the last one.
+    //          So a single forward pass is enough to evaluate the tree.
+    struct calc_ast
+    {
+        std::vector<calc_node> nodes;
+
+        bool empty() const { return nodes.empty(); }
+        std::size_t size() const { return nodes.size(); }
+        std::uint32_t root() const { return static_cast<std::uint32_t>(nodes.size() - 1); }
+
+        void clear() { nodes.clear(); }
+
+        std::uint32_t add_literal(calc_value_t value)
+        {
+            nodes.push_back(calc_node{ calc_op::literal, 0, 0, value });
+            return root();
+        }
+
+        std::uint32_t add_operator(calc_op op, std::uint32_t lhs, std::uint32_t rhs)
+        {
+            nodes.push_back(calc_node{ op, lhs, rhs, 0 });
+            return root();
+        }
+    };
+
+    // Converts the decimal digits of a literal token. It wraps around on overflow.
+    template <typename Iterator>
+    calc_value_t to_calc_value(Iterator first, Iterator last)
+    {
+        std::uint64_t v = 0;
+        for (; first != last; ++first) {
+            v = v * 10 + static_cast<std::uint64_t>(*first - '0');
+        }
+        return static_cast<calc_value_t>(v);
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_AST_H
@@ -0,0 +1,531 @@
+#ifndef ALGOVISU_CALC_BATCH_H
+#define ALGOVISU_CALC_BATCH_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
+
+#include "calculator.h"
+#include "calc_ast.h"
+#include "calc_evaluator.h"
+#include "cycle_clock.h"
+#include "spsc_ring.h"
+#include "calc_output.h"
+
+
+namespace algovisu
+{
+    // The work of a batch stage, or'ed to merge the steps into one stage.
+    enum calc_batch_work : unsigned
+    {
+        batch_lex = 1,
+        batch_parse = 2,
+        batch_evaluate = 4,
+        batch_format = 8,
+        batch_all = 15
+    };
+
+    struct calc_batch_stage
+    {
+        unsigned work;
+        std::size_t workers;
+    };
+
+    // The stages between the reader and the writer, in order.
+    //
+    //  pipelined: one thread per step. (the default)
+    //  data parallel: { { batch_all, N } }, N threads do every step of their batches.
+    //  serial: no stage, everything is done by the calling thread.
+    struct calc_batch_options
+    {
+        std::size_t batchBytes = 256 * 1024;
+        std::size_t ringCapacity = 4;       // batches between two workers
+        std::size_t batches = 0;            // in flight, 0 for 2 per worker + 2
+        std::vector<calc_batch_stage> stages{ { { batch_lex, 1 },
+                                                { batch_parse, 1 },
+                                                { batch_evaluate, 1 },
+                                                { batch_format, 1 } } };
+    };
+
+    // The utilization counters of a stage, summed over its workers.
+    // The cycles are of read_cycle_counter().
+    struct calc_stage_utilization
+    {
+        std::string name;
+        std::size_t workers;
+        std::uint64_t batches;
+        std::uint64_t busyCycles;
+        std::uint64_t inputWaitCycles;      // the upstream is behind
+        std::uint64_t outputWaitCycles;     // the backpressure of the downstream
+
+        double utilization() const
+        {
+            std::uint64_t const total = busyCycles + inputWaitCycles + outputWaitCycles;
+            return total ? double(busyCycles) / double(total) : 0.0;
+        }
+    };
+
+    namespace detail
+    {
+        // NOTE: the counters are written by their worker only, and read
+        //          by any thread while the workers run.
+        struct calc_stage_counters
+        {
+            static void bump(std::atomic<std::uint64_t> & c, std::uint64_t n)
+            {
+                c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+
+            std::atomic<std::uint64_t> batches{ 0 };
+            std::atomic<std::uint64_t> busyCycles{ 0 };
+            std::atomic<std::uint64_t> inputWaitCycles{ 0 };
+            std::atomic<std::uint64_t> outputWaitCycles{ 0 };
+        };
+
+        inline std::string batch_stage_name(unsigned work)
+        {
+            static char const * const names[] = { "lex", "parse", "evaluate", "format" };
+            std::string name;
+            for (unsigned i = 0; i < 4; ++i) {
+                if (work & (1u << i)) {
+                    name += name.empty() ? "" : "+";
+                    name += names[i];
+                }
+            }
+            return name;
+        }
+    } // namespace detail
+
+    // read -> lex -> parse -> evaluate -> format -> write, over the batches of lines.
+    //
+    // Every stage runs on its own thread group, and passes the batches to
+    // the next one through the bounded spsc_rings. The batch s goes from the
+    // worker s % a of a stage to the worker s % b of the next one, on the ring
+    // of that pair. So every ring has a single producer and a single consumer,
+    // and the batches are still taken in the order of the input.
+    //
+    // A result line is written for every non-blank input line,
+    // the value or "error".
+    //
+    // NOTE: the batches are recycled from the writer back to the reader, so the
+    //          memory is bounded by options.batches, whatever the input size is.
+    template <typename Lexer = lex::lexertl::lexer<>>
+    class calc_batch_executor
+    {
+    public:
+        using lexer_def_t = calc_token<Lexer>;
+        using grammar_t = calc_buffer_grammar<lexer_def_t>;
+        using token_t = typename lexer_def_t::token_type;
+
+        explicit calc_batch_executor(calc_batch_options const& options = {})
+            : options_(options)
+        {
+            // the DFA of the lexer is built on its first use,
+            // so it's built here before it's shared by the lex workers.
+            calc_token_buffer<lexer_def_t> buffer;
+            char const s[] = "0";
+            lex_calc(tokens_, s, s + 1, buffer);
+
+            counters_.emplace_back(new detail::calc_stage_counters);     // read
+            for (auto const& stage : options_.stages) {
+                for (std::size_t i = 0; i < stage.workers; ++i) {
+                    counters_.emplace_back(new detail::calc_stage_counters);
+                }
+            }
+            counters_.emplace_back(new detail::calc_stage_counters);     // write
+        }
+
+        // Reads the lines from in, and writes the results to out in the same order.
+        // It returns the number of the expressions.
+        std::uint64_t run(std::istream & in, std::ostream & out)
+        {
+            ostream_output_sink sink(out);
+            return run_with_sink(in, sink);
+        }
+
+        // The same as run(), with an output sink such as fd_output_sink.
+        template <typename Sink>
+        std::uint64_t run_with_sink(std::istream & in, Sink & out)
+        {
+            expressions_ = 0;
+            outputOk_ = true;
+            for (auto & c : counters_) {
+                c->batches.store(0, std::memory_order_relaxed);
+                c->busyCycles.store(0, std::memory_order_relaxed);
+                c->inputWaitCycles.store(0, std::memory_order_relaxed);
+                c->outputWaitCycles.store(0, std::memory_order_relaxed);
+            }
+            if (options_.stages.empty()) {
+                run_serial(in, out);
+            } else {
+                run_pipelined(in, out);
+            }
+            return expressions_;
+        }
+
+        // false if a write of the last run has failed.
+        bool output_good() const { return outputOk_; }
+
+        // It can be called while run() is running.
+        std::vector<calc_stage_utilization> utilization() const
+        {
+            std::vector<calc_stage_utilization> stages;
+            std::size_t next = 0;
+            auto add = [&](std::string name, std::size_t workers) {
+                calc_stage_utilization u{ std::move(name), workers, 0, 0, 0, 0 };
+                for (std::size_t i = 0; i < workers; ++i, ++next) {
+                    auto const& c = *counters_[next];
+                    u.batches += c.batches.load(std::memory_order_relaxed);
+                    u.busyCycles += c.busyCycles.load(std::memory_order_relaxed);
+                    u.inputWaitCycles += c.inputWaitCycles.load(std::memory_order_relaxed);
+                    u.outputWaitCycles += c.outputWaitCycles.load(std::memory_order_relaxed);
+                }
+                stages.push_back(std::move(u));
+            };
+            add("read", 1);
+            for (auto const& stage : options_.stages) {
+                add(detail::batch_stage_name(stage.work), stage.workers);
+            }
+            add("write", 1);
+            return stages;
+        }
+
+    private:
+        enum line_status : std::uint8_t
+        {
+            line_ok,
+            line_blank,
+            line_error
+        };
+
+        struct line
+        {
+            std::uint32_t first;        // of the text
+            std::uint32_t last;
+            std::uint32_t tokenFirst;   // of the tokens
+            std::uint32_t tokenLast;
+            line_status status;
+            calc_value_t value;
+        };
+
+        // The buffers are kept through the recycling of a batch.
+        struct batch
+        {
+            std::string text;
+            std::vector<line> lines;
+            std::vector<token_t> tokens;
+            std::vector<calc_ast> asts;     // per line
+            std::string output;
+        };
+
+        using ring_t = spsc_ring<batch *>;
+
+        // the per-worker state of the steps
+        struct worker
+        {
+            explicit worker(lexer_def_t const& tokens)
+                : grammar(tokens)
+            { }
+
+            grammar_t grammar;
+            calc_evaluator evaluator;
+        };
+
+        // Reads the next batch of whole lines. The partial last line
+        // is carried over to the next batch. It returns false at the end.
+        bool read(std::istream & in, batch & b)
+        {
+            b.text.swap(carry_);
+            carry_.clear();
+            while (in) {
+                std::size_t const size = b.text.size();
+                b.text.resize(size + options_.batchBytes);
+                in.read(&b.text[size], static_cast<std::streamsize>(options_.batchBytes));
+                b.text.resize(size + static_cast<std::size_t>(in.gcount()));
+                std::size_t const newline = b.text.rfind('\n');
+                if (newline != std::string::npos && newline >= size) {
+                    carry_.assign(b.text, newline + 1, std::string::npos);
+                    b.text.resize(newline + 1);
+                    break;
+                }
+            }
+            return !b.text.empty();
+        }
+
+        void lex(batch & b)
+        {
+            b.lines.clear();
+            b.tokens.clear();
+            char const * const text = b.text.data();
+            std::size_t first = 0;
+            while (first < b.text.size()) {
+                std::size_t last = b.text.find('\n', first);
+                if (last == std::string::npos) {
+                    last = b.text.size();
+                }
+                std::uint32_t const tokenFirst = static_cast<std::uint32_t>(b.tokens.size());
+                bool const ok = lex_calc(tokens_, text + first, text + last, b.tokens);
+                std::uint32_t const tokenLast = static_cast<std::uint32_t>(b.tokens.size());
+                line_status const status = !ok ? line_error : tokenFirst == tokenLast ? line_blank : line_ok;
+                b.lines.push_back(line{ static_cast<std::uint32_t>(first), static_cast<std::uint32_t>(last),
+                                        tokenFirst, tokenLast, status, 0 });
+                first = last + 1;
+            }
+        }
+
+        void parse(batch & b, worker & w)
+        {
+            if (b.asts.size() < b.lines.size()) {
+                b.asts.resize(b.lines.size());
+            }
+            token_t const * const tokens = b.tokens.data();
+            for (std::size_t i = 0; i < b.lines.size(); ++i) {
+                line & l = b.lines[i];
+                if (l.status == line_ok) {
+                    b.asts[i].clear();
+                    if (!parse_calc(w.grammar, tokens + l.tokenFirst, tokens + l.tokenLast, b.asts[i])) {
+                        l.status = line_error;
+                    }
+                }
+            }
+        }
+
+        void evaluate(batch & b, worker & w)
+        {
+            for (std::size_t i = 0; i < b.lines.size(); ++i) {
+                line & l = b.lines[i];
+                if (l.status == line_ok && !w.evaluator.evaluate(b.asts[i], l.value)) {
+                    l.status = line_error;
+                }
+            }
+        }
+
+        void format(batch & b)
+        {
+            b.output.resize(b.lines.size() * (calc_value_max_chars + 1));
+            char * const first = &b.output[0];
+            char * p = first;
+            for (auto const& l : b.lines) {
+                if (l.status == line_ok) {
+                    p = format_calc_value(p, l.value);
+                    *p++ = '\n';
+                } else if (l.status == line_error) {
+                    std::memcpy(p, "error\n", 6);
+                    p += 6;
+                }
+            }
+            b.output.resize(static_cast<std::size_t>(p - first));
+        }
+
+        void work(unsigned steps, batch & b, worker & w)
+        {
+            if (steps & batch_lex) {
+                lex(b);
+            }
+            if (steps & batch_parse) {
+                parse(b, w);
+            }
+            if (steps & batch_evaluate) {
+                evaluate(b, w);
+            }
+            if (steps & batch_format) {
+                format(b);
+            }
+        }
+
+        // the outputs of the batches in one write of the sink.
+        template <typename Sink>
+        void write(Sink & sink, batch * const * batches, std::size_t count)
+        {
+            blocks_.clear();
+            for (std::size_t i = 0; i < count; ++i) {
+                batch const& b = *batches[i];
+                blocks_.push_back(calc_output_block{ b.output.data(), b.output.size() });
+                for (auto const& l : b.lines) {
+                    expressions_ += (l.status != line_blank);
+                }
+            }
+            outputOk_ = sink.write(blocks_.data(), blocks_.size()) && outputOk_;
+        }
+
+        template <typename Sink>
+        void run_serial(std::istream & in, Sink & out)
+        {
+            auto & reader = *counters_.front();
+            auto & writer = *counters_.back();
+            batch b;
+            worker w(tokens_);
+            for (std::uint64_t start = read_cycle_counter(); read(in, b); start = read_cycle_counter()) {
+                std::uint64_t const readEnd = read_cycle_counter();
+                work(batch_all, b, w);
+                std::uint64_t const worked = read_cycle_counter();
+                batch * const p = &b;
+                write(out, &p, 1);
+                std::uint64_t const written = read_cycle_counter();
+                detail::calc_stage_counters::bump(reader.busyCycles, readEnd - start);
+                detail::calc_stage_counters::bump(reader.batches, 1);
+                detail::calc_stage_counters::bump(writer.busyCycles, written - worked);
+                detail::calc_stage_counters::bump(writer.batches, 1);
+            }
+            carry_.clear();
+        }
+
+        template <typename Sink>
+        void run_pipelined(std::istream & in, Sink & out)
+        {
+            using detail::calc_stage_counters;
+
+            std::size_t totalWorkers = 0;
+            for (auto const& stage : options_.stages) {
+                totalWorkers += stage.workers;
+            }
+            std::size_t const batchCount = options_.batches ? options_.batches : 2 * totalWorkers + 2;
+            std::vector<std::unique_ptr<batch>> pool;
+            ring_t freeBatches(batchCount);
+            for (std::size_t i = 0; i < batchCount; ++i) {
+                pool.emplace_back(new batch);
+                freeBatches.push(pool.back().get());
+            }
+
+            // rings[k][i * b + j] connects the worker i of the stage k - 1
+            // to the worker j of the stage k. The reader is the stage -1 of 1 worker,
+            // and the writer is the last stage of 1 worker.
+            std::vector<std::size_t> widths(1, 1);
+            for (auto const& stage : options_.stages) {
+                widths.push_back(stage.workers);
+            }
+            widths.push_back(1);
+            std::vector<std::vector<std::unique_ptr<ring_t>>> rings(widths.size() - 1);
+            for (std::size_t k = 0; k + 1 < widths.size(); ++k) {
+                for (std::size_t n = 0; n < widths[k] * widths[k + 1]; ++n) {
+                    rings[k].emplace_back(new ring_t(options_.ringCapacity));
+                }
+            }
+
+            // waits on a ring, and counts the cycles waited.
+            auto push = [](ring_t & ring, batch * b, std::atomic<std::uint64_t> & waited) {
+                if (!ring.try_push(b)) {
+                    std::uint64_t const start = read_cycle_counter();
+                    ring.push(b);
+                    calc_stage_counters::bump(waited, read_cycle_counter() - start);
+                }
+            };
+            auto pop = [](ring_t & ring, std::atomic<std::uint64_t> & waited) {
+                batch * b = nullptr;
+                if (!ring.try_pop(b)) {
+                    std::uint64_t const start = read_cycle_counter();
+                    ring.pop(b);
+                    calc_stage_counters::bump(waited, read_cycle_counter() - start);
+                }
+                return b;
+            };
+
+            // the worker `index` of the stage k, of a counter.
+            // It takes the batches of index, index + width, ... in order, and
+            // a null batch is the end of the stream.
+            auto run_worker = [&](std::size_t k, std::size_t index, unsigned steps, calc_stage_counters & c) {
+                std::size_t const inWidth = widths[k - 1];
+                std::size_t const width = widths[k];
+                std::size_t const outWidth = widths[k + 1];
+                worker w(tokens_);
+                for (std::uint64_t s = index; ; s += width) {
+                    batch * b = pop(*rings[k - 1][(s % inWidth) * width + index], c.inputWaitCycles);
+                    if (!b) {
+                        break;
+                    }
+                    std::uint64_t const start = read_cycle_counter();
+                    work(steps, *b, w);
+                    calc_stage_counters::bump(c.busyCycles, read_cycle_counter() - start);
+                    calc_stage_counters::bump(c.batches, 1);
+                    push(*rings[k][index * outWidth + s % outWidth], b, c.outputWaitCycles);
+                }
+                for (std::size_t j = 0; j < outWidth; ++j) {
+                    push(*rings[k][index * outWidth + j], nullptr, c.outputWaitCycles);
+                }
+            };
+
+            std::vector<std::thread> threads;
+            std::size_t counter = 1;
+            for (std::size_t k = 1; k + 1 < widths.size(); ++k) {
+                for (std::size_t i = 0; i < widths[k]; ++i) {
+                    threads.emplace_back(run_worker, k, i, options_.stages[k - 1].work,
+                                         std::ref(*counters_[counter++]));
+                }
+            }
+
+            // the writer gathers the batches ready in order, up to the half
+            // of the batches, into a write. They are recycled after it.
+            std::thread writer([&] {
+                auto & c = *counters_.back();
+                std::size_t const inWidth = widths[widths.size() - 2];
+                std::size_t const maxGather = std::max<std::size_t>(1, batchCount / 2);
+                std::vector<batch *> gathered;
+                bool end = false;
+                for (std::uint64_t s = 0; !end; ) {
+                    batch * b = pop(*rings.back()[s % inWidth], c.inputWaitCycles);
+                    if (!b) {
+                        break;
+                    }
+                    gathered.assign(1, b);
+                    for (++s; gathered.size() < maxGather && rings.back()[s % inWidth]->try_pop(b); ++s) {
+                        if (!b) {
+                            end = true;
+                            break;
+                        }
+                        gathered.push_back(b);
+                    }
+                    std::uint64_t const start = read_cycle_counter();
+                    write(out, gathered.data(), gathered.size());
+                    calc_stage_counters::bump(c.busyCycles, read_cycle_counter() - start);
+                    calc_stage_counters::bump(c.batches, gathered.size());
+                    for (batch * g : gathered) {
+                        freeBatches.push(g);
+                    }
+                }
+            });
+
+            // the reader is the calling thread.
+            auto & c = *counters_.front();
+            std::size_t const outWidth = widths[1];
+            for (std::uint64_t s = 0; ; ++s) {
+                batch * b = pop(freeBatches, c.outputWaitCycles);
+                std::uint64_t const start = read_cycle_counter();
+                bool const more = read(in, *b);
+                calc_stage_counters::bump(c.busyCycles, read_cycle_counter() - start);
+                if (!more) {
+                    break;
+                }
+                calc_stage_counters::bump(c.batches, 1);
+                push(*rings.front()[s % outWidth], b, c.outputWaitCycles);
+            }
+            for (std::size_t j = 0; j < outWidth; ++j) {
+                push(*rings.front()[j], nullptr, c.outputWaitCycles);
+            }
+
+            for (auto & t : threads) {
+                t.join();
+            }
+            writer.join();
+            carry_.clear();
+        }
+
+        calc_batch_options options_;
+        lexer_def_t tokens_;
+        std::vector<std::unique_ptr<detail::calc_stage_counters>> counters_;
+        std::string carry_;
+        std::vector<calc_output_block> blocks_;
+        std::uint64_t expressions_ = 0;
+        bool outputOk_ = true;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_BATCH_H
@@ -0,0 +1,148 @@
+#ifndef ALGOVISU_CALC_BYTECODE_H
+#define ALGOVISU_CALC_BYTECODE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+#include "calc_evaluator.h"
+
+
+namespace algovisu
+{
+    // NOTE: the operators have the same values as calc_op.
+    enum class calc_opcode : std::uint8_t
+    {
+        push,       // pushes the value.
+        add,        // pops the rhs and the lhs, and pushes the result.
+        sub,
+        mul,
+        div
+    };
+
+    // NOTE: the layout is fixed, for the bytecode is stored in the files
+    //          and used in place. It's 16 bytes and 8 byte aligned.
+    struct calc_instruction
+    {
+        calc_opcode op;
+        calc_value_t value;     // for push.
+    };
+
+    static_assert(sizeof(calc_instruction) == 16, "calc_instruction is stored as it is");
+
+    inline calc_opcode to_opcode(calc_op op)
+    {
+        return static_cast<calc_opcode>(op);
+    }
+
+    // The stack machine code of an expression.
+    struct calc_program
+    {
+        std::vector<calc_instruction> code;
+        std::uint32_t stackDepth = 0;      // the highest stack the code needs.
+
+        bool empty() const { return code.empty(); }
+        std::size_t size() const { return code.size(); }
+    };
+
+    // Compiles an ast to the stack machine code.
+    //
+    // The nodes are emitted in the post-order walked from the root, so the
+    // ast doesn't have to be stored in the exact post-order. The walk uses
+    // an explicit stack, because a long chain is as deep as it's long.
+    class calc_compiler
+    {
+    public:
+        void compile(calc_ast const& ast, calc_program & program)
+        {
+            program.code.clear();
+            program.stackDepth = 0;
+            if (ast.empty()) {
+                return;
+            }
+            calc_node const * const nodes = ast.nodes.data();
+            std::uint32_t depth = 0;
+            stack_.clear();
+            stack_.push_back(frame{ ast.root(), false });
+            while (!stack_.empty()) {
+                frame & f = stack_.back();
+                calc_node const& node = nodes[f.node];
+                if (node.op == calc_op::literal) {
+                    program.code.push_back(calc_instruction{ calc_opcode::push, node.value });
+                    program.stackDepth = std::max(program.stackDepth, ++depth);
+                    stack_.pop_back();
+                } else if (!f.expanded) {
+                    f.expanded = true;
+                    std::uint32_t const lhs = node.lhs;
+                    std::uint32_t const rhs = node.rhs;
+                    stack_.push_back(frame{ rhs, false });
+                    stack_.push_back(frame{ lhs, false });
+                } else {
+                    program.code.push_back(calc_instruction{ to_opcode(node.op), 0 });
+                    --depth;
+                    stack_.pop_back();
+                }
+            }
+        }
+
+    private:
+        struct frame
+        {
+            std::uint32_t node;
+            bool expanded;
+        };
+
+        std::vector<frame> stack_;
+    };
+
+    inline void compile_calc(calc_ast const& ast, calc_program & program)
+    {
+        calc_compiler compiler;
+        compiler.compile(ast, program);
+    }
+
+    // Runs the stack machine code with the same arithmetic as calc_evaluator.
+    // The stack is reused to avoid the allocations.
+    class calc_vm
+    {
+    public:
+        // false for the division by zero, or the empty code.
+        bool run(calc_instruction const * code, std::size_t size, std::uint32_t stackDepth,
+                 calc_value_t & result)
+        {
+            if (size == 0) {
+                return false;
+            }
+            if (stack_.size() < stackDepth) {
+                stack_.resize(stackDepth);
+            }
+            calc_value_t * sp = stack_.data();     // the next free slot.
+            for (calc_instruction const * pc = code, * end = code + size; pc != end; ++pc) {
+                if (pc->op == calc_opcode::push) {
+                    *sp++ = pc->value;
+                    continue;
+                }
+                --sp;
+                if (!calc_apply(static_cast<calc_op>(pc->op), sp[-1], sp[0], sp[-1])) {
+                    return false;
+                }
+            }
+            result = sp[-1];
+            return true;
+        }
+
+        bool run(calc_program const& program, calc_value_t & result)
+        {
+            return run(program.code.data(), program.code.size(), program.stackDepth, result);
+        }
+
+    private:
+        std::vector<calc_value_t> stack_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_BYTECODE_H
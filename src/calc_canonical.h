@@ -0,0 +1,207 @@
+#ifndef ALGOVISU_CALC_CANONICAL_H
+#define ALGOVISU_CALC_CANONICAL_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+#include "calc_hash.h"
+#include "calc_evaluator.h"
+
+
+namespace algovisu
+{
+    // + and * are associative and commutative in the wrapping arithmetic,
+    // so their operands can be regrouped and reordered with the same result.
+    inline bool calc_is_commutative(calc_op op)
+    {
+        return op == calc_op::add || op == calc_op::mul;
+    }
+
+    // Rewrites an ast into its canonical form, and hashes the structure.
+    //
+    //  - a chain of + or * is flattened into its operands,
+    //      so (1+2)+3 and 1+(2+3) are the same.
+    //  - the literal operands of a chain are folded into one, which is
+    //      dropped if it's the identity. 2*3*(4-1) is 6*(4-1).
+    //      But x*1 is kept, not to be x, which could be an operand of
+    //      the chain of its parent. So the form is canonical again.
+    //  - the operands are sorted by their structural hash, and chained
+    //      again to the left. a+b and b+a are the same.
+    //  - the operands of - and / keep their order.
+    //
+    // So the expressions equal by these rules have the same hash, and the
+    // same text by calc_printer, which can be the key of the caches. The
+    // canonical ast evaluates to the same value, and fails on the same
+    // division by zero, because every operator node but the folded ones
+    // is kept.
+    //
+    // The nodes are visited in their stored order, with no recursion,
+    // and a chain is gathered once at its top node.
+    //
+    // NOTE: a literal is compared by its value, so a wrapped one like
+    //          18446744073709551615 is the same as the value it wraps to.
+    //
+    // ex.)
+    //  calc_canonicalizer canonicalizer;
+    //  std::uint64_t const key = canonicalizer.canonicalize(ast, canonical);
+    class calc_canonicalizer
+    {
+    public:
+        // Writes the canonical form of ast into out, and returns its hash.
+        std::uint64_t canonicalize(calc_ast const& ast, calc_ast & out)
+        {
+            out.clear();
+            if (ast.empty()) {
+                return 0;
+            }
+            std::size_t const n = ast.size();
+            calc_node const * const nodes = ast.nodes.data();
+
+            // the operands in the chain of their parent.
+            state_.assign(n, normal);
+            for (std::size_t i = 0; i < n; ++i) {
+                calc_op const op = nodes[i].op;
+                if (calc_is_commutative(op)) {
+                    if (nodes[nodes[i].lhs].op == op) {
+                        state_[nodes[i].lhs] = inner;
+                    }
+                    if (nodes[nodes[i].rhs].op == op) {
+                        state_[nodes[i].rhs] = inner;
+                    }
+                }
+            }
+
+            outOf_.resize(n);
+            hashOf_.resize(n);
+            valueOf_.resize(n);
+            for (std::uint32_t i = 0; i < n; ++i) {
+                calc_node const& node = nodes[i];
+                if (state_[i] == inner) {
+                    continue;
+                }
+                if (node.op == calc_op::literal) {
+                    // emitted by its parent, unless it's folded.
+                    state_[i] = constant;
+                    valueOf_[i] = node.value;
+                    hashOf_[i] = literal_hash(node.value);
+                } else if (calc_is_commutative(node.op)) {
+                    emit_chain(nodes, i, out);
+                } else {
+                    std::uint32_t const lhs = operand(node.lhs, out);
+                    std::uint32_t const rhs = operand(node.rhs, out);
+                    outOf_[i] = out.add_operator(node.op, lhs, rhs);
+                    hashOf_[i] = combine(combine(op_hash(node.op, false), hashOf_[node.lhs]), hashOf_[node.rhs]);
+                }
+            }
+            std::uint32_t const root = ast.root();
+            if (state_[root] == constant) {
+                out.add_literal(valueOf_[root]);
+            }
+            return hashOf_[root];
+        }
+
+    private:
+        enum : std::uint8_t
+        {
+            normal,
+            inner,      // an operand in the chain of its parent.
+            constant    // a literal, or a chain folded into one, not emitted yet.
+        };
+
+        struct term
+        {
+            std::uint64_t hash;
+            std::uint32_t node;     // in the output, but for the folded literal.
+            bool literal;
+        };
+
+        static std::uint64_t combine(std::uint64_t h, std::uint64_t v)
+        {
+            return calc_mix64(h * 0x9e3779b97f4a7c15ull + v);
+        }
+
+        static std::uint64_t literal_hash(calc_value_t v)
+        {
+            return calc_mix64(static_cast<std::uint64_t>(v) ^ 0x6c69746572616c21ull);
+        }
+
+        static std::uint64_t op_hash(calc_op op, bool chain)
+        {
+            return calc_mix64(static_cast<std::uint64_t>(op) * 2 + chain + 0x6f70657261746f72ull);
+        }
+
+        // The output node of a non-inner operand. A constant is emitted now.
+        std::uint32_t operand(std::uint32_t node, calc_ast & out)
+        {
+            return state_[node] == constant ? out.add_literal(valueOf_[node]) : outOf_[node];
+        }
+
+        void emit_chain(calc_node const * nodes, std::uint32_t top, calc_ast & out)
+        {
+            calc_op const op = nodes[top].op;
+            calc_value_t const identity = op == calc_op::add ? 0 : 1;
+            calc_value_t folded = identity;
+            bool anyLiteral = false;
+
+            terms_.clear();
+            stack_.clear();
+            stack_.push_back(nodes[top].rhs);
+            stack_.push_back(nodes[top].lhs);
+            while (!stack_.empty()) {
+                std::uint32_t const c = stack_.back();
+                stack_.pop_back();
+                if (state_[c] == inner) {
+                    stack_.push_back(nodes[c].rhs);
+                    stack_.push_back(nodes[c].lhs);
+                } else if (state_[c] == constant) {
+                    calc_apply(op, folded, valueOf_[c], folded);
+                    anyLiteral = true;
+                } else {
+                    terms_.push_back(term{ hashOf_[c], outOf_[c], false });
+                }
+            }
+            if (terms_.empty()) {
+                // folded into a literal only, which is emitted by the parent.
+                state_[top] = constant;
+                valueOf_[top] = folded;
+                hashOf_[top] = literal_hash(folded);
+                return;
+            }
+            if (anyLiteral && (folded != identity || terms_.size() == 1)) {
+                terms_.push_back(term{ literal_hash(folded), 0, true });
+            }
+            std::sort(terms_.begin(), terms_.end(),
+                      [](term const& a, term const& b) { return a.hash < b.hash; });
+
+            std::uint64_t h = op_hash(op, true);
+            std::uint32_t chain = 0;
+            for (std::size_t k = 0; k < terms_.size(); ++k) {
+                std::uint32_t const o = terms_[k].literal ? out.add_literal(folded) : terms_[k].node;
+                chain = k == 0 ? o : out.add_operator(op, chain, o);
+                h = combine(h, terms_[k].hash);
+            }
+            outOf_[top] = chain;
+            hashOf_[top] = h;
+        }
+
+        std::vector<std::uint8_t> state_;
+        std::vector<std::uint32_t> outOf_;      // the output node of an input node.
+        std::vector<std::uint64_t> hashOf_;     // the hash of an input node.
+        std::vector<calc_value_t> valueOf_;     // of a constant.
+        std::vector<std::uint32_t> stack_;
+        std::vector<term> terms_;
+    };
+
+    inline std::uint64_t calc_canonicalize(calc_ast const& ast, calc_ast & out)
+    {
+        calc_canonicalizer canonicalizer;
+        return canonicalizer.canonicalize(ast, out);
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_CANONICAL_H
@@ -0,0 +1,462 @@
+#ifndef ALGOVISU_CALC_CODE_CACHE_H
+#define ALGOVISU_CALC_CODE_CACHE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/file.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #define ALGOVISU_HAS_MMAP 1
+#endif
+
+#include "calc_hash.h"
+#include "calc_bytecode.h"
+
+
+namespace algovisu
+{
+    // The text the cache is keyed by. The blanks the lexer skips are
+    // removed, so "1 + 2" and "1+2" are the same expression. A blank between
+    // two digits is kept as a single ' ', so "1 2" isn't the literal "12".
+    inline void calc_normalize_text(char const * first, char const * last, std::string & out)
+    {
+        auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+
+        out.resize(static_cast<std::size_t>(last - first));
+        char * const begin = &out[0];
+        char * p = begin;
+        bool blank = false;
+        for (; first != last; ++first) {
+            char const c = *first;
+            if (c == ' ' || (c >= '\t' && c <= '\r' && c != '\n')) {
+                blank = true;
+                continue;
+            }
+            // the skipped blanks fit the separator.
+            if (blank && p != begin && is_digit(p[-1]) && is_digit(c)) {
+                *p++ = ' ';
+            }
+            *p++ = c;
+            blank = false;
+        }
+        out.resize(static_cast<std::size_t>(p - begin));
+    }
+
+    // The compiled code of a cache entry, in the mapped file.
+    struct calc_code_view
+    {
+        calc_instruction const * code;
+        std::uint32_t size;
+        std::uint32_t stackDepth;
+    };
+
+#if defined(ALGOVISU_HAS_MMAP)
+    // A persistent cache of the compiled expressions, keyed by the hash of
+    // their normalized text.
+    //
+    // The file is an append-only log of the records, which is mapped
+    // read-only. The index from the hashes to the records is built once when
+    // it's opened, and a lookup is a probe of it. The code is run in place
+    // from the mapping, with no copy or decoding.
+    //
+    //  file    : header, record, record, ...
+    //  record  : record_header, key text (padded to 8 bytes), instructions
+    //
+    // Any number of the processes can read a file, and one writer can append
+    // to it at a time, which is locked by flock(). A reader sees the records
+    // appended after it has opened the file by refresh().
+    //
+    // A record is checksummed, so a torn append by a crash is found and
+    // ignored by the readers. The writer cuts it off when it opens the file.
+    //
+    // NOTE: find() may be called by many threads at once, but not while
+    //          open(), append(), refresh() or close() is running. The views
+    //          are valid until the next append() or refresh().
+    //
+    // ex.)
+    //  calc_code_cache cache;
+    //  cache.open("calc.cache", true);
+    //  calc_code_view view;
+    //  if (!cache.find(text.data(), text.size(), view)) {
+    //      compile_calc(ast, program);
+    //      cache.append(text.data(), text.size(), program);
+    //  }
+    class calc_code_cache
+    {
+    public:
+        calc_code_cache() = default;
+
+        ~calc_code_cache()
+        {
+            close();
+        }
+
+        calc_code_cache(calc_code_cache const&) = delete;
+        calc_code_cache & operator = (calc_code_cache const&) = delete;
+
+        // Opens a cache file. The writer creates it if it doesn't exist.
+        // It fails if another writer has the file open.
+        bool open(char const * path, bool writable)
+        {
+            close();
+            fd_ = ::open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+            if (fd_ < 0) {
+                return false;
+            }
+            writable_ = writable;
+            if ((writable && ::flock(fd_, LOCK_EX | LOCK_NB) != 0) || !open_file()) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+            if (base_) {
+                ::munmap(const_cast<unsigned char *>(base_), mapSize_);
+            }
+            if (fd_ >= 0) {
+                ::close(fd_);     // releases the lock too.
+            }
+            fd_ = -1;
+            writable_ = false;
+            base_ = nullptr;
+            mapSize_ = 0;
+            end_ = 0;
+            count_ = 0;
+            slots_.clear();
+        }
+
+        bool is_open() const { return fd_ >= 0; }
+        bool writable() const { return writable_; }
+
+        // the number of the entries.
+        std::size_t size() const { return count_; }
+
+        // the end of the last valid record.
+        std::uint64_t file_size() const { return end_; }
+
+        // The key is the normalized text.
+        bool find(char const * key, std::size_t size, calc_code_view & view) const
+        {
+            return find(calc_text_hash(key, size), key, size, view);
+        }
+
+        bool find(calc_hash128 const& hash, char const * key, std::size_t size, calc_code_view & view) const
+        {
+            if (slots_.empty()) {
+                return false;
+            }
+            std::size_t const mask = slots_.size() - 1;
+            for (std::size_t i = hash.lo & mask; slots_[i].offset != 0; i = (i + 1) & mask) {
+                if (slots_[i].hashLo != hash.lo) {
+                    continue;
+                }
+                unsigned char const * p = base_ + slots_[i].offset;
+                record_header const * h = reinterpret_cast<record_header const *>(p);
+                if (h->hash != hash || h->keySize != size
+                        || std::memcmp(p + sizeof(record_header), key, size) != 0) {
+                    continue;
+                }
+                view.code = reinterpret_cast<calc_instruction const *>(
+                                p + sizeof(record_header) + padded(h->keySize));
+                view.size = h->codeSize;
+                view.stackDepth = h->stackDepth;
+                return true;
+            }
+            return false;
+        }
+
+        // Appends the code of an expression, unless it's already there.
+        bool append(char const * key, std::size_t size, calc_program const& program)
+        {
+            if (!writable_ || program.empty()
+                    || size > UINT32_MAX || program.size() > UINT32_MAX) {
+                return false;
+            }
+            calc_hash128 const hash = calc_text_hash(key, size);
+            calc_code_view view;
+            if (find(hash, key, size, view)) {
+                return true;
+            }
+
+            record_header h{};
+            h.hash = hash;
+            h.keySize = static_cast<std::uint32_t>(size);
+            h.codeSize = static_cast<std::uint32_t>(program.size());
+            h.stackDepth = program.stackDepth;
+            std::size_t const recordSize = static_cast<std::size_t>(record_size(h));
+            record_.assign(recordSize, 0);
+            unsigned char * p = record_.data() + sizeof(record_header);
+            std::memcpy(p, key, size);
+            p += padded(h.keySize);
+            // field by field, so that the paddings are zeros.
+            for (calc_instruction const& ins : program.code) {
+                std::memcpy(p + offsetof(calc_instruction, op), &ins.op, sizeof(ins.op));
+                std::memcpy(p + offsetof(calc_instruction, value), &ins.value, sizeof(ins.value));
+                p += sizeof(calc_instruction);
+            }
+            std::memcpy(record_.data(), &h, sizeof(h));
+            h.checksum = checksum(record_.data(), recordSize);
+            std::memcpy(record_.data(), &h.checksum, sizeof(h.checksum));
+
+            if (!write_at(record_.data(), recordSize, end_)) {
+                return false;
+            }
+            std::uint64_t const offset = end_;
+            end_ += recordSize;
+            if (!map()) {
+                return false;
+            }
+            insert(hash.lo, offset);
+            return true;
+        }
+
+        // Reads the records appended since the last refresh, for a reader.
+        bool refresh()
+        {
+            if (fd_ < 0) {
+                return false;
+            }
+            std::uint64_t fileSize;
+            if (!stat_size(fileSize)) {
+                return false;
+            }
+            scan(fileSize);
+            return map();
+        }
+
+        // Flushes the appended records to the disk.
+        bool sync()
+        {
+            return fd_ >= 0 && ::fsync(fd_) == 0;
+        }
+
+    private:
+        static constexpr std::uint64_t file_magic = 0x3130434356474c41ull;     // "ALGVCC01"
+        static constexpr std::uint32_t file_version = 1;
+
+        struct file_header
+        {
+            std::uint64_t magic;
+            std::uint32_t version;
+            std::uint32_t instructionSize;
+        };
+
+        struct record_header
+        {
+            std::uint64_t checksum;     // of the rest of the record.
+            calc_hash128 hash;
+            std::uint32_t keySize;
+            std::uint32_t codeSize;     // the number of the instructions.
+            std::uint32_t stackDepth;
+            std::uint32_t reserved;
+        };
+
+        // a record offset, 0 for the empty slot.
+        struct slot
+        {
+            std::uint64_t hashLo;
+            std::uint64_t offset;
+        };
+
+        static std::uint64_t padded(std::uint64_t n) { return (n + 7) & ~std::uint64_t(7); }
+
+        static std::uint64_t record_size(record_header const& h)
+        {
+            return sizeof(record_header) + padded(h.keySize)
+                    + std::uint64_t(h.codeSize) * sizeof(calc_instruction);
+        }
+
+        static std::uint64_t checksum(unsigned char const * record, std::size_t size)
+        {
+            std::size_t const skip = sizeof(record_header::checksum);
+            return siphash128(record + skip, size - skip, 0x636f646563616368ull, 0x6368656b73756d31ull).lo;
+        }
+
+        bool open_file()
+        {
+            std::uint64_t fileSize;
+            if (!stat_size(fileSize)) {
+                return false;
+            }
+            file_header const expected{ file_magic, file_version, sizeof(calc_instruction) };
+            if (fileSize < sizeof(file_header)) {
+                // a new file, or the header torn by a crash.
+                if (!writable_ || ::ftruncate(fd_, 0) != 0
+                        || !write_at(reinterpret_cast<unsigned char const *>(&expected), sizeof(expected), 0)) {
+                    return false;
+                }
+                fileSize = sizeof(file_header);
+            }
+            file_header header;
+            if (!read_at(reinterpret_cast<unsigned char *>(&header), sizeof(header), 0)
+                    || std::memcmp(&header, &expected, sizeof(header)) != 0) {
+                return false;
+            }
+            end_ = sizeof(file_header);
+            scan(fileSize);
+            if (writable_ && fileSize > end_ && ::ftruncate(fd_, static_cast<off_t>(end_)) != 0) {
+                return false;
+            }
+            return map();
+        }
+
+        // Indexes the valid records from end_ to the first torn one.
+        // They are read by pread() rather than the mapping, for the file
+        // may be cut by the writer meanwhile.
+        void scan(std::uint64_t fileSize)
+        {
+            if (scratch_.empty()) {
+                scratch_.resize(1 << 20);
+            }
+            while (end_ + sizeof(record_header) <= fileSize) {
+                std::size_t const length = static_cast<std::size_t>(
+                                                std::min<std::uint64_t>(fileSize - end_, scratch_.size()));
+                if (!read_at(scratch_.data(), length, end_)) {
+                    return;
+                }
+                std::size_t pos = 0;
+                while (pos + sizeof(record_header) <= length) {
+                    record_header h;
+                    std::memcpy(&h, scratch_.data() + pos, sizeof(h));
+                    std::uint64_t const recordSize = record_size(h);
+                    if (recordSize > fileSize - end_ - pos) {
+                        end_ += pos;
+                        return;
+                    }
+                    if (pos + recordSize > length) {
+                        break;
+                    }
+                    if (checksum(scratch_.data() + pos, static_cast<std::size_t>(recordSize)) != h.checksum) {
+                        end_ += pos;
+                        return;
+                    }
+                    insert(h.hash.lo, end_ + pos);
+                    pos += static_cast<std::size_t>(recordSize);
+                }
+                if (pos == 0) {
+                    // a record larger than the buffer.
+                    scratch_.resize(static_cast<std::size_t>(record_size(
+                        *reinterpret_cast<record_header const *>(scratch_.data()))));
+                }
+                end_ += pos;
+            }
+        }
+
+        void insert(std::uint64_t hashLo, std::uint64_t offset)
+        {
+            if ((count_ + 1) * 2 > slots_.size()) {
+                std::vector<slot> old(std::max<std::size_t>(slots_.size() * 2, 1024));
+                old.swap(slots_);
+                count_ = 0;
+                for (slot const& s : old) {
+                    if (s.offset != 0) {
+                        insert(s.hashLo, s.offset);
+                    }
+                }
+            }
+            std::size_t const mask = slots_.size() - 1;
+            std::size_t i = hashLo & mask;
+            while (slots_[i].offset != 0) {
+                i = (i + 1) & mask;
+            }
+            slots_[i] = slot{ hashLo, offset };
+            ++count_;
+        }
+
+        // Maps the file up to end_ at least. The mapping is reserved larger
+        // than the file, so that the appends don't remap it every time.
+        bool map()
+        {
+            if (base_ && end_ <= mapSize_) {
+                return true;
+            }
+            std::size_t size = std::size_t(64) << 20;
+            while (size < end_ * 2) {
+                size *= 2;
+            }
+            if (base_) {
+                ::munmap(const_cast<unsigned char *>(base_), mapSize_);
+                base_ = nullptr;
+                mapSize_ = 0;
+            }
+            void * p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+            if (p == MAP_FAILED) {
+                return false;
+            }
+            base_ = static_cast<unsigned char const *>(p);
+            mapSize_ = size;
+            return true;
+        }
+
+        bool stat_size(std::uint64_t & size) const
+        {
+            struct stat st;
+            if (::fstat(fd_, &st) != 0) {
+                return false;
+            }
+            size = static_cast<std::uint64_t>(st.st_size);
+            return true;
+        }
+
+        bool read_at(unsigned char * p, std::size_t n, std::uint64_t offset) const
+        {
+            while (n > 0) {
+                ssize_t const r = ::pread(fd_, p, n, static_cast<off_t>(offset));
+                if (r < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (r <= 0) {
+                    return false;
+                }
+                p += r;
+                n -= static_cast<std::size_t>(r);
+                offset += static_cast<std::uint64_t>(r);
+            }
+            return true;
+        }
+
+        bool write_at(unsigned char const * p, std::size_t n, std::uint64_t offset)
+        {
+            while (n > 0) {
+                ssize_t const r = ::pwrite(fd_, p, n, static_cast<off_t>(offset));
+                if (r < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (r <= 0) {
+                    return false;
+                }
+                p += r;
+                n -= static_cast<std::size_t>(r);
+                offset += static_cast<std::uint64_t>(r);
+            }
+            return true;
+        }
+
+        int fd_ = -1;
+        bool writable_ = false;
+        unsigned char const * base_ = nullptr;
+        std::size_t mapSize_ = 0;
+        std::uint64_t end_ = 0;
+        std::size_t count_ = 0;
+        std::vector<slot> slots_;
+        std::vector<unsigned char> scratch_;
+        std::vector<unsigned char> record_;
+    };
+#endif
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_CODE_CACHE_H
@@ -0,0 +1,155 @@
+#ifndef ALGOVISU_CALC_COLUMN_VM_H
+#define ALGOVISU_CALC_COLUMN_VM_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "calc_register_vm.h"
+
+
+namespace algovisu
+{
+    // Runs the register machine code over the rows of the columns, a block
+    // of the rows at a time.
+    //
+    // A register holds the values of a block, and an instruction is a loop
+    // over it, so an instruction is dispatched once per a block rather than
+    // per a row. The loops of +, - and * are vectorized by the compiler to
+    // the SIMD instructions of the target, and the division stays scalar.
+    //
+    // NOTE: a division by zero in a block runs the block again row by row,
+    //          to find the first row that fails.
+    //
+    // ex.)
+    //  calc_register_compiler compiler;
+    //  calc_register_program program;
+    //  compiler.compile(ast, { { aNode, 0 }, { bNode, 1 } }, program);
+    //  calc_value_t const * columns[] = { a.data(), b.data() };
+    //  calc_column_vm vm;
+    //  std::size_t const done = vm.run(program, columns, rows, out.data());
+    class calc_column_vm
+    {
+    public:
+        static constexpr std::size_t block_rows = 256;
+
+        // The rows evaluated to out, which are all of them, or the rows
+        // before the first one of a division by zero.
+        std::size_t run(calc_register_program const& program, calc_value_t const * const * columns, std::size_t rows,
+                        calc_value_t * out)
+        {
+            if (program.empty()) {
+                return 0;
+            }
+            registers_.resize(std::max<std::size_t>(program.registers, 1) * block_rows);
+            slots_.resize(program.spillSlots * block_rows);
+            for (std::size_t first = 0; first < rows; first += block_rows) {
+                std::size_t const count = std::min(block_rows, rows - first);
+                if (!run_block(program, columns, first, count)) {
+                    for (std::size_t row = first; row < first + count; ++row) {
+                        if (!rowVm_.run(program, columns, row, out[row])) {
+                            return row;
+                        }
+                    }
+                }
+                calc_value_t const * const result = registers_.data() + program.result * block_rows;
+                std::copy(result, result + count, out + first);
+            }
+            return rows;
+        }
+
+    private:
+        bool run_block(calc_register_program const& program, calc_value_t const * const * columns,
+                       std::size_t first, std::size_t count)
+        {
+            calc_value_t * const r = registers_.data();
+            for (calc_register_instruction const& in : program.code) {
+                calc_value_t * const d = r + in.dst * block_rows;
+                calc_value_t const * const a = r + in.lhs * block_rows;
+                calc_value_t const * const b = r + in.rhs * block_rows;
+                calc_value_t const v = in.value;
+                switch (in.op) {
+                    case calc_register_opcode::load:
+                        std::fill(d, d + count, v);
+                        break;
+                    case calc_register_opcode::add:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::add, a[i], b[i], d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::sub:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::sub, a[i], b[i], d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::mul:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::mul, a[i], b[i], d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::div:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            if (!calc_apply(calc_op::div, a[i], b[i], d[i])) {
+                                return false;
+                            }
+                        }
+                        break;
+                    case calc_register_opcode::add_imm:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::add, a[i], v, d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::sub_imm:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::sub, a[i], v, d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::mul_imm:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::mul, a[i], v, d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::div_imm:
+                        if (v == 0) {
+                            return false;
+                        }
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::div, a[i], v, d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::imm_sub:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            calc_apply(calc_op::sub, v, b[i], d[i]);
+                        }
+                        break;
+                    case calc_register_opcode::imm_div:
+                        for (std::size_t i = 0; i < count; ++i) {
+                            if (!calc_apply(calc_op::div, v, b[i], d[i])) {
+                                return false;
+                            }
+                        }
+                        break;
+                    case calc_register_opcode::spill:
+                        std::copy(a, a + count, slots_.data() + v * block_rows);
+                        break;
+                    case calc_register_opcode::reload:
+                        std::copy(slots_.data() + v * block_rows, slots_.data() + v * block_rows + count, d);
+                        break;
+                    case calc_register_opcode::column:
+                        std::copy(columns[v] + first, columns[v] + first + count, d);
+                        break;
+                }
+            }
+            return true;
+        }
+
+        std::vector<calc_value_t> registers_;   // block_rows values per a register.
+        std::vector<calc_value_t> slots_;
+        calc_register_vm rowVm_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_COLUMN_VM_H
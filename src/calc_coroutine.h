@@ -0,0 +1,252 @@
+#ifndef ALGOVISU_CALC_COROUTINE_H
+#define ALGOVISU_CALC_COROUTINE_H
+
+
+// NOTE: the coroutines need C++20. The header is empty before that,
+//          and ALGOVISU_HAS_COROUTINES tells whether it's not.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define ALGOVISU_HAS_COROUTINES 1
+
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+
+#include "calc_ast.h"
+#include "calc_stream.h"
+#include "calc_evaluator.h"
+
+
+namespace algovisu
+{
+    enum class calc_stream_event_kind
+    {
+        value,          // an expression is evaluated
+        parse_error,    // an expression doesn't lex or parse
+        eval_error,     // an expression is parsed, but not evaluated
+        need_input,     // feed the input, or close it
+        paused          // the budget is used up, resume it later
+    };
+
+    // ast is the expression of value, parse_error and eval_error.
+    // It's valid until the task is resumed again.
+    struct calc_stream_event
+    {
+        calc_stream_event_kind kind;
+        calc_value_t value;
+        calc_ast const * ast;
+    };
+
+    // The coroutine of calc_stream(). It's resumed by the caller, and it
+    // suspends itself at every event.
+    class calc_stream_task
+    {
+    public:
+        struct promise_type
+        {
+            calc_stream_task get_return_object()
+            {
+                return calc_stream_task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+
+            std::suspend_always yield_value(calc_stream_event const& e) noexcept
+            {
+                event_ = e;
+                return {};
+            }
+
+            void return_void() noexcept
+            { }
+
+            void unhandled_exception()
+            {
+                exception_ = std::current_exception();
+            }
+
+            calc_stream_event event_{ calc_stream_event_kind::need_input, 0, nullptr };
+            std::exception_ptr exception_;
+        };
+
+        calc_stream_task(calc_stream_task && other) noexcept
+            : handle_(std::exchange(other.handle_, nullptr))
+        { }
+
+        calc_stream_task & operator = (calc_stream_task && other) noexcept
+        {
+            std::swap(handle_, other.handle_);
+            return *this;
+        }
+
+        ~calc_stream_task()
+        {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        // Runs to the next event. It returns false when the stream is done.
+        bool resume()
+        {
+            if (!handle_ || handle_.done()) {
+                return false;
+            }
+            handle_.resume();
+            if (handle_.promise().exception_) {
+                std::rethrow_exception(handle_.promise().exception_);
+            }
+            return !handle_.done();
+        }
+
+        calc_stream_event const& event() const { return handle_.promise().event_; }
+
+    private:
+        explicit calc_stream_task(std::coroutine_handle<promise_type> handle)
+            : handle_(handle)
+        { }
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    // The input of calc_stream(). The bytes are not copied, so they must
+    // live until the task asks for more again.
+    class calc_stream_input
+    {
+    public:
+        struct awaiter
+        {
+            bool await_ready() const noexcept { return !input.empty() || input.closed(); }
+
+            void await_suspend(std::coroutine_handle<calc_stream_task::promise_type> h) noexcept
+            {
+                h.promise().event_ = calc_stream_event{ calc_stream_event_kind::need_input, 0, nullptr };
+            }
+
+            void await_resume() const noexcept
+            { }
+
+            calc_stream_input & input;
+        };
+
+        void feed(char const * first, char const * last)
+        {
+            first_ = first;
+            last_ = last;
+        }
+
+        // no more input. The last expression doesn't need a newline.
+        void close() { closed_ = true; }
+
+        bool empty() const { return first_ == last_; }
+        bool closed() const { return closed_; }
+
+        char const * first() const { return first_; }
+        char const * last() const { return last_; }
+        void consume(char const * p) { first_ = p; }
+
+        // co_await input.more() suspends with the need_input event,
+        // unless there is some input already.
+        awaiter more() { return awaiter{ *this }; }
+
+    private:
+        char const * first_ = nullptr;
+        char const * last_ = nullptr;
+        bool closed_ = false;
+    };
+
+    // A coroutine front end of calc_push_parser and calc_evaluator.
+    //
+    // It yields an event for every expression, and asks for more input by
+    // the need_input event. The budget is the number of the tokens to lex
+    // and of the nodes to evaluate before it gives up the CPU, so that a
+    // huge expression can't starve the other work of an event loop.
+    //
+    // ex.)
+    //  calc_stream_input input;
+    //  auto task = calc_stream(input, 4096);
+    //  while (task.resume()) {
+    //      auto const& e = task.event();
+    //      if (e.kind == calc_stream_event_kind::need_input) {
+    //          read a chunk, and input.feed(...) or input.close().
+    //      } else if (e.kind == calc_stream_event_kind::value) {
+    //          use e.value
+    //      }
+    //  }
+    //
+    // NOTE: the input is taken by reference, and must outlive the task.
+    inline calc_stream_task calc_stream(calc_stream_input & input,
+                                        std::size_t budget = std::numeric_limits<std::size_t>::max())
+    {
+        budget = std::max<std::size_t>(budget, 1);
+        std::uint32_t const slice = static_cast<std::uint32_t>(
+            std::min<std::size_t>(budget, std::numeric_limits<std::uint32_t>::max()));
+
+        // the expressions completed by a push. Their nodes are swapped out
+        // of the parser, so the buffers are reused without a copy.
+        std::vector<calc_ast> completed;
+        std::vector<bool> parsed;
+        std::size_t count = 0;
+        auto on_expression = [&](calc_ast & ast, bool ok) {
+            if (count == completed.size()) {
+                completed.emplace_back();
+                parsed.push_back(ok);
+            }
+            std::swap(completed[count].nodes, ast.nodes);
+            parsed[count] = ok;
+            ++count;
+        };
+
+        calc_push_parser parser;
+        calc_evaluator evaluator;
+        for (bool finished = false; !finished; ) {
+            if (input.empty()) {
+                if (!input.closed()) {
+                    co_await input.more();
+                    continue;
+                }
+                parser.finish(on_expression);
+                finished = true;
+            } else {
+                input.consume(parser.push(input.first(), input.last(), on_expression, budget));
+            }
+
+            bool const stopped = !input.empty();
+            for (std::size_t i = 0; i < count; ++i) {
+                calc_ast const& ast = completed[i];
+                if (!parsed[i]) {
+                    co_yield calc_stream_event{ calc_stream_event_kind::parse_error, 0, &ast };
+                    continue;
+                }
+                // in the slices of the budget, with a pause between them.
+                std::uint32_t const n = static_cast<std::uint32_t>(ast.size());
+                bool ok = true;
+                for (std::uint32_t first = 0; ok && first < n; first += std::min(slice, n - first)) {
+                    if (first > 0) {
+                        co_yield calc_stream_event{ calc_stream_event_kind::paused, 0, nullptr };
+                    }
+                    ok = evaluator.evaluate_nodes(ast, first, first + std::min(slice, n - first));
+                }
+                if (ok) {
+                    co_yield calc_stream_event{ calc_stream_event_kind::value, evaluator.value(ast.root()), &ast };
+                } else {
+                    co_yield calc_stream_event{ calc_stream_event_kind::eval_error, 0, &ast };
+                }
+            }
+            if (stopped && count == 0) {
+                co_yield calc_stream_event{ calc_stream_event_kind::paused, 0, nullptr };
+            }
+            count = 0;
+        }
+    }
+} // namespace algovisu
+
+
+#endif  // coroutines
+#endif  // ALGOVISU_CALC_COROUTINE_H
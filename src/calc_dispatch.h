@@ -0,0 +1,25 @@
+#ifndef ALGOVISU_CALC_DISPATCH_H
+#define ALGOVISU_CALC_DISPATCH_H
+
+
+#include <cstdint>
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define ALGOVISU_HAS_COMPUTED_GOTO 1
+#endif
+
+
+namespace algovisu
+{
+    // The dispatch of the virtual machines. The threaded one is by the labels
+    // as values of GCC and Clang, and the vms fall back to the switch where
+    // ALGOVISU_HAS_COMPUTED_GOTO isn't defined.
+    enum class calc_dispatch : std::uint8_t
+    {
+        switch_loop,    // a switch on the op of every instruction.
+        threaded        // a jump to the handler address in the instruction.
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_DISPATCH_H
@@ -0,0 +1,416 @@
+#ifndef ALGOVISU_CALC_DOCUMENT_H
+#define ALGOVISU_CALC_DOCUMENT_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "calculator.h"
+#include "calc_ast.h"
+
+
+namespace algovisu
+{
+    // A token of calc_document, at its offset in the text.
+    struct calc_document_token
+    {
+        std::uint32_t offset;
+        std::uint32_t size;
+        std::uint32_t node;     // the literal node, for a literal.
+        char kind;              // '0' for a literal, or the operator or the parenthesis.
+    };
+
+    // What the last edit has done again.
+    struct calc_edit_stats
+    {
+        bool full = false;              // lexed and parsed from scratch.
+        std::size_t relexedTokens = 0;
+        std::size_t reparsedTokens = 0;
+        std::size_t replacedNodes = 0;  // the old nodes replaced by the reparsed ones.
+    };
+
+    // An expression text with its tokens and its calc_ast, which are kept
+    // up to date by the edits without lexing and parsing the whole text again.
+    //
+    // An edit is relexed from the end of the last token before it, which
+    // is a safe boundary as the lexer looks one character ahead only, and
+    // for a literal, which could go on with the digits. It
+    // stops at the first new token starting where an old one did after
+    // the edit, as the rest of the tokens are the same from there.
+    //
+    // Then the smallest run of the operands around the changed tokens is
+    // parsed again, in the chain they are in:
+    //
+    //  - the factors of a * / chain, if no + or - is changed outside the parentheses.
+    //  - or else the terms of a + - chain.
+    //  - or else the whole text, if the parentheses don't match in the changed tokens.
+    //
+    // As the chains are to the left, the nodes of "a op b op c" are
+    // a, b, op, c, op in post-order. So the nodes of a run of the operands
+    // with the operators before them are contiguous, and are replaced in place.
+    // A run not at the start of its chain is parsed after a dummy operand,
+    // "0 op b op c", whose node is linked to the chain before the run.
+    // The nodes after the run are shifted, and so are the tokens after the edit.
+    //
+    // So the whole thing never runs the grammar on more than the run.
+    // But the shifts are linear passes over the arrays when the sizes change,
+    // which are a few memmove()s and adds, and much faster than the parse.
+    //
+    // NOTE: if an edit makes the text invalid, the next edit lexes and parses
+    //          the whole text again, as there's no ast to edit.
+    //
+    // NOTE: the offsets are 32 bits, so the text is less than 4GB.
+    //
+    // ex.)
+    //  calc_document<> document;
+    //  document.assign(text);
+    //  document.edit(offset, 1, "7");
+    //  if (document.valid()) {
+    //      evaluate(document.ast(), result);
+    //  }
+    template <typename Lexer = lex::lexertl::lexer<>>
+    class calc_document
+    {
+    public:
+        using lexer_def_t = calc_token<Lexer>;
+        using grammar_t = calc_buffer_grammar<lexer_def_t>;
+
+        calc_document()
+            : grammar_(lexer_)
+        { }
+
+        calc_document(calc_document const&) = delete;
+        calc_document & operator = (calc_document const&) = delete;
+
+        bool assign(char const * first, char const * last)
+        {
+            text_.assign(first, last);
+            return rebuild();
+        }
+
+        bool assign(std::string const& text)
+        {
+            return assign(text.data(), text.data() + text.size());
+        }
+
+        // Replaces [offset, offset + count) of the text with [first, last).
+        // It returns valid().
+        bool edit(std::size_t offset, std::size_t count, char const * first, char const * last)
+        {
+            std::size_t const inserted = static_cast<std::size_t>(last - first);
+            text_.replace(offset, count, first, inserted);
+            if (!valid_) {
+                return rebuild();
+            }
+            stats_ = calc_edit_stats{};
+            std::ptrdiff_t const delta = static_cast<std::ptrdiff_t>(inserted) - static_cast<std::ptrdiff_t>(count);
+
+            // the first token which could change, the one ending after the edit,
+            // or a literal ending at it, which could go on.
+            std::size_t const a = static_cast<std::size_t>(
+                    std::lower_bound(tokens_.begin(), tokens_.end(), offset,
+                                     [](calc_document_token const& t, std::size_t o) {
+                                         std::size_t const end = t.offset + t.size;
+                                         return end < o || (end == o && t.kind != '0');
+                                     }) - tokens_.begin());
+            std::size_t const restart = a > 0 ? tokens_[a - 1].offset + tokens_[a - 1].size : 0;
+
+            // [a, m) of the old tokens are replaced by the relexed ones.
+            std::size_t const editEnd = offset + inserted;
+            std::size_t m = a;
+            bool aligned = false;
+            char const * const base = text_.data();
+            relexed_.clear();
+            bool const lexed = lex_calc_each(lexer_, base + restart, base + text_.size(), [&](auto const& t) {
+                std::size_t const o = static_cast<std::size_t>(t.value().begin() - base);
+                if (o >= editEnd) {
+                    std::size_t const old = static_cast<std::size_t>(static_cast<std::ptrdiff_t>(o) - delta);
+                    while (m < tokens_.size() && tokens_[m].offset < old) {
+                        ++m;
+                    }
+                    if (m < tokens_.size() && tokens_[m].offset == old) {
+                        aligned = true;
+                        return false;
+                    }
+                }
+                relexed_.push_back(calc_document_token{
+                        static_cast<std::uint32_t>(o), static_cast<std::uint32_t>(t.value().size()), 0, kind_of(t) });
+                return true;
+            });
+            if (!lexed) {
+                valid_ = false;
+                return false;
+            }
+            if (!aligned) {
+                m = tokens_.size();
+            }
+            stats_.relexedTokens = relexed_.size();
+            if (m == a && relexed_.empty()) {
+                // the white spaces only.
+                shift_offsets(a, delta);
+                return true;
+            }
+
+            // the run to parse again, found on the old tokens.
+            shape const oldShape = shape_of(tokens_.data() + a, tokens_.data() + m);
+            shape const newShape = shape_of(relexed_.data(), relexed_.data() + relexed_.size());
+            if (!oldShape.balanced || !newShape.balanced) {
+                return rebuild();
+            }
+            bool const additive = oldShape.additive || newShape.additive;
+            bool chainStart = true;
+            std::size_t const start = scan_left(a, additive, chainStart);
+            std::size_t const oldEnd = scan_right(m, additive);
+            std::uint32_t nodeStart = 0;
+            std::size_t oldNodes = 0;
+            bool found = false;
+            for (std::size_t i = start; i < oldEnd; ++i) {
+                char const k = tokens_[i].kind;
+                if (k == '0' && !found) {
+                    nodeStart = tokens_[i].node;
+                    found = true;
+                }
+                oldNodes += k != '(' && k != ')';
+            }
+
+            // the tokens.
+            splice(tokens_, a, m, relexed_);
+            std::size_t const newEnd = oldEnd - (m - a) + relexed_.size();
+            shift_offsets(a + relexed_.size(), delta);
+
+            // the run, with a dummy operand if it's not at the start of its chain.
+            std::size_t const skip = chainStart ? 0 : 1;
+            run_.clear();
+            if (newEnd > start) {
+                if (!chainStart) {
+                    run_ += '0';
+                }
+                std::size_t const runBegin = tokens_[start].offset;
+                std::size_t const runEnd = tokens_[newEnd - 1].offset + tokens_[newEnd - 1].size;
+                run_.append(text_, runBegin, runEnd - runBegin);
+            }
+            stats_.reparsedTokens = newEnd - start;
+            stats_.replacedNodes = oldNodes;
+            runBuffer_.clear();
+            runAst_.clear();
+            if (!found || run_.empty() || !lex_calc(lexer_, run_.data(), run_.data() + run_.size(), runBuffer_)
+                    || !parse_calc(grammar_, runBuffer_, runAst_)) {
+                valid_ = false;
+                return false;
+            }
+
+            // the nodes.
+            std::uint32_t const prefix = nodeStart - 1;     // the chain before the run.
+            newNodes_.clear();
+            for (std::size_t j = skip; j < runAst_.size(); ++j) {
+                calc_node node = runAst_.nodes[j];
+                if (node.op != calc_op::literal) {
+                    node.lhs = node.lhs < skip ? prefix : static_cast<std::uint32_t>(node.lhs - skip + nodeStart);
+                    node.rhs = static_cast<std::uint32_t>(node.rhs - skip + nodeStart);
+                }
+                newNodes_.push_back(node);
+            }
+            splice(ast_.nodes, nodeStart, nodeStart + oldNodes, newNodes_);
+            std::ptrdiff_t const nodeDelta = static_cast<std::ptrdiff_t>(newNodes_.size())
+                                                - static_cast<std::ptrdiff_t>(oldNodes);
+            if (nodeDelta != 0) {
+                // the last node of the run is the only one referred from after it.
+                std::uint32_t const last = static_cast<std::uint32_t>(nodeStart + oldNodes - 1);
+                for (std::size_t i = nodeStart + newNodes_.size(); i < ast_.size(); ++i) {
+                    calc_node & node = ast_.nodes[i];
+                    if (node.op != calc_op::literal) {
+                        node.lhs = node.lhs >= last ? static_cast<std::uint32_t>(node.lhs + nodeDelta) : node.lhs;
+                        node.rhs = node.rhs >= last ? static_cast<std::uint32_t>(node.rhs + nodeDelta) : node.rhs;
+                    }
+                }
+                for (std::size_t i = newEnd; i < tokens_.size(); ++i) {
+                    if (tokens_[i].kind == '0') {
+                        tokens_[i].node = static_cast<std::uint32_t>(tokens_[i].node + nodeDelta);
+                    }
+                }
+            }
+            link_literals(start, newEnd, nodeStart);
+            return true;
+        }
+
+        bool edit(std::size_t offset, std::size_t count, std::string const& s)
+        {
+            return edit(offset, count, s.data(), s.data() + s.size());
+        }
+
+        // false if the text is not a valid expression.
+        bool valid() const { return valid_; }
+
+        std::string const& text() const { return text_; }
+        std::vector<calc_document_token> const& tokens() const { return tokens_; }
+        calc_ast const& ast() const { return ast_; }
+        calc_edit_stats const& last_edit() const { return stats_; }
+
+    private:
+        // Of the changed tokens.
+        struct shape
+        {
+            bool balanced;      // the parentheses match within them.
+            bool additive;      // with a + or - outside the parentheses.
+        };
+
+        template <typename Token>
+        char kind_of(Token const& t) const
+        {
+            return t.id() == lexer_.decimal_integer_.id() ? '0' : static_cast<char>(t.id());
+        }
+
+        static shape shape_of(calc_document_token const * first, calc_document_token const * last)
+        {
+            shape s{ true, false };
+            int depth = 0;
+            for (; first != last; ++first) {
+                char const k = first->kind;
+                if (k == '(') {
+                    ++depth;
+                } else if (k == ')') {
+                    if (--depth < 0) {
+                        s.balanced = false;
+                    }
+                } else if (depth == 0 && (k == '+' || k == '-')) {
+                    s.additive = true;
+                }
+            }
+            s.balanced = s.balanced && depth == 0;
+            return s;
+        }
+
+        static bool is_separator(char k, bool additive)
+        {
+            return k == '+' || k == '-' || (!additive && (k == '*' || k == '/'));
+        }
+
+        // The start of the run with the token a, in its chain. first if it's
+        // the start of the chain, or else it's the operator before the run.
+        std::size_t scan_left(std::size_t a, bool additive, bool & first) const
+        {
+            int depth = 0;
+            for (std::size_t i = a; i-- > 0; ) {
+                char const k = tokens_[i].kind;
+                if (k == ')') {
+                    ++depth;
+                } else if (k == '(') {
+                    if (depth-- == 0) {
+                        first = true;
+                        return i + 1;
+                    }
+                } else if (depth == 0 && is_separator(k, additive)) {
+                    // a * / chain starts after the + or -.
+                    first = !additive && (k == '+' || k == '-');
+                    return first ? i + 1 : i;
+                }
+            }
+            first = true;
+            return 0;
+        }
+
+        // The end of the run from the token m, in its chain.
+        std::size_t scan_right(std::size_t m, bool additive) const
+        {
+            int depth = 0;
+            for (std::size_t i = m; i < tokens_.size(); ++i) {
+                char const k = tokens_[i].kind;
+                if (k == '(') {
+                    ++depth;
+                } else if (k == ')') {
+                    if (depth-- == 0) {
+                        return i;
+                    }
+                } else if (depth == 0 && is_separator(k, additive)) {
+                    return i;
+                }
+            }
+            return tokens_.size();
+        }
+
+        // The literal tokens in [first, last) and the literal nodes from node
+        // are in the same order.
+        void link_literals(std::size_t first, std::size_t last, std::uint32_t node)
+        {
+            calc_node const * const nodes = ast_.nodes.data();
+            for (std::size_t i = first; i < last; ++i) {
+                if (tokens_[i].kind == '0') {
+                    while (nodes[node].op != calc_op::literal) {
+                        ++node;
+                    }
+                    tokens_[i].node = node++;
+                }
+            }
+        }
+
+        void shift_offsets(std::size_t first, std::ptrdiff_t delta)
+        {
+            if (delta != 0) {
+                for (std::size_t i = first; i < tokens_.size(); ++i) {
+                    tokens_[i].offset = static_cast<std::uint32_t>(tokens_[i].offset + delta);
+                }
+            }
+        }
+
+        template <typename T>
+        static void splice(std::vector<T> & v, std::size_t first, std::size_t last, std::vector<T> const& src)
+        {
+            std::size_t const common = std::min(last - first, src.size());
+            std::copy(src.begin(), src.begin() + common, v.begin() + first);
+            if (src.size() > common) {
+                v.insert(v.begin() + first + common, src.begin() + common, src.end());
+            } else {
+                v.erase(v.begin() + first + common, v.begin() + last);
+            }
+        }
+
+        bool rebuild()
+        {
+            stats_ = calc_edit_stats{};
+            stats_.full = true;
+            tokens_.clear();
+            ast_.clear();
+            valid_ = false;
+            calc_token_buffer<lexer_def_t> buffer;
+            char const * const base = text_.data();
+            if (!lex_calc(lexer_, base, base + text_.size(), buffer)) {
+                return false;
+            }
+            tokens_.reserve(buffer.size());
+            for (auto const& t : buffer) {
+                tokens_.push_back(calc_document_token{
+                        static_cast<std::uint32_t>(t.value().begin() - base),
+                        static_cast<std::uint32_t>(t.value().size()), 0, kind_of(t) });
+            }
+            stats_.relexedTokens = stats_.reparsedTokens = tokens_.size();
+            if (!parse_calc(grammar_, buffer, ast_)) {
+                ast_.clear();
+                return false;
+            }
+            link_literals(0, tokens_.size(), 0);
+            valid_ = true;
+            return true;
+        }
+
+        lexer_def_t lexer_;
+        grammar_t grammar_;
+        std::string text_;
+        std::vector<calc_document_token> tokens_;
+        calc_ast ast_;
+        bool valid_ = false;
+        calc_edit_stats stats_;
+
+        // reused by the edits.
+        std::vector<calc_document_token> relexed_;
+        std::string run_;
+        calc_token_buffer<lexer_def_t> runBuffer_;
+        calc_ast runAst_;
+        std::vector<calc_node> newNodes_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_DOCUMENT_H
@@ -0,0 +1,120 @@
+#ifndef ALGOVISU_CALC_EVALUATOR_H
+#define ALGOVISU_CALC_EVALUATOR_H
+
+
+#include <cstdint>
+#include <vector>
+
+#include "calc_ast.h"
+
+
+namespace algovisu
+{
+    // Applies a binary operator. It returns false for the division by zero.
+    //
+    // NOTE: +, - and * wrap around on overflow, and the division truncates
+    //          toward zero. The only overflowing division, min / -1, gives min.
+    inline bool calc_apply(calc_op op, calc_value_t lhs, calc_value_t rhs, calc_value_t & result)
+    {
+        using unsigned_t = std::uint64_t;
+        switch (op) {
+            case calc_op::add:
+                result = static_cast<calc_value_t>(unsigned_t(lhs) + unsigned_t(rhs));
+                return true;
+            case calc_op::sub:
+                result = static_cast<calc_value_t>(unsigned_t(lhs) - unsigned_t(rhs));
+                return true;
+            case calc_op::mul:
+                result = static_cast<calc_value_t>(unsigned_t(lhs) * unsigned_t(rhs));
+                return true;
+            case calc_op::div:
+                if (rhs == 0) {
+                    return false;
+                }
+                if (rhs == -1) {
+                    result = static_cast<calc_value_t>(unsigned_t(0) - unsigned_t(lhs));
+                    return true;
+                }
+                result = lhs / rhs;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Step probe policies for basic_calc_evaluator.
+    //
+    // A step is an application of an operator node. The probe is told
+    // before and after each step, and no_step_probe does nothing.
+    struct no_step_probe
+    {
+        void before_step(std::uint32_t, calc_op)
+        { }
+
+        void after_step(std::uint32_t, calc_op, calc_value_t, calc_value_t, calc_value_t)
+        { }
+    };
+
+    // Evaluates a calc_ast in one forward pass over its post-ordered nodes.
+    // The value of every node is kept until the next evaluation,
+    // and the buffer is reused to avoid the allocations.
+    template <typename StepProbe = no_step_probe>
+    class basic_calc_evaluator
+    {
+    public:
+        bool evaluate(calc_ast const& ast, calc_value_t & result)
+        {
+            if (ast.empty() || !evaluate_nodes(ast, 0, static_cast<std::uint32_t>(ast.size()))) {
+                return false;
+            }
+            result = values_[ast.root()];
+            return true;
+        }
+
+        // Evaluates the nodes [first, last) only, so that a large tree can be
+        // evaluated in slices. The slices must be evaluated in order from 0.
+        bool evaluate_nodes(calc_ast const& ast, std::uint32_t first, std::uint32_t last)
+        {
+            if (first == 0) {
+                values_.resize(ast.size());
+            }
+            calc_value_t * values = values_.data();
+            calc_node const * nodes = ast.nodes.data();
+            for (std::uint32_t i = first; i < last; ++i) {
+                calc_node const& node = nodes[i];
+                if (node.op == calc_op::literal) {
+                    values[i] = node.value;
+                    continue;
+                }
+                probe_.before_step(i, node.op);
+                calc_value_t const lhs = values[node.lhs];
+                calc_value_t const rhs = values[node.rhs];
+                if (!calc_apply(node.op, lhs, rhs, values[i])) {
+                    return false;
+                }
+                probe_.after_step(i, node.op, lhs, rhs, values[i]);
+            }
+            return true;
+        }
+
+        // the value of a node by the last successful evaluation.
+        calc_value_t value(std::uint32_t node) const { return values_[node]; }
+
+        StepProbe & probe() { return probe_; }
+
+    private:
+        std::vector<calc_value_t> values_;
+        StepProbe probe_;
+    };
+
+    using calc_evaluator = basic_calc_evaluator<>;
+
+    inline bool evaluate(calc_ast const& ast, calc_value_t & result)
+    {
+        calc_evaluator evaluator;
+        return evaluator.evaluate(ast, result);
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_EVALUATOR_H
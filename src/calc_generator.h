@@ -0,0 +1,320 @@
+#ifndef ALGOVISU_CALC_GENERATOR_H
+#define ALGOVISU_CALC_GENERATOR_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+
+namespace algovisu
+{
+    // The knobs of calc_generator.
+    //
+    // The probabilities are in [0, 1]. They are converted to the integer
+    // thresholds once, so the output doesn't depend on the floating point
+    // behavior of the platform.
+    struct calc_generator_options
+    {
+        std::uint64_t seed = 1;
+
+        std::size_t minTokens = 3;                  // tokens per expression, 1 less at worst
+        std::size_t maxTokens = 200;
+        std::size_t maxDepth = 8;                   // nesting of the parentheses
+        double group = 0.1;                         // an operand is a parenthesized group
+        std::array<unsigned, 4> opWeights{ { 1, 1, 1, 1 } };   // + - * /
+        std::size_t minDigits = 1;                  // literal length
+        std::size_t maxDigits = 3;
+        double whitespace = 0.5;                    // a blank after a token
+        double repetition = 0.0;                    // an expression repeats a recent one
+        double invalid = 0.0;                       // an expression is broken on purpose
+    };
+
+    // A seeded generator of calc expressions, one per line.
+    //
+    // The output is reproducible byte for byte from the options, on every
+    // platform. It's hand-rolled rather than built on Spirit.Karma, for
+    // the speed. See "generate/lines/4096k" of algovisu_bench.
+    //
+    // NOTE: the literals never start with 0, so "0" and the leading zeros
+    //          appear only in the invalid expressions. A valid expression can
+    //          still fail to be evaluated by a division by a zero group.
+    class calc_generator
+    {
+    public:
+        explicit calc_generator(calc_generator_options const& options = {})
+            : options_(options)
+            , random_{ options.seed }
+            , group16_(threshold_of(options.group) >> 16)
+            , close_(threshold_of(0.5))
+            , whitespace16_((threshold_of(options.whitespace) >> 16) + (options.whitespace >= 1.0))
+            , repetition_(threshold_of(options.repetition))
+            , invalid_(threshold_of(options.invalid))
+        {
+            options_.minTokens = std::max<std::size_t>(options_.minTokens, 1);     // a literal at least.
+            options_.maxTokens = std::max(options_.maxTokens, options_.minTokens);
+            options_.minDigits = std::max<std::size_t>(options_.minDigits, 1);
+            options_.maxDigits = std::max(options_.maxDigits, options_.minDigits);
+            digitRange_ = options_.maxDigits - options_.minDigits + 1;
+
+            std::uint64_t total = 0;
+            for (std::size_t i = 0; i < 4; ++i) {
+                total += options_.opWeights[i];
+                opLimits_[i] = total;
+            }
+            if (total == 0) {
+                opLimits_ = { { 1, 2, 3, 4 } };
+            }
+        }
+
+        // Appends an expression to out, without a newline.
+        // It returns false if the expression is made invalid on purpose.
+        bool next(std::string & out)
+        {
+            if (repetition_ && !recent_.empty() && chance(repetition_)) {
+                auto const& e = recent_[bounded(recent_.size())];
+                out.append(e.first);
+                return e.second;
+            }
+
+            std::size_t const start = out.size();
+            append_valid(out);
+            bool const valid = !(invalid_ && chance(invalid_));
+            if (!valid) {
+                break_expression(out, start);
+            }
+
+            if (repetition_) {
+                std::pair<std::string, bool> e(out.substr(start), valid);
+                if (recent_.size() < max_recent) {
+                    recent_.push_back(std::move(e));
+                } else {
+                    recent_[recentNext_++ % max_recent] = std::move(e);
+                }
+            }
+            return valid;
+        }
+
+        // Generates the lines of at least `bytes` bytes in total, and passes
+        // them to sink(char const * data, std::size_t size) in ~64 KB chunks.
+        // It returns the number of the bytes generated.
+        template <typename Sink>
+        std::uint64_t generate_chunks(std::uint64_t bytes, Sink sink)
+        {
+            std::size_t const chunk = 64 * 1024;
+            std::uint64_t total = 0;
+            chunk_.clear();
+            while (total < bytes) {
+                next(chunk_);
+                chunk_ += '\n';
+                if (chunk_.size() >= chunk || total + chunk_.size() >= bytes) {
+                    sink(chunk_.data(), chunk_.size());
+                    total += chunk_.size();
+                    chunk_.clear();
+                }
+            }
+            return total;
+        }
+
+        std::uint64_t generate(std::uint64_t bytes, std::ostream & os)
+        {
+            return generate_chunks(bytes, [&os](char const * data, std::size_t size) {
+                os.write(data, static_cast<std::streamsize>(size));
+            });
+        }
+
+        std::uint64_t generate(std::uint64_t bytes, std::string & out)
+        {
+            return generate_chunks(bytes, [&out](char const * data, std::size_t size) {
+                out.append(data, size);
+            });
+        }
+
+    private:
+        static constexpr std::size_t max_recent = 64;
+
+        static std::uint32_t threshold_of(double p)
+        {
+            if (p <= 0.0) {
+                return 0;
+            }
+            if (p >= 1.0) {
+                return ~std::uint32_t(0);
+            }
+            return static_cast<std::uint32_t>(p * 4294967296.0);
+        }
+
+        struct splitmix64
+        {
+            std::uint64_t operator()()
+            {
+                std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                return z ^ (z >> 31);
+            }
+
+            std::uint64_t state;
+        };
+
+        std::uint64_t random()
+        {
+            return random_();
+        }
+
+        // [0, n)
+        std::size_t bounded(std::size_t n)
+        {
+            return static_cast<std::size_t>(((random() >> 32) * std::uint64_t(n)) >> 32);
+        }
+
+        bool chance(std::uint32_t threshold)
+        {
+            return threshold == ~std::uint32_t(0) || (random() >> 32) < threshold;
+        }
+
+        std::size_t between(std::size_t lo, std::size_t hi)
+        {
+            return lo + bounded(hi - lo + 1);
+        }
+
+        // A blank is written anyway, and kept by the 16 bits of a random number.
+        // The branchless writes keep the random decisions off the branch predictor.
+        char * blank(char * p, std::uint64_t bits) const
+        {
+            *p = ' ';
+            return p + ((bits & 0xffff) < whitespace16_);
+        }
+
+        // The maxDigits digits are written anyway, and the length is taken
+        // from the high 16 bits of r. The digits are from the low 32 bits,
+        // 9 digits per 32 bits by the multiply and shift.
+        char * literal(char * p, std::uint64_t r, splitmix64 & random) const
+        {
+            std::size_t const maxDigits = options_.maxDigits;
+            std::size_t const digits = options_.minDigits + static_cast<std::size_t>(((r >> 48) * digitRange_) >> 16);
+            std::uint64_t m = (r & 0xffffffffu) * 9;
+            p[0] = static_cast<char>('1' + (m >> 32));
+            for (std::size_t i = 1; i < maxDigits; ++i) {
+                if (i % 9 == 0) {
+                    m = random();
+                }
+                m = (m & 0xffffffffu) * 10;
+                p[i] = static_cast<char>('0' + (m >> 32));
+            }
+            return p + digits;
+        }
+
+        char op(std::uint64_t r) const
+        {
+            std::uint64_t const v = ((r & 0xffffffffu) * opLimits_[3]) >> 32;
+            return "+-*/"[(v >= opLimits_[0]) + (v >= opLimits_[1]) + (v >= opLimits_[2])];
+        }
+
+        // operand (op operand)*, where an operand opens up to maxDepth groups
+        // before its literal and may close some of them after.
+        // The groups left open are counted in, so the target is never exceeded.
+        //
+        // NOTE: the random state is kept in a local. The char writes may
+        //          alias the members, which would be reloaded after each write.
+        void append_valid(std::string & out)
+        {
+            std::size_t const target = between(options_.minTokens, options_.maxTokens);
+            std::size_t const maxDepth = options_.maxDepth;
+            std::uint32_t const group = group16_;
+            std::uint32_t const close = close_;
+            std::size_t const start = out.size();
+            out.resize(start + target * (options_.maxDigits + 1) + 1);
+            char * const first = &out[start];
+            char * p = first;
+            splitmix64 random = random_;
+
+            // a random number is split into the decisions of a few tokens.
+            // its high 16 bits decide whether the next operand opens a group.
+            std::uint64_t r = random();
+            std::size_t tokens = 0;
+            std::size_t depth = 0;
+            for (;;) {
+                while (depth < maxDepth && tokens + depth + 3 <= target && (r >> 48) < group) {
+                    *p++ = '(';
+                    r = random();
+                    p = blank(p, r);
+                    ++depth;
+                    ++tokens;
+                }
+                std::uint64_t const l = random();
+                p = blank(literal(p, l, random), l >> 32);
+                ++tokens;
+                while (depth > 0) {
+                    std::uint64_t const c = random();
+                    if ((c >> 32) >= close) {
+                        break;
+                    }
+                    *p++ = ')';
+                    p = blank(p, c);
+                    --depth;
+                    ++tokens;
+                }
+                if (tokens + depth + 2 > target) {
+                    break;
+                }
+                r = random();
+                *p++ = op(r);
+                p = blank(p, r >> 32);
+                ++tokens;
+            }
+            for (; depth > 0; --depth) {
+                *p++ = ')';
+            }
+            // no trailing blank
+            while (p[-1] == ' ') {
+                --p;
+            }
+            out.resize(start + static_cast<std::size_t>(p - first));
+            random_ = random;
+        }
+
+        // Every way leaves an expression which doesn't lex or parse.
+        void break_expression(std::string & out, std::size_t start)
+        {
+            switch (bounded(5)) {
+                case 0:
+                    out += " +";
+                    break;
+                case 1:
+                    out.insert(start, 1, ')');
+                    break;
+                case 2:
+                    out.insert(start, "* ");
+                    break;
+                case 3:
+                    out.insert(start + bounded(out.size() - start + 1), 1, '$');
+                    break;
+                default:
+                    out.insert(start, "0");     // a leading zero, or 0 before a group
+                    break;
+            }
+        }
+
+        calc_generator_options options_;
+        splitmix64 random_;
+        std::uint32_t group16_;
+        std::uint32_t close_;
+        std::uint32_t whitespace16_;
+        std::uint64_t digitRange_;
+        std::uint32_t repetition_;
+        std::uint32_t invalid_;
+        std::array<std::uint64_t, 4> opLimits_;
+
+        std::vector<std::pair<std::string, bool>> recent_;
+        std::size_t recentNext_ = 0;
+        std::string chunk_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_GENERATOR_H
@@ -0,0 +1,375 @@
+#ifndef ALGOVISU_CALC_GRAPH_EMITTER_H
+#define ALGOVISU_CALC_GRAPH_EMITTER_H
+
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+#include "calc_output.h"
+#include "calc_tree_layout.h"
+
+
+namespace algovisu
+{
+    struct calc_emit_stats
+    {
+        std::uint64_t nodes = 0;
+        std::uint64_t edges = 0;
+        std::uint64_t summaries = 0;    // the subtrees drawn as one shape.
+        std::uint64_t summarized = 0;   // the nodes in them.
+        std::uint64_t culled = 0;       // the subtrees out of the viewport.
+    };
+
+    // Writes a calc_ast as a Graphviz DOT graph or an SVG picture, through
+    // a large buffer to the sink, so the document is never built in memory.
+    //
+    // The whole tree is written to DOT in the stored order of the nodes.
+    // With a layout and a viewport, the tree is walked from the root with
+    // an explicit stack, and a subtree out of the viewport is skipped at
+    // once, and a subtree narrower than minPixels is drawn as a triangle.
+    // So a small window on a huge tree writes and walks the nodes in the
+    // window only. The bounds of the subtrees for it are found by a pass
+    // over the nodes for every document though, with no output.
+    //
+    // NOTE: the numbers are written in the tenths of a pixel.
+    //
+    // ex.)
+    //  fd_output_sink sink(fd);
+    //  calc_graph_emitter<fd_output_sink> emitter(sink);
+    //  calc_viewport viewport = fit_calc_viewport(ast, layout, 1920, 1080);
+    //  viewport.minPixels = 4;
+    //  emitter.svg(ast, layout, viewport);
+    //  emitter.flush();
+    template <typename Sink>
+    class calc_graph_emitter
+    {
+    public:
+        explicit calc_graph_emitter(Sink & sink, std::size_t bufferSize = 1 << 20)
+            : buffer_(sink, bufferSize)
+        { }
+
+        // The whole tree, for dot to lay it out.
+        void dot(calc_ast const& ast)
+        {
+            stats_ = calc_emit_stats{};
+            put("digraph calc {\nnode [shape=plaintext];\n");
+            for (std::uint32_t i = 0; i < ast.size(); ++i) {
+                calc_node const& node = ast.nodes[i];
+                put_dot_node(i, node);
+                put("];\n");
+                if (node.op != calc_op::literal) {
+                    put_dot_edge(i, node.lhs);
+                    put_dot_edge(i, node.rhs);
+                    stats_.edges += 2;
+                }
+            }
+            stats_.nodes = ast.size();
+            put("}\n");
+        }
+
+        // The nodes in the viewport, at the positions of the layout, for neato -n.
+        // The far ends of the edges across it are declared too, as neato -n
+        // needs the position of every node.
+        void dot(calc_ast const& ast, calc_tree_layout const& layout, calc_viewport const& viewport)
+        {
+            stats_ = calc_emit_stats{};
+            find_bounds(ast, layout);
+            put("digraph calc {\nnode [shape=plaintext];\n");
+            auto const declare = [&](std::uint32_t i, bool summary) {
+                double const x = px(viewport, layout.x(i));
+                double const y = -py(viewport, layout.depth(i));
+                if (summary) {
+                    put("n");
+                    buffer_.put_decimal(i);
+                    put(" [shape=triangle,label=\"");
+                    buffer_.put_decimal(size_[i]);
+                    put("\"");
+                } else {
+                    put_dot_node(i, ast.nodes[i]);
+                }
+                put(",pos=\"");
+                put_fixed(x);
+                buffer_.put(',');
+                put_fixed(y);
+                put("!\"];\n");
+            };
+            // the edges of a parent are in a row.
+            std::uint32_t declared = ~std::uint32_t(0);
+            walk(ast, layout, viewport,
+                 declare,
+                 [&](std::uint32_t parent, std::uint32_t child, bool parentShown, bool childShown) {
+                     if (!parentShown && parent != declared) {
+                         declare(parent, false);
+                         declared = parent;
+                     }
+                     if (!childShown) {
+                         declare(child, false);
+                     }
+                     put_dot_edge(parent, child);
+                 });
+            put("}\n");
+        }
+
+        // The nodes in the viewport, with the edges behind them.
+        void svg(calc_ast const& ast, calc_tree_layout const& layout, calc_viewport const& viewport)
+        {
+            stats_ = calc_emit_stats{};
+            find_bounds(ast, layout);
+            double const radius = viewport.scale * 0.3;
+            bool const labels = viewport.scale >= 12;
+            put("<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"");
+            put_fixed(viewport.width);
+            put("\" height=\"");
+            put_fixed(viewport.height);
+            put("\">\n<style>path{fill:none;stroke:#888}circle{fill:#fff;stroke:#333}"
+                ".s{fill:#ccc;stroke:#999}text{text-anchor:middle;dominant-baseline:central;font:");
+            put_fixed(radius);
+            put("px sans-serif}</style>\n");
+
+            // the edges, in the paths of edges_per_path.
+            std::uint64_t inPath = 0;
+            walk(ast, layout, viewport,
+                 [](std::uint32_t, bool) {},
+                 [&](std::uint32_t parent, std::uint32_t child, bool, bool) {
+                     if (inPath == 0) {
+                         put("<path d=\"");
+                     }
+                     buffer_.put('M');
+                     put_point(viewport, layout, parent);
+                     buffer_.put('L');
+                     put_point(viewport, layout, child);
+                     if (++inPath == edges_per_path) {
+                         put("\"/>\n");
+                         inPath = 0;
+                     }
+                 });
+            if (inPath != 0) {
+                put("\"/>\n");
+            }
+            // the same walk again, which counts the same.
+            stats_ = calc_emit_stats{};
+
+            walk(ast, layout, viewport,
+                 [&](std::uint32_t i, bool summary) {
+                     if (summary) {
+                         // from the node down to the corners of its subtree.
+                         double const bottom = py(viewport, layout.depth(i) + layout.height(i));
+                         put("<path class=\"s\" d=\"M");
+                         put_point(viewport, layout, i);
+                         buffer_.put('L');
+                         put_fixed(px(viewport, minX_[i]));
+                         buffer_.put(' ');
+                         put_fixed(bottom);
+                         buffer_.put('L');
+                         put_fixed(px(viewport, maxX_[i]));
+                         buffer_.put(' ');
+                         put_fixed(bottom);
+                         put("Z\"><title>");
+                         buffer_.put_decimal(size_[i]);
+                         put(" nodes</title></path>\n");
+                         return;
+                     }
+                     double const x = px(viewport, layout.x(i));
+                     double const y = py(viewport, layout.depth(i));
+                     put("<circle cx=\"");
+                     put_fixed(x);
+                     put("\" cy=\"");
+                     put_fixed(y);
+                     put("\" r=\"");
+                     put_fixed(radius);
+                     put("\"/>");
+                     if (labels) {
+                         put("<text x=\"");
+                         put_fixed(x);
+                         put("\" y=\"");
+                         put_fixed(y);
+                         put("\">");
+                         put_label(ast.nodes[i]);
+                         put("</text>");
+                     }
+                     buffer_.put('\n');
+                 },
+                 [](std::uint32_t, std::uint32_t, bool, bool) {});
+            put("</svg>\n");
+        }
+
+        // of the last document.
+        calc_emit_stats const& stats() const { return stats_; }
+
+        bool flush() { return buffer_.flush(); }
+        bool good() const { return buffer_.good(); }
+
+    private:
+        static constexpr std::uint64_t edges_per_path = 4096;
+
+        template <std::size_t N>
+        void put(char const (&s)[N])
+        {
+            buffer_.put(s, N - 1);
+        }
+
+        // in the tenths, rounded.
+        void put_fixed(double v)
+        {
+            std::int64_t const tenths = static_cast<std::int64_t>(std::llround(v * 10));
+            std::uint64_t u = static_cast<std::uint64_t>(tenths);
+            if (tenths < 0) {
+                buffer_.put('-');
+                u = 0 - u;
+            }
+            buffer_.put_decimal(u / 10);
+            if (u % 10 != 0) {
+                buffer_.put('.');
+                buffer_.put(static_cast<char>('0' + u % 10));
+            }
+        }
+
+        void put_point(calc_viewport const& viewport, calc_tree_layout const& layout, std::uint32_t i)
+        {
+            put_fixed(px(viewport, layout.x(i)));
+            buffer_.put(' ');
+            put_fixed(py(viewport, layout.depth(i)));
+        }
+
+        void put_label(calc_node const& node)
+        {
+            if (node.op == calc_op::literal) {
+                buffer_.put_value(node.value);
+            } else {
+                buffer_.put(to_char(node.op));
+            }
+        }
+
+        // with the attributes open.
+        void put_dot_node(std::uint32_t i, calc_node const& node)
+        {
+            buffer_.put('n');
+            buffer_.put_decimal(i);
+            put(" [label=\"");
+            put_label(node);
+            buffer_.put('"');
+        }
+
+        void put_dot_edge(std::uint32_t parent, std::uint32_t child)
+        {
+            buffer_.put('n');
+            buffer_.put_decimal(parent);
+            put(" -> n");
+            buffer_.put_decimal(child);
+            put(";\n");
+        }
+
+        static double px(calc_viewport const& v, double x) { return (x - v.left) * v.scale; }
+        static double py(calc_viewport const& v, double depth) { return (depth - v.top) * v.scale; }
+
+        // The x bounds and the size of every subtree, bottom-up.
+        // The bounds are the half units around the nodes, rounded outward to float.
+        void find_bounds(calc_ast const& ast, calc_tree_layout const& layout)
+        {
+            std::size_t const n = ast.size();
+            minX_.resize(n);
+            maxX_.resize(n);
+            size_.resize(n);
+            calc_node const * const nodes = ast.nodes.data();
+            double const * const xs = layout.xs().data();
+            for (std::uint32_t i = 0; i < n; ++i) {
+                calc_node const& node = nodes[i];
+                if (node.op == calc_op::literal) {
+                    minX_[i] = calc_float_below(xs[i] - 0.5);
+                    maxX_[i] = calc_float_above(xs[i] + 0.5);
+                    size_[i] = 1;
+                } else {
+                    minX_[i] = std::min(minX_[node.lhs], minX_[node.rhs]);
+                    maxX_[i] = std::max(maxX_[node.lhs], maxX_[node.rhs]);
+                    size_[i] = size_[node.lhs] + size_[node.rhs] + 1;
+                }
+            }
+        }
+
+        // Calls onNode(node, summary) for the nodes in the viewport, and
+        // onEdge(parent, child, parentShown, childShown) for the edges across
+        // it, from the root. An end is shown if onNode is called for it.
+        template <typename OnNode, typename OnEdge>
+        void walk(calc_ast const& ast, calc_tree_layout const& layout, calc_viewport const& viewport,
+                  OnNode && onNode, OnEdge && onEdge)
+        {
+            if (ast.empty()) {
+                return;
+            }
+            calc_node const * const nodes = ast.nodes.data();
+            // the node circles stick out by a half unit.
+            double const left = viewport.left - 0.5;
+            double const right = viewport.right() + 0.5;
+            double const top = viewport.top - 0.5;
+            double const bottom = viewport.bottom() + 0.5;
+            double const minWidth = viewport.minPixels / viewport.scale;
+
+            enum class seen { culled, summary, inside, outside };
+            auto const see = [&](std::uint32_t i) {
+                double const x = layout.x(i);
+                double const depth = layout.depth(i);
+                if (minX_[i] > right || maxX_[i] < left || depth > bottom || depth + layout.height(i) < top) {
+                    return seen::culled;
+                }
+                if (nodes[i].op != calc_op::literal && maxX_[i] - minX_[i] < minWidth) {
+                    return seen::summary;
+                }
+                return x >= left && x <= right && depth >= top && depth <= bottom ? seen::inside : seen::outside;
+            };
+
+            stack_.clear();
+            stack_.push_back(ast.root());
+            while (!stack_.empty()) {
+                std::uint32_t const i = stack_.back();
+                stack_.pop_back();
+                calc_node const& node = nodes[i];
+                seen const s = see(i);
+                if (s == seen::culled) {
+                    ++stats_.culled;
+                    continue;
+                }
+                if (s == seen::summary) {
+                    onNode(i, true);
+                    ++stats_.summaries;
+                    stats_.summarized += size_[i];
+                    continue;
+                }
+                if (s == seen::inside) {
+                    onNode(i, false);
+                    ++stats_.nodes;
+                }
+                if (node.op == calc_op::literal) {
+                    continue;
+                }
+                // an edge is across the viewport if its bounding box is.
+                double const x = layout.x(i);
+                double const depth = layout.depth(i);
+                for (std::uint32_t child : { node.lhs, node.rhs }) {
+                    double const cx = layout.x(child);
+                    if (std::max(x, cx) >= left && std::min(x, cx) <= right && depth + 1 >= top && depth <= bottom) {
+                        seen const c = see(child);
+                        onEdge(i, child, s == seen::inside, c == seen::summary || c == seen::inside);
+                        ++stats_.edges;
+                    }
+                }
+                // the left one first.
+                stack_.push_back(node.rhs);
+                stack_.push_back(node.lhs);
+            }
+        }
+
+        calc_output_buffer<Sink> buffer_;
+        calc_emit_stats stats_;
+        std::vector<float> minX_;
+        std::vector<float> maxX_;
+        std::vector<std::uint32_t> size_;
+        std::vector<std::uint32_t> stack_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_GRAPH_EMITTER_H
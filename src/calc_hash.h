@@ -0,0 +1,146 @@
+#ifndef ALGOVISU_CALC_HASH_H
+#define ALGOVISU_CALC_HASH_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+
+namespace algovisu
+{
+    struct calc_hash128
+    {
+        std::uint64_t lo;
+        std::uint64_t hi;
+
+        friend bool operator == (calc_hash128 const& a, calc_hash128 const& b)
+        {
+            return a.lo == b.lo && a.hi == b.hi;
+        }
+
+        friend bool operator != (calc_hash128 const& a, calc_hash128 const& b)
+        {
+            return !(a == b);
+        }
+    };
+
+    namespace detail
+    {
+        inline std::uint64_t rotl64(std::uint64_t x, int b)
+        {
+            return (x << b) | (x >> (64 - b));
+        }
+
+        struct sip_state
+        {
+            std::uint64_t v0, v1, v2, v3;
+
+            void round()
+            {
+                v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);
+                v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;
+                v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;
+                v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);
+            }
+
+            void compress(std::uint64_t m)
+            {
+                v3 ^= m;
+                round();
+                round();
+                v0 ^= m;
+            }
+
+            std::uint64_t finalize(std::uint64_t marker)
+            {
+                v2 ^= marker;
+                round();
+                round();
+                round();
+                round();
+                return v0 ^ v1 ^ v2 ^ v3;
+            }
+        };
+
+        // NOTE: the words are read in the host order. The hashes are the
+        //          reference ones on the little endian hosts only.
+        inline std::uint64_t load_u64(unsigned char const * p)
+        {
+            std::uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+    } // namespace detail
+
+    // SipHash-2-4 with the 128 bit output.
+    //
+    // It's keyed, and the collisions of the content keys are as unlikely as
+    // a random 128 bit value. So a hash may stand for the text it's made of.
+    inline calc_hash128 siphash128(void const * data, std::size_t size,
+                                   std::uint64_t k0, std::uint64_t k1)
+    {
+        detail::sip_state s{
+            k0 ^ 0x736f6d6570736575ull,
+            k1 ^ 0x646f72616e646f6dull ^ 0xee,
+            k0 ^ 0x6c7967656e657261ull,
+            k1 ^ 0x7465646279746573ull
+        };
+        auto p = static_cast<unsigned char const *>(data);
+        std::size_t const words = size / 8;
+        for (std::size_t i = 0; i < words; ++i, p += 8) {
+            s.compress(detail::load_u64(p));
+        }
+        std::uint64_t last = static_cast<std::uint64_t>(size) << 56;
+        for (std::size_t i = 0; i < size % 8; ++i) {
+            last |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+        }
+        s.compress(last);
+        calc_hash128 h;
+        h.lo = s.finalize(0xee);
+        s.v1 ^= 0xdd;
+        h.hi = s.finalize(0);
+        return h;
+    }
+
+    // The content hash of the calc expression text, with a fixed key
+    // so that it's the same across the runs.
+    inline calc_hash128 calc_text_hash(char const * text, std::size_t size)
+    {
+        return siphash128(text, size, 0x616c676f76697375ull, 0x63616c6363616368ull);
+    }
+
+    // The final mix of MurmurHash3. Every bit of the input affects
+    // every bit of the output.
+    inline std::uint64_t calc_mix64(std::uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // A fast 64 bit hash for the in-memory tables. It's not keyed, and is
+    // not for the persistent keys, which calc_text_hash() is for.
+    inline std::uint64_t calc_bytes_hash(void const * data, std::size_t size)
+    {
+        auto p = static_cast<unsigned char const *>(data);
+        std::uint64_t h = 0x9e3779b97f4a7c15ull ^ (static_cast<std::uint64_t>(size) * 0xff51afd7ed558ccdull);
+        for (; size >= 8; size -= 8, p += 8) {
+            h = (h ^ detail::load_u64(p)) * 0xbf58476d1ce4e5b9ull;
+            h ^= h >> 31;
+        }
+        if (size > 0) {
+            std::uint64_t last = 0;
+            std::memcpy(&last, p, size);
+            h = (h ^ last) * 0xbf58476d1ce4e5b9ull;
+            h ^= h >> 31;
+        }
+        return calc_mix64(h);
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_HASH_H
@@ -0,0 +1,305 @@
+#ifndef ALGOVISU_CALC_INCREMENTAL_H
+#define ALGOVISU_CALC_INCREMENTAL_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+#include "calc_evaluator.h"
+
+
+namespace algovisu
+{
+    // Evaluates a calc_ast once, and then again after a literal is changed,
+    // by recomputing only the values the literal is under.
+    //
+    // A path to the root is as long as the tree is deep, which is the
+    // length of a chain like 1-2+3-... So the chains are flattened into
+    // the groups, like calc_canonicalizer does:
+    //
+    //  - a chain of + and - is a sum of the signed terms, a-(b-c) is a-b+c.
+    //  - a chain of * is a product of the terms.
+    //  - / is not associative with the truncation, so it's a node of its own.
+    //
+    // The terms of a group are the leaves of a segment tree, and a change
+    // of a term is O(log n) in the group. The path to the root is then
+    // as long as the groups are nested, which is how the parentheses and
+    // the precedences alternate.
+    //
+    // The value of every node is kept, or found from the tree of its group
+    // for an inner node of a chain, which is a range of the terms.
+    //
+    // NOTE: like calc_evaluator, the expression fails if any division
+    //          is by zero. A failed division is counted, and its value is 0.
+    //
+    // ex.)
+    //  calc_incremental_evaluator evaluator(ast);
+    //  evaluator.set_literal(node, 42);
+    //  if (evaluator.valid()) {
+    //      std::cout << evaluator.result();
+    //  }
+    class calc_incremental_evaluator
+    {
+    public:
+        calc_incremental_evaluator() = default;
+
+        // The ast is kept by the reference, and must live while it's used.
+        explicit calc_incremental_evaluator(calc_ast & ast)
+        {
+            build(ast);
+        }
+
+        // Builds the groups of ast, and evaluates it.
+        // It returns valid(), so false for an empty ast like calc_evaluator.
+        bool build(calc_ast & ast)
+        {
+            ast_ = &ast;
+            std::size_t const n = ast.size();
+            infos_.assign(n, node_info{});
+            values_.assign(n, 0);
+            failed_.assign(n, 0);
+            groups_.clear();
+            trees_.clear();
+            failures_ = 0;
+            calc_node const * const nodes = ast.nodes.data();
+            for (std::uint32_t i = 0; i < n; ++i) {
+                if (nodes[i].op != calc_op::literal) {
+                    infos_[nodes[i].lhs].parent = i;
+                    infos_[nodes[i].rhs].parent = i;
+                }
+            }
+            // in the stored order, so the terms have their values before the top.
+            for (std::uint32_t i = 0; i < n; ++i) {
+                calc_node const& node = nodes[i];
+                if (node.op == calc_op::literal) {
+                    values_[i] = node.value;
+                } else if (node.op == calc_op::div) {
+                    values_[i] = divide(i);
+                } else if (!is_inner(i)) {
+                    build_group(i);
+                }
+            }
+            return valid();
+        }
+
+        // Changes a literal, and recomputes the values above it.
+        // It returns valid(). The literal of the ast is changed too.
+        // It returns false, and changes nothing, if node is not a literal.
+        bool set_literal(std::uint32_t node, calc_value_t value)
+        {
+            if (node >= values_.size() || ast_->nodes[node].op != calc_op::literal) {
+                return false;
+            }
+            ast_->nodes[node].value = value;
+            if (values_[node] == value) {
+                return valid();
+            }
+            values_[node] = value;
+            for (std::uint32_t cur = node; ; ) {
+                node_info const& info = infos_[cur];
+                std::uint32_t next;
+                calc_value_t v;
+                if (info.group != none) {
+                    group const& g = groups_[info.group];
+                    calc_value_t * tree = trees_.data() + g.tree;
+                    std::size_t p = g.size + info.index;
+                    tree[p] = info.sign < 0 ? negate(values_[cur]) : values_[cur];
+                    for (p /= 2; p >= 1; p /= 2) {
+                        tree[p] = combine(g.op, tree[2 * p], tree[2 * p + 1]);
+                    }
+                    next = g.top;
+                    v = tree[1];
+                } else if (info.parent != none) {
+                    next = info.parent;
+                    v = divide(next);
+                } else {
+                    break;
+                }
+                // nothing above changes, and the failures are counted already.
+                if (values_[next] == v) {
+                    break;
+                }
+                values_[next] = v;
+                cur = next;
+            }
+            return valid();
+        }
+
+        // false if a division is by zero, or nothing is built.
+        bool valid() const { return !values_.empty() && failures_ == 0; }
+
+        // 0 if nothing is built.
+        calc_value_t result() const { return values_.empty() ? 0 : value(ast_->root()); }
+
+        // The value of any node. It's O(log n) for an inner node of a chain.
+        calc_value_t value(std::uint32_t node) const
+        {
+            node_info const& info = infos_[node];
+            if (info.own == none || groups_[info.own].top == node) {
+                return values_[node];
+            }
+            group const& g = groups_[info.own];
+            calc_value_t const * tree = trees_.data() + g.tree;
+            calc_value_t v = identity(g.op);
+            for (std::size_t l = g.size + info.begin, r = g.size + info.end; l < r; l /= 2, r /= 2) {
+                if (l & 1) {
+                    v = combine(g.op, v, tree[l++]);
+                }
+                if (r & 1) {
+                    v = combine(g.op, v, tree[--r]);
+                }
+            }
+            return info.ownSign < 0 ? negate(v) : v;
+        }
+
+        // the number of the groups, and of the terms in them.
+        std::size_t group_count() const { return groups_.size(); }
+        std::size_t term_count() const { return trees_.size() / 2; }
+
+    private:
+        static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+        struct node_info
+        {
+            std::uint32_t parent = none;
+            std::uint32_t group = none;     // the group it's a term of.
+            std::uint32_t index = 0;        // of the term in the group.
+            std::uint32_t own = none;       // the group it's the top or an inner node of.
+            std::uint32_t begin = 0;        // the terms of an inner node.
+            std::uint32_t end = 0;
+            std::int8_t sign = 1;           // of the term.
+            std::int8_t ownSign = 1;        // of an inner node, to the top.
+        };
+
+        // A chain. Its segment tree is tree[1, 2 * size), with the terms
+        // at tree[size, 2 * size). It works for any size, as + and * commute.
+        struct group
+        {
+            calc_op op;                     // add for + and -, or mul.
+            std::uint32_t top;
+            std::uint32_t size;
+            std::size_t tree;
+        };
+
+        static calc_op chain_of(calc_op op)
+        {
+            return op == calc_op::sub ? calc_op::add : op;
+        }
+
+        static calc_value_t negate(calc_value_t v)
+        {
+            return static_cast<calc_value_t>(std::uint64_t(0) - static_cast<std::uint64_t>(v));
+        }
+
+        static calc_value_t identity(calc_op op)
+        {
+            return op == calc_op::add ? 0 : 1;
+        }
+
+        static calc_value_t combine(calc_op op, calc_value_t a, calc_value_t b)
+        {
+            calc_value_t r;
+            calc_apply(op, a, b, r);
+            return r;
+        }
+
+        bool is_inner(std::uint32_t i) const
+        {
+            std::uint32_t const p = infos_[i].parent;
+            calc_op const op = ast_->nodes[i].op;
+            return p != none && op != calc_op::div && op != calc_op::literal
+                    && chain_of(ast_->nodes[p].op) == chain_of(op);
+        }
+
+        // The value of a division node, with the failures counted.
+        calc_value_t divide(std::uint32_t i)
+        {
+            calc_node const& node = ast_->nodes[i];
+            calc_value_t r = 0;
+            bool const ok = calc_apply(calc_op::div, values_[node.lhs], values_[node.rhs], r);
+            if (ok == (failed_[i] != 0)) {
+                failed_[i] = !ok;
+                if (ok) {
+                    --failures_;
+                } else {
+                    ++failures_;
+                }
+            }
+            return ok ? r : 0;
+        }
+
+        // Flattens the chain at top into a group, in order from the left,
+        // with an explicit stack.
+        void build_group(std::uint32_t top)
+        {
+            calc_node const * const nodes = ast_->nodes.data();
+            std::uint32_t const g = static_cast<std::uint32_t>(groups_.size());
+            calc_op const op = chain_of(nodes[top].op);
+            std::size_t const treeBase = trees_.size();
+
+            // the leaves are appended first, and the tree is put before them.
+            leaves_.clear();
+            stack_.clear();
+            stack_.push_back(frame{ top, 1, false });
+            while (!stack_.empty()) {
+                frame const f = stack_.back();
+                stack_.pop_back();
+                node_info & info = infos_[f.node];
+                if (f.node != top && !is_inner(f.node)) {
+                    info.group = g;
+                    info.index = static_cast<std::uint32_t>(leaves_.size());
+                    info.sign = f.sign;
+                    leaves_.push_back(f.sign < 0 ? negate(values_[f.node]) : values_[f.node]);
+                    continue;
+                }
+                if (f.exit) {
+                    info.end = static_cast<std::uint32_t>(leaves_.size());
+                    continue;
+                }
+                info.own = g;
+                info.begin = static_cast<std::uint32_t>(leaves_.size());
+                info.ownSign = f.sign;
+                calc_node const& node = nodes[f.node];
+                std::int8_t const rhsSign = node.op == calc_op::sub ? std::int8_t(-f.sign) : f.sign;
+                stack_.push_back(frame{ f.node, f.sign, true });
+                stack_.push_back(frame{ node.rhs, rhsSign, false });
+                stack_.push_back(frame{ node.lhs, f.sign, false });
+            }
+
+            std::uint32_t const size = static_cast<std::uint32_t>(leaves_.size());
+            trees_.resize(treeBase + 2 * size);
+            calc_value_t * tree = trees_.data() + treeBase;
+            std::copy(leaves_.begin(), leaves_.end(), tree + size);
+            for (std::size_t p = size - 1; p >= 1; --p) {
+                tree[p] = combine(op, tree[2 * p], tree[2 * p + 1]);
+            }
+            groups_.push_back(group{ op, top, size, treeBase });
+            values_[top] = tree[1];
+        }
+
+        struct frame
+        {
+            std::uint32_t node;
+            std::int8_t sign;
+            bool exit;
+        };
+
+        calc_ast * ast_ = nullptr;
+        std::vector<node_info> infos_;
+        std::vector<calc_value_t> values_;      // but of the inner nodes.
+        std::vector<std::uint8_t> failed_;      // the divisions by zero.
+        std::vector<group> groups_;
+        std::vector<calc_value_t> trees_;
+        std::size_t failures_ = 0;
+
+        std::vector<calc_value_t> leaves_;
+        std::vector<frame> stack_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_INCREMENTAL_H
@@ -0,0 +1,557 @@
+#ifndef ALGOVISU_CALC_JIT_H
+#define ALGOVISU_CALC_JIT_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <utility>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #define ALGOVISU_HAS_CALC_JIT 1
+#endif
+
+#include "calc_ast.h"
+#include "calc_register_vm.h"
+
+
+namespace algovisu
+{
+#if defined(ALGOVISU_HAS_CALC_JIT)
+    namespace detail
+    {
+        enum x86_reg : std::uint8_t
+        {
+            rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+            r8, r9, r10, r11, r12, r13, r14, r15,
+            no_reg = 0xff
+        };
+
+        // The few x86-64 instructions of the kernels, all on 64 bits.
+        class x86_emitter
+        {
+        public:
+            enum alu_op : std::uint8_t
+            {
+                alu_add = 0,    // the /digit of 81 and 83.
+                alu_sub = 5,
+                alu_cmp = 7
+            };
+
+            enum condition : std::uint8_t
+            {
+                below = 0x2,
+                equal = 0x4,
+                not_equal = 0x5
+            };
+
+            std::vector<std::uint8_t> & bytes() { return bytes_; }
+            std::size_t position() const { return bytes_.size(); }
+
+            void clear() { bytes_.clear(); }
+
+            void mov(x86_reg dst, x86_reg src)
+            {
+                if (dst != src) {
+                    rr(0x89, src, dst);
+                }
+            }
+
+            void mov(x86_reg dst, calc_value_t imm)
+            {
+                if (fits_int32(imm)) {
+                    rex(0, 0, dst);
+                    put(0xc7);
+                    modrm(3, 0, dst);
+                    put32(static_cast<std::int32_t>(imm));
+                } else {
+                    rex(0, 0, dst);
+                    put(static_cast<std::uint8_t>(0xb8 + (dst & 7)));
+                    put64(imm);
+                }
+            }
+
+            // dst op= src
+            void add(x86_reg dst, x86_reg src) { rr(0x01, src, dst); }
+            void sub(x86_reg dst, x86_reg src) { rr(0x29, src, dst); }
+            void test(x86_reg dst, x86_reg src) { rr(0x85, src, dst); }
+            void cmp(x86_reg dst, x86_reg src) { rr(0x39, src, dst); }
+
+            void imul(x86_reg dst, x86_reg src)
+            {
+                rex(dst, 0, src);
+                put(0x0f);
+                put(0xaf);
+                modrm(3, dst, src);
+            }
+
+            void imul(x86_reg dst, x86_reg src, std::int32_t imm)
+            {
+                rex(dst, 0, src);
+                put(0x69);
+                modrm(3, dst, src);
+                put32(imm);
+            }
+
+            void alu(alu_op op, x86_reg dst, std::int32_t imm)
+            {
+                rex(0, 0, dst);
+                if (imm >= -128 && imm <= 127) {
+                    put(0x83);
+                    modrm(3, op, dst);
+                    put(static_cast<std::uint8_t>(imm));
+                } else {
+                    put(0x81);
+                    modrm(3, op, dst);
+                    put32(imm);
+                }
+            }
+
+            void neg(x86_reg r) { unary(3, r); }
+            void idiv(x86_reg r) { unary(7, r); }
+            void inc(x86_reg r) { unary(0, r); }
+
+            void cqo()
+            {
+                put(0x48);
+                put(0x99);
+            }
+
+            // dst = [base + index * 8 + disp], with no index for no_reg.
+            void load(x86_reg dst, x86_reg base, x86_reg index, std::int32_t disp)
+            {
+                memory(0x8b, dst, base, index, disp);
+            }
+
+            // [base + index * 8 + disp] = src
+            void store(x86_reg base, x86_reg index, std::int32_t disp, x86_reg src)
+            {
+                memory(0x89, src, base, index, disp);
+            }
+
+            void push(x86_reg r)
+            {
+                if (r >= r8) {
+                    put(0x41);
+                }
+                put(static_cast<std::uint8_t>(0x50 + (r & 7)));
+            }
+
+            void pop(x86_reg r)
+            {
+                if (r >= r8) {
+                    put(0x41);
+                }
+                put(static_cast<std::uint8_t>(0x58 + (r & 7)));
+            }
+
+            void ret() { put(0xc3); }
+
+            // The jumps give the position of their displacement to patch.
+            std::size_t jump(condition c)
+            {
+                put(0x0f);
+                put(static_cast<std::uint8_t>(0x80 + c));
+                put32(0);
+                return position() - 4;
+            }
+
+            std::size_t jump()
+            {
+                put(0xe9);
+                put32(0);
+                return position() - 4;
+            }
+
+            void patch(std::size_t at, std::size_t target)
+            {
+                std::int32_t const rel = static_cast<std::int32_t>(target) - static_cast<std::int32_t>(at + 4);
+                std::memcpy(&bytes_[at], &rel, 4);
+            }
+
+            static bool fits_int32(calc_value_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+        private:
+            void put(std::uint8_t b) { bytes_.push_back(b); }
+
+            void put32(std::int32_t v)
+            {
+                std::uint8_t b[4];
+                std::memcpy(b, &v, 4);
+                bytes_.insert(bytes_.end(), b, b + 4);
+            }
+
+            void put64(std::int64_t v)
+            {
+                std::uint8_t b[8];
+                std::memcpy(b, &v, 8);
+                bytes_.insert(bytes_.end(), b, b + 8);
+            }
+
+            // REX.W with the high bits of the reg, the index and the base or rm.
+            void rex(unsigned reg, unsigned index, unsigned base)
+            {
+                put(static_cast<std::uint8_t>(0x48 | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1)));
+            }
+
+            void modrm(unsigned mod, unsigned reg, unsigned rm)
+            {
+                put(static_cast<std::uint8_t>(mod << 6 | (reg & 7) << 3 | (rm & 7)));
+            }
+
+            // op r/m, reg of the register operands.
+            void rr(std::uint8_t op, x86_reg reg, x86_reg rm)
+            {
+                rex(reg, 0, rm);
+                put(op);
+                modrm(3, reg, rm);
+            }
+
+            void unary(unsigned digit, x86_reg r)
+            {
+                rex(0, 0, r);
+                put(0xf7 + (digit == 0 ? 8 : 0));     // inc is ff /0.
+                modrm(3, digit, r);
+            }
+
+            // Always a disp32, and a SIB for an index or a base of rsp or r12.
+            void memory(std::uint8_t op, x86_reg reg, x86_reg base, x86_reg index, std::int32_t disp)
+            {
+                rex(reg, index == no_reg ? 0 : index, base);
+                put(op);
+                if (index != no_reg) {
+                    modrm(2, reg, 4);
+                    put(static_cast<std::uint8_t>(3 << 6 | (index & 7) << 3 | (base & 7)));
+                } else if ((base & 7) == 4) {
+                    modrm(2, reg, 4);
+                    put(0x24);
+                } else {
+                    modrm(2, reg, base);
+                }
+                put32(disp);
+            }
+
+            std::vector<std::uint8_t> bytes_;
+        };
+    } // namespace detail
+
+    // A native kernel of an expression over the rows of the columns.
+    //
+    // The code is in its own mapping, which is writable while it's written
+    // and executable after, never both.
+    class calc_jit_kernel
+    {
+    public:
+        using function_t = std::size_t (*)(calc_value_t const * const * columns, std::size_t rows, calc_value_t * out);
+
+        calc_jit_kernel() = default;
+
+        calc_jit_kernel(calc_jit_kernel && other) noexcept
+            : code_(std::exchange(other.code_, nullptr))
+            , mapped_(std::exchange(other.mapped_, 0))
+            , size_(std::exchange(other.size_, 0))
+        { }
+
+        calc_jit_kernel & operator = (calc_jit_kernel && other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                code_ = std::exchange(other.code_, nullptr);
+                mapped_ = std::exchange(other.mapped_, 0);
+                size_ = std::exchange(other.size_, 0);
+            }
+            return *this;
+        }
+
+        ~calc_jit_kernel()
+        {
+            reset();
+        }
+
+        bool empty() const { return code_ == nullptr; }
+        std::size_t code_size() const { return size_; }
+
+        // The rows evaluated to out, which are all of them, or the rows
+        // before the first one of a division by zero, as calc_column_vm.
+        std::size_t run(calc_value_t const * const * columns, std::size_t rows, calc_value_t * out) const
+        {
+            return reinterpret_cast<function_t>(code_)(columns, rows, out);
+        }
+
+        // false if the memory can't be mapped, or made executable.
+        bool load(std::vector<std::uint8_t> const& code)
+        {
+            reset();
+            long const page = sysconf(_SC_PAGESIZE);
+            std::size_t const mapped = (code.size() + page - 1) / page * page;
+            void * const p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                return false;
+            }
+            std::memcpy(p, code.data(), code.size());
+            if (mprotect(p, mapped, PROT_READ | PROT_EXEC) != 0) {
+                munmap(p, mapped);
+                return false;
+            }
+            code_ = p;
+            mapped_ = mapped;
+            size_ = code.size();
+            return true;
+        }
+
+        void reset()
+        {
+            if (code_) {
+                munmap(code_, mapped_);
+                code_ = nullptr;
+                mapped_ = 0;
+                size_ = 0;
+            }
+        }
+
+    private:
+        void * code_ = nullptr;
+        std::size_t mapped_ = 0;
+        std::size_t size_ = 0;
+    };
+
+    // Compiles an expression to a native x86-64 kernel over the rows of the
+    // columns its literals are bound to, as calc_column_vm runs it.
+    //
+    // The expression is compiled to the register machine code first, over
+    // a file of the 6 callee saved registers, and the 2 scratch registers
+    // of the reloads are r8 and r9. Every instruction is a few native ones,
+    // and the kernel is a loop of them over the rows. rax and rdx are kept
+    // for idiv, rcx for the 64 bit literals, and the spill slots are on the
+    // machine stack.
+    //
+    //  kernel(columns: rdi, rows: rsi, out: rdx -> r10), the row in r11.
+    //
+    // NOTE: a division has the zero check, and the one of -1 that calc_apply
+    //          has, as idiv faults on the lowest value divided by -1.
+    //
+    // ex.)
+    //  calc_jit jit;
+    //  calc_jit_kernel kernel;
+    //  jit.compile(ast, { { aNode, 0 }, { bNode, 1 } }, kernel);
+    //  calc_value_t const * columns[] = { a.data(), b.data() };
+    //  std::size_t const done = kernel.run(columns, rows, out.data());
+    class calc_jit
+    {
+    public:
+        static constexpr std::uint32_t registers = 6;
+
+        calc_jit()
+            : compiler_(registers)
+        { }
+
+        // false for the empty ast, or if the code can't be mapped.
+        bool compile(calc_ast const& ast, std::vector<calc_column_binding> const& columns, calc_jit_kernel & kernel)
+        {
+            compiler_.compile(ast, columns, program_);
+            if (program_.empty()) {
+                kernel.reset();
+                return false;
+            }
+            emit(program_);
+            return kernel.load(x86_.bytes());
+        }
+
+        bool compile(calc_ast const& ast, calc_jit_kernel & kernel)
+        {
+            return compile(ast, {}, kernel);
+        }
+
+        // The register machine code of the last compile.
+        calc_register_program const& program() const { return program_; }
+
+    private:
+        using x86_reg = detail::x86_reg;
+        using x86 = detail::x86_emitter;
+
+        static x86_reg machine(std::uint8_t r)
+        {
+            static x86_reg const map[registers + 2] = {
+                detail::rbx, detail::rbp, detail::r12, detail::r13, detail::r14, detail::r15,
+                detail::r8, detail::r9
+            };
+            return map[r];
+        }
+
+        void emit(calc_register_program const& program)
+        {
+            static x86_reg const saved[] = { detail::rbx, detail::rbp, detail::r12, detail::r13, detail::r14, detail::r15 };
+            std::int32_t const frame = static_cast<std::int32_t>((program.spillSlots + 1) / 2 * 16);
+
+            x86_.clear();
+            fails_.clear();
+            for (x86_reg r : saved) {
+                x86_.push(r);
+            }
+            if (frame) {
+                x86_.alu(x86::alu_sub, detail::rsp, frame);
+            }
+            x86_.mov(detail::r10, detail::rdx);
+            x86_.mov(detail::r11, calc_value_t(0));
+            x86_.test(detail::rsi, detail::rsi);
+            std::size_t const empty = x86_.jump(x86::equal);
+
+            std::size_t const loop = x86_.position();
+            for (calc_register_instruction const& in : program.code) {
+                emit(in);
+            }
+            x86_.store(detail::r10, detail::r11, 0, machine(program.result));
+            x86_.inc(detail::r11);
+            x86_.cmp(detail::r11, detail::rsi);
+            x86_.patch(x86_.jump(x86::below), loop);
+
+            x86_.patch(empty, x86_.position());
+            x86_.mov(detail::rax, detail::rsi);
+            std::size_t const epilogue = x86_.position();
+            if (frame) {
+                x86_.alu(x86::alu_add, detail::rsp, frame);
+            }
+            for (std::size_t i = sizeof(saved) / sizeof(saved[0]); i-- > 0; ) {
+                x86_.pop(saved[i]);
+            }
+            x86_.ret();
+
+            // the rows before the one of the division by zero.
+            std::size_t const fail = x86_.position();
+            x86_.mov(detail::rax, detail::r11);
+            x86_.patch(x86_.jump(), epilogue);
+            for (std::size_t at : fails_) {
+                x86_.patch(at, fail);
+            }
+        }
+
+        void emit(calc_register_instruction const& in)
+        {
+            x86_reg const d = machine(in.dst);
+            x86_reg const a = machine(in.lhs);
+            x86_reg const b = machine(in.rhs);
+            calc_value_t const v = in.value;
+            bool const small = x86::fits_int32(v);
+            switch (in.op) {
+                case calc_register_opcode::load:
+                    x86_.mov(d, v);
+                    break;
+                case calc_register_opcode::add:
+                case calc_register_opcode::sub:
+                case calc_register_opcode::mul:
+                    binary(static_cast<calc_op>(in.op), d, a, b);
+                    break;
+                case calc_register_opcode::div:
+                    x86_.mov(detail::rax, a);
+                    divide(d, b);
+                    break;
+                case calc_register_opcode::add_imm:
+                case calc_register_opcode::sub_imm:
+                    if (small) {
+                        x86_.mov(d, a);
+                        x86_.alu(in.op == calc_register_opcode::add_imm ? x86::alu_add : x86::alu_sub, d,
+                                 static_cast<std::int32_t>(v));
+                    } else {
+                        x86_.mov(detail::rcx, v);
+                        binary(in.op == calc_register_opcode::add_imm ? calc_op::add : calc_op::sub, d, a, detail::rcx);
+                    }
+                    break;
+                case calc_register_opcode::mul_imm:
+                    if (small) {
+                        x86_.imul(d, a, static_cast<std::int32_t>(v));
+                    } else {
+                        x86_.mov(detail::rcx, v);
+                        binary(calc_op::mul, d, a, detail::rcx);
+                    }
+                    break;
+                case calc_register_opcode::div_imm:
+                    if (v == 0) {
+                        fails_.push_back(x86_.jump());
+                    } else if (v == -1) {
+                        x86_.mov(d, a);
+                        x86_.neg(d);
+                    } else {
+                        x86_.mov(detail::rax, a);
+                        x86_.mov(detail::rcx, v);
+                        x86_.cqo();
+                        x86_.idiv(detail::rcx);
+                        x86_.mov(d, detail::rax);
+                    }
+                    break;
+                case calc_register_opcode::imm_sub:
+                    x86_.mov(detail::rax, v);
+                    x86_.sub(detail::rax, b);
+                    x86_.mov(d, detail::rax);
+                    break;
+                case calc_register_opcode::imm_div:
+                    x86_.mov(detail::rax, v);
+                    divide(d, b);
+                    break;
+                case calc_register_opcode::spill:
+                    x86_.store(detail::rsp, detail::no_reg, static_cast<std::int32_t>(v * 8), a);
+                    break;
+                case calc_register_opcode::reload:
+                    x86_.load(d, detail::rsp, detail::no_reg, static_cast<std::int32_t>(v * 8));
+                    break;
+                case calc_register_opcode::column:
+                    x86_.load(d, detail::rdi, detail::no_reg, static_cast<std::int32_t>(v * 8));
+                    x86_.load(d, d, detail::r11, 0);
+                    break;
+            }
+        }
+
+        // d = a op b
+        void binary(calc_op op, x86_reg d, x86_reg a, x86_reg b)
+        {
+            auto apply = [&](x86_reg x, x86_reg y) {
+                if (op == calc_op::add) {
+                    x86_.add(x, y);
+                } else if (op == calc_op::sub) {
+                    x86_.sub(x, y);
+                } else {
+                    x86_.imul(x, y);
+                }
+            };
+            if (d == b && d != a) {
+                if (op != calc_op::sub) {
+                    apply(d, a);
+                    return;
+                }
+                x86_.mov(detail::rax, a);
+                apply(detail::rax, b);
+                x86_.mov(d, detail::rax);
+                return;
+            }
+            x86_.mov(d, a);
+            apply(d, b);
+        }
+
+        // d = rax / b, with the checks of calc_apply.
+        void divide(x86_reg d, x86_reg b)
+        {
+            x86_.test(b, b);
+            fails_.push_back(x86_.jump(x86::equal));
+            x86_.alu(x86::alu_cmp, b, -1);
+            std::size_t const divide = x86_.jump(x86::not_equal);
+            x86_.neg(detail::rax);
+            std::size_t const done = x86_.jump();
+            x86_.patch(divide, x86_.position());
+            x86_.cqo();
+            x86_.idiv(b);
+            x86_.patch(done, x86_.position());
+            x86_.mov(d, detail::rax);
+        }
+
+        calc_register_compiler compiler_;
+        calc_register_program program_;
+        detail::x86_emitter x86_;
+        std::vector<std::size_t> fails_;    // the jumps to patch to the failure.
+    };
+#endif
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_JIT_H
@@ -0,0 +1,91 @@
+#ifndef ALGOVISU_CALC_KARMA_H
+#define ALGOVISU_CALC_KARMA_H
+
+
+#include <cstdint>
+
+#include <boost/spirit/include/karma.hpp>
+#include <boost/phoenix.hpp>
+
+#include "calc_ast.h"
+#include "calc_printer.h"
+
+
+namespace algovisu
+{
+    namespace karma = boost::spirit::karma;
+
+    // The Spirit.Karma version of calc_printer. It writes the same text.
+    //
+    // The nonterminals take the node index as their inherited attribute,
+    // and the node fields are read by the semantic actions, so the flat
+    // AST is generated as it is without a recursive attribute type.
+    //
+    // The choices are the optional generators guarded by eps, not the
+    // alternatives. An alternative buffers the output of a branch until it
+    // succeeds, so the nested ones would hold and copy the text again at
+    // every level. The optionals write straight to the output iterator.
+    //
+    // NOTE: the rules recurse as deep as the tree is. A long chain of
+    //          the operators, like a 1M token line, overflows the stack,
+    //          which calc_printer doesn't.
+    //
+    // ex.)
+    //  calc_karma_grammar<std::back_insert_iterator<std::string>> g;
+    //  karma::generate(out, g.of(ast));
+    template <typename OutputIterator>
+    struct calc_karma_grammar : karma::grammar<OutputIterator, void(std::uint32_t)>
+    {
+        calc_karma_grammar()
+            : calc_karma_grammar::base_type(expr_)
+        {
+            namespace phx = boost::phoenix;
+            using karma::_1;
+            using karma::_r1;
+            using karma::_r2;
+            using karma::eps;
+            using karma::char_;
+            using karma::ulong_long;
+
+            // the literal, or the operator, by the guards.
+            expr_ = -(eps(phx::bind(&calc_karma_grammar::is_literal, this, _r1))
+                        << ulong_long[_1 = phx::bind(&calc_karma_grammar::literal, this, _r1)])
+                  << -(eps(!phx::bind(&calc_karma_grammar::is_literal, this, _r1))
+                        << operand_(phx::bind(&calc_karma_grammar::lhs, this, _r1),
+                                    phx::bind(&calc_karma_grammar::parens, this, _r1, false))
+                        << char_[_1 = phx::bind(&calc_karma_grammar::op, this, _r1)]
+                        << operand_(phx::bind(&calc_karma_grammar::rhs, this, _r1),
+                                    phx::bind(&calc_karma_grammar::parens, this, _r1, true)));
+
+            operand_ = -(eps(_r2) << '(') << expr_(_r1) << -(eps(_r2) << ')');
+        }
+
+        // The start rule bound to the root of the ast.
+        // The ast must live while the grammar generates.
+        auto of(calc_ast const& ast)
+        {
+            ast_ = &ast;
+            return (*this)(ast.root());
+        }
+
+    private:
+        bool is_literal(std::uint32_t n) const { return ast_->nodes[n].op == calc_op::literal; }
+        unsigned long long literal(std::uint32_t n) const { return static_cast<std::uint64_t>(ast_->nodes[n].value); }
+        std::uint32_t lhs(std::uint32_t n) const { return ast_->nodes[n].lhs; }
+        std::uint32_t rhs(std::uint32_t n) const { return ast_->nodes[n].rhs; }
+        char op(std::uint32_t n) const { return to_char(ast_->nodes[n].op); }
+
+        bool parens(std::uint32_t n, bool right) const
+        {
+            calc_node const& node = ast_->nodes[n];
+            return calc_needs_parens(node.op, ast_->nodes[right ? node.rhs : node.lhs].op, right);
+        }
+
+        calc_ast const * ast_ = nullptr;
+        karma::rule<OutputIterator, void(std::uint32_t)> expr_;
+        karma::rule<OutputIterator, void(std::uint32_t, bool)> operand_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_KARMA_H
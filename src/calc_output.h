@@ -0,0 +1,288 @@
+#ifndef ALGOVISU_CALC_OUTPUT_H
+#define ALGOVISU_CALC_OUTPUT_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <cerrno>
+    #include <climits>
+    #include <unistd.h>
+    #include <sys/uio.h>
+    #define ALGOVISU_HAS_WRITEV 1
+#endif
+
+#include "calc_ast.h"
+
+
+namespace algovisu
+{
+    // "-9223372036854775808"
+    constexpr std::size_t calc_value_max_chars = 20;
+
+    namespace detail
+    {
+        constexpr char digit_pairs[] =
+            "00010203040506070809" "10111213141516171819"
+            "20212223242526272829" "30313233343536373839"
+            "40414243444546474849" "50515253545556575859"
+            "60616263646566676869" "70717273747576777879"
+            "80818283848586878889" "90919293949596979899";
+
+        // by the bit length, with no division. 1233 / 4096 is ~log10(2).
+        inline unsigned decimal_digits(std::uint64_t u)
+        {
+            static constexpr std::uint64_t powers[] = {
+                0, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+                100000000ull, 1000000000ull, 10000000000ull, 100000000000ull,
+                1000000000000ull, 10000000000000ull, 100000000000000ull,
+                1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+                1000000000000000000ull, 10000000000000000000ull
+            };
+#if defined(__GNUC__)
+            unsigned const bits = 64 - static_cast<unsigned>(__builtin_clzll(u | 1));
+#else
+            unsigned bits = 1;
+            for (std::uint64_t v = u; v >>= 1; ) {
+                ++bits;
+            }
+#endif
+            unsigned const t = (bits * 1233) >> 12;
+            return t + (u >= powers[t]);
+        }
+    } // namespace detail
+
+    // Writes the decimal digits of u at p, and returns the end.
+    // There must be the room of calc_value_max_chars.
+    //
+    // NOTE: the digits are written backward by pairs, so there is
+    //          one division per 2 digits, by a multiplication of the compiler.
+    inline char * format_decimal(char * p, std::uint64_t u)
+    {
+        char * const end = p + detail::decimal_digits(u);
+        char * q = end;
+        // the 8 digit chunks in 32 bits, where the divisions are cheaper.
+        while (u >= 100000000) {
+            std::uint32_t chunk = static_cast<std::uint32_t>(u % 100000000);
+            u /= 100000000;
+            for (int i = 0; i < 4; ++i) {
+                q -= 2;
+                std::memcpy(q, detail::digit_pairs + (chunk % 100) * 2, 2);
+                chunk /= 100;
+            }
+        }
+        std::uint32_t w = static_cast<std::uint32_t>(u);
+        while (w >= 100) {
+            q -= 2;
+            std::memcpy(q, detail::digit_pairs + (w % 100) * 2, 2);
+            w /= 100;
+        }
+        if (w >= 10) {
+            std::memcpy(q - 2, detail::digit_pairs + w * 2, 2);
+        } else {
+            q[-1] = static_cast<char>('0' + w);
+        }
+        return end;
+    }
+
+    inline char * format_calc_value(char * p, calc_value_t v)
+    {
+        std::uint64_t u = static_cast<std::uint64_t>(v);
+        if (v < 0) {
+            *p++ = '-';
+            u = 0 - u;
+        }
+        return format_decimal(p, u);
+    }
+
+    struct calc_output_block
+    {
+        char const * data;
+        std::size_t size;
+    };
+
+    // The output sinks write the blocks in order, all or nothing.
+    // write() returns false on an error.
+    class ostream_output_sink
+    {
+    public:
+        explicit ostream_output_sink(std::ostream & os)
+            : os_(os)
+        { }
+
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                os_.write(blocks[i].data, static_cast<std::streamsize>(blocks[i].size));
+            }
+            return static_cast<bool>(os_);
+        }
+
+    private:
+        std::ostream & os_;
+    };
+
+#if defined(ALGOVISU_HAS_WRITEV)
+    // Gathers the blocks into writev calls, and retries the partial writes.
+    class fd_output_sink
+    {
+    public:
+        explicit fd_output_sink(int fd)
+            : fd_(fd)
+        { }
+
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            iovecs_.clear();
+            for (std::size_t i = 0; i < count; ++i) {
+                if (blocks[i].size) {
+                    iovecs_.push_back(iovec{ const_cast<char *>(blocks[i].data), blocks[i].size });
+                }
+            }
+            iovec * iov = iovecs_.data();
+            std::size_t left = iovecs_.size();
+            while (left > 0) {
+                int const n = static_cast<int>(std::min<std::size_t>(left, IOV_MAX));
+                ssize_t written = ::writev(fd_, iov, n);
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                // skips the blocks written, and the written part of the next one.
+                for (; left > 0 && static_cast<std::size_t>(written) >= iov->iov_len; ++iov, --left) {
+                    written -= static_cast<ssize_t>(iov->iov_len);
+                }
+                if (left > 0) {
+                    iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+                    iov->iov_len -= static_cast<std::size_t>(written);
+                }
+            }
+            return true;
+        }
+
+    private:
+        int fd_;
+        std::vector<iovec> iovecs_;
+    };
+#endif
+
+    // A large buffer in front of a sink. It's written to the sink when it's full.
+    template <typename Sink>
+    class calc_output_buffer
+    {
+    public:
+        explicit calc_output_buffer(Sink & sink, std::size_t bufferSize = 1 << 20)
+            : sink_(sink)
+            , buffer_(std::max(bufferSize, calc_value_max_chars + 8))
+            , p_(buffer_.data())
+        { }
+
+        ~calc_output_buffer()
+        {
+            flush();
+        }
+
+        calc_output_buffer(calc_output_buffer const&) = delete;
+        calc_output_buffer & operator = (calc_output_buffer const&) = delete;
+
+        void put(char c)
+        {
+            reserve(1);
+            *p_++ = c;
+        }
+
+        void put(char const * s, std::size_t n)
+        {
+            if (n > buffer_.size()) {
+                flush();
+                calc_output_block const block{ s, n };
+                ok_ = sink_.write(&block, 1) && ok_;
+                return;
+            }
+            reserve(n);
+            std::memcpy(p_, s, n);
+            p_ += n;
+        }
+
+        void put_decimal(std::uint64_t u)
+        {
+            reserve(calc_value_max_chars);
+            p_ = format_decimal(p_, u);
+        }
+
+        void put_value(calc_value_t v)
+        {
+            reserve(calc_value_max_chars);
+            p_ = format_calc_value(p_, v);
+        }
+
+        bool flush()
+        {
+            calc_output_block const block{ buffer_.data(), static_cast<std::size_t>(p_ - buffer_.data()) };
+            p_ = buffer_.data();
+            ok_ = (block.size == 0 || sink_.write(&block, 1)) && ok_;
+            return ok_;
+        }
+
+        // false if a write to the sink has failed.
+        bool good() const { return ok_; }
+
+    private:
+        void reserve(std::size_t n)
+        {
+            if (static_cast<std::size_t>(buffer_.data() + buffer_.size() - p_) < n) {
+                flush();
+            }
+        }
+
+        Sink & sink_;
+        std::vector<char> buffer_;
+        char * p_;
+        bool ok_ = true;
+    };
+
+    // Formats the results into a large buffer, and writes it to the sink
+    // when it's full. A line per result, the value or "error".
+    //
+    // ex.)
+    //  ostream_output_sink sink(std::cout);
+    //  calc_result_writer<ostream_output_sink> writer(sink);
+    //  writer.value(42);
+    //  writer.flush();
+    template <typename Sink>
+    class calc_result_writer
+    {
+    public:
+        explicit calc_result_writer(Sink & sink, std::size_t bufferSize = 1 << 20)
+            : buffer_(sink, bufferSize)
+        { }
+
+        void value(calc_value_t v)
+        {
+            buffer_.put_value(v);
+            buffer_.put('\n');
+        }
+
+        void error()
+        {
+            buffer_.put("error\n", 6);
+        }
+
+        bool flush() { return buffer_.flush(); }
+        bool good() const { return buffer_.good(); }
+
+    private:
+        calc_output_buffer<Sink> buffer_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_OUTPUT_H
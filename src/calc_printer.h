@@ -0,0 +1,159 @@
+#ifndef ALGOVISU_CALC_PRINTER_H
+#define ALGOVISU_CALC_PRINTER_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <iterator>
+
+#include "calc_ast.h"
+#include "calc_output.h"
+
+
+namespace algovisu
+{
+    // The binding power of a node. A literal binds the tightest.
+    inline int calc_precedence(calc_op op)
+    {
+        switch (op) {
+            case calc_op::add:
+            case calc_op::sub:
+                return 1;
+            case calc_op::mul:
+            case calc_op::div:
+                return 2;
+            default:
+                return 3;
+        }
+    }
+
+    // Whether an operand needs the parentheses, for the tree to be parsed back
+    // as it is. The operators are left associative, so the right operand of
+    // the same precedence needs them, even for + and *.
+    inline bool calc_needs_parens(calc_op parent, calc_op child, bool right)
+    {
+        int const p = calc_precedence(parent);
+        int const c = calc_precedence(child);
+        return right ? c <= p : c < p;
+    }
+
+    // The normalized text of a calc expression, without the white spaces and
+    // with only the parentheses the precedence needs. A literal is written
+    // as the unsigned digits, so the wrapped value is lexed back the same.
+    //
+    // The tree is walked with an explicit stack rather than the recursion,
+    // because a long chain is as deep as it's long. The text is written to the
+    // sink through the buffer, and the whole string is never built.
+    //
+    // ex.)
+    //  ostream_output_sink sink(std::cout);
+    //  calc_printer<ostream_output_sink> printer(sink);
+    //  printer.print(ast);
+    //  printer.put('\n');
+    template <typename Sink>
+    class calc_printer
+    {
+    public:
+        explicit calc_printer(Sink & sink, std::size_t bufferSize = 64 * 1024)
+            : buffer_(sink, bufferSize)
+        { }
+
+        void print(calc_ast const& ast)
+        {
+            if (ast.empty()) {
+                return;
+            }
+            calc_node const * const nodes = ast.nodes.data();
+            stack_.push_back(frame{ ast.root(), 0, false });
+            while (!stack_.empty()) {
+                frame & f = stack_.back();
+                calc_node const& node = nodes[f.node];
+                if (node.op == calc_op::literal) {
+                    buffer_.put_decimal(static_cast<std::uint64_t>(node.value));
+                    stack_.pop_back();
+                    continue;
+                }
+                switch (f.stage++) {
+                    case 0:
+                        if (f.parens) {
+                            buffer_.put('(');
+                        }
+                        operand(nodes, node.op, node.lhs, false);
+                        break;
+                    case 1:
+                        buffer_.put(to_char(node.op));
+                        operand(nodes, node.op, node.rhs, true);
+                        break;
+                    default:
+                        if (f.parens) {
+                            buffer_.put(')');
+                        }
+                        stack_.pop_back();
+                        break;
+                }
+            }
+        }
+
+        void put(char c) { buffer_.put(c); }
+
+        bool flush() { return buffer_.flush(); }
+        bool good() const { return buffer_.good(); }
+
+    private:
+        struct frame
+        {
+            std::uint32_t node;
+            std::uint8_t stage;     // before lhs, before rhs, done
+            bool parens;
+        };
+
+        // A literal operand is written at once, which is the most of them.
+        // NOTE: the push may reallocate the stack, so the frame
+        //          reference of the caller is not used after it.
+        void operand(calc_node const * nodes, calc_op parent, std::uint32_t child, bool right)
+        {
+            calc_node const& node = nodes[child];
+            if (node.op == calc_op::literal) {
+                buffer_.put_decimal(static_cast<std::uint64_t>(node.value));
+            } else {
+                stack_.push_back(frame{ child, 0, calc_needs_parens(parent, node.op, right) });
+            }
+        }
+
+        calc_output_buffer<Sink> buffer_;
+        std::vector<frame> stack_;
+    };
+
+    // An output iterator into a calc_output_buffer, for Spirit.Karma.
+    template <typename Sink>
+    class calc_output_iterator
+    {
+    public:
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        explicit calc_output_iterator(calc_output_buffer<Sink> & buffer)
+            : buffer_(&buffer)
+        { }
+
+        calc_output_iterator & operator = (char c)
+        {
+            buffer_->put(c);
+            return *this;
+        }
+
+        calc_output_iterator & operator * () { return *this; }
+        calc_output_iterator & operator ++ () { return *this; }
+        calc_output_iterator & operator ++ (int) { return *this; }
+
+    private:
+        calc_output_buffer<Sink> * buffer_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_PRINTER_H
@@ -0,0 +1,323 @@
+#ifndef ALGOVISU_CALC_PROGRAM_CACHE_H
+#define ALGOVISU_CALC_PROGRAM_CACHE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "calc_hash.h"
+#include "calc_bytecode.h"
+#include "thread_slots.h"
+
+
+namespace algovisu
+{
+    namespace detail
+    {
+        // The epoch a thread has entered its read scope at, 0 if it's not in one.
+        struct calc_cache_reader
+        {
+            std::atomic<std::uint64_t> epoch{ 0 };
+            unsigned depth = 0;     // of the nested scopes, for the owner only.
+        };
+
+        // NOTE: all the caches share these, as thread_slots expects
+        //          a single list per slot type.
+        inline thread_slots<calc_cache_reader> & calc_cache_readers()
+        {
+            static auto & slots = *new thread_slots<calc_cache_reader>;
+            return slots;
+        }
+
+        inline std::atomic<std::uint64_t> & calc_cache_epoch()
+        {
+            static std::atomic<std::uint64_t> epoch{ 1 };
+            return epoch;
+        }
+    } // namespace detail
+
+    // A cached program, with the expression bytes it's keyed by.
+    class calc_cached_program
+    {
+    public:
+        calc_cached_program(std::uint64_t hash, char const * text, std::size_t size, calc_program && compiled)
+            : key(text, size)
+            , program(std::move(compiled))
+            , hash_(hash)
+            , bytes_(sizeof(*this) + key.capacity() + program.code.capacity() * sizeof(calc_instruction))
+        { }
+
+        std::string const key;
+        calc_program const program;
+
+    private:
+        friend class calc_program_cache;
+
+        std::uint64_t const hash_;
+        std::size_t const bytes_;
+        std::atomic<calc_cached_program *> next_{ nullptr };
+        std::atomic<bool> referenced_{ false };     // the CLOCK bit, set by the hits.
+    };
+
+    struct calc_program_cache_options
+    {
+        std::size_t shards = 64;
+        std::size_t budgetBytes = std::size_t(256) << 20;   // of the entries, split evenly by the shards
+        std::size_t expectedEntries = 65536;                 // sizes the bucket arrays, which never grow
+    };
+
+    struct calc_program_cache_stats
+    {
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+        std::uint64_t evictions = 0;
+        std::size_t retired = 0;        // the evicted ones not freed yet
+    };
+
+    // A concurrent in-memory cache of the compiled programs, keyed by the
+    // expression bytes as they are.
+    //
+    // The keys are split into the shards by their hash, and each shard is
+    // a chained hash table. The lookups take no lock and write nothing
+    // shared but the CLOCK bit of the entry found. The inserts and the
+    // evictions lock their shard only.
+    //
+    // An entry is never changed once it's linked. The evicted one is unlinked
+    // and freed later, when no reader could still see it, which is tracked by
+    // the epochs like RCU. So find() and insert() must be called in
+    // a read_scope, and their entries are valid until the scope ends.
+    //
+    // Each shard has its part of the memory budget, and evicts by CLOCK when
+    // it's over. A new entry starts with its bit cleared, so the one-off
+    // expressions are evicted before the hot ones, which have been hit since.
+    //
+    // NOTE: a thread staying in a read scope holds back the freeing of
+    //          the evicted entries of all the caches. Keep the scopes short.
+    //
+    // ex.)
+    //  calc_program_cache::read_scope scope;
+    //  calc_cached_program const * p = cache.find(text.data(), text.size());
+    //  if (!p) {
+    //      compile_calc(ast, program);
+    //      p = cache.insert(text.data(), text.size(), std::move(program));
+    //  }
+    //  vm.run(p->program, result);
+    class calc_program_cache
+    {
+    public:
+        // A read-side critical section. It can be nested.
+        class read_scope
+        {
+        public:
+            read_scope()
+                : reader_(detail::calc_cache_readers().local())
+            {
+                if (reader_.depth++ == 0) {
+                    reader_.epoch.store(detail::calc_cache_epoch().load(std::memory_order_acquire),
+                                        std::memory_order_relaxed);
+                    // the epoch is seen by the reclaimers before any entry is read.
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+            }
+
+            ~read_scope()
+            {
+                if (--reader_.depth == 0) {
+                    reader_.epoch.store(0, std::memory_order_release);
+                }
+            }
+
+            read_scope(read_scope const&) = delete;
+            read_scope & operator = (read_scope const&) = delete;
+
+        private:
+            detail::calc_cache_reader & reader_;
+        };
+
+        explicit calc_program_cache(calc_program_cache_options const& options = calc_program_cache_options())
+            : shards_(std::max<std::size_t>(options.shards, 1))
+            , shardBudget_(options.budgetBytes / shards_.size())
+        {
+            std::size_t buckets = 1;
+            while (buckets * shards_.size() < options.expectedEntries) {
+                buckets *= 2;
+            }
+            for (shard & s : shards_) {
+                s.buckets.reset(new std::atomic<calc_cached_program *>[buckets]);
+                for (std::size_t i = 0; i < buckets; ++i) {
+                    s.buckets[i].store(nullptr, std::memory_order_relaxed);
+                }
+                s.mask = buckets - 1;
+            }
+        }
+
+        // NOTE: no thread may be reading it.
+        ~calc_program_cache()
+        {
+            for (shard & s : shards_) {
+                for (calc_cached_program * e : s.clock) {
+                    delete e;
+                }
+                for (auto const& r : s.retired) {
+                    delete r.first;
+                }
+            }
+        }
+
+        calc_program_cache(calc_program_cache const&) = delete;
+        calc_program_cache & operator = (calc_program_cache const&) = delete;
+
+        calc_cached_program const * find(char const * key, std::size_t size) const
+        {
+            std::uint64_t const hash = calc_bytes_hash(key, size);
+            shard const& s = shard_of(hash);
+            calc_cached_program * e = lookup(s, hash, key, size);
+            // only once, not to write the shared line at every hit.
+            if (e && !e->referenced_.load(std::memory_order_relaxed)) {
+                e->referenced_.store(true, std::memory_order_relaxed);
+            }
+            return e;
+        }
+
+        // Inserts the program, unless another thread has done it first,
+        // and returns the entry in the cache. nullptr if it's larger than
+        // the budget of a shard.
+        calc_cached_program const * insert(char const * key, std::size_t size, calc_program program)
+        {
+            std::uint64_t const hash = calc_bytes_hash(key, size);
+            shard & s = shard_of(hash);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (calc_cached_program * e = lookup(s, hash, key, size)) {
+                return e;
+            }
+            std::unique_ptr<calc_cached_program> entry(
+                new calc_cached_program(hash, key, size, std::move(program)));
+            if (entry->bytes_ > shardBudget_) {
+                return nullptr;
+            }
+            while (s.bytes + entry->bytes_ > shardBudget_) {
+                evict_one(s);
+            }
+            calc_cached_program * e = entry.release();
+            std::atomic<calc_cached_program *> & bucket = s.buckets[hash & s.mask];
+            e->next_.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(e, std::memory_order_release);
+            s.clock.push_back(e);
+            s.bytes += e->bytes_;
+            if (s.retired.size() >= 64) {
+                reclaim(s);
+            }
+            return e;
+        }
+
+        calc_program_cache_stats stats() const
+        {
+            calc_program_cache_stats st;
+            for (shard const& s : shards_) {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                st.entries += s.clock.size();
+                st.bytes += s.bytes;
+                st.evictions += s.evictions;
+                st.retired += s.retired.size();
+            }
+            return st;
+        }
+
+    private:
+        struct alignas(64) shard
+        {
+            mutable std::mutex mutex;
+            std::unique_ptr<std::atomic<calc_cached_program *>[]> buckets;
+            std::size_t mask = 0;
+
+            // the rest is guarded by the mutex.
+            std::vector<calc_cached_program *> clock;     // the entries, in no order
+            std::size_t hand = 0;
+            std::size_t bytes = 0;
+            std::uint64_t evictions = 0;
+            std::vector<std::pair<calc_cached_program *, std::uint64_t>> retired;   // with the epoch
+        };
+
+        shard & shard_of(std::uint64_t hash) { return shards_[(hash >> 40) % shards_.size()]; }
+        shard const& shard_of(std::uint64_t hash) const { return shards_[(hash >> 40) % shards_.size()]; }
+
+        static calc_cached_program * lookup(shard const& s, std::uint64_t hash, char const * key, std::size_t size)
+        {
+            calc_cached_program * e = s.buckets[hash & s.mask].load(std::memory_order_acquire);
+            for (; e; e = e->next_.load(std::memory_order_acquire)) {
+                if (e->hash_ == hash && e->key.size() == size && std::memcmp(e->key.data(), key, size) == 0) {
+                    break;
+                }
+            }
+            return e;
+        }
+
+        // The hand clears the bits on its way, and evicts the first entry
+        // without it.
+        void evict_one(shard & s)
+        {
+            for (;;) {
+                if (s.hand >= s.clock.size()) {
+                    s.hand = 0;
+                }
+                calc_cached_program * e = s.clock[s.hand];
+                if (e->referenced_.load(std::memory_order_relaxed)) {
+                    e->referenced_.store(false, std::memory_order_relaxed);
+                    ++s.hand;
+                    continue;
+                }
+                // unlinked for the new readers, and the ones on it go on to the next.
+                std::atomic<calc_cached_program *> * link = &s.buckets[e->hash_ & s.mask];
+                while (link->load(std::memory_order_relaxed) != e) {
+                    link = &link->load(std::memory_order_relaxed)->next_;
+                }
+                link->store(e->next_.load(std::memory_order_relaxed), std::memory_order_release);
+
+                s.clock[s.hand] = s.clock.back();
+                s.clock.pop_back();
+                s.bytes -= e->bytes_;
+                ++s.evictions;
+                // the readers entered after the increment can't see it.
+                s.retired.emplace_back(e, detail::calc_cache_epoch().fetch_add(1, std::memory_order_seq_cst));
+                return;
+            }
+        }
+
+        // Frees the retired entries older than every reader in a scope.
+        static void reclaim(shard & s)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+            detail::calc_cache_readers().for_each([&oldest](detail::calc_cache_reader const& r) {
+                std::uint64_t const e = r.epoch.load(std::memory_order_acquire);
+                if (e != 0 && e < oldest) {
+                    oldest = e;
+                }
+            });
+            std::size_t kept = 0;
+            for (auto const& r : s.retired) {
+                if (r.second < oldest) {
+                    delete r.first;
+                } else {
+                    s.retired[kept++] = r;
+                }
+            }
+            s.retired.resize(kept);
+        }
+
+        std::vector<shard> shards_;
+        std::size_t const shardBudget_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_PROGRAM_CACHE_H
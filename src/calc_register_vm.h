@@ -0,0 +1,537 @@
+#ifndef ALGOVISU_CALC_REGISTER_VM_H
+#define ALGOVISU_CALC_REGISTER_VM_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+#include "calc_dispatch.h"
+#include "calc_evaluator.h"
+
+
+namespace algovisu
+{
+    // NOTE: the register operators have the same values as calc_op.
+    enum class calc_register_opcode : std::uint8_t
+    {
+        load,       // dst = the value.
+        add,        // dst = lhs op rhs.
+        sub,
+        mul,
+        div,
+        add_imm,    // dst = lhs op the value.
+        sub_imm,
+        mul_imm,
+        div_imm,
+        imm_sub,    // dst = the value op rhs.
+        imm_div,
+        spill,      // the spill slot of the value = lhs.
+        reload,     // dst = the spill slot of the value.
+        column      // dst = the row of the value-th column.
+    };
+
+    // An instruction names its destination and two source registers, and a
+    // literal operand is in the value, so a literal costs no instruction of
+    // its own unless both the operands are literals.
+    struct calc_register_instruction
+    {
+        calc_register_opcode op;
+        std::uint8_t dst;
+        std::uint8_t lhs;
+        std::uint8_t rhs;
+        calc_value_t value;     // the literal, the spill slot, or the column.
+    };
+
+    static_assert(sizeof(calc_register_instruction) == 16, "calc_register_instruction is as big as calc_instruction");
+
+    // A literal node read from a column, as a variable.
+    struct calc_column_binding
+    {
+        std::uint32_t node;
+        std::uint32_t column;
+    };
+
+    // The registers an expression is allocated to by default.
+    constexpr std::uint32_t calc_register_file = 16;
+
+    // The register machine code of an expression.
+    struct calc_register_program
+    {
+        std::vector<calc_register_instruction> code;
+        std::uint32_t registers = 0;    // the highest register the code uses + 1.
+        std::uint32_t spillSlots = 0;
+        std::uint8_t result = 0;        // the register of the value of the expression.
+
+        bool empty() const { return code.empty(); }
+        std::size_t size() const { return code.size(); }
+    };
+
+    // Compiles an ast to the register machine code, by the linear scan over
+    // a fixed register file.
+    //
+    // The operands are evaluated in the order of Sethi and Ullman, the one
+    // that needs more registers first, so a chain needs a single register
+    // whichever side it leans to. Then the live interval of a value is from
+    // the instruction computing it to the one using it, and as every value
+    // of a tree is used once, the intervals nest like the stack of calc_vm.
+    // The scan gives a free register to every value. When there's none, it
+    // spills the live value used last, which is the one computed first,
+    // and the use of a spilled value reloads it to one of the two scratch
+    // registers above the file.
+    //
+    // The literals can be bound to the columns, then they're read from the
+    // row the code is run for, as the variables the language doesn't have.
+    //
+    // NOTE: the code is emitted in the one pass of the scan, as the spills
+    //          are decided in the order of the instructions.
+    //
+    // ex.)
+    //  calc_register_compiler compiler;
+    //  calc_register_program program;
+    //  compiler.compile(ast, program);
+    //  calc_register_vm vm;
+    //  calc_value_t result;
+    //  vm.run(program, result);
+    class calc_register_compiler
+    {
+    public:
+        // the file is 1 to 253 registers, for the 2 scratch ones.
+        explicit calc_register_compiler(std::uint32_t registers = calc_register_file)
+            : registers_(std::min<std::uint32_t>(std::max<std::uint32_t>(registers, 1), 253))
+        { }
+
+        std::uint32_t registers() const { return registers_; }
+
+        void compile(calc_ast const& ast, calc_register_program & program)
+        {
+            compile(ast, {}, program);
+        }
+
+        void compile(calc_ast const& ast, std::vector<calc_column_binding> const& columns,
+                     calc_register_program & program)
+        {
+            program.code.clear();
+            program.registers = 0;
+            program.spillSlots = 0;
+            program.result = 0;
+            if (ast.empty()) {
+                return;
+            }
+            column_.assign(ast.size(), none);
+            for (calc_column_binding const& binding : columns) {
+                if (binding.node < ast.size() && ast.nodes[binding.node].op == calc_op::literal) {
+                    column_[binding.node] = binding.column;
+                }
+            }
+            order(ast);
+            allocate(program);
+        }
+
+    private:
+        static constexpr std::uint32_t none = ~std::uint32_t(0);
+        static constexpr std::uint8_t spilled = 0xff;
+
+        // An instruction of the unlimited registers, one per a value, whose
+        // sources are the instructions computing them.
+        struct virtual_instruction
+        {
+            calc_register_opcode op;
+            std::uint32_t lhs;
+            std::uint32_t rhs;
+            calc_value_t value;
+        };
+
+        struct frame
+        {
+            std::uint32_t node;
+            bool expanded;
+        };
+
+        // The registers a node needs, by the operands stored before it.
+        void label(calc_ast const& ast)
+        {
+            calc_node const * const nodes = ast.nodes.data();
+            need_.resize(ast.size());
+            for (std::size_t i = 0; i < ast.size(); ++i) {
+                calc_node const& node = nodes[i];
+                if (node.op == calc_op::literal) {
+                    need_[i] = column_[i] == none ? 0 : 1;  // an immediate, or a column.
+                    continue;
+                }
+                std::uint8_t const lhs = need_[node.lhs];
+                std::uint8_t const rhs = need_[node.rhs];
+                std::uint32_t const need = lhs == rhs ? lhs + 1u : std::max(lhs, rhs);
+                need_[i] = static_cast<std::uint8_t>(std::min<std::uint32_t>(need, 0xff));
+            }
+        }
+
+        void order(calc_ast const& ast)
+        {
+            label(ast);
+            calc_node const * const nodes = ast.nodes.data();
+            code_.clear();
+            value_.resize(ast.size());
+            if (immediate(nodes, ast.root())) {
+                code_.push_back(virtual_instruction{ calc_register_opcode::load, none, none, nodes[ast.root()].value });
+                return;
+            }
+            stack_.clear();
+            stack_.push_back(frame{ ast.root(), false });
+            while (!stack_.empty()) {
+                frame & f = stack_.back();
+                calc_node const& node = nodes[f.node];
+                if (node.op == calc_op::literal) {
+                    code_.push_back(virtual_instruction{ calc_register_opcode::column, none, none, column_[f.node] });
+                    value_[f.node] = current();
+                    stack_.pop_back();
+                    continue;
+                }
+                if (!f.expanded) {
+                    f.expanded = true;
+                    // the last pushed is the first evaluated.
+                    std::uint32_t first = node.lhs;
+                    std::uint32_t second = node.rhs;
+                    if (need_[second] > need_[first]) {
+                        std::swap(first, second);
+                    }
+                    if (!immediate(nodes, second)) {
+                        stack_.push_back(frame{ second, false });
+                    }
+                    if (!immediate(nodes, first)) {
+                        stack_.push_back(frame{ first, false });
+                    }
+                    continue;
+                }
+                bool const lhsImmediate = immediate(nodes, node.lhs);
+                bool const rhsImmediate = immediate(nodes, node.rhs);
+                calc_value_t const lhsValue = nodes[node.lhs].value;
+                calc_value_t const rhsValue = nodes[node.rhs].value;
+                if (!lhsImmediate && !rhsImmediate) {
+                    code_.push_back(virtual_instruction{ static_cast<calc_register_opcode>(node.op),
+                                                         value_[node.lhs], value_[node.rhs], 0 });
+                } else if (!lhsImmediate) {
+                    code_.push_back(virtual_instruction{ to_imm(node.op), value_[node.lhs], none, rhsValue });
+                } else if (!rhsImmediate) {
+                    // the literal lhs of + and * is swapped to the rhs.
+                    if (node.op == calc_op::sub || node.op == calc_op::div) {
+                        code_.push_back(virtual_instruction{ node.op == calc_op::sub ? calc_register_opcode::imm_sub
+                                                                                     : calc_register_opcode::imm_div,
+                                                             none, value_[node.rhs], lhsValue });
+                    } else {
+                        code_.push_back(virtual_instruction{ to_imm(node.op), value_[node.rhs], none, lhsValue });
+                    }
+                } else {
+                    code_.push_back(virtual_instruction{ calc_register_opcode::load, none, none, lhsValue });
+                    code_.push_back(virtual_instruction{ to_imm(node.op), current(), none, rhsValue });
+                }
+                value_[f.node] = current();
+                stack_.pop_back();
+            }
+        }
+
+        bool immediate(calc_node const * nodes, std::uint32_t node) const
+        {
+            return nodes[node].op == calc_op::literal && column_[node] == none;
+        }
+
+        void allocate(calc_register_program & program)
+        {
+            std::size_t const size = code_.size();
+            register_.resize(size);
+            slot_.resize(size);
+            free_.clear();
+            for (std::uint32_t r = registers_; r-- > 0; ) {
+                free_.push_back(static_cast<std::uint8_t>(r));
+            }
+            freeSlots_.clear();
+            live_.clear();
+            std::size_t spilledLive = 0;   // the spilled values are the oldest live ones.
+            used_ = 0;
+            program.code.reserve(size);
+            for (std::uint32_t i = 0; i < size; ++i) {
+                virtual_instruction const& v = code_[i];
+                calc_register_instruction out{ v.op, 0, 0, 0, v.value };
+                if (v.lhs != none) {
+                    out.lhs = source(v.lhs, static_cast<std::uint8_t>(registers_), program);
+                }
+                if (v.rhs != none) {
+                    out.rhs = source(v.rhs, static_cast<std::uint8_t>(registers_ + 1), program);
+                }
+                // the sources are the newest live values, and are free once read.
+                for (int k = (v.lhs != none) + (v.rhs != none); k > 0; --k) {
+                    std::uint32_t const value = live_.back();
+                    live_.pop_back();
+                    if (register_[value] != spilled) {
+                        free_.push_back(register_[value]);
+                    }
+                }
+                spilledLive = std::min(spilledLive, live_.size());
+
+                if (free_.empty()) {
+                    std::uint32_t const victim = live_[spilledLive++];
+                    std::uint32_t const slot = take_slot(program);
+                    program.code.push_back(calc_register_instruction{
+                        calc_register_opcode::spill, 0, register_[victim], 0, static_cast<calc_value_t>(slot) });
+                    free_.push_back(register_[victim]);
+                    register_[victim] = spilled;
+                    slot_[victim] = slot;
+                }
+                out.dst = free_.back();
+                free_.pop_back();
+                register_[i] = out.dst;
+                live_.push_back(i);
+                used_ = std::max<std::uint32_t>(used_, out.dst + 1u);
+                program.code.push_back(out);
+            }
+            program.registers = used_;
+            program.result = register_[size - 1];
+        }
+
+        // The register to read a value from, reloading a spilled one.
+        std::uint8_t source(std::uint32_t value, std::uint8_t scratch, calc_register_program & program)
+        {
+            if (register_[value] != spilled) {
+                return register_[value];
+            }
+            program.code.push_back(calc_register_instruction{
+                calc_register_opcode::reload, scratch, 0, 0, static_cast<calc_value_t>(slot_[value]) });
+            freeSlots_.push_back(slot_[value]);
+            used_ = std::max<std::uint32_t>(used_, scratch + 1u);
+            return scratch;
+        }
+
+        std::uint32_t take_slot(calc_register_program & program)
+        {
+            if (freeSlots_.empty()) {
+                return program.spillSlots++;
+            }
+            std::uint32_t const slot = freeSlots_.back();
+            freeSlots_.pop_back();
+            return slot;
+        }
+
+        std::uint32_t current() const { return static_cast<std::uint32_t>(code_.size() - 1); }
+
+        static calc_register_opcode to_imm(calc_op op)
+        {
+            return static_cast<calc_register_opcode>(static_cast<int>(calc_register_opcode::add_imm)
+                                                     + static_cast<int>(op) - static_cast<int>(calc_op::add));
+        }
+
+        std::uint32_t registers_;
+        std::vector<std::uint32_t> column_;     // the column a literal is read from, or none.
+        std::vector<std::uint8_t> need_;
+        std::vector<std::uint32_t> value_;      // the instruction computing an operator node.
+        std::vector<frame> stack_;
+        std::vector<virtual_instruction> code_;
+        std::vector<std::uint8_t> register_;
+        std::vector<std::uint32_t> slot_;
+        std::vector<std::uint8_t> free_;
+        std::vector<std::uint32_t> freeSlots_;
+        std::vector<std::uint32_t> live_;      // the values in the order they're computed.
+        std::uint32_t used_ = 0;
+    };
+
+    inline void compile_calc(calc_ast const& ast, calc_register_program & program)
+    {
+        calc_register_compiler compiler;
+        compiler.compile(ast, program);
+    }
+
+    // Runs the register machine code with the same arithmetic as calc_vm.
+    // The registers and the spill slots are reused to avoid the allocations.
+    // The dispatch is chosen as calc_threaded_vm's, see calc_dispatch.
+    class calc_register_vm
+    {
+    public:
+        explicit calc_register_vm(calc_dispatch dispatch = calc_dispatch::threaded)
+            : dispatch_(dispatch)
+        {
+#if !defined(ALGOVISU_HAS_COMPUTED_GOTO)
+            dispatch_ = calc_dispatch::switch_loop;
+#endif
+        }
+
+        calc_dispatch dispatch() const { return dispatch_; }
+
+        // false for the division by zero, or the empty code.
+        bool run(calc_register_program const& program, calc_value_t & result)
+        {
+            return run(program, nullptr, 0, result);
+        }
+
+        // Runs the code for a row of the columns the literals are bound to.
+        bool run(calc_register_program const& program, calc_value_t const * const * columns, std::size_t row,
+                 calc_value_t & result)
+        {
+            if (program.empty()) {
+                return false;
+            }
+            if (registers_.size() < program.registers) {
+                registers_.resize(program.registers);
+            }
+            if (slots_.size() < program.spillSlots) {
+                slots_.resize(program.spillSlots);
+            }
+            calc_register_instruction const * const code = program.code.data();
+            calc_register_instruction const * const end = code + program.code.size();
+            calc_value_t * const r = registers_.data();
+#if defined(ALGOVISU_HAS_COMPUTED_GOTO)
+            bool const ok = dispatch_ == calc_dispatch::threaded
+                          ? run_threaded(code, end, r, slots_.data(), columns, row)
+                          : run_switch(code, end, r, slots_.data(), columns, row);
+#else
+            bool const ok = run_switch(code, end, r, slots_.data(), columns, row);
+#endif
+            if (!ok) {
+                return false;
+            }
+            result = registers_[program.result];
+            return true;
+        }
+
+    private:
+        static bool run_switch(calc_register_instruction const * pc, calc_register_instruction const * end,
+                               calc_value_t * r, calc_value_t * slots,
+                               calc_value_t const * const * columns, std::size_t row)
+        {
+            for (; pc != end; ++pc) {
+                switch (pc->op) {
+                    case calc_register_opcode::load:
+                        r[pc->dst] = pc->value;
+                        break;
+                    case calc_register_opcode::add:
+                        calc_apply(calc_op::add, r[pc->lhs], r[pc->rhs], r[pc->dst]);
+                        break;
+                    case calc_register_opcode::sub:
+                        calc_apply(calc_op::sub, r[pc->lhs], r[pc->rhs], r[pc->dst]);
+                        break;
+                    case calc_register_opcode::mul:
+                        calc_apply(calc_op::mul, r[pc->lhs], r[pc->rhs], r[pc->dst]);
+                        break;
+                    case calc_register_opcode::div:
+                        if (!calc_apply(calc_op::div, r[pc->lhs], r[pc->rhs], r[pc->dst])) {
+                            return false;
+                        }
+                        break;
+                    case calc_register_opcode::add_imm:
+                        calc_apply(calc_op::add, r[pc->lhs], pc->value, r[pc->dst]);
+                        break;
+                    case calc_register_opcode::sub_imm:
+                        calc_apply(calc_op::sub, r[pc->lhs], pc->value, r[pc->dst]);
+                        break;
+                    case calc_register_opcode::mul_imm:
+                        calc_apply(calc_op::mul, r[pc->lhs], pc->value, r[pc->dst]);
+                        break;
+                    case calc_register_opcode::div_imm:
+                        if (!calc_apply(calc_op::div, r[pc->lhs], pc->value, r[pc->dst])) {
+                            return false;
+                        }
+                        break;
+                    case calc_register_opcode::imm_sub:
+                        calc_apply(calc_op::sub, pc->value, r[pc->rhs], r[pc->dst]);
+                        break;
+                    case calc_register_opcode::imm_div:
+                        if (!calc_apply(calc_op::div, pc->value, r[pc->rhs], r[pc->dst])) {
+                            return false;
+                        }
+                        break;
+                    case calc_register_opcode::spill:
+                        slots[pc->value] = r[pc->lhs];
+                        break;
+                    case calc_register_opcode::reload:
+                        r[pc->dst] = slots[pc->value];
+                        break;
+                    case calc_register_opcode::column:
+                        r[pc->dst] = columns[pc->value][row];
+                        break;
+                }
+            }
+            return true;
+        }
+
+#if defined(ALGOVISU_HAS_COMPUTED_GOTO)
+        // Every handler jumps by the op of the next instruction itself, as
+        // the threaded code of calc_threaded_vm, but by a table of the
+        // labels, so the instructions stay as they're compiled.
+        static bool run_threaded(calc_register_instruction const * pc, calc_register_instruction const * end,
+                                 calc_value_t * r, calc_value_t * slots,
+                                 calc_value_t const * const * columns, std::size_t row)
+        {
+            static void * const labels[] = {
+                &&op_load, &&op_add, &&op_sub, &&op_mul, &&op_div,
+                &&op_add_imm, &&op_sub_imm, &&op_mul_imm, &&op_div_imm,
+                &&op_imm_sub, &&op_imm_div, &&op_spill, &&op_reload, &&op_column
+            };
+            static_assert(sizeof(labels) / sizeof(labels[0]) == static_cast<std::size_t>(calc_register_opcode::column) + 1,
+                          "a label for every op");
+
+#define ALGOVISU_CALC_NEXT() \
+            if (++pc == end) { return true; } \
+            goto *labels[static_cast<std::size_t>(pc->op)]
+
+            goto *labels[static_cast<std::size_t>(pc->op)];
+        op_load:
+            r[pc->dst] = pc->value;
+            ALGOVISU_CALC_NEXT();
+        op_add:
+            calc_apply(calc_op::add, r[pc->lhs], r[pc->rhs], r[pc->dst]);
+            ALGOVISU_CALC_NEXT();
+        op_sub:
+            calc_apply(calc_op::sub, r[pc->lhs], r[pc->rhs], r[pc->dst]);
+            ALGOVISU_CALC_NEXT();
+        op_mul:
+            calc_apply(calc_op::mul, r[pc->lhs], r[pc->rhs], r[pc->dst]);
+            ALGOVISU_CALC_NEXT();
+        op_div:
+            if (!calc_apply(calc_op::div, r[pc->lhs], r[pc->rhs], r[pc->dst])) {
+                return false;
+            }
+            ALGOVISU_CALC_NEXT();
+        op_add_imm:
+            calc_apply(calc_op::add, r[pc->lhs], pc->value, r[pc->dst]);
+            ALGOVISU_CALC_NEXT();
+        op_sub_imm:
+            calc_apply(calc_op::sub, r[pc->lhs], pc->value, r[pc->dst]);
+            ALGOVISU_CALC_NEXT();
+        op_mul_imm:
+            calc_apply(calc_op::mul, r[pc->lhs], pc->value, r[pc->dst]);
+            ALGOVISU_CALC_NEXT();
+        op_div_imm:
+            if (!calc_apply(calc_op::div, r[pc->lhs], pc->value, r[pc->dst])) {
+                return false;
+            }
+            ALGOVISU_CALC_NEXT();
+        op_imm_sub:
+            calc_apply(calc_op::sub, pc->value, r[pc->rhs], r[pc->dst]);
+            ALGOVISU_CALC_NEXT();
+        op_imm_div:
+            if (!calc_apply(calc_op::div, pc->value, r[pc->rhs], r[pc->dst])) {
+                return false;
+            }
+            ALGOVISU_CALC_NEXT();
+        op_spill:
+            slots[pc->value] = r[pc->lhs];
+            ALGOVISU_CALC_NEXT();
+        op_reload:
+            r[pc->dst] = slots[pc->value];
+            ALGOVISU_CALC_NEXT();
+        op_column:
+            r[pc->dst] = columns[pc->value][row];
+            ALGOVISU_CALC_NEXT();
+
+#undef ALGOVISU_CALC_NEXT
+        }
+#endif
+
+        calc_dispatch dispatch_;
+        std::vector<calc_value_t> registers_;
+        std::vector<calc_value_t> slots_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_REGISTER_VM_H
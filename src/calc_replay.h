@@ -0,0 +1,252 @@
+#ifndef ALGOVISU_CALC_REPLAY_H
+#define ALGOVISU_CALC_REPLAY_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+#include "calc_evaluator.h"
+#include "calc_step_trace.h"
+
+
+namespace algovisu
+{
+    struct calc_replay_options
+    {
+        // the nodes between the checkpoints, at first.
+        std::size_t interval = 1024;
+
+        // When there are more checkpoints, every other one is dropped,
+        // and the interval is doubled.
+        std::size_t maxCheckpoints = 4096;
+    };
+
+    // Moves an evaluation of a calc_ast to any step, forward or backward.
+    //
+    // The state of the evaluation between the steps is the operand stack,
+    // the values of the sub-expressions evaluated but not yet used, as the
+    // nodes are post-ordered. build() evaluates the ast once, and takes a
+    // checkpoint of the stack every interval nodes. seek() restores the
+    // last checkpoint before the step, and replays the nodes from it,
+    // which are about the interval at most.
+    //
+    // The stack is in the chunks of chunk_size values, shared by the
+    // checkpoints and the stack. A checkpoint copies the pointers only,
+    // and a shared chunk is copied when it's written first. So the bottom
+    // of the stack, which the steps don't reach between the checkpoints,
+    // is stored once for all of them.
+    //
+    // NOTE: the steps are of the operators, like calc_step_recorder records
+    //          them, and the step of a division by zero is not a step.
+    //
+    // ex.)
+    //  calc_replay replay;
+    //  replay.build(ast);
+    //  replay.seek(replay.step_count() / 2);
+    //  calc_step step;
+    //  while (replay.next(step)) {
+    //      std::cout << step.lhs << to_char(step.op) << step.rhs << '=' << step.result << '\n';
+    //  }
+    class calc_replay
+    {
+    public:
+        static constexpr std::size_t chunk_size = 64;
+
+        explicit calc_replay(calc_replay_options const& options = calc_replay_options{})
+            : options_(options)
+        { }
+
+        // The ast is kept by the reference, and must live while it's used.
+        // It returns false if a division is by zero, and the steps are the
+        // ones before it.
+        bool build(calc_ast const& ast)
+        {
+            ast_ = &ast;
+            interval_ = std::max<std::size_t>(options_.interval, 1);
+            checkpoints_.clear();
+            stack_.clear();
+            depth_ = 0;
+            node_ = 0;
+            step_ = 0;
+            stepCount_ = UINT64_MAX;
+            checkpoints_.push_back(checkpoint{ 0, 0, 0, {} });
+
+            calc_step s;
+            while (next(s)) {
+                if (node_ - checkpoints_.back().node >= interval_) {
+                    take_checkpoint();
+                }
+            }
+            stepCount_ = step_;
+            valid_ = node_ == ast.size();
+            // at the start, as it's evaluated.
+            restore(checkpoints_.front());
+            return valid_;
+        }
+
+        // false if a division is by zero.
+        bool valid() const { return valid_; }
+
+        // the number of the steps.
+        std::uint64_t step_count() const { return stepCount_; }
+
+        // Moves to the state after the steps [0, step) are done.
+        bool seek(std::uint64_t step)
+        {
+            if (!ast_ || step > stepCount_) {
+                return false;
+            }
+            auto const found = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), step,
+                                                [](std::uint64_t s, checkpoint const& c) { return s < c.step; });
+            checkpoint const& c = *(found - 1);
+            // unless the step is ahead, and the checkpoint is not nearer.
+            if (step < step_ || c.step > step_) {
+                restore(c);
+            }
+            std::uint32_t const from = node_;
+            calc_step s;
+            while (step_ < step) {
+                next(s);
+            }
+            replayed_ = node_ - from;
+            return true;
+        }
+
+        // Does the next step, with the literals before it.
+        bool next(calc_step & s)
+        {
+            calc_node const * const nodes = ast_->nodes.data();
+            std::uint32_t const n = static_cast<std::uint32_t>(ast_->size());
+            for (; node_ < n; ++node_) {
+                calc_node const& node = nodes[node_];
+                if (node.op == calc_op::literal) {
+                    push(node.value);
+                    continue;
+                }
+                if (step_ == stepCount_) {
+                    return false;
+                }
+                calc_value_t const rhs = at(depth_ - 1);
+                calc_value_t const lhs = at(depth_ - 2);
+                calc_value_t result;
+                if (!calc_apply(node.op, lhs, rhs, result)) {
+                    return false;
+                }
+                depth_ -= 2;
+                push(result);
+                s = calc_step{ node_, node.op, lhs, rhs, result };
+                ++node_;
+                ++step_;
+                return true;
+            }
+            return false;
+        }
+
+        // the number of the steps done.
+        std::uint64_t position() const { return step_; }
+
+        // the next node to evaluate.
+        std::uint32_t node() const { return node_; }
+
+        // The operand stack, from the bottom.
+        std::size_t depth() const { return depth_; }
+        calc_value_t operand(std::size_t i) const { return at(i); }
+
+        // the nodes replayed by the last seek.
+        std::size_t last_replayed() const { return replayed_; }
+
+        std::size_t checkpoint_count() const { return checkpoints_.size(); }
+        std::size_t interval() const { return interval_; }
+
+        // The bytes of the checkpoints, with a shared chunk counted once.
+        // It's O(the chunks of all the checkpoints).
+        std::size_t memory_bytes() const
+        {
+            std::vector<chunk const *> chunks;
+            std::size_t bytes = checkpoints_.size() * sizeof(checkpoint);
+            for (checkpoint const& c : checkpoints_) {
+                bytes += c.chunks.size() * sizeof(chunk_ptr);
+                for (chunk_ptr const& p : c.chunks) {
+                    chunks.push_back(p.get());
+                }
+            }
+            std::sort(chunks.begin(), chunks.end());
+            return bytes + static_cast<std::size_t>(std::unique(chunks.begin(), chunks.end()) - chunks.begin())
+                                * sizeof(chunk);
+        }
+
+    private:
+        using chunk = std::array<calc_value_t, chunk_size>;
+        using chunk_ptr = std::shared_ptr<chunk>;
+
+        struct checkpoint
+        {
+            std::uint64_t step;
+            std::uint32_t node;
+            std::size_t depth;
+            std::vector<chunk_ptr> chunks;
+        };
+
+        calc_value_t at(std::size_t i) const
+        {
+            return (*stack_[i / chunk_size])[i % chunk_size];
+        }
+
+        void push(calc_value_t v)
+        {
+            std::size_t const i = depth_ / chunk_size;
+            if (i == stack_.size()) {
+                stack_.push_back(std::make_shared<chunk>());
+            } else if (stack_[i].use_count() > 1) {
+                // shared with a checkpoint.
+                stack_[i] = std::make_shared<chunk>(*stack_[i]);
+            }
+            (*stack_[i])[depth_ % chunk_size] = v;
+            ++depth_;
+        }
+
+        void take_checkpoint()
+        {
+            std::size_t const used = (depth_ + chunk_size - 1) / chunk_size;
+            checkpoints_.push_back(checkpoint{ step_, node_, depth_,
+                                               std::vector<chunk_ptr>(stack_.begin(), stack_.begin() + used) });
+            if (checkpoints_.size() > std::max<std::size_t>(options_.maxCheckpoints, 2)) {
+                // the first one is kept, which is the start.
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < checkpoints_.size(); i += 2) {
+                    checkpoints_[kept++] = std::move(checkpoints_[i]);
+                }
+                checkpoints_.resize(kept);
+                interval_ *= 2;
+            }
+        }
+
+        void restore(checkpoint const& c)
+        {
+            stack_.assign(c.chunks.begin(), c.chunks.end());
+            depth_ = c.depth;
+            node_ = c.node;
+            step_ = c.step;
+        }
+
+        calc_replay_options options_;
+        calc_ast const * ast_ = nullptr;
+        std::size_t interval_ = 0;
+        std::vector<checkpoint> checkpoints_;
+        std::vector<chunk_ptr> stack_;
+        std::size_t depth_ = 0;
+        std::uint32_t node_ = 0;
+        std::uint64_t step_ = 0;
+        std::uint64_t stepCount_ = 0;
+        bool valid_ = false;
+        std::size_t replayed_ = 0;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_REPLAY_H
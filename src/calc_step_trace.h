@@ -0,0 +1,237 @@
+#ifndef ALGOVISU_CALC_STEP_TRACE_H
+#define ALGOVISU_CALC_STEP_TRACE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "calc_ast.h"
+#include "calc_evaluator.h"
+#include "thread_slots.h"
+
+
+namespace algovisu
+{
+    // A step of the evaluator, in 12 bytes.
+    //
+    // The operands are not recorded, as they are the values of the child
+    // nodes, which are the literals of the ast or the results of the earlier
+    // steps. calc_step_decoder finds them again.
+    //
+    // NOTE: the node index has 29 bits, and the operator the rest. The
+    //          nodes over max_node don't fit, and calc_step_buffer drops
+    //          their steps.
+    struct calc_step_record
+    {
+        static constexpr std::uint32_t max_node = 0x1fffffffu;
+
+        std::uint32_t nodeOp;
+        std::uint32_t resultLo;
+        std::uint32_t resultHi;
+
+        static calc_step_record make(std::uint32_t node, calc_op op, calc_value_t result)
+        {
+            std::uint64_t const r = static_cast<std::uint64_t>(result);
+            return calc_step_record{ node | (std::uint32_t(op) << 29),
+                                     static_cast<std::uint32_t>(r),
+                                     static_cast<std::uint32_t>(r >> 32) };
+        }
+
+        std::uint32_t node() const { return nodeOp & max_node; }
+        calc_op op() const { return static_cast<calc_op>(nodeOp >> 29); }
+
+        calc_value_t result() const
+        {
+            return static_cast<calc_value_t>(std::uint64_t(resultLo) | (std::uint64_t(resultHi) << 32));
+        }
+    };
+
+    static_assert(sizeof(calc_step_record) == 12, "a step is 12 bytes");
+
+    // The steps recorded by a thread, in a buffer allocated once.
+    //
+    // The owner thread appends, and the others may read the steps appended
+    // so far at any time. The steps over the capacity, and the ones of the
+    // nodes over calc_step_record::max_node, are dropped and counted.
+    //
+    // NOTE: clear() and reserve() are for the owner only, and no other thread
+    //          should be reading then.
+    class calc_step_buffer
+    {
+    public:
+        void push(std::uint32_t node, calc_op op, calc_value_t result)
+        {
+            std::size_t const n = size_.load(std::memory_order_relaxed);
+            if (node > calc_step_record::max_node || (n >= capacity_ && !allocate())) {
+                dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            records_[n] = calc_step_record::make(node, op, result);
+            size_.store(n + 1, std::memory_order_release);
+        }
+
+        // Allocates the buffer now, not to do it in the first step.
+        void reserve(std::size_t capacity)
+        {
+            if (capacity != capacity_) {
+                records_.reset(new calc_step_record[capacity]);
+                capacity_ = capacity;
+                clear();
+            }
+        }
+
+        void clear()
+        {
+            size_.store(0, std::memory_order_relaxed);
+            dropped_.store(0, std::memory_order_relaxed);
+        }
+
+        calc_step_record const * data() const { return records_.get(); }
+        std::size_t size() const { return size_.load(std::memory_order_acquire); }
+        std::size_t capacity() const { return capacity_; }
+        std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        bool allocate();
+
+        std::unique_ptr<calc_step_record[]> records_;
+        std::size_t capacity_ = 0;
+        std::atomic<std::size_t> size_{ 0 };
+        std::atomic<std::uint64_t> dropped_{ 0 };
+    };
+
+    namespace detail
+    {
+        inline std::atomic<std::size_t> & step_trace_capacity()
+        {
+            static std::atomic<std::size_t> capacity{ std::size_t(1) << 20 };
+            return capacity;
+        }
+
+        inline thread_slots<calc_step_buffer> & step_trace_slots()
+        {
+            // never destroyed, the thread_local owners may outlive a static one.
+            static auto & slots = *new thread_slots<calc_step_buffer>;
+            return slots;
+        }
+    } // namespace detail
+
+    // The buffer is allocated on the first step, unless it's reserved.
+    inline bool calc_step_buffer::allocate()
+    {
+        if (records_) {
+            return false;
+        }
+        capacity_ = detail::step_trace_capacity().load(std::memory_order_relaxed);
+        records_.reset(new calc_step_record[capacity_]);
+        return capacity_ > 0;
+    }
+
+    // Sets the capacity of the buffers allocated from now on, in steps.
+    inline void configure_step_trace(std::size_t capacity)
+    {
+        detail::step_trace_capacity().store(capacity, std::memory_order_relaxed);
+    }
+
+    // The calling thread's buffer.
+    inline calc_step_buffer & local_step_trace()
+    {
+        // the slot is looked up once, as this is on every step.
+        static thread_local calc_step_buffer * buffer = nullptr;
+        if (!buffer) {
+            buffer = &detail::step_trace_slots().local();
+        }
+        return *buffer;
+    }
+
+    // The buffers of every thread, including the exited ones.
+    template <typename F>
+    void for_each_step_trace(F f)
+    {
+        detail::step_trace_slots().for_each(f);
+    }
+
+    // The step probe of basic_calc_evaluator, which records the steps into
+    // the buffer of the thread.
+    //
+    // It's removed with ALGOVISU_NO_STEP_TRACE defined, as no_step_probe.
+    // The steps of an ast over 2^29 nodes are only counted, as dropped.
+    //
+    // Measured with the "calc step trace overhead" benchmark on a release
+    // build, a 10M step evaluation takes 1.1-1.2x as long with it.
+    //
+    // ex.)
+    //  basic_calc_evaluator<calc_step_recorder> evaluator;
+    //  evaluator.evaluate(ast, result);
+    //  calc_step_buffer const& steps = local_step_trace();
+#if defined(ALGOVISU_NO_STEP_TRACE)
+    using calc_step_recorder = no_step_probe;
+#else
+    struct calc_step_recorder
+    {
+        void before_step(std::uint32_t, calc_op)
+        { }
+
+        void after_step(std::uint32_t node, calc_op op, calc_value_t, calc_value_t, calc_value_t result)
+        {
+            local_step_trace().push(node, op, result);
+        }
+    };
+#endif
+
+    // A step with its operands.
+    struct calc_step
+    {
+        std::uint32_t node;
+        calc_op op;
+        calc_value_t lhs;
+        calc_value_t rhs;
+        calc_value_t result;
+    };
+
+    // Decodes the steps of an evaluation of an ast, in the recorded order.
+    //
+    // ex.)
+    //  calc_step_decoder decoder(ast);
+    //  for (std::size_t i = 0; i < steps.size(); ++i) {
+    //      calc_step const s = decoder.decode(steps.data()[i]);
+    //  }
+    class calc_step_decoder
+    {
+    public:
+        calc_step_decoder() = default;
+
+        explicit calc_step_decoder(calc_ast const& ast)
+        {
+            reset(ast);
+        }
+
+        void reset(calc_ast const& ast)
+        {
+            ast_ = &ast;
+            values_.resize(ast.size());
+            for (std::size_t i = 0; i < ast.size(); ++i) {
+                values_[i] = ast.nodes[i].value;
+            }
+        }
+
+        calc_step decode(calc_step_record const& r)
+        {
+            std::uint32_t const node = r.node();
+            calc_node const& n = ast_->nodes[node];
+            calc_value_t const result = r.result();
+            values_[node] = result;
+            return calc_step{ node, r.op(), values_[n.lhs], values_[n.rhs], result };
+        }
+
+    private:
+        calc_ast const * ast_ = nullptr;
+        std::vector<calc_value_t> values_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_STEP_TRACE_H
@@ -0,0 +1,264 @@
+#ifndef ALGOVISU_CALC_STREAM_H
+#define ALGOVISU_CALC_STREAM_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "calc_ast.h"
+
+
+namespace algovisu
+{
+    // The token ids of the push lexer. The literal id is the one of
+    // calc_token::decimal_integer_, and the others are the characters.
+    constexpr int calc_literal_token = 65536;       // lex::min_token_id
+    constexpr int calc_end_token = '\n';            // the end of an expression
+    constexpr int calc_invalid_token = 0;           // a character which is not a token
+
+    struct calc_push_token
+    {
+        int id;
+        calc_value_t value;     // for the literal
+    };
+
+    // A resumable lexer which takes the input in arbitrary chunks.
+    //
+    // It lexes the same tokens as calc_token: "0|[1-9]\d*", + - * / ( )
+    // and the white spaces. A newline ends an expression. A literal split
+    // across the chunks is kept in the state until its end is seen.
+    class calc_push_lexer
+    {
+    public:
+        // Lexes [first, last) and passes the tokens to on_token(calc_push_token const&).
+        // It stops after the budget of the tokens, and returns where it stopped.
+        // NOTE: the character which ends a literal is a token too, so the
+        //          budget can be passed by 1.
+        template <typename F>
+        char const * push(char const * first, char const * last, F && on_token,
+                          std::size_t budget = std::numeric_limits<std::size_t>::max())
+        {
+            std::size_t tokens = 0;
+            for (; first != last && tokens < budget; ++first) {
+                char const c = *first;
+                if (is_digit(c)) {
+                    if (inLiteral_ && !zero_) {
+                        value_ = value_ * 10 + static_cast<std::uint64_t>(c - '0');
+                        continue;
+                    }
+                    if (inLiteral_) {
+                        // "0" is a whole literal, so the digit begins a new one.
+                        on_token(literal());
+                        ++tokens;
+                    }
+                    inLiteral_ = true;
+                    zero_ = (c == '0');
+                    value_ = static_cast<std::uint64_t>(c - '0');
+                    continue;
+                }
+                if (inLiteral_) {
+                    on_token(literal());
+                    ++tokens;
+                }
+                switch (c) {
+                    case '+': case '-': case '*': case '/': case '(': case ')': case '\n':
+                        on_token(calc_push_token{ c, 0 });
+                        ++tokens;
+                        break;
+                    case ' ': case '\t': case '\r': case '\v': case '\f':
+                        break;
+                    default:
+                        on_token(calc_push_token{ calc_invalid_token, 0 });
+                        ++tokens;
+                        break;
+                }
+            }
+            return first;
+        }
+
+        // The end of the stream. The pending literal is passed, if any.
+        template <typename F>
+        void finish(F && on_token)
+        {
+            if (inLiteral_) {
+                on_token(literal());
+            }
+        }
+
+    private:
+        static bool is_digit(char c)
+        {
+            return static_cast<unsigned char>(c - '0') < 10;
+        }
+
+        calc_push_token literal()
+        {
+            inLiteral_ = false;
+            return calc_push_token{ calc_literal_token, static_cast<calc_value_t>(value_) };
+        }
+
+        std::uint64_t value_ = 0;
+        bool inLiteral_ = false;
+        bool zero_ = false;
+    };
+
+    // A resumable parser of the newline separated calc expressions.
+    //
+    // The tokens are parsed by the operator precedence, with the explicit
+    // stacks instead of the recursion. It builds the same post-ordered
+    // calc_ast as calc_grammar does. The memory it holds is the AST and
+    // the stacks of the current expression, whatever the stream size is.
+    //
+    // on_expression(calc_ast & ast, bool ok) is called for every expression.
+    // ok is false for an expression which doesn't lex or parse, and its AST
+    // is incomplete. The blank lines are skipped. The callee may take the
+    // nodes away by a swap, and the parser goes on with what it gets back.
+    //
+    // ex.)
+    //  calc_push_parser parser;
+    //  while (read a chunk) {
+    //      parser.push(chunk, chunk + size, on_expression);
+    //  }
+    //  parser.finish(on_expression);
+    class calc_push_parser
+    {
+    public:
+        // It stops after the budget of the tokens, and returns where it stopped.
+        // Push the rest of the chunk again to resume.
+        template <typename F>
+        char const * push(char const * first, char const * last, F && on_expression,
+                          std::size_t budget = std::numeric_limits<std::size_t>::max())
+        {
+            return lexer_.push(first, last, [this, &on_expression](calc_push_token const& t) {
+                on_token(t, on_expression);
+            }, budget);
+        }
+
+        // The end of the stream. The last expression doesn't need a newline.
+        template <typename F>
+        void finish(F && on_expression)
+        {
+            lexer_.finish([this, &on_expression](calc_push_token const& t) {
+                on_token(t, on_expression);
+            });
+            on_token(calc_push_token{ calc_end_token, 0 }, on_expression);
+        }
+
+        // The number of the tokens seen in the current expression.
+        std::size_t pending_tokens() const { return tokens_; }
+
+    private:
+        enum : char { open_group = '(' };
+
+        template <typename F>
+        void on_token(calc_push_token const& t, F & on_expression)
+        {
+            if (t.id == calc_end_token) {
+                if (tokens_ > 0) {
+                    bool const ok = !failed_ && expectOperator_ && reduce_all();
+                    on_expression(ast_, ok);
+                }
+                reset();
+                return;
+            }
+            ++tokens_;
+            if (failed_) {
+                return;     // skips to the end of the expression
+            }
+            failed_ = !(expectOperator_ ? on_operator(t) : on_operand(t));
+        }
+
+        bool on_operand(calc_push_token const& t)
+        {
+            switch (t.id) {
+                case calc_literal_token:
+                    operands_.push_back(ast_.add_literal(t.value));
+                    expectOperator_ = true;
+                    return true;
+                case '(':
+                    operators_.push_back(open_group);
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        bool on_operator(calc_push_token const& t)
+        {
+            switch (t.id) {
+                case '+': case '-':
+                    reduce_while([](char op) { return op != open_group; });
+                    break;
+                case '*': case '/':
+                    reduce_while([](char op) { return op == '*' || op == '/'; });
+                    break;
+                case ')':
+                    reduce_while([](char op) { return op != open_group; });
+                    if (operators_.empty()) {
+                        return false;
+                    }
+                    operators_.pop_back();
+                    return true;
+                default:
+                    return false;
+            }
+            operators_.push_back(static_cast<char>(t.id));
+            expectOperator_ = false;
+            return true;
+        }
+
+        // the operators are left associative, so the ones of the same
+        // precedence on the stack are reduced before the new one is pushed.
+        template <typename Pred>
+        void reduce_while(Pred pred)
+        {
+            while (!operators_.empty() && pred(operators_.back())) {
+                reduce();
+            }
+        }
+
+        void reduce()
+        {
+            calc_op op = calc_op::add;
+            switch (operators_.back()) {
+                case '-': op = calc_op::sub; break;
+                case '*': op = calc_op::mul; break;
+                case '/': op = calc_op::div; break;
+                default: break;
+            }
+            operators_.pop_back();
+            std::uint32_t const rhs = operands_.back();
+            operands_.pop_back();
+            operands_.back() = ast_.add_operator(op, operands_.back(), rhs);
+        }
+
+        bool reduce_all()
+        {
+            reduce_while([](char op) { return op != open_group; });
+            return operators_.empty();
+        }
+
+        void reset()
+        {
+            ast_.clear();
+            operands_.clear();
+            operators_.clear();
+            tokens_ = 0;
+            expectOperator_ = false;
+            failed_ = false;
+        }
+
+        calc_push_lexer lexer_;
+        calc_ast ast_;
+        std::vector<std::uint32_t> operands_;
+        std::vector<char> operators_;
+        std::size_t tokens_ = 0;
+        bool expectOperator_ = false;
+        bool failed_ = false;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_STREAM_H
@@ -0,0 +1,326 @@
+#ifndef ALGOVISU_CALC_THREADED_VM_H
+#define ALGOVISU_CALC_THREADED_VM_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "calc_ast.h"
+#include "calc_bytecode.h"
+#include "calc_dispatch.h"
+#include "calc_evaluator.h"
+
+
+namespace algovisu
+{
+    // The operations of the threaded code, with the superinstructions, which
+    // are the most common sequences of the generated corpus fused. A push
+    // is followed by an operator in 36% of the instructions, and a push, a
+    // mul and an add or a sub, which "a + b * c" ends with, are 6% of them.
+    enum class calc_threaded_op : std::uint8_t
+    {
+        push,
+        add,
+        sub,
+        mul,
+        div,
+        push_add,       // the top op= the value.
+        push_sub,
+        push_mul,
+        push_div,
+        push_mul_add,   // the second += the top * the value, and pops.
+        push_mul_sub,
+        end,            // returns the top.
+        count
+    };
+
+    // The handler is the address of the label of the op for the threaded
+    // dispatch, or the op itself for the switch.
+    struct calc_threaded_instruction
+    {
+        std::uintptr_t handler;
+        calc_value_t value;
+    };
+
+    struct calc_threaded_program
+    {
+        std::vector<calc_threaded_instruction> code;   // with the end.
+        std::uint32_t stackDepth = 0;
+        calc_dispatch dispatch = calc_dispatch::switch_loop;
+
+        bool empty() const { return code.empty(); }
+    };
+
+    // Runs the stack machine code of calc_vm, translated to the threaded code.
+    //
+    // calc_vm tests the op of every instruction in one place, so the branch
+    // of the dispatch is predicted from the last op only, and it mispredicts
+    // as often as the operators of an expression change. The threaded code
+    // has the address of the handler in every instruction, and every handler
+    // ends with its own indirect jump to the next, which is predicted by
+    // the op before. The superinstructions cut the dispatches themselves.
+    //
+    // The threaded dispatch is by the labels as values of GCC and Clang, and
+    // it's the switch elsewhere. The switch is kept as a fallback, and for
+    // the comparison.
+    //
+    // NOTE: a translated program is for the vm of the same dispatch.
+    //
+    // ex.)
+    //  calc_threaded_vm vm;
+    //  calc_threaded_program threaded;
+    //  vm.translate(program, threaded);
+    //  calc_value_t result;
+    //  vm.run(threaded, result);
+    class calc_threaded_vm
+    {
+    public:
+        explicit calc_threaded_vm(calc_dispatch dispatch = calc_dispatch::threaded, bool superinstructions = true)
+            : dispatch_(dispatch)
+            , superinstructions_(superinstructions)
+        {
+#if !defined(ALGOVISU_HAS_COMPUTED_GOTO)
+            dispatch_ = calc_dispatch::switch_loop;
+#endif
+        }
+
+        calc_dispatch dispatch() const { return dispatch_; }
+        bool superinstructions() const { return superinstructions_; }
+
+        void translate(calc_instruction const * code, std::size_t size, std::uint32_t stackDepth,
+                       calc_threaded_program & program) const
+        {
+            program.code.clear();
+            program.stackDepth = stackDepth;
+            program.dispatch = dispatch_;
+            if (size == 0) {
+                return;
+            }
+            program.code.reserve(size + 1);
+            for (std::size_t i = 0; i < size; ++i) {
+                calc_opcode const op = code[i].op;
+                calc_value_t const value = code[i].value;
+                if (op != calc_opcode::push || !superinstructions_ || i + 1 == size || code[i + 1].op == calc_opcode::push) {
+                    emit(static_cast<calc_threaded_op>(op), value, program);
+                    continue;
+                }
+                calc_opcode const next = code[i + 1].op;
+                if (next == calc_opcode::mul && i + 2 < size
+                        && (code[i + 2].op == calc_opcode::add || code[i + 2].op == calc_opcode::sub)) {
+                    emit(code[i + 2].op == calc_opcode::add ? calc_threaded_op::push_mul_add : calc_threaded_op::push_mul_sub,
+                         value, program);
+                    i += 2;
+                    continue;
+                }
+                emit(static_cast<calc_threaded_op>(static_cast<int>(calc_threaded_op::push_add) + static_cast<int>(next) - 1),
+                     value, program);
+                ++i;
+            }
+            emit(calc_threaded_op::end, 0, program);
+        }
+
+        void translate(calc_program const& program, calc_threaded_program & threaded) const
+        {
+            translate(program.code.data(), program.code.size(), program.stackDepth, threaded);
+        }
+
+        // false for the division by zero, or the empty code.
+        bool run(calc_threaded_program const& program, calc_value_t & result)
+        {
+            if (program.empty()) {
+                return false;
+            }
+            if (stack_.size() < program.stackDepth) {
+                stack_.resize(program.stackDepth);
+            }
+#if defined(ALGOVISU_HAS_COMPUTED_GOTO)
+            if (program.dispatch == calc_dispatch::threaded) {
+                return run_threaded(program.code.data(), stack_.data(), result, nullptr);
+            }
+#endif
+            return run_switch(program.code.data(), stack_.data(), result);
+        }
+
+    private:
+        void emit(calc_threaded_op op, calc_value_t value, calc_threaded_program & program) const
+        {
+            std::uintptr_t handler = static_cast<std::uintptr_t>(op);
+#if defined(ALGOVISU_HAS_COMPUTED_GOTO)
+            if (dispatch_ == calc_dispatch::threaded) {
+                handler = handlers()[static_cast<std::size_t>(op)];
+            }
+#endif
+            program.code.push_back(calc_threaded_instruction{ handler, value });
+        }
+
+        static bool run_switch(calc_threaded_instruction const * pc, calc_value_t * sp, calc_value_t & result)
+        {
+            for (;; ++pc) {
+                switch (static_cast<calc_threaded_op>(pc->handler)) {
+                    case calc_threaded_op::push:
+                        *sp++ = pc->value;
+                        break;
+                    case calc_threaded_op::add:
+                        --sp;
+                        calc_apply(calc_op::add, sp[-1], sp[0], sp[-1]);
+                        break;
+                    case calc_threaded_op::sub:
+                        --sp;
+                        calc_apply(calc_op::sub, sp[-1], sp[0], sp[-1]);
+                        break;
+                    case calc_threaded_op::mul:
+                        --sp;
+                        calc_apply(calc_op::mul, sp[-1], sp[0], sp[-1]);
+                        break;
+                    case calc_threaded_op::div:
+                        --sp;
+                        if (!calc_apply(calc_op::div, sp[-1], sp[0], sp[-1])) {
+                            return false;
+                        }
+                        break;
+                    case calc_threaded_op::push_add:
+                        calc_apply(calc_op::add, sp[-1], pc->value, sp[-1]);
+                        break;
+                    case calc_threaded_op::push_sub:
+                        calc_apply(calc_op::sub, sp[-1], pc->value, sp[-1]);
+                        break;
+                    case calc_threaded_op::push_mul:
+                        calc_apply(calc_op::mul, sp[-1], pc->value, sp[-1]);
+                        break;
+                    case calc_threaded_op::push_div:
+                        if (!calc_apply(calc_op::div, sp[-1], pc->value, sp[-1])) {
+                            return false;
+                        }
+                        break;
+                    case calc_threaded_op::push_mul_add:
+                        --sp;
+                        calc_apply(calc_op::mul, sp[0], pc->value, sp[0]);
+                        calc_apply(calc_op::add, sp[-1], sp[0], sp[-1]);
+                        break;
+                    case calc_threaded_op::push_mul_sub:
+                        --sp;
+                        calc_apply(calc_op::mul, sp[0], pc->value, sp[0]);
+                        calc_apply(calc_op::sub, sp[-1], sp[0], sp[-1]);
+                        break;
+                    default:
+                        result = sp[-1];
+                        return true;
+                }
+            }
+        }
+
+#if defined(ALGOVISU_HAS_COMPUTED_GOTO)
+        // The label addresses, by the op.
+        static std::uintptr_t const * handlers()
+        {
+            static std::uintptr_t const * const table = [] {
+                std::uintptr_t const * t = nullptr;
+                calc_value_t unused;
+                run_threaded(nullptr, nullptr, unused, &t);
+                return t;
+            }();
+            return table;
+        }
+
+        // Runs the code, or gives the label addresses if the table is asked.
+        static bool run_threaded(calc_threaded_instruction const * pc, calc_value_t * sp, calc_value_t & result,
+                                 std::uintptr_t const ** table)
+        {
+            static std::uintptr_t const labels[] = {
+                reinterpret_cast<std::uintptr_t>(&&op_push),
+                reinterpret_cast<std::uintptr_t>(&&op_add),
+                reinterpret_cast<std::uintptr_t>(&&op_sub),
+                reinterpret_cast<std::uintptr_t>(&&op_mul),
+                reinterpret_cast<std::uintptr_t>(&&op_div),
+                reinterpret_cast<std::uintptr_t>(&&op_push_add),
+                reinterpret_cast<std::uintptr_t>(&&op_push_sub),
+                reinterpret_cast<std::uintptr_t>(&&op_push_mul),
+                reinterpret_cast<std::uintptr_t>(&&op_push_div),
+                reinterpret_cast<std::uintptr_t>(&&op_push_mul_add),
+                reinterpret_cast<std::uintptr_t>(&&op_push_mul_sub),
+                reinterpret_cast<std::uintptr_t>(&&op_end)
+            };
+            static_assert(sizeof(labels) / sizeof(labels[0]) == static_cast<std::size_t>(calc_threaded_op::count),
+                          "a label for every op");
+            if (table) {
+                *table = labels;
+                return true;
+            }
+
+        // every handler jumps to the next one by itself.
+#define ALGOVISU_CALC_NEXT() goto *reinterpret_cast<void *>(pc->handler)
+
+            ALGOVISU_CALC_NEXT();
+        op_push:
+            *sp++ = pc->value;
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_add:
+            --sp;
+            calc_apply(calc_op::add, sp[-1], sp[0], sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_sub:
+            --sp;
+            calc_apply(calc_op::sub, sp[-1], sp[0], sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_mul:
+            --sp;
+            calc_apply(calc_op::mul, sp[-1], sp[0], sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_div:
+            --sp;
+            if (!calc_apply(calc_op::div, sp[-1], sp[0], sp[-1])) {
+                return false;
+            }
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_push_add:
+            calc_apply(calc_op::add, sp[-1], pc->value, sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_push_sub:
+            calc_apply(calc_op::sub, sp[-1], pc->value, sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_push_mul:
+            calc_apply(calc_op::mul, sp[-1], pc->value, sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_push_div:
+            if (!calc_apply(calc_op::div, sp[-1], pc->value, sp[-1])) {
+                return false;
+            }
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_push_mul_add:
+            --sp;
+            calc_apply(calc_op::mul, sp[0], pc->value, sp[0]);
+            calc_apply(calc_op::add, sp[-1], sp[0], sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_push_mul_sub:
+            --sp;
+            calc_apply(calc_op::mul, sp[0], pc->value, sp[0]);
+            calc_apply(calc_op::sub, sp[-1], sp[0], sp[-1]);
+            ++pc;
+            ALGOVISU_CALC_NEXT();
+        op_end:
+            result = sp[-1];
+            return true;
+
+#undef ALGOVISU_CALC_NEXT
+        }
+#endif
+
+        calc_dispatch dispatch_;
+        bool superinstructions_;
+        std::vector<calc_value_t> stack_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_THREADED_VM_H
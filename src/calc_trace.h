@@ -0,0 +1,115 @@
+#ifndef ALGOVISU_CALC_TRACE_H
+#define ALGOVISU_CALC_TRACE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <string>
+
+#include "event_trace.h"
+#include "rule_profiler.h"
+#include "calc_evaluator.h"
+#include "calc_pipeline.h"
+
+
+namespace algovisu
+{
+    // The trace policies of calc_pipeline. Each one records the spans of
+    // its layer into the per-thread trace buffer of event_trace.h.
+    //
+    //  stage_tracer: "read", "lex", "parse" and "evaluate"
+    //  rule_tracer: every calc_grammar rule call, by its rule name.
+    //                  the end event of a failed(backtracked) call has arg 1.
+    //  step_tracer: every evaluator step, by its operator("add", "sub", ...).
+    //                  the arg is the AST node index of the step.
+    //
+    // ex.)
+    //  calc_pipeline<calc_instruments<stage_tracer, rule_tracer, step_tracer>> pipeline;
+    //  ...
+    //  flush_trace_json(ofs);
+    struct stage_tracer
+    {
+        class scope
+        {
+        public:
+            explicit scope(calc_stage stage)
+                : span_(name_of(stage))
+            { }
+
+        private:
+            static std::uint16_t name_of(calc_stage stage)
+            {
+                static std::array<std::uint16_t, calc_stage_count> const names = {
+                    trace_name(to_string(calc_stage::read)),
+                    trace_name(to_string(calc_stage::lex)),
+                    trace_name(to_string(calc_stage::parse)),
+                    trace_name(to_string(calc_stage::evaluate))
+                };
+                return names[static_cast<std::size_t>(stage)];
+            }
+
+            trace_span span_;
+        };
+    };
+
+    namespace detail
+    {
+        struct rule_trace_probe
+        {
+            template <typename Iterator, typename Context, typename State>
+            void operator()(Iterator const&, Iterator const&,
+                            Context const&,
+                            State state,
+                            std::string const&) const
+            {
+                if (state == qi::pre_parse) {
+                    trace_event(name_, trace_phase::begin);
+                } else {
+                    trace_event(name_, trace_phase::end, state == qi::successful_parse ? 0 : 1);
+                }
+            }
+
+            std::uint16_t name_;
+        };
+    } // namespace detail
+
+    struct rule_tracer
+    {
+        template <typename Rule>
+        static void attach(Rule & r, char const * name)
+        {
+            qi::debug(r, detail::rule_trace_probe{ trace_name(name) });
+        }
+    };
+
+    // NOTE: a step failed by the division by zero has no end event.
+    struct step_tracer
+    {
+        void before_step(std::uint32_t node, calc_op op)
+        {
+            trace_event(name_of(op), trace_phase::begin, node);
+        }
+
+        void after_step(std::uint32_t node, calc_op op, calc_value_t, calc_value_t, calc_value_t)
+        {
+            trace_event(name_of(op), trace_phase::end, node);
+        }
+
+    private:
+        static std::uint16_t name_of(calc_op op)
+        {
+            static std::array<std::uint16_t, 5> const names = {
+                trace_name("literal"),
+                trace_name("add"),
+                trace_name("sub"),
+                trace_name("mul"),
+                trace_name("div")
+            };
+            return names[static_cast<std::size_t>(op)];
+        }
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_TRACE_H
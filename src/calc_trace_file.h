@@ -0,0 +1,624 @@
+#ifndef ALGOVISU_CALC_TRACE_FILE_H
+#define ALGOVISU_CALC_TRACE_FILE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #define ALGOVISU_HAS_MMAP 1
+#endif
+
+#include "calc_hash.h"
+#include "calc_step_trace.h"
+
+
+#if defined(ALGOVISU_HAS_MMAP)
+namespace algovisu
+{
+    // A file of the steps of calc_step_record, written by calc_trace_writer
+    // and read by calc_trace_reader.
+    //
+    //  file    : header, block, block, ..., index, trailer
+    //  block   : block_header, node column, result column
+    //  index   : the offset of every index_stride-th block
+    //
+    // Every block but the last has blockSteps steps, so the block of a step
+    // is step / blockSteps. The index finds every index_stride-th of them,
+    // and the rest are skipped by their sizes, at most index_stride - 1.
+    //
+    // The steps of a block are delta-coded against the least node and
+    // result of the block, and bit-packed at the fixed widths of the block.
+    // A node and its operator are nodeBits + 3 bits, and a result is
+    // resultBits, or 64 bits raw if the results are too far apart.
+    // So any step of a block is decoded at once, with no other step.
+    //
+    // A block is checksummed, and it's verified when it's read first.
+    // If the trailer is missing by a crash, the reader finds the blocks
+    // by their headers up to the first torn one.
+    //
+    // NOTE: the numbers are little-endian, as they're stored.
+    namespace detail
+    {
+        static constexpr std::uint64_t trace_file_magic = 0x3130525456474c41ull;     // "ALGVTR01"
+        static constexpr std::uint64_t trace_trailer_magic = 0x3130444e56474c41ull;  // "ALGVND01"
+        static constexpr std::uint32_t trace_file_version = 1;
+        static constexpr std::uint32_t trace_index_stride = 16;
+        static constexpr std::uint32_t trace_raw_bits = 64;
+        static constexpr std::uint32_t trace_max_packed_bits = 56;
+
+        struct trace_file_header
+        {
+            std::uint64_t magic;
+            std::uint32_t version;
+            std::uint32_t blockSteps;
+        };
+
+        struct trace_block_header
+        {
+            std::uint64_t checksum;     // of the rest of the block.
+            std::uint64_t resultBase;
+            std::uint32_t count;
+            std::uint32_t nodeBase;
+            std::uint8_t nodeBits;
+            std::uint8_t resultBits;
+            std::uint16_t reserved;
+            std::uint32_t size;         // of the whole block, in bytes.
+        };
+
+        struct trace_file_trailer
+        {
+            std::uint64_t stepCount;
+            std::uint64_t blockCount;
+            std::uint64_t indexOffset;
+            std::uint64_t checksum;     // of the index and the fields above.
+            std::uint64_t magic;
+        };
+
+        // The bytes of a column of count values of the bits.
+        // It has 8 more bytes, so that a value is read by a word.
+        inline std::size_t trace_column_size(std::size_t count, std::uint32_t bits)
+        {
+            return ((count * bits + 7) / 8 + 7) / 8 * 8 + 8;
+        }
+
+        // The size of a block of the steps at the widest, which must fit
+        // the 32 bits of trace_block_header::size.
+        inline std::uint64_t trace_max_block_size(std::uint64_t steps)
+        {
+            return sizeof(trace_block_header) + trace_column_size(static_cast<std::size_t>(steps), 29 + 3)
+                 + trace_column_size(static_cast<std::size_t>(steps), trace_raw_bits);
+        }
+
+        inline std::uint64_t trace_checksum(unsigned char const * p, std::size_t size)
+        {
+            return siphash128(p, size, 0x7472616365636863ull, 0x6b73756d626c6b31ull).lo;
+        }
+
+        inline std::uint64_t load_word(unsigned char const * p)
+        {
+            std::uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline std::uint64_t load_bits(unsigned char const * column, std::uint64_t i, std::uint32_t bits)
+        {
+            std::uint64_t const bit = i * bits;
+            std::uint64_t const mask = bits == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+            return (load_word(column + bit / 8) >> (bit % 8)) & mask;
+        }
+
+        inline std::uint32_t bit_width(std::uint64_t v)
+        {
+            std::uint32_t n = 0;
+            for (; v != 0; v >>= 1) {
+                ++n;
+            }
+            return n;
+        }
+
+        inline bool trace_write_at(int fd, unsigned char const * p, std::size_t n, std::uint64_t offset)
+        {
+            while (n > 0) {
+                ssize_t const r = ::pwrite(fd, p, n, static_cast<off_t>(offset));
+                if (r < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (r <= 0) {
+                    return false;
+                }
+                p += r;
+                n -= static_cast<std::size_t>(r);
+                offset += static_cast<std::uint64_t>(r);
+            }
+            return true;
+        }
+    } // namespace detail
+
+    // Writes the steps into a trace file, from the first.
+    //
+    // The file is complete when it's closed. A file cut by a crash before
+    // is still read by calc_trace_reader, but for the steps not written yet.
+    //
+    // ex.)
+    //  calc_trace_writer writer;
+    //  writer.open("eval.trace");
+    //  calc_step_buffer const& steps = local_step_trace();
+    //  writer.append(steps.data(), steps.size());
+    //  writer.close();
+    class calc_trace_writer
+    {
+    public:
+        calc_trace_writer() = default;
+
+        ~calc_trace_writer()
+        {
+            close();
+        }
+
+        calc_trace_writer(calc_trace_writer const&) = delete;
+        calc_trace_writer & operator = (calc_trace_writer const&) = delete;
+
+        // Creates a trace file, or truncates it.
+        // A larger block compresses as well with fewer headers, and a smaller
+        // one is read and verified faster when a step of it is sought.
+        // It fails over about 350M steps, as a block of them may not fit 4GB.
+        bool open(char const * path, std::uint32_t blockSteps = 4096)
+        {
+            close();
+            if (blockSteps == 0 || detail::trace_max_block_size(blockSteps) > UINT32_MAX) {
+                return false;
+            }
+            fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd_ < 0) {
+                return false;
+            }
+            blockSteps_ = blockSteps;
+            steps_.reserve(blockSteps);
+            detail::trace_file_header const header{ detail::trace_file_magic, detail::trace_file_version, blockSteps };
+            out_.resize(sizeof(header));
+            std::memcpy(out_.data(), &header, sizeof(header));
+            end_ = 0;
+            return true;
+        }
+
+        bool append(calc_step_record const& step)
+        {
+            return append(&step, 1);
+        }
+
+        bool append(calc_step_record const * steps, std::size_t count)
+        {
+            if (fd_ < 0) {
+                return false;
+            }
+            while (count > 0) {
+                std::size_t const n = std::min(count, blockSteps_ - steps_.size());
+                steps_.insert(steps_.end(), steps, steps + n);
+                steps += n;
+                count -= n;
+                if (steps_.size() == blockSteps_ && !(encode_block() && flush(false))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Writes the last block, the index and the trailer, and closes the file.
+        bool close()
+        {
+            if (fd_ < 0) {
+                return true;
+            }
+            bool ok = (steps_.empty() || encode_block()) && write_trailer() && flush(true);
+            ok = ::close(fd_) == 0 && ok;
+            fd_ = -1;
+            steps_.clear();
+            index_.clear();
+            out_.clear();
+            stepCount_ = 0;
+            blockCount_ = 0;
+            return ok;
+        }
+
+        bool is_open() const { return fd_ >= 0; }
+
+        // the number of the steps appended.
+        std::uint64_t size() const { return stepCount_ + steps_.size(); }
+
+        // the bytes written, or buffered to be.
+        std::uint64_t file_size() const { return end_ + out_.size(); }
+
+    private:
+        static constexpr std::size_t flush_size = std::size_t(4) << 20;
+
+        bool flush(bool always)
+        {
+            if (out_.empty() || (!always && out_.size() < flush_size)) {
+                return true;
+            }
+            if (!detail::trace_write_at(fd_, out_.data(), out_.size(), end_)) {
+                return false;
+            }
+            end_ += out_.size();
+            out_.clear();
+            return true;
+        }
+
+        bool encode_block()
+        {
+            std::size_t const count = steps_.size();
+            std::uint32_t minNode = UINT32_MAX, maxNode = 0;
+            calc_value_t minResult = steps_[0].result(), maxResult = minResult;
+            for (calc_step_record const& s : steps_) {
+                minNode = std::min(minNode, s.node());
+                maxNode = std::max(maxNode, s.node());
+                minResult = std::min(minResult, s.result());
+                maxResult = std::max(maxResult, s.result());
+            }
+            detail::trace_block_header h{};
+            h.count = static_cast<std::uint32_t>(count);
+            h.nodeBase = minNode;
+            h.nodeBits = static_cast<std::uint8_t>(detail::bit_width(maxNode - minNode));
+            h.resultBase = static_cast<std::uint64_t>(minResult);
+            std::uint32_t resultBits = detail::bit_width(
+                    static_cast<std::uint64_t>(maxResult) - static_cast<std::uint64_t>(minResult));
+            if (resultBits > detail::trace_max_packed_bits) {
+                resultBits = detail::trace_raw_bits;
+                h.resultBase = 0;
+            }
+            h.resultBits = static_cast<std::uint8_t>(resultBits);
+            std::uint32_t const nodeOpBits = h.nodeBits + 3u;
+            std::size_t const nodeSize = detail::trace_column_size(count, nodeOpBits);
+            std::size_t const resultSize = detail::trace_column_size(count, resultBits);
+            std::size_t const size = sizeof(h) + nodeSize + resultSize;
+            h.size = static_cast<std::uint32_t>(size);
+
+            if (blockCount_ % detail::trace_index_stride == 0) {
+                index_.push_back(file_size());
+            }
+            std::size_t const begin = out_.size();
+            out_.resize(begin + size, 0);
+            unsigned char * const block = out_.data() + begin;
+            unsigned char * const nodes = block + sizeof(h);
+            unsigned char * const results = nodes + nodeSize;
+            for (std::size_t i = 0; i < count; ++i) {
+                calc_step_record const& s = steps_[i];
+                std::uint64_t const nodeOp = (std::uint64_t(s.node() - minNode) << 3) | std::uint64_t(s.op());
+                std::uint64_t const result = static_cast<std::uint64_t>(s.result()) - h.resultBase;
+                store_bits(nodes, i, nodeOpBits, nodeOp);
+                if (resultBits == detail::trace_raw_bits) {
+                    std::memcpy(results + i * 8, &result, sizeof(result));
+                } else if (resultBits != 0) {
+                    store_bits(results, i, resultBits, result);
+                }
+            }
+            std::memcpy(block, &h, sizeof(h));
+            h.checksum = detail::trace_checksum(block + sizeof(h.checksum), size - sizeof(h.checksum));
+            std::memcpy(block, &h.checksum, sizeof(h.checksum));
+
+            stepCount_ += count;
+            ++blockCount_;
+            steps_.clear();
+            return true;
+        }
+
+        // ORs the value into the zeros, by a word.
+        static void store_bits(unsigned char * column, std::uint64_t i, std::uint32_t bits, std::uint64_t v)
+        {
+            std::uint64_t const bit = i * bits;
+            unsigned char * const p = column + bit / 8;
+            std::uint64_t const w = detail::load_word(p) | (v << (bit % 8));
+            std::memcpy(p, &w, sizeof(w));
+        }
+
+        bool write_trailer()
+        {
+            detail::trace_file_trailer t{};
+            t.stepCount = stepCount_;
+            t.blockCount = blockCount_;
+            t.indexOffset = file_size();
+            std::size_t const indexBytes = index_.size() * sizeof(std::uint64_t);
+            std::size_t const begin = out_.size();
+            out_.resize(begin + indexBytes + sizeof(t));
+            std::memcpy(out_.data() + begin, index_.data(), indexBytes);
+            std::memcpy(out_.data() + begin + indexBytes, &t, sizeof(t));
+            t.checksum = detail::trace_checksum(out_.data() + begin, indexBytes + offsetof(detail::trace_file_trailer, checksum));
+            t.magic = detail::trace_trailer_magic;
+            std::memcpy(out_.data() + begin + indexBytes, &t, sizeof(t));
+            return true;
+        }
+
+        int fd_ = -1;
+        std::size_t blockSteps_ = 0;
+        std::vector<calc_step_record> steps_;   // of the block being filled.
+        std::vector<std::uint64_t> index_;
+        std::vector<unsigned char> out_;
+        std::uint64_t end_ = 0;                 // the bytes written.
+        std::uint64_t stepCount_ = 0;           // in the encoded blocks.
+        std::uint64_t blockCount_ = 0;
+    };
+
+    // Reads the steps of a trace file at random, from its mapping.
+    //
+    // A step is found in O(1): the block is step / blockSteps, its nearest
+    // indexed block is in the index, and the block is up to 15 headers after.
+    // The last block found is remembered, so reading the steps in order
+    // doesn't look them up again.
+    //
+    // NOTE: a reader is for one thread at a time, as the blocks are
+    //          marked when they're verified.
+    //
+    // ex.)
+    //  calc_trace_reader reader;
+    //  if (reader.open("eval.trace")) {
+    //      calc_step_record step;
+    //      reader.read(reader.size() / 2, step);
+    //  }
+    class calc_trace_reader
+    {
+    public:
+        calc_trace_reader() = default;
+
+        ~calc_trace_reader()
+        {
+            close();
+        }
+
+        calc_trace_reader(calc_trace_reader const&) = delete;
+        calc_trace_reader & operator = (calc_trace_reader const&) = delete;
+
+        // Opens a trace file. With verify false, the blocks are read with
+        // no checksum checked, but for the last one of a cut file.
+        bool open(char const * path, bool verify = true)
+        {
+            close();
+            int const fd = ::open(path, O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            bool ok = ::fstat(fd, &st) == 0 && std::uint64_t(st.st_size) >= sizeof(detail::trace_file_header);
+            if (ok) {
+                mapSize_ = static_cast<std::size_t>(st.st_size);
+                void * p = ::mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, fd, 0);
+                ok = p != MAP_FAILED;
+                base_ = ok ? static_cast<unsigned char const *>(p) : nullptr;
+            }
+            ::close(fd);     // the mapping stays.
+            if (!ok || !open_mapped()) {
+                close();
+                return false;
+            }
+            verify_ = verify;
+            return true;
+        }
+
+        void close()
+        {
+            if (base_) {
+                ::munmap(const_cast<unsigned char *>(base_), mapSize_);
+            }
+            base_ = nullptr;
+            mapSize_ = 0;
+            blockSteps_ = 0;
+            stepCount_ = 0;
+            blockCount_ = 0;
+            complete_ = false;
+            index_.clear();
+            verified_.clear();
+            lastBlock_ = UINT64_MAX;
+            last_ = nullptr;
+        }
+
+        bool is_open() const { return base_ != nullptr; }
+
+        // the number of the steps.
+        std::uint64_t size() const { return stepCount_; }
+        std::uint64_t block_count() const { return blockCount_; }
+        std::uint32_t block_steps() const { return blockSteps_; }
+
+        // false if the file has no trailer, and was recovered.
+        bool complete() const { return complete_; }
+
+        // Reads a step. It fails if the step is not in the file,
+        // or its block is corrupted.
+        bool read(std::uint64_t step, calc_step_record & out)
+        {
+            if (step >= stepCount_) {
+                return false;
+            }
+            detail::trace_block_header const * h = find_block(step / blockSteps_);
+            if (!h || step % blockSteps_ >= h->count) {
+                return false;
+            }
+            out = decode(h, step % blockSteps_);
+            return true;
+        }
+
+        // Reads the steps [first, first + count), and returns how many
+        // are read before the end or a corrupted block.
+        std::size_t read(std::uint64_t first, std::size_t count, calc_step_record * out)
+        {
+            std::size_t done = 0;
+            while (done < count && first < stepCount_) {
+                detail::trace_block_header const * h = find_block(first / blockSteps_);
+                std::uint32_t const begin = static_cast<std::uint32_t>(first % blockSteps_);
+                if (!h || begin >= h->count) {
+                    break;
+                }
+                std::size_t const n = std::min<std::size_t>(count - done, h->count - begin);
+                for (std::size_t i = 0; i < n; ++i) {
+                    out[done + i] = decode(h, begin + i);
+                }
+                done += n;
+                first += n;
+            }
+            return done;
+        }
+
+    private:
+        bool open_mapped()
+        {
+            detail::trace_file_header header;
+            std::memcpy(&header, base_, sizeof(header));
+            if (header.magic != detail::trace_file_magic || header.version != detail::trace_file_version
+                    || header.blockSteps == 0 || detail::trace_max_block_size(header.blockSteps) > UINT32_MAX) {
+                return false;
+            }
+            blockSteps_ = header.blockSteps;
+            if (!read_trailer()) {
+                recover();
+            }
+            verified_.assign(static_cast<std::size_t>(blockCount_), 0);
+            return true;
+        }
+
+        bool read_trailer()
+        {
+            detail::trace_file_trailer t;
+            if (mapSize_ < sizeof(detail::trace_file_header) + sizeof(t)) {
+                return false;
+            }
+            std::memcpy(&t, base_ + mapSize_ - sizeof(t), sizeof(t));
+            std::uint64_t const indexCount = (t.blockCount + detail::trace_index_stride - 1) / detail::trace_index_stride;
+            if (t.magic != detail::trace_trailer_magic || t.indexOffset > mapSize_ - sizeof(t)
+                    || (mapSize_ - sizeof(t) - t.indexOffset) != indexCount * sizeof(std::uint64_t)) {
+                return false;
+            }
+            std::size_t const checked = static_cast<std::size_t>(indexCount * sizeof(std::uint64_t))
+                                            + offsetof(detail::trace_file_trailer, checksum);
+            if (detail::trace_checksum(base_ + t.indexOffset, checked) != t.checksum) {
+                return false;
+            }
+            // every block but the last is full, or the blocks are read past the index.
+            bool const consistent = t.blockCount == 0 ? t.stepCount == 0
+                                  : t.stepCount > 0 && (t.stepCount - 1) / blockSteps_ == t.blockCount - 1;
+            if (!consistent) {
+                return false;
+            }
+            index_.resize(static_cast<std::size_t>(indexCount));
+            std::memcpy(index_.data(), base_ + t.indexOffset, index_.size() * sizeof(std::uint64_t));
+            stepCount_ = t.stepCount;
+            blockCount_ = t.blockCount;
+            complete_ = true;
+            return true;
+        }
+
+        // Finds the blocks by their headers, up to the first torn one.
+        // The checksums are checked when the blocks are read, but the last
+        // one's, which a crash is likely to have cut.
+        void recover()
+        {
+            std::uint64_t offset = sizeof(detail::trace_file_header);
+            std::uint64_t lastOffset = 0;
+            detail::trace_block_header h;
+            while (offset + sizeof(h) <= mapSize_) {
+                std::memcpy(&h, base_ + offset, sizeof(h));
+                if (!valid_header(h) || h.size > mapSize_ - offset) {
+                    break;
+                }
+                if (blockCount_ % detail::trace_index_stride == 0) {
+                    index_.push_back(offset);
+                }
+                lastOffset = offset;
+                ++blockCount_;
+                stepCount_ += h.count;
+                offset += h.size;
+                if (h.count != blockSteps_) {
+                    break;      // only the last block is short.
+                }
+            }
+            if (blockCount_ > 0 && !verify(base_ + lastOffset)) {
+                --blockCount_;
+                stepCount_ -= reinterpret_cast<detail::trace_block_header const *>(base_ + lastOffset)->count;
+                if (blockCount_ % detail::trace_index_stride == 0) {
+                    index_.pop_back();
+                }
+            }
+        }
+
+        bool valid_header(detail::trace_block_header const& h) const
+        {
+            std::uint32_t const nodeOpBits = h.nodeBits + 3u;
+            return h.count > 0 && h.count <= blockSteps_ && h.nodeBits <= 29
+                    && (h.resultBits <= detail::trace_max_packed_bits || h.resultBits == detail::trace_raw_bits)
+                    && h.size == sizeof(h) + detail::trace_column_size(h.count, nodeOpBits)
+                                    + detail::trace_column_size(h.count, h.resultBits);
+        }
+
+        static bool verify(unsigned char const * block)
+        {
+            detail::trace_block_header const * h = reinterpret_cast<detail::trace_block_header const *>(block);
+            std::size_t const skip = sizeof(h->checksum);
+            return detail::trace_checksum(block + skip, h->size - skip) == h->checksum;
+        }
+
+        detail::trace_block_header const * find_block(std::uint64_t block)
+        {
+            if (block == lastBlock_) {
+                return last_;
+            }
+            std::uint64_t offset = index_[static_cast<std::size_t>(block / detail::trace_index_stride)];
+            for (std::uint64_t b = block - block % detail::trace_index_stride; b < block; ++b) {
+                offset += reinterpret_cast<detail::trace_block_header const *>(base_ + offset)->size;
+                if (offset + sizeof(detail::trace_block_header) > mapSize_) {
+                    return nullptr;
+                }
+            }
+            auto const * h = reinterpret_cast<detail::trace_block_header const *>(base_ + offset);
+            if (!verified_[static_cast<std::size_t>(block)]) {
+                // the header of a complete file is trusted as its index is.
+                if (!valid_header(*h) || offset + h->size > mapSize_ || (verify_ && !verify(base_ + offset))) {
+                    return nullptr;
+                }
+                verified_[static_cast<std::size_t>(block)] = 1;
+            }
+            lastBlock_ = block;
+            last_ = h;
+            return h;
+        }
+
+        static calc_step_record decode(detail::trace_block_header const * h, std::uint64_t i)
+        {
+            unsigned char const * const nodes = reinterpret_cast<unsigned char const *>(h + 1);
+            std::uint32_t const nodeOpBits = h->nodeBits + 3u;
+            std::uint64_t const nodeOp = detail::load_bits(nodes, i, nodeOpBits);
+            unsigned char const * const results = nodes + detail::trace_column_size(h->count, nodeOpBits);
+            std::uint64_t result = h->resultBase;
+            if (h->resultBits == detail::trace_raw_bits) {
+                result = detail::load_word(results + i * 8);
+            } else if (h->resultBits != 0) {
+                result += detail::load_bits(results, i, h->resultBits);
+            }
+            return calc_step_record::make(h->nodeBase + static_cast<std::uint32_t>(nodeOp >> 3),
+                                          static_cast<calc_op>(nodeOp & 7),
+                                          static_cast<calc_value_t>(result));
+        }
+
+        unsigned char const * base_ = nullptr;
+        std::size_t mapSize_ = 0;
+        std::uint32_t blockSteps_ = 0;
+        std::uint64_t stepCount_ = 0;
+        std::uint64_t blockCount_ = 0;
+        bool complete_ = false;
+        bool verify_ = true;
+        std::vector<std::uint64_t> index_;
+        std::vector<std::uint8_t> verified_;
+        std::uint64_t lastBlock_ = UINT64_MAX;
+        detail::trace_block_header const * last_ = nullptr;
+    };
+} // namespace algovisu
+#endif
+
+
+#endif  // ALGOVISU_CALC_TRACE_FILE_H
@@ -0,0 +1,406 @@
+#ifndef ALGOVISU_CALC_TREE_LAYOUT_H
+#define ALGOVISU_CALC_TREE_LAYOUT_H
+
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+
+
+namespace algovisu
+{
+    // The tidy layout of a calc_ast, by Reingold and Tilford.
+    //
+    // A node is at the depth of it, and at the middle of its two children.
+    // The subtrees are as near as the separation allows on every level, and
+    // a subtree is laid out the same wherever it is.
+    //
+    // A node is placed relative to its parent bottom-up, which is the stored
+    // order of the nodes, and then absolutely top-down, which is the reverse
+    // order. So there's no recursion. The subtrees of a node are separated
+    // by walking the right contour of the left one and the left contour of
+    // the right one down to the lower height. A contour goes on by the
+    // threads from the leaves where its subtree is shorter than the other
+    // one. Every node is walked in O(1) amortized, and the layout is O(n).
+    //
+    // The root is at x 0, and the x of the others may be negative.
+    //
+    // ex.)
+    //  calc_tree_layout layout;
+    //  layout.layout(ast);
+    //  for (std::uint32_t i = 0; i < ast.size(); ++i) {
+    //      draw(layout.x(i), layout.depth(i));
+    //  }
+    class calc_tree_layout
+    {
+    public:
+        explicit calc_tree_layout(double separation = 1.0)
+            : separation_(separation)
+        { }
+
+        // Lays out the whole ast.
+        void layout(calc_ast const& ast)
+        {
+            std::size_t const n = ast.size();
+            resize(n);
+            std::fill(parent_.begin(), parent_.end(), none);
+            for (std::uint32_t i = 0; i < n; ++i) {
+                place(ast, i);
+            }
+            if (n > 0) {
+                x_[n - 1] = 0;
+                depth_[n - 1] = 0;
+                position(ast, 0, static_cast<std::uint32_t>(n - 1));
+            }
+        }
+
+        // Lays out again after the subtree at [first, oldEnd) of the ast
+        // is replaced by the one at [first, newEnd), and the nodes after
+        // it are moved by newEnd - oldEnd.
+        //
+        // The new subtree and its ancestors are laid out again, with the
+        // contours of the siblings walked, and the siblings are moved if
+        // their parents spread. The nodes after the subtree are moved in
+        // the arrays though, like calc_document moves them.
+        void update(calc_ast const& ast, std::uint32_t first, std::uint32_t oldEnd, std::uint32_t newEnd)
+        {
+            std::uint32_t const oldParent = parent_[oldEnd - 1];
+            // the threads from the leaves which are on the contours no more.
+            for (std::uint32_t a = oldParent; a != none; a = parent_[a]) {
+                if (threaded_[a] != none) {
+                    thread_[threaded_[a]] = none;
+                    threaded_[a] = none;
+                }
+            }
+            if (newEnd != oldEnd) {
+                splice(oldEnd, newEnd);
+            }
+
+            auto const moved = [=](std::uint32_t i) {
+                return i == none || i < oldEnd ? i : static_cast<std::uint32_t>(i + newEnd - oldEnd);
+            };
+            std::uint32_t const root = newEnd - 1;
+            std::uint32_t const parent = moved(oldParent);
+            for (std::uint32_t i = first; i < newEnd; ++i) {
+                parent_[i] = none;
+                place(ast, i);
+            }
+            parent_[root] = parent;
+
+            path_.clear();
+            for (std::uint32_t a = parent; a != none; a = parent_[a]) {
+                place(ast, a);
+                path_.push_back(a);
+            }
+            // from the root down, the sibling subtrees are moved as their parents are.
+            if (parent == none) {
+                x_[root] = 0;
+                depth_[root] = 0;
+            } else {
+                x_[path_.back()] = 0;
+                for (std::size_t k = path_.size(); k-- > 0; ) {
+                    std::uint32_t const a = path_[k];
+                    std::uint32_t const next = k > 0 ? path_[k - 1] : root;
+                    calc_node const& node = ast.nodes[a];
+                    std::uint32_t const sibling = node.lhs == next ? node.rhs : node.lhs;
+                    x_[next] = x_[a] + dx_[next];
+                    double const shift = x_[a] + dx_[sibling] - x_[sibling];
+                    if (shift != 0) {
+                        for (std::uint32_t i = sibling + 1 - size_[sibling]; i <= sibling; ++i) {
+                            x_[i] += shift;
+                        }
+                    }
+                }
+                depth_[root] = depth_[parent] + 1;
+            }
+            position(ast, first, root);
+        }
+
+        // The coordinates of the nodes, by the index.
+        std::vector<double> const& xs() const { return x_; }
+        std::vector<std::uint32_t> const& depths() const { return depth_; }
+
+        double x(std::uint32_t node) const { return x_[node]; }
+        std::uint32_t depth(std::uint32_t node) const { return depth_[node]; }
+
+        // the levels below a node.
+        std::uint32_t height(std::uint32_t node) const { return height_[node]; }
+
+        double separation() const { return separation_; }
+
+    private:
+        static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+        void resize(std::size_t n)
+        {
+            if (dx_.capacity() < n) {
+                // with a room for the larger subtrees by update().
+                reserve(n + n / 16);
+            }
+            dx_.resize(n);
+            thread_.resize(n);
+            threadDx_.resize(n);
+            threaded_.resize(n);
+            leftmost_.resize(n);
+            rightmost_.resize(n);
+            leftX_.resize(n);
+            rightX_.resize(n);
+            height_.resize(n);
+            size_.resize(n);
+            parent_.resize(n);
+            x_.resize(n);
+            depth_.resize(n);
+        }
+
+        void reserve(std::size_t n)
+        {
+            dx_.reserve(n);
+            thread_.reserve(n);
+            threadDx_.reserve(n);
+            threaded_.reserve(n);
+            leftmost_.reserve(n);
+            rightmost_.reserve(n);
+            leftX_.reserve(n);
+            rightX_.reserve(n);
+            height_.reserve(n);
+            size_.reserve(n);
+            parent_.reserve(n);
+            x_.reserve(n);
+            depth_.reserve(n);
+        }
+
+        // Places the children of a node relative to it, and finds its
+        // extreme nodes, which are the leftmost and the rightmost of the
+        // lowest level of it.
+        void place(calc_ast const& ast, std::uint32_t v)
+        {
+            calc_node const& node = ast.nodes[v];
+            thread_[v] = none;
+            threaded_[v] = none;
+            if (node.op == calc_op::literal) {
+                leftmost_[v] = rightmost_[v] = v;
+                leftX_[v] = rightX_[v] = 0;
+                height_[v] = 0;
+                size_[v] = 1;
+                return;
+            }
+            std::uint32_t const lhs = node.lhs;
+            std::uint32_t const rhs = node.rhs;
+            calc_node const * const nodes = ast.nodes.data();
+
+            // the walk down the facing contours, with x relative to each subtree.
+            std::uint32_t l = lhs, r = rhs;
+            double lx = 0, rx = 0;
+            double d = separation_;
+            for (;;) {
+                std::uint32_t const nl = next_right(nodes, l);
+                std::uint32_t const nr = next_left(nodes, r);
+                if (nl == none || nr == none) {
+                    break;
+                }
+                lx += step(nodes, l, nl);
+                rx += step(nodes, r, nr);
+                l = nl;
+                r = nr;
+                d = std::max(d, lx - rx + separation_);
+            }
+            double const half = d / 2;
+            dx_[lhs] = -half;
+            dx_[rhs] = half;
+
+            // the shorter subtree's contour goes on along the other one.
+            std::uint32_t const hl = height_[lhs];
+            std::uint32_t const hr = height_[rhs];
+            if (hl > hr) {
+                std::uint32_t const t = next_right(nodes, l);
+                std::uint32_t const leaf = rightmost_[rhs];
+                thread_[leaf] = t;
+                threadDx_[leaf] = (lx + step(nodes, l, t) - half) - (rightX_[rhs] + half);
+                threaded_[v] = leaf;
+            } else if (hr > hl) {
+                std::uint32_t const t = next_left(nodes, r);
+                std::uint32_t const leaf = leftmost_[lhs];
+                thread_[leaf] = t;
+                threadDx_[leaf] = (rx + step(nodes, r, t) + half) - (leftX_[lhs] - half);
+                threaded_[v] = leaf;
+            }
+            if (hl >= hr) {
+                leftmost_[v] = leftmost_[lhs];
+                leftX_[v] = leftX_[lhs] - half;
+            } else {
+                leftmost_[v] = leftmost_[rhs];
+                leftX_[v] = leftX_[rhs] + half;
+            }
+            if (hr >= hl) {
+                rightmost_[v] = rightmost_[rhs];
+                rightX_[v] = rightX_[rhs] + half;
+            } else {
+                rightmost_[v] = rightmost_[lhs];
+                rightX_[v] = rightX_[lhs] - half;
+            }
+            height_[v] = std::max(hl, hr) + 1;
+            size_[v] = size_[lhs] + size_[rhs] + 1;
+            parent_[lhs] = v;
+            parent_[rhs] = v;
+        }
+
+        std::uint32_t next_left(calc_node const * nodes, std::uint32_t v) const
+        {
+            return nodes[v].op != calc_op::literal ? nodes[v].lhs : thread_[v];
+        }
+
+        std::uint32_t next_right(calc_node const * nodes, std::uint32_t v) const
+        {
+            return nodes[v].op != calc_op::literal ? nodes[v].rhs : thread_[v];
+        }
+
+        // the x of the next node on a contour, relative to the node.
+        double step(calc_node const * nodes, std::uint32_t v, std::uint32_t next) const
+        {
+            return nodes[v].op != calc_op::literal ? dx_[next] : threadDx_[v];
+        }
+
+        // The absolute coordinates of [first, root), from the root's.
+        void position(calc_ast const& ast, std::uint32_t first, std::uint32_t root)
+        {
+            calc_node const * const nodes = ast.nodes.data();
+            for (std::uint32_t i = root + 1; i-- > first; ) {
+                if (nodes[i].op != calc_op::literal) {
+                    std::uint32_t const lhs = nodes[i].lhs;
+                    std::uint32_t const rhs = nodes[i].rhs;
+                    x_[lhs] = x_[i] + dx_[lhs];
+                    x_[rhs] = x_[i] + dx_[rhs];
+                    depth_[lhs] = depth_[rhs] = depth_[i] + 1;
+                }
+            }
+        }
+
+        // Makes the room of the new subtree, and moves the node indices after it.
+        void splice(std::uint32_t oldEnd, std::uint32_t newEnd)
+        {
+            auto resize_range = [=](auto & v) {
+                if (newEnd > oldEnd) {
+                    v.insert(v.begin() + oldEnd, newEnd - oldEnd, typename std::decay_t<decltype(v)>::value_type{});
+                } else {
+                    v.erase(v.begin() + newEnd, v.begin() + oldEnd);
+                }
+            };
+            resize_range(dx_);
+            resize_range(thread_);
+            resize_range(threadDx_);
+            resize_range(threaded_);
+            resize_range(leftmost_);
+            resize_range(rightmost_);
+            resize_range(leftX_);
+            resize_range(rightX_);
+            resize_range(height_);
+            resize_range(size_);
+            resize_range(parent_);
+            resize_range(x_);
+            resize_range(depth_);
+
+            // A node before the subtree refers to the nodes of its own subtree,
+            // which are before the subtree too, but its parent. The parents
+            // after the subtree are its ancestors, which are placed again.
+            std::uint32_t const delta = newEnd - oldEnd;
+            auto move_indices = [=](std::vector<std::uint32_t> & v) {
+                for (std::size_t i = newEnd; i < v.size(); ++i) {
+                    std::uint32_t & index = v[i];
+                    if (index != none && index >= oldEnd) {
+                        index += delta;
+                    }
+                }
+            };
+            move_indices(thread_);
+            move_indices(threaded_);
+            move_indices(leftmost_);
+            move_indices(rightmost_);
+            move_indices(parent_);
+        }
+
+        double separation_;
+
+        // relative to the parent, by the bottom-up pass.
+        std::vector<double> dx_;
+        std::vector<std::uint32_t> thread_;     // of a leaf, the next node on its contour.
+        std::vector<double> threadDx_;
+        std::vector<std::uint32_t> threaded_;   // the leaf a node has threaded.
+        std::vector<std::uint32_t> leftmost_;
+        std::vector<std::uint32_t> rightmost_;
+        std::vector<double> leftX_;
+        std::vector<double> rightX_;
+        std::vector<std::uint32_t> height_;
+        std::vector<std::uint32_t> size_;
+        std::vector<std::uint32_t> parent_;
+
+        // absolute, by the top-down pass.
+        std::vector<double> x_;
+        std::vector<std::uint32_t> depth_;
+
+        std::vector<std::uint32_t> path_;
+    };
+
+    // A window on a calc_tree_layout, with the x and the depth of the layout
+    // at its top-left corner, and its size in pixels.
+    struct calc_viewport
+    {
+        double left = 0;
+        double top = 0;
+        double width = 1920;
+        double height = 1080;
+
+        // the pixels per a unit of the layout, a level or the separation.
+        double scale = 24;
+
+        // A subtree narrower than this in pixels is drawn as one shape.
+        // 0 draws every node.
+        double minPixels = 0;
+
+        double right() const { return left + width / scale; }
+        double bottom() const { return top + height / scale; }
+    };
+
+    // The float at or below v, and at or above it, for the x bounds kept
+    // in float. A float can't hold a half unit from |x| >= 2^22, so
+    // the bounds are rounded outward rather than to the nearest.
+    inline float calc_float_below(double v)
+    {
+        float const f = static_cast<float>(v);
+        return f > v ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    inline float calc_float_above(double v)
+    {
+        float const f = static_cast<float>(v);
+        return f < v ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    // The viewport of the given size which shows the whole tree.
+    inline calc_viewport fit_calc_viewport(calc_ast const& ast, calc_tree_layout const& layout,
+                                           double width, double height)
+    {
+        calc_viewport v;
+        v.width = width;
+        v.height = height;
+        if (ast.empty()) {
+            return v;
+        }
+        auto const xs = std::minmax_element(layout.xs().begin(), layout.xs().end());
+        // the half units around, for the radius of the nodes.
+        double const w = *xs.second - *xs.first + 1;
+        double const h = layout.height(ast.root()) + 1.0;
+        v.scale = std::min(width / w, height / h);
+        v.left = *xs.first - 0.5;
+        v.top = -0.5;
+        return v;
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_TREE_LAYOUT_H
@@ -0,0 +1,412 @@
+#ifndef ALGOVISU_CALC_TREE_LOD_H
+#define ALGOVISU_CALC_TREE_LOD_H
+
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "calc_ast.h"
+#include "calc_tree_layout.h"
+
+
+namespace algovisu
+{
+    struct calc_subtree_summary
+    {
+        std::uint32_t count;
+        std::uint32_t depth;
+        std::uint32_t height;
+        std::array<std::uint32_t, 4> ops;   // of + - * and /.
+        calc_value_t minLiteral;
+        calc_value_t maxLiteral;
+        double minX;
+        double maxX;
+    };
+
+    // A node to draw, or a subtree to draw as one shape.
+    struct calc_lod_item
+    {
+        static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+        std::uint32_t node;
+        std::uint32_t parent;   // for the edge to it, or none for the root.
+        bool summary;
+    };
+
+    // The level of detail of a laid out calc_ast, for drawing a huge tree
+    // at any zoom.
+    //
+    // build() summarizes every subtree in a pass over the nodes, bottom-up,
+    // with its bounds in the layout, and sorts the nodes into the levels.
+    // query() finds the items to draw in a viewport by expanding the widest
+    // subtrees first, by the powers of two of the widths. A subtree out of
+    // the viewport is dropped, and a subtree narrower than minPixels, or
+    // any subtree once maxItems is reached, is one summary. So the items
+    // are maxItems at most.
+    //
+    // The expanding starts at the nodes of the first level in the viewport,
+    // which are found by x in the level, or at their narrowest ancestors.
+    // The blocks of them across the viewport are found by a tree of the block
+    // bounds, as the subtrees of a level overlap in x where one is deeper.
+    // So the ancestors above the viewport are not walked, and the query is
+    // O(k log n) for the k subtrees it expands, whatever the width of the
+    // level is.
+    //
+    // NOTE: it's built again when the ast or the layout changes.
+    //
+    // ex.)
+    //  calc_tree_lod lod;
+    //  lod.build(ast, layout);
+    //  std::vector<calc_lod_item> items;
+    //  lod.query(viewport, 10000, items);
+    //  for (calc_lod_item const& item : items) {
+    //      item.summary ? draw_subtree(lod.summary(item.node)) : draw_node(item.node);
+    //  }
+    class calc_tree_lod
+    {
+    public:
+        void build(calc_ast const& ast, calc_tree_layout const& layout)
+        {
+            std::size_t const n = ast.size();
+            nodes_.resize(n);
+            parent_.assign(n, calc_lod_item::none);
+            ops_.resize(n);
+            minLiteral_.resize(n);
+            maxLiteral_.resize(n);
+            calc_node const * const nodes = ast.nodes.data();
+            double const * const xs = layout.xs().data();
+            for (std::uint32_t i = 0; i < n; ++i) {
+                calc_node const& node = nodes[i];
+                lod_node & v = nodes_[i];
+                v.x = xs[i];
+                v.depth = layout.depth(i);
+                v.height = layout.height(i);
+                v.lhs = node.lhs;
+                v.rhs = node.rhs;
+                if (node.op == calc_op::literal) {
+                    // the half units around, for the nodes drawn, rounded outward.
+                    v.minX = calc_float_below(xs[i] - 0.5);
+                    v.maxX = calc_float_above(xs[i] + 0.5);
+                    ops_[i] = op_counts{};
+                    minLiteral_[i] = maxLiteral_[i] = node.value;
+                    continue;
+                }
+                std::uint32_t const lhs = node.lhs;
+                std::uint32_t const rhs = node.rhs;
+                parent_[lhs] = parent_[rhs] = i;
+                v.minX = std::min(nodes_[lhs].minX, nodes_[rhs].minX);
+                v.maxX = std::max(nodes_[lhs].maxX, nodes_[rhs].maxX);
+                for (std::size_t k = 0; k < 4; ++k) {
+                    ops_[i][k] = ops_[lhs][k] + ops_[rhs][k];
+                }
+                ++ops_[i][static_cast<std::size_t>(node.op) - 1];
+                minLiteral_[i] = std::min(minLiteral_[lhs], minLiteral_[rhs]);
+                maxLiteral_[i] = std::max(maxLiteral_[lhs], maxLiteral_[rhs]);
+            }
+            build_levels();
+        }
+
+        calc_subtree_summary summary(std::uint32_t node) const
+        {
+            op_counts const& ops = ops_[node];
+            return calc_subtree_summary{
+                (ops[0] + ops[1] + ops[2] + ops[3]) * 2 + 1,
+                nodes_[node].depth,
+                nodes_[node].height,
+                ops,
+                minLiteral_[node],
+                maxLiteral_[node],
+                nodes_[node].minX,
+                nodes_[node].maxX
+            };
+        }
+
+        // The items in the viewport, maxItems at most, with the nodes before
+        // their children.
+        void query(calc_viewport const& viewport, std::size_t maxItems, std::vector<calc_lod_item> & items)
+        {
+            items.clear();
+            for (std::vector<entry> & bucket : buckets_) {
+                bucket.clear();
+            }
+            expanded_ = 0;
+            if (nodes_.empty() || maxItems == 0) {
+                return;
+            }
+            lod_node const * const nodes = nodes_.data();
+            double const left = viewport.left - 0.5;
+            double const right = viewport.right() + 0.5;
+            double const top = viewport.top - 0.5;
+            double const bottom = viewport.bottom() + 0.5;
+            double const minWidth = viewport.minPixels / viewport.scale;
+
+            std::size_t waiting = 0;
+            std::size_t widest = 0;
+            auto const push = [&](std::uint32_t i, std::uint32_t parent) {
+                lod_node const& v = nodes[i];
+                if (v.minX <= right && v.maxX >= left && v.depth <= bottom && v.depth + v.height >= top) {
+                    float const width = v.maxX - v.minX;
+                    std::size_t const b = bucket_of(width);
+                    buckets_[b].push_back(entry{ width, i, parent });
+                    widest = std::max(widest, b);
+                    ++waiting;
+                    if (v.height > 0) {
+                        prefetch(nodes + v.lhs);
+                        prefetch(nodes + v.rhs);
+                    }
+                }
+            };
+            if (!seed(left, right, top, bottom, minWidth, maxItems, push)) {
+                for (std::vector<entry> & bucket : buckets_) {
+                    bucket.clear();
+                }
+                waiting = 0;
+                push(static_cast<std::uint32_t>(nodes_.size() - 1), calc_lod_item::none);
+            }
+            while (waiting > 0) {
+                while (buckets_[widest].empty()) {
+                    --widest;
+                }
+                entry const e = buckets_[widest].back();
+                buckets_[widest].pop_back();
+                --waiting;
+                lod_node const& node = nodes[e.node];
+                bool const inside = node.x >= left && node.x <= right && node.depth >= top && node.depth <= bottom;
+                if (node.height == 0) {
+                    if (inside) {
+                        items.push_back(calc_lod_item{ e.node, e.parent, false });
+                    }
+                    continue;
+                }
+                // the node and its children, as the other items wait.
+                if (e.width < minWidth || items.size() + waiting + 3 > maxItems) {
+                    items.push_back(calc_lod_item{ e.node, e.parent, true });
+                    continue;
+                }
+                ++expanded_;
+                if (inside) {
+                    items.push_back(calc_lod_item{ e.node, e.parent, false });
+                }
+                push(node.lhs, e.node);
+                push(node.rhs, e.node);
+            }
+        }
+
+        // the subtrees expanded by the last query.
+        std::size_t last_expanded() const { return expanded_; }
+
+        std::size_t memory_bytes() const
+        {
+            return nodes_.capacity() * sizeof(lod_node) + parent_.capacity() * sizeof(std::uint32_t)
+                 + ops_.capacity() * sizeof(op_counts)
+                 + minLiteral_.capacity() * sizeof(calc_value_t) + maxLiteral_.capacity() * sizeof(calc_value_t)
+                 + (levelStart_.capacity() + levelNodes_.capacity()) * sizeof(std::uint32_t)
+                 + (treeMinX_.capacity() + treeMaxX_.capacity()) * sizeof(float);
+        }
+
+    private:
+        using op_counts = std::array<std::uint32_t, 4>;
+
+        // What a query reads of a node, together.
+        struct lod_node
+        {
+            float minX;
+            float maxX;
+            double x;
+            std::uint32_t depth;
+            std::uint32_t height;
+            std::uint32_t lhs;
+            std::uint32_t rhs;
+        };
+
+        struct entry
+        {
+            float width;
+            std::uint32_t node;
+            std::uint32_t parent;
+        };
+
+        static constexpr std::size_t block_size = 64;
+
+        // The nodes by the depth, and by x in a level, with the bounds of the
+        // blocks of them. A block may be across two levels.
+        //
+        // The bounds are the leaves of a tree, from the root at 1, of the
+        // least minX and the greatest maxX of the blocks under a node.
+        void build_levels()
+        {
+            std::size_t const n = nodes_.size();
+            std::size_t const levels = n > 0 ? nodes_.back().height + 1 : 0;
+            levelStart_.assign(levels + 1, 0);
+            for (lod_node const& v : nodes_) {
+                ++levelStart_[v.depth + 1];
+            }
+            for (std::size_t d = 0; d < levels; ++d) {
+                levelStart_[d + 1] += levelStart_[d];
+            }
+            // the nodes of a level are post-ordered from the left.
+            levelNodes_.resize(n);
+            std::vector<std::uint32_t> next(levelStart_.begin(), levelStart_.end());
+            for (std::uint32_t i = 0; i < n; ++i) {
+                levelNodes_[next[nodes_[i].depth]++] = i;
+            }
+            std::size_t const blocks = (n + block_size - 1) / block_size;
+            leaves_ = 1;
+            while (leaves_ < blocks) {
+                leaves_ *= 2;
+            }
+            treeMinX_.assign(leaves_ * 2, std::numeric_limits<float>::max());
+            treeMaxX_.assign(leaves_ * 2, std::numeric_limits<float>::lowest());
+            for (std::size_t p = 0; p < n; ++p) {
+                lod_node const& v = nodes_[levelNodes_[p]];
+                std::size_t const t = leaves_ + p / block_size;
+                treeMinX_[t] = std::min(treeMinX_[t], v.minX);
+                treeMaxX_[t] = std::max(treeMaxX_[t], v.maxX);
+            }
+            for (std::size_t t = leaves_ - 1; t > 0; --t) {
+                treeMinX_[t] = std::min(treeMinX_[t * 2], treeMinX_[t * 2 + 1]);
+                treeMaxX_[t] = std::max(treeMaxX_[t * 2], treeMaxX_[t * 2 + 1]);
+            }
+        }
+
+        // The first block in [first, last) of a tree node hit, or last.
+        // It descends the nodes hit only, so it's O(log n).
+        template <typename Hit>
+        std::size_t find_block(std::size_t first, std::size_t last, Hit const& hit) const
+        {
+            return find_block(1, 0, leaves_, first, last, hit);
+        }
+
+        template <typename Hit>
+        std::size_t find_block(std::size_t t, std::size_t from, std::size_t to,
+                               std::size_t first, std::size_t last, Hit const& hit) const
+        {
+            if (to <= first || last <= from || !hit(t)) {
+                return last;
+            }
+            if (to - from == 1) {
+                return from;
+            }
+            std::size_t const middle = (from + to) / 2;
+            std::size_t const found = find_block(t * 2, from, middle, first, last, hit);
+            return found != last ? found : find_block(t * 2 + 1, middle, to, first, last, hit);
+        }
+
+        // Pushes the subtrees of the first level in the viewport, or their
+        // narrowest ancestors above, which are the ones the expanding from
+        // the root would reach. false if they're more than maxItems.
+        template <typename Push>
+        bool seed(double left, double right, double top, double bottom, double minWidth,
+                  std::size_t maxItems, Push const& push)
+        {
+            std::size_t const levels = levelStart_.size() - 1;
+            double const first = std::ceil(std::max(top, 0.0));
+            if (first >= levels || first > bottom) {
+                return true;
+            }
+            std::size_t const d = static_cast<std::size_t>(first);
+            std::uint32_t const * const level = levelNodes_.data();
+            std::size_t const begin = levelStart_[d];
+            std::size_t const end = levelStart_[d + 1];
+            std::size_t const a = static_cast<std::size_t>(
+                std::lower_bound(level + begin, level + end, left,
+                                 [&](std::uint32_t i, double x) { return nodes_[i].x < x; }) - level);
+            std::size_t const b = static_cast<std::size_t>(
+                std::upper_bound(level + a, level + end, right,
+                                 [&](double x, std::uint32_t i) { return x < nodes_[i].x; }) - level);
+
+            std::size_t pushed = 0;
+            std::uint32_t lastCut = calc_lod_item::none;
+            std::uint32_t lastCutFirst = 0;
+            auto const seed_node = [&](std::uint32_t v) {
+                if (lastCut != calc_lod_item::none && v >= lastCutFirst && v <= lastCut) {
+                    return;
+                }
+                std::uint32_t u = v;
+                for (std::uint32_t p = parent_[u]; p != calc_lod_item::none && width_of(p) < minWidth; p = parent_[u]) {
+                    u = p;
+                }
+                if (u != v) {
+                    lastCut = u;
+                    lastCutFirst = u + 1 - summary(u).count;
+                }
+                push(u, parent_[u]);
+                ++pushed;
+            };
+            // the subtrees from the left or the right into the viewport, in
+            // the blocks of them.
+            auto const across = [&](std::size_t from, std::size_t to, auto const& hit, auto const& overlaps) {
+                std::size_t const last = (to + block_size - 1) / block_size;
+                for (std::size_t k = find_block(from / block_size, last, hit); k < last && pushed <= maxItems;
+                     k = find_block(k + 1, last, hit)) {
+                    std::size_t const stop = std::min(to, (k + 1) * block_size);
+                    for (std::size_t p = std::max(from, k * block_size); p < stop && pushed <= maxItems; ++p) {
+                        if (overlaps(nodes_[level[p]])) {
+                            seed_node(level[p]);
+                        }
+                    }
+                }
+            };
+            if (begin < a) {
+                across(begin, a,
+                       [&](std::size_t t) { return treeMaxX_[t] >= left; },
+                       [&](lod_node const& v) { return v.maxX >= left; });
+            }
+            for (std::size_t p = a; p < b && pushed <= maxItems; ++p) {
+                seed_node(level[p]);
+            }
+            if (b < end) {
+                across(b, end,
+                       [&](std::size_t t) { return treeMinX_[t] <= right; },
+                       [&](lod_node const& v) { return v.minX <= right; });
+            }
+            return pushed <= maxItems;
+        }
+
+        // The children of a subtree waiting are read when it's expanded,
+        // which is a cache miss in a huge tree otherwise.
+        static void prefetch(void const * p)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(p);
+#else
+            (void)p;
+#endif
+        }
+
+        float width_of(std::uint32_t i) const { return nodes_[i].maxX - nodes_[i].minX; }
+
+        // by the power of two of the width, as a child is narrower than its parent.
+        static constexpr std::size_t bucket_count = 64;
+
+        static std::size_t bucket_of(float width)
+        {
+            int const e = std::ilogb(std::max(width, 1.0f));
+            return static_cast<std::size_t>(std::min(e, static_cast<int>(bucket_count) - 1));
+        }
+
+        // of the subtrees, by the root.
+        std::vector<lod_node> nodes_;
+        std::vector<std::uint32_t> parent_;
+        std::vector<op_counts> ops_;
+        std::vector<calc_value_t> minLiteral_;
+        std::vector<calc_value_t> maxLiteral_;
+
+        std::vector<std::uint32_t> levelStart_;
+        std::vector<std::uint32_t> levelNodes_;
+        std::vector<float> treeMinX_;
+        std::vector<float> treeMaxX_;
+        std::size_t leaves_ = 0;
+
+        std::array<std::vector<entry>, bucket_count> buckets_;
+        std::size_t expanded_ = 0;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CALC_TREE_LOD_H
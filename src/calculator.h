@@ -2,9 +2,16 @@
 #define ALGOVISU_CACULATOR_H
 
 
+#include <cstdint>
+#include <vector>
+
+#include <boost/iterator/iterator_adaptor.hpp>
 #include <boost/spirit/include/lex_lexertl.hpp>
 #include <boost/spirit/include/qi.hpp>
 
+#include "calc_ast.h"
+#include "rule_profiler.h"
+
 
 namespace algovisu
 {
@@ -32,44 +39,238 @@ namespace algovisu
         lex::token_def<> white_space_;
     };
 
+    // The tokens lexed by calc_token, without the white spaces.
     template <typename Lexer>
-    struct calc_grammar
-            : qi::grammar<
-                    typename Lexer::iterator_type,
-                    qi::in_state_skipper<typename Lexer::lexer_def>
-              >
+    using calc_token_buffer = std::vector<typename Lexer::token_type>;
+
+    // Lexes the input, and calls f with every token but the white spaces
+    // while it returns true.
+    // It returns false if there's a character which is not a calc token.
+    //
+    // NOTE: this does the same thing as qi::in_state("WS")[tokens.self]
+    //          does for calc_grammar. The whitespaces are skipped in the WS state,
+    //          and the state of a token is checked because the lexer iterator
+    //          reads one token ahead in the previous state.
+    template <typename Lexer, typename F>
+    bool lex_calc_each(Lexer const& tokens, char const * pBegin, char const * pEnd, F && f)
+    {
+        auto iter = tokens.begin(pBegin, pEnd);
+        auto end = tokens.end();
+        std::size_t const wsState = iter.map_state("WS");
+        for (;;) {
+            std::size_t const state = iter.set_state(wsState);
+            while (iter != end && lex::lexertl::token_is_valid(*iter) && iter->state() == wsState) {
+                ++iter;
+            }
+            iter.set_state(state);
+            if (iter == end) {
+                return true;
+            }
+            if (!lex::lexertl::token_is_valid(*iter)) {
+                return false;
+            }
+            if (!f(*iter)) {
+                return true;
+            }
+            ++iter;
+        }
+    }
+
+    // Lexes the whole input into the token buffer.
+    // It returns false if there's a character which is not a calc token.
+    template <typename Lexer>
+    bool lex_calc(Lexer const& tokens,
+                  char const * pBegin, char const * pEnd,
+                  calc_token_buffer<Lexer> & buffer)
+    {
+        return lex_calc_each(tokens, pBegin, pEnd, [&buffer](auto const& token) {
+            buffer.push_back(token);
+            return true;
+        });
+    }
+
+    // The iterator over calc_token_buffer for calc_buffer_grammar.
+    //
+    // NOTE: the token parsers of Spirit.Lex need base_iterator_type
+    //          to expose the matched input range as their attribute.
+    template <typename Token>
+    class token_buffer_iterator
+            : public boost::iterator_adaptor<token_buffer_iterator<Token>, Token const *>
+    {
+    public:
+        using base_iterator_type = typename Token::iterator_type;
+
+        token_buffer_iterator() = default;
+
+        explicit token_buffer_iterator(Token const * p)
+            : token_buffer_iterator::iterator_adaptor_(p)
+        { }
+    };
+
+    namespace detail
+    {
+        // Builds the post-ordered calc_ast from the semantic actions of the grammar.
+        // The operands stack holds the root nodes of the parsed sub-expressions.
+        struct calc_ast_builder
+        {
+            void reset(calc_ast * ast)
+            {
+                ast_ = ast;
+                operands_.clear();
+            }
+
+            bool done() const
+            {
+                return ast_ == nullptr || operands_.size() == 1;
+            }
+
+            calc_ast * ast_ = nullptr;
+            std::vector<std::uint32_t> operands_;
+        };
+
+        struct push_literal
+        {
+            template <typename Range, typename Context>
+            void operator()(Range const& r, Context &, bool &) const
+            {
+                if (builder_->ast_) {
+                    calc_value_t const v = to_calc_value(std::begin(r), std::end(r));
+                    builder_->operands_.push_back(builder_->ast_->add_literal(v));
+                }
+            }
+
+            calc_ast_builder * builder_;
+        };
+
+        struct push_operator
+        {
+            template <typename Attribute, typename Context>
+            void operator()(Attribute const&, Context &, bool &) const
+            {
+                if (builder_->ast_) {
+                    auto & operands = builder_->operands_;
+                    std::uint32_t const rhs = operands.back();
+                    operands.pop_back();
+                    operands.back() = builder_->ast_->add_operator(op_, operands.back(), rhs);
+                }
+            }
+
+            calc_ast_builder * builder_;
+            calc_op op_;
+        };
+    } // namespace detail
+
+    // Profiler is one of the instrumentation policies in rule_profiler.h.
+    // With the default no_rule_profiler, the grammar is not instrumented at all.
+    //
+    // The grammar builds a calc_ast while parsing if build_into() is given one.
+    // So a grammar object should be used by one thread at a time.
+    template <typename Iterator, typename Skipper, typename Profiler = no_rule_profiler>
+    struct basic_calc_grammar : qi::grammar<Iterator, Skipper>
     {
         template <typename TokenDef>
-        calc_grammar(TokenDef const& tok)
-            : calc_grammar::base_type(additive_expr_)
+        basic_calc_grammar(TokenDef const& tok)
+            : basic_calc_grammar::base_type(additive_expr_)
         {
             // NOTE: rules are defined from lowest priority to highest priority.
 
             using qi::char_;
+            using detail::push_operator;
 
             additive_expr_ = multiplicative_expr_
                                 >> *(
-                                        char_('+') >> multiplicative_expr_
-                                    |   char_('-') >> multiplicative_expr_
+                                        char_('+') >> multiplicative_expr_[push_operator{ &builder_, calc_op::add }]
+                                    |   char_('-') >> multiplicative_expr_[push_operator{ &builder_, calc_op::sub }]
                                     );
 
             multiplicative_expr_ = factor_
                                     >> *(
-                                            char_('*') >> factor_
-                                        |   char_('/') >> factor_
+                                            char_('*') >> factor_[push_operator{ &builder_, calc_op::mul }]
+                                        |   char_('/') >> factor_[push_operator{ &builder_, calc_op::div }]
                                         );
 
-            factor_ = tok.decimal_integer_
+            factor_ = tok.decimal_integer_[detail::push_literal{ &builder_ }]
                             | '(' >> additive_expr_ >> ')';
+
+            Profiler::attach(additive_expr_, "additive_expr_");
+            Profiler::attach(multiplicative_expr_, "multiplicative_expr_");
+            Profiler::attach(factor_, "factor_");
         }
 
-        using iterator_t = typename Lexer::iterator_type;
-        using skipper_t = qi::in_state_skipper<typename Lexer::lexer_def>;
+        // The nodes of the next parsed expression will be appended to the ast.
+        // Pass nullptr to just recognize the expressions.
+        void build_into(calc_ast * ast)
+        {
+            builder_.reset(ast);
+        }
+
+        // true if the AST of the last parsed expression is complete.
+        bool built() const
+        {
+            return builder_.done();
+        }
+
+        using iterator_t = Iterator;
+        using skipper_t = Skipper;
 
         qi::rule<iterator_t, skipper_t> additive_expr_;
         qi::rule<iterator_t, skipper_t> multiplicative_expr_;
         qi::rule<iterator_t, skipper_t> factor_;
+
+    private:
+        detail::calc_ast_builder builder_;
     };
+
+    // The grammar over the lexer iterators, with the WS state skipper.
+    template <typename Lexer, typename Profiler = no_rule_profiler>
+    struct calc_grammar
+            : basic_calc_grammar<
+                    typename Lexer::iterator_type,
+                    qi::in_state_skipper<typename Lexer::lexer_def>,
+                    Profiler
+              >
+    {
+        using calc_grammar::basic_calc_grammar::basic_calc_grammar;
+    };
+
+    // The grammar over the calc_token_buffer lexed by lex_calc().
+    // The whitespaces are already removed, so there's no skipper.
+    template <typename Lexer, typename Profiler = no_rule_profiler>
+    struct calc_buffer_grammar
+            : basic_calc_grammar<
+                    token_buffer_iterator<typename Lexer::token_type>,
+                    qi::unused_type,
+                    Profiler
+              >
+    {
+        using calc_buffer_grammar::basic_calc_grammar::basic_calc_grammar;
+    };
+
+    // Parses the tokens [pBegin, pEnd) of a token buffer and appends its nodes to the ast.
+    template <typename Lexer, typename Profiler>
+    bool parse_calc(calc_buffer_grammar<Lexer, Profiler> & grammar,
+                    typename Lexer::token_type const * pBegin,
+                    typename Lexer::token_type const * pEnd,
+                    calc_ast & ast)
+    {
+        using iterator_t = token_buffer_iterator<typename Lexer::token_type>;
+        iterator_t first(pBegin);
+        iterator_t last(pEnd);
+
+        grammar.build_into(&ast);
+        bool const r = qi::parse(first, last, grammar) && first == last && grammar.built();
+        grammar.build_into(nullptr);
+        return r;
+    }
+
+    // Parses the whole token buffer and appends its nodes to the ast.
+    template <typename Lexer, typename Profiler>
+    bool parse_calc(calc_buffer_grammar<Lexer, Profiler> & grammar,
+                    calc_token_buffer<Lexer> const& buffer,
+                    calc_ast & ast)
+    {
+        return parse_calc(grammar, buffer.data(), buffer.data() + buffer.size(), ast);
+    }
 } // namespace algovisu
 
 
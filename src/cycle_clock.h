@@ -0,0 +1,58 @@
+#ifndef ALGOVISU_CYCLE_CLOCK_H
+#define ALGOVISU_CYCLE_CLOCK_H
+
+
+#include <cstdint>
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define ALGOVISU_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define ALGOVISU_HAS_RDTSC 1
+#endif
+
+
+namespace algovisu
+{
+    // Returns a monotonic cycle count which is cheap enough
+    // to be read on every rule invocation.
+    //
+    // NOTE: on x86 this is the raw TSC. It's not serializing, so
+    //          a few instructions may be reordered around it.
+    //          On the other platforms, the steady clock's tick is used instead.
+    inline std::uint64_t read_cycle_counter()
+    {
+#if defined(ALGOVISU_HAS_RDTSC)
+        return __rdtsc();
+#else
+        return static_cast<std::uint64_t>(
+                    std::chrono::steady_clock::now().time_since_epoch().count()
+                );
+#endif
+    }
+
+    // The number of cycles per nanosecond, to convert the cycle counts
+    // into the wall clock time. It's measured once against the steady clock
+    // on the first call, which takes about 10ms.
+    inline double cycles_per_nanosecond()
+    {
+        static double const ratio = [] {
+            using clock_t = std::chrono::steady_clock;
+            auto const start = clock_t::now();
+            std::uint64_t const startCycles = read_cycle_counter();
+            auto now = start;
+            while (now - start < std::chrono::milliseconds(10)) {
+                now = clock_t::now();
+            }
+            std::uint64_t const cycles = read_cycle_counter() - startCycles;
+            double const ns = std::chrono::duration<double, std::nano>(now - start).count();
+            return cycles / ns;
+        }();
+        return ratio;
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_CYCLE_CLOCK_H
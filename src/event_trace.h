@@ -0,0 +1,551 @@
+#ifndef ALGOVISU_EVENT_TRACE_H
+#define ALGOVISU_EVENT_TRACE_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include <boost/io/ios_state.hpp>
+
+#include "cycle_clock.h"
+#include "thread_slots.h"
+
+
+namespace algovisu
+{
+    // What to do when a thread's trace buffer is full.
+    //
+    // drop_newest keeps the recorded events until they are flushed and
+    // drops the new ones. drop_oldest overwrites the oldest events, so the
+    // memory is bounded and the latest events are always kept.
+    // It drops 1/16 of the buffer at once when it's full.
+    enum class trace_overflow : std::uint8_t
+    {
+        drop_newest,
+        drop_oldest
+    };
+
+    enum class trace_phase : std::uint8_t
+    {
+        begin = 'B',
+        end = 'E'
+    };
+
+    struct trace_record
+    {
+        std::uint64_t ts;       // TSC cycles
+        std::uint16_t name;     // interned by trace_name()
+        trace_phase phase;
+        std::uint32_t arg;
+    };
+
+    namespace detail
+    {
+        // A single-producer ring of the trace events of a thread.
+        //
+        // The owner thread pushes at the head. The flushing thread pops at
+        // the tail. In drop_oldest mode, the owner also pops the oldest events
+        // when the ring is full, so the tail is advanced by CAS on both sides,
+        // and the flushing side discards an event whose pop has failed.
+        //
+        // NOTE: an event is two relaxed atomic words, so the flushing side may
+        //          read an event while it's overwritten without a data race.
+        class trace_ring
+        {
+            struct event
+            {
+                std::atomic<std::uint64_t> ts;
+                std::atomic<std::uint64_t> info;    // name | phase << 16 | arg << 32
+            };
+
+        public:
+            trace_ring(std::size_t capacity, trace_overflow overflow, std::uint32_t tid)
+                : events_(new event[capacity])
+                , mask_(capacity - 1)
+                , overflow_(overflow)
+                , tid_(tid)
+            { }
+
+            void push(trace_record const& r)
+            {
+                std::uint64_t const head = head_.load(std::memory_order_relaxed);
+                // the tail is reloaded only when the ring looks full.
+                if (head - cachedTail_ > mask_) {
+                    std::uint64_t tail = tail_.load(std::memory_order_acquire);
+                    if (head - tail > mask_) {
+                        if (overflow_ == trace_overflow::drop_newest) {
+                            cachedTail_ = tail;
+                            count_dropped(1);
+                            return;
+                        }
+                        // pop the oldest 1/16, unless the flushing side has just popped them.
+                        // dropping in a batch keeps the CAS off the most of the pushes.
+                        std::uint64_t const n = drop_batch();
+                        if (tail_.compare_exchange_strong(tail, tail + n, std::memory_order_acq_rel)) {
+                            count_dropped(n);
+                            tail += n;
+                        }
+                    }
+                    cachedTail_ = tail;
+                }
+                event & e = events_[head & mask_];
+                e.ts.store(r.ts, std::memory_order_relaxed);
+                e.info.store(std::uint64_t(r.name)
+                                | (std::uint64_t(r.phase) << 16)
+                                | (std::uint64_t(r.arg) << 32),
+                             std::memory_order_relaxed);
+                head_.store(head + 1, std::memory_order_release);
+            }
+
+            // Pops all the events pushed so far.
+            template <typename F>
+            void drain(F f)
+            {
+                std::uint64_t const head = head_.load(std::memory_order_acquire);
+                std::uint64_t tail = tail_.load(std::memory_order_acquire);
+                while (tail < head) {
+                    event const& e = events_[tail & mask_];
+                    trace_record r;
+                    r.ts = e.ts.load(std::memory_order_relaxed);
+                    std::uint64_t const info = e.info.load(std::memory_order_relaxed);
+                    r.name = static_cast<std::uint16_t>(info);
+                    r.phase = static_cast<trace_phase>((info >> 16) & 0xff);
+                    r.arg = static_cast<std::uint32_t>(info >> 32);
+                    if (tail_.compare_exchange_strong(tail, tail + 1, std::memory_order_acq_rel)) {
+                        f(r);
+                        ++tail;
+                    }
+                    // else, the owner has dropped it and the tail is reloaded.
+                }
+            }
+
+            std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+            std::uint32_t tid() const { return tid_; }
+            std::size_t capacity() const { return static_cast<std::size_t>(mask_ + 1); }
+            trace_overflow overflow() const { return overflow_; }
+
+        private:
+            std::uint64_t drop_batch() const
+            {
+                return (mask_ + 1) / 16 ? (mask_ + 1) / 16 : 1;
+            }
+
+            void count_dropped(std::uint64_t n)
+            {
+                dropped_.store(dropped_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+
+            std::unique_ptr<event[]> events_;
+            std::uint64_t const mask_;
+            trace_overflow const overflow_;
+            std::uint32_t const tid_;
+            std::atomic<std::uint64_t> head_{ 0 };
+            std::atomic<std::uint64_t> tail_{ 0 };
+            std::atomic<std::uint64_t> dropped_{ 0 };
+            std::uint64_t cachedTail_ = 0;      // owned by the producer
+        };
+
+        // The ring is created on the first event of the thread, with the
+        // configuration at that time. A slot reused by a new thread keeps its
+        // ring unless the configuration has changed. The rings are never freed,
+        // and a replaced one is retired to be drained later.
+        struct trace_slot
+        {
+            std::atomic<trace_ring *> ring{ nullptr };
+        };
+
+        struct trace_state
+        {
+            std::atomic<std::size_t> capacity{ std::size_t(1) << 20 };
+            std::atomic<trace_overflow> overflow{ trace_overflow::drop_newest };
+            std::atomic<std::uint32_t> nextTid{ 1 };
+
+            std::mutex namesMutex;
+            std::vector<std::string> names;
+
+            std::mutex retiredMutex;
+            std::vector<trace_ring *> retired;
+
+            thread_slots<trace_slot> slots;
+        };
+
+        inline trace_state & trace_globals()
+        {
+            // never destroyed, the thread_local owners may outlive a static one.
+            static auto & state = *new trace_state;
+            return state;
+        }
+
+        inline trace_ring & local_trace_ring()
+        {
+            static thread_local trace_ring * ring = nullptr;
+            if (!ring) {
+                trace_state & state = trace_globals();
+                trace_slot & slot = state.slots.local();
+                std::size_t const capacity = state.capacity.load();
+                trace_overflow const overflow = state.overflow.load();
+                ring = slot.ring.load(std::memory_order_acquire);
+                if (!ring || ring->capacity() != capacity || ring->overflow() != overflow) {
+                    if (ring) {
+                        std::lock_guard<std::mutex> lock(state.retiredMutex);
+                        state.retired.push_back(ring);
+                    }
+                    ring = new trace_ring(capacity, overflow, state.nextTid.fetch_add(1));
+                    slot.ring.store(ring, std::memory_order_release);
+                }
+            }
+            return *ring;
+        }
+
+        template <typename F>
+        void for_each_trace_ring(F f)
+        {
+            trace_state & state = trace_globals();
+            {
+                std::lock_guard<std::mutex> lock(state.retiredMutex);
+                for (trace_ring * ring : state.retired) {
+                    f(*ring);
+                }
+            }
+            state.slots.for_each([&f](trace_slot const& slot) {
+                if (auto ring = slot.ring.load(std::memory_order_acquire)) {
+                    f(*ring);
+                }
+            });
+        }
+    } // namespace detail
+
+    // Sets the size of the per-thread trace buffers. A thread which has
+    // already traced keeps its buffer, and the new threads use this one.
+    // The capacity is rounded up to a power of two. Each event takes 16 bytes.
+    inline void configure_trace(std::size_t capacity, trace_overflow overflow)
+    {
+        std::size_t c = 1;
+        while (c < capacity) {
+            c <<= 1;
+        }
+        detail::trace_globals().capacity.store(c);
+        detail::trace_globals().overflow.store(overflow);
+    }
+
+    // The ids are 16 bits.
+    constexpr std::size_t max_trace_names = 65536;
+
+    // Interns an event name. Call it once per name and keep the id.
+    // It exits when there are max_trace_names already, as the ids would wrap.
+    inline std::uint16_t trace_name(char const * name)
+    {
+        auto & state = detail::trace_globals();
+        std::lock_guard<std::mutex> lock(state.namesMutex);
+        auto iter = std::find(state.names.begin(), state.names.end(), name);
+        if (iter != state.names.end()) {
+            return static_cast<std::uint16_t>(iter - state.names.begin());
+        }
+        if (state.names.size() == max_trace_names) {
+            std::cerr << "Too many trace names: " << name << std::endl;
+            exit(-1);
+        }
+        state.names.emplace_back(name);
+        return static_cast<std::uint16_t>(state.names.size() - 1);
+    }
+
+    // An event costs a TSC read and ~1ns to push.
+    inline void trace_event(std::uint16_t name, trace_phase phase, std::uint32_t arg = 0)
+    {
+        detail::local_trace_ring().push(trace_record{ read_cycle_counter(), name, phase, arg });
+    }
+
+    // A span is two TSC reads and ~2ns more, as the ring is looked up once.
+    // The "trace span cost" benchmark reports both. It's ~31ns on a release
+    // build with a 15ns TSC read, so the 50ns budget holds as long as
+    // a TSC read is under ~23ns. A VM which traps rdtsc doesn't meet it.
+    class trace_span
+    {
+    public:
+        explicit trace_span(std::uint16_t name, std::uint32_t arg = 0)
+            : ring_(detail::local_trace_ring())
+            , name_(name)
+            , arg_(arg)
+        {
+            ring_.push(trace_record{ read_cycle_counter(), name_, trace_phase::begin, arg_ });
+        }
+
+        ~trace_span()
+        {
+            ring_.push(trace_record{ read_cycle_counter(), name_, trace_phase::end, arg_ });
+        }
+
+        trace_span(trace_span const&) = delete;
+        trace_span & operator = (trace_span const&) = delete;
+
+    private:
+        detail::trace_ring & ring_;
+        std::uint16_t name_;
+        std::uint32_t arg_;
+    };
+
+    // The number of the events dropped by the full buffers so far.
+    inline std::uint64_t trace_dropped_events()
+    {
+        std::uint64_t dropped = 0;
+        detail::for_each_trace_ring([&dropped](detail::trace_ring const& ring) {
+            dropped += ring.dropped();
+        });
+        return dropped;
+    }
+
+    struct trace_thread_events
+    {
+        std::uint32_t tid;
+        std::vector<trace_record> records;
+    };
+
+    // Pops the recorded events of every thread.
+    //
+    // NOTE: the threads may keep recording while the events are drained.
+    //          The tid of the events is the id of the per-thread buffer,
+    //          which may be reused by a new thread after its thread has exited.
+    inline std::vector<trace_thread_events> drain_trace()
+    {
+        std::vector<trace_thread_events> threads;
+        detail::for_each_trace_ring([&threads](detail::trace_ring & ring) {
+            trace_thread_events t{ ring.tid(), {} };
+            ring.drain([&t](trace_record const& r) { t.records.push_back(r); });
+            if (!t.records.empty()) {
+                threads.push_back(std::move(t));
+            }
+        });
+        return threads;
+    }
+
+    inline std::string trace_name_of(std::uint16_t name)
+    {
+        auto & state = detail::trace_globals();
+        std::lock_guard<std::mutex> lock(state.namesMutex);
+        return name < state.names.size() ? state.names[name] : std::string("?");
+    }
+
+    namespace detail
+    {
+        // Quotes a string as a JSON string literal.
+        inline std::string json_quote(std::string const& s)
+        {
+            static char const hex[] = "0123456789abcdef";
+            std::string quoted(1, '"');
+            for (char ch : s) {
+                unsigned char const c = static_cast<unsigned char>(ch);
+                switch (c) {
+                    case '"': quoted += "\\\""; break;
+                    case '\\': quoted += "\\\\"; break;
+                    case '\n': quoted += "\\n"; break;
+                    case '\r': quoted += "\\r"; break;
+                    case '\t': quoted += "\\t"; break;
+                    default:
+                        if (c < 0x20) {
+                            quoted += "\\u00";
+                            quoted += hex[c >> 4];
+                            quoted += hex[c & 0xf];
+                        } else {
+                            quoted += ch;
+                        }
+                }
+            }
+            quoted += '"';
+            return quoted;
+        }
+
+        inline std::uint64_t trace_base_ts(std::vector<trace_thread_events> const& threads)
+        {
+            std::uint64_t base = ~std::uint64_t(0);
+            for (auto const& t : threads) {
+                for (auto const& r : t.records) {
+                    base = std::min(base, r.ts);
+                }
+            }
+            return base;
+        }
+    } // namespace detail
+
+    // Writes the Chrome trace-event JSON, which chrome://tracing,
+    // the Perfetto UI and speedscope can load.
+    // The arg of an event is written as args.arg if it's not zero.
+    // The timestamps are in microseconds, in the fixed notation to the nanosecond.
+    inline void write_trace_json(std::ostream & os, std::vector<trace_thread_events> const& threads)
+    {
+        boost::io::ios_flags_saver flagsSaver(os);
+        boost::io::ios_precision_saver precisionSaver(os);
+        os << std::fixed << std::setprecision(3);
+
+        double const cyclesPerUs = cycles_per_nanosecond() * 1000.0;
+        std::uint64_t const base = detail::trace_base_ts(threads);
+
+        // the names are quoted once.
+        std::vector<std::string> names;
+        auto name_of = [&names](std::uint16_t id) -> std::string const& {
+            while (names.size() <= id) {
+                names.push_back(detail::json_quote(trace_name_of(static_cast<std::uint16_t>(names.size()))));
+            }
+            return names[id];
+        };
+
+        os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (auto const& t : threads) {
+            for (auto const& r : t.records) {
+                os << (first ? "\n" : ",\n")
+                   << "{\"name\":" << name_of(r.name)
+                   << ",\"ph\":\"" << static_cast<char>(r.phase)
+                   << "\",\"ts\":" << double(r.ts - base) / cyclesPerUs
+                   << ",\"pid\":1,\"tid\":" << t.tid;
+                if (r.arg) {
+                    os << ",\"args\":{\"arg\":" << r.arg << '}';
+                }
+                os << '}';
+                first = false;
+            }
+        }
+        os << "\n]}\n";
+    }
+
+    inline void flush_trace_json(std::ostream & os)
+    {
+        write_trace_json(os, drain_trace());
+    }
+
+    namespace detail
+    {
+        // A minimal protobuf encoder for the Perfetto trace format.
+        class proto_writer
+        {
+        public:
+            void varint(std::uint32_t field, std::uint64_t v)
+            {
+                key(field, 0);
+                raw_varint(v);
+            }
+
+            void bytes(std::uint32_t field, std::string const& s)
+            {
+                key(field, 2);
+                raw_varint(s.size());
+                buffer_ += s;
+            }
+
+            void message(std::uint32_t field, proto_writer const& m)
+            {
+                bytes(field, m.buffer_);
+            }
+
+            std::string const& str() const { return buffer_; }
+
+        private:
+            void key(std::uint32_t field, std::uint32_t wireType)
+            {
+                raw_varint((std::uint64_t(field) << 3) | wireType);
+            }
+
+            void raw_varint(std::uint64_t v)
+            {
+                while (v >= 0x80) {
+                    buffer_ += static_cast<char>((v & 0x7f) | 0x80);
+                    v >>= 7;
+                }
+                buffer_ += static_cast<char>(v);
+            }
+
+            std::string buffer_;
+        };
+    } // namespace detail
+
+    // Writes a Perfetto protobuf trace(perfetto.protos.Trace) of TrackEvents.
+    // Every thread has its own track, and the timestamps are in nanoseconds.
+    inline void write_trace_perfetto(std::ostream & os, std::vector<trace_thread_events> const& threads)
+    {
+        using detail::proto_writer;
+
+        // field numbers of perfetto/trace/*.proto
+        enum : std::uint32_t
+        {
+            trace_packet = 1,                   // Trace
+            packet_timestamp = 8,               // TracePacket
+            packet_sequence_id = 10,
+            packet_track_event = 11,
+            packet_sequence_flags = 13,
+            packet_track_descriptor = 60,
+            track_uuid = 1,                     // TrackDescriptor
+            track_name = 2,
+            track_thread = 4,
+            thread_pid = 1,                     // ThreadDescriptor
+            thread_tid = 2,
+            event_type = 9,                     // TrackEvent
+            event_track_uuid = 11,
+            event_name = 23,
+            event_debug_annotations = 4,
+            annotation_name = 10,               // DebugAnnotation
+            annotation_uint = 3
+        };
+        enum : std::uint64_t { slice_begin = 1, slice_end = 2, incremental_state_cleared = 1 };
+
+        double const cyclesPerNs = cycles_per_nanosecond();
+        std::uint64_t const base = detail::trace_base_ts(threads);
+
+        auto write_packet = [&os](proto_writer const& packet) {
+            proto_writer trace;
+            trace.message(trace_packet, packet);
+            os.write(trace.str().data(), static_cast<std::streamsize>(trace.str().size()));
+        };
+
+        for (auto const& t : threads) {
+            std::uint64_t const uuid = 0x616c676f00000000ull | t.tid;
+
+            proto_writer thread;
+            thread.varint(thread_pid, 1);
+            thread.varint(thread_tid, t.tid);
+            proto_writer descriptor;
+            descriptor.varint(track_uuid, uuid);
+            descriptor.bytes(track_name, "thread " + std::to_string(t.tid));
+            descriptor.message(track_thread, thread);
+            proto_writer packet;
+            packet.message(packet_track_descriptor, descriptor);
+            packet.varint(packet_sequence_id, t.tid);
+            packet.varint(packet_sequence_flags, incremental_state_cleared);
+            write_packet(packet);
+
+            for (auto const& r : t.records) {
+                proto_writer event;
+                event.varint(event_type, r.phase == trace_phase::begin ? slice_begin : slice_end);
+                event.varint(event_track_uuid, uuid);
+                if (r.phase == trace_phase::begin) {
+                    event.bytes(event_name, trace_name_of(r.name));
+                    if (r.arg) {
+                        proto_writer annotation;
+                        annotation.bytes(annotation_name, "arg");
+                        annotation.varint(annotation_uint, r.arg);
+                        event.message(event_debug_annotations, annotation);
+                    }
+                }
+                proto_writer p;
+                p.varint(packet_timestamp, static_cast<std::uint64_t>(double(r.ts - base) / cyclesPerNs));
+                p.message(packet_track_event, event);
+                p.varint(packet_sequence_id, t.tid);
+                write_packet(p);
+            }
+        }
+    }
+
+    inline void flush_trace_perfetto(std::ostream & os)
+    {
+        write_trace_perfetto(os, drain_trace());
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_EVENT_TRACE_H
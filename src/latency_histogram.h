@@ -0,0 +1,250 @@
+#ifndef ALGOVISU_LATENCY_HISTOGRAM_H
+#define ALGOVISU_LATENCY_HISTOGRAM_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <limits>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+
+namespace algovisu
+{
+    // HDR-style log-linear bucketing.
+    //
+    // The values below 2^sub_bucket_bits have their own buckets. Above that,
+    // every power of two range is split into 2^sub_bucket_bits buckets,
+    // so the relative error of a bucket is at most 1 / 2^sub_bucket_bits(~3%).
+    struct latency_buckets
+    {
+        static constexpr unsigned sub_bucket_bits = 5;
+        static constexpr std::size_t sub_bucket_count = std::size_t(1) << sub_bucket_bits;
+        static constexpr std::size_t count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+        static unsigned highest_bit(std::uint64_t v)
+        {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanReverse64(&index, v);
+            return static_cast<unsigned>(index);
+#else
+            return 63 - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+        }
+
+        static std::size_t index_of(std::uint64_t v)
+        {
+            if (v < sub_bucket_count) {
+                return static_cast<std::size_t>(v);
+            }
+            unsigned const msb = highest_bit(v);
+            unsigned const shift = msb - sub_bucket_bits;
+            return (shift + 1) * sub_bucket_count
+                        + static_cast<std::size_t>((v >> shift) - sub_bucket_count);
+        }
+
+        static std::uint64_t lower_bound_of(std::size_t index)
+        {
+            if (index < sub_bucket_count) {
+                return index;
+            }
+            std::size_t const shift = index / sub_bucket_count - 1;
+            std::uint64_t const m = sub_bucket_count + index % sub_bucket_count;
+            return m << shift;
+        }
+
+        static std::uint64_t upper_bound_of(std::size_t index)
+        {
+            if (index < sub_bucket_count) {
+                return index;
+            }
+            std::size_t const shift = index / sub_bucket_count - 1;
+            return lower_bound_of(index) + ((std::uint64_t(1) << shift) - 1);
+        }
+    };
+
+    // A histogram written by a single thread.
+    //
+    // NOTE: the counters are relaxed atomics only to let the other threads
+    //          read them while the owner writes. The owner never uses
+    //          the read-modify-write instructions, so the recording is
+    //          as cheap as the plain increments.
+    class latency_histogram
+    {
+    public:
+        void record(std::uint64_t v)
+        {
+            bump(counts_[latency_buckets::index_of(v)], 1);
+            bump(total_, 1);
+            bump(sum_, v);
+            if (v > max_.load(std::memory_order_relaxed)) {
+                max_.store(v, std::memory_order_relaxed);
+            }
+            if (v < min_.load(std::memory_order_relaxed)) {
+                min_.store(v, std::memory_order_relaxed);
+            }
+        }
+
+        void reset()
+        {
+            for (auto & c : counts_) {
+                c.store(0, std::memory_order_relaxed);
+            }
+            total_.store(0, std::memory_order_relaxed);
+            sum_.store(0, std::memory_order_relaxed);
+            max_.store(0, std::memory_order_relaxed);
+            min_.store(std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+        }
+
+    private:
+        friend class latency_summary;
+
+        static void bump(std::atomic<std::uint64_t> & c, std::uint64_t n)
+        {
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        std::atomic<std::uint64_t> counts_[latency_buckets::count] = {};
+        std::atomic<std::uint64_t> total_{ 0 };
+        std::atomic<std::uint64_t> sum_{ 0 };
+        std::atomic<std::uint64_t> max_{ 0 };
+        std::atomic<std::uint64_t> min_{ std::numeric_limits<std::uint64_t>::max() };
+    };
+
+    // A plain copy of the merged histograms.
+    class latency_summary
+    {
+    public:
+        latency_summary()
+            : counts_(latency_buckets::count)
+        { }
+
+        void merge(latency_histogram const& h)
+        {
+            for (std::size_t i = 0; i < latency_buckets::count; ++i) {
+                counts_[i] += h.counts_[i].load(std::memory_order_relaxed);
+            }
+            total_ += h.total_.load(std::memory_order_relaxed);
+            sum_ += h.sum_.load(std::memory_order_relaxed);
+            max_ = std::max(max_, h.max_.load(std::memory_order_relaxed));
+            min_ = std::min(min_, h.min_.load(std::memory_order_relaxed));
+        }
+
+        void merge(latency_summary const& s)
+        {
+            for (std::size_t i = 0; i < latency_buckets::count; ++i) {
+                counts_[i] += s.counts_[i];
+            }
+            total_ += s.total_;
+            sum_ += s.sum_;
+            max_ = std::max(max_, s.max_);
+            min_ = std::min(min_, s.min_);
+        }
+
+        std::uint64_t count() const { return total_; }
+        std::uint64_t sum() const { return sum_; }
+        std::uint64_t max() const { return total_ ? max_ : 0; }
+        std::uint64_t min() const { return total_ ? min_ : 0; }
+        double mean() const { return total_ ? double(sum_) / double(total_) : 0.0; }
+
+        std::uint64_t bucket_count(std::size_t index) const { return counts_[index]; }
+
+        // The highest value which is equivalent to the q-th quantile(0 <= q <= 1).
+        std::uint64_t percentile(double q) const
+        {
+            if (total_ == 0) {
+                return 0;
+            }
+            std::uint64_t const rank = std::max<std::uint64_t>(
+                                            1, static_cast<std::uint64_t>(q * double(total_) + 0.5)
+                                        );
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < latency_buckets::count; ++i) {
+                seen += counts_[i];
+                if (seen >= rank) {
+                    return std::min(latency_buckets::upper_bound_of(i), max_);
+                }
+            }
+            return max_;
+        }
+
+    private:
+        std::vector<std::uint64_t> counts_;
+        std::uint64_t total_ = 0;
+        std::uint64_t sum_ = 0;
+        std::uint64_t max_ = 0;
+        std::uint64_t min_ = std::numeric_limits<std::uint64_t>::max();
+    };
+
+    // The values are divided by unitsPerNs to print them in nanoseconds.
+    inline void dump_latency_text(std::ostream & os,
+                                  char const * name,
+                                  latency_summary const& s,
+                                  double unitsPerNs = 1.0)
+    {
+        auto ns = [unitsPerNs](double v) { return static_cast<std::uint64_t>(v / unitsPerNs); };
+        os << std::left << std::setw(12) << name
+           << std::right << std::setw(12) << s.count()
+           << std::setw(12) << ns(s.min())
+           << std::setw(12) << ns(s.percentile(0.5))
+           << std::setw(12) << ns(s.percentile(0.9))
+           << std::setw(12) << ns(s.percentile(0.99))
+           << std::setw(12) << ns(s.percentile(0.999))
+           << std::setw(12) << ns(s.max())
+           << std::setw(12) << ns(s.mean()) << '\n';
+    }
+
+    inline void dump_latency_text_header(std::ostream & os)
+    {
+        os << std::left << std::setw(12) << "(ns)"
+           << std::right << std::setw(12) << "count"
+           << std::setw(12) << "min"
+           << std::setw(12) << "p50"
+           << std::setw(12) << "p90"
+           << std::setw(12) << "p99"
+           << std::setw(12) << "p99.9"
+           << std::setw(12) << "max"
+           << std::setw(12) << "mean" << '\n';
+    }
+
+    // The non-empty buckets are dumped as [lower bound, upper bound, count],
+    // so that the histograms can be merged again later.
+    inline void dump_latency_json(std::ostream & os,
+                                  latency_summary const& s,
+                                  double unitsPerNs = 1.0)
+    {
+        auto ns = [unitsPerNs](double v) { return static_cast<std::uint64_t>(v / unitsPerNs); };
+        os << "{\"count\":" << s.count()
+           << ",\"min_ns\":" << ns(s.min())
+           << ",\"p50_ns\":" << ns(s.percentile(0.5))
+           << ",\"p90_ns\":" << ns(s.percentile(0.9))
+           << ",\"p99_ns\":" << ns(s.percentile(0.99))
+           << ",\"p999_ns\":" << ns(s.percentile(0.999))
+           << ",\"max_ns\":" << ns(s.max())
+           << ",\"mean_ns\":" << ns(s.mean())
+           << ",\"buckets\":[";
+        bool first = true;
+        for (std::size_t i = 0; i < latency_buckets::count; ++i) {
+            if (s.bucket_count(i) == 0) {
+                continue;
+            }
+            os << (first ? "" : ",")
+               << '[' << ns(double(latency_buckets::lower_bound_of(i)))
+               << ',' << ns(double(latency_buckets::upper_bound_of(i)))
+               << ',' << s.bucket_count(i) << ']';
+            first = false;
+        }
+        os << "]}";
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_LATENCY_HISTOGRAM_H
@@ -0,0 +1,135 @@
+#ifndef ALGOVISU_PERF_COUNTERS_H
+#define ALGOVISU_PERF_COUNTERS_H
+
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+    #include <cstring>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+    #define ALGOVISU_HAS_PERF_EVENTS 1
+#endif
+
+
+namespace algovisu
+{
+    struct perf_counts
+    {
+        std::uint64_t cycles = 0;
+        std::uint64_t instructions = 0;
+        std::uint64_t branches = 0;
+        std::uint64_t branchMisses = 0;
+
+        double branch_miss_rate() const { return branches ? double(branchMisses) / double(branches) : 0.0; }
+    };
+
+    // The hardware counters of the calling thread, in the user space, for
+    // the benchmarks.
+    //
+    // NOTE: they're by perf_event_open(2) on Linux, and not available
+    //          without a PMU, like in many VMs, or when perf_event_paranoid
+    //          is above 2. Then available() is false and the counts are 0.
+    //
+    // ex.)
+    //  perf_counters counters;
+    //  counters.start();
+    //  run();
+    //  perf_counts const counts = counters.stop();
+    //  if (counters.available()) {
+    //      std::printf("%.2f%% branch misses\n", counts.branch_miss_rate() * 100);
+    //  }
+    class perf_counters
+    {
+    public:
+        perf_counters()
+        {
+#if defined(ALGOVISU_HAS_PERF_EVENTS)
+            std::uint64_t const configs[event_count] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+            };
+            for (std::size_t i = 0; i < event_count; ++i) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[i];
+                attr.disabled = i == 0;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP;
+                fds_[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0));
+                if (fds_[i] < 0) {
+                    close();
+                    return;
+                }
+            }
+#endif
+        }
+
+        ~perf_counters()
+        {
+            close();
+        }
+
+        perf_counters(perf_counters const&) = delete;
+        perf_counters & operator = (perf_counters const&) = delete;
+
+        bool available() const { return fds_[0] >= 0; }
+
+        void start()
+        {
+#if defined(ALGOVISU_HAS_PERF_EVENTS)
+            if (available()) {
+                ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+#endif
+        }
+
+        // The counts since start().
+        perf_counts stop()
+        {
+            perf_counts counts;
+#if defined(ALGOVISU_HAS_PERF_EVENTS)
+            if (available()) {
+                ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+                // the number of the events, and their values in order.
+                std::uint64_t values[1 + event_count] = {};
+                if (read(fds_[0], values, sizeof(values)) == static_cast<ssize_t>(sizeof(values))) {
+                    counts.cycles = values[1];
+                    counts.instructions = values[2];
+                    counts.branches = values[3];
+                    counts.branchMisses = values[4];
+                }
+            }
+#endif
+            return counts;
+        }
+
+    private:
+        static constexpr std::size_t event_count = 4;
+
+        void close()
+        {
+#if defined(ALGOVISU_HAS_PERF_EVENTS)
+            // the group members first.
+            for (std::size_t i = event_count; i-- > 0; ) {
+                if (fds_[i] >= 0) {
+                    ::close(fds_[i]);
+                    fds_[i] = -1;
+                }
+            }
+#endif
+        }
+
+        int fds_[event_count] = { -1, -1, -1, -1 };
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_PERF_COUNTERS_H
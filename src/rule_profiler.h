@@ -0,0 +1,340 @@
+#ifndef ALGOVISU_RULE_PROFILER_H
+#define ALGOVISU_RULE_PROFILER_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include <boost/spirit/include/qi.hpp>
+
+#include "cycle_clock.h"
+
+
+namespace algovisu
+{
+    namespace qi = boost::spirit::qi;
+
+    // Instrumentation policies for calc_grammar.
+    //
+    // A policy is asked to attach itself to every rule once the rule is defined.
+    // no_rule_profiler does nothing, so the rules stay exactly as they are and
+    // the grammar has no extra cost at all.
+    // basic_rule_profiler wraps each rule with a qi::debug handler which counts
+    // the calls, the backtracks(failed parses) and the elapsed TSC cycles
+    // into the per-thread counters.
+    struct no_rule_profiler
+    {
+        template <typename Rule>
+        static void attach(Rule &, char const *)
+        { }
+    };
+
+    struct rule_profile_entry
+    {
+        std::string name;
+        std::uint64_t calls = 0;
+        std::uint64_t backtracks = 0;
+        std::uint64_t sampled = 0;        // the timed calls.
+        std::uint64_t cycles = 0;         // inclusive, recursive calls are counted again.
+        std::uint64_t self_cycles = 0;    // exclusive of the nested rules.
+    };
+
+    namespace detail
+    {
+        constexpr std::size_t max_profiled_rules = 64;
+        constexpr std::size_t max_profiled_depth = 256;
+
+        // The counters are only written by the owner thread.
+        // They are atomics just to make the reads from the report side race-free.
+        struct rule_counters
+        {
+            std::atomic<std::uint64_t> calls{ 0 };
+            std::atomic<std::uint64_t> backtracks{ 0 };
+            std::atomic<std::uint64_t> sampled{ 0 };
+            std::atomic<std::uint64_t> cycles{ 0 };         // of the sampled calls only.
+            std::atomic<std::uint64_t> self_cycles{ 0 };    // of the sampled calls only.
+        };
+
+        inline void bump(std::atomic<std::uint64_t> & c, std::uint64_t n)
+        {
+            // single writer, so no lock prefix is needed.
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        struct rule_profile_thread_data;
+
+        class rule_profile_registry
+        {
+        public:
+            static rule_profile_registry & instance()
+            {
+                static rule_profile_registry registry;
+                return registry;
+            }
+
+            std::size_t register_rule(char const * name)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto iter = std::find(names_.begin(), names_.end(), name);
+                if (iter != names_.end()) {
+                    return static_cast<std::size_t>(iter - names_.begin());
+                }
+                if (names_.size() == max_profiled_rules) {
+                    std::cerr << "Too many profiled rules: " << name << std::endl;
+                    exit(-1);
+                }
+                names_.emplace_back(name);
+                return names_.size() - 1;
+            }
+
+            void add_thread(rule_profile_thread_data * data)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                threads_.push_back(data);
+            }
+
+            void remove_thread(rule_profile_thread_data * data);
+
+            std::vector<rule_profile_entry> collect();
+
+            void reset();
+
+        private:
+            std::mutex mutex_;
+            std::vector<std::string> names_;
+            std::vector<rule_profile_thread_data *> threads_;
+            rule_counters retired_[max_profiled_rules];
+        };
+
+        struct rule_profile_thread_data
+        {
+            struct frame
+            {
+                std::uint64_t start;
+                std::uint64_t nested;
+                bool sampled;
+            };
+
+            rule_profile_thread_data()
+            {
+                rule_profile_registry::instance().add_thread(this);
+            }
+
+            ~rule_profile_thread_data()
+            {
+                rule_profile_registry::instance().remove_thread(this);
+            }
+
+            // Each rule has its own tick, so a rarely called rule like
+            // the outermost one is sampled as often as the others.
+            // Once a call is sampled, every call nested in it is timed too.
+            // Otherwise its nested time would be known only for the few nested
+            // calls which happen to be sampled, and the self cycles would be
+            // either the inclusive ones or nothing.
+            template <std::size_t SamplePeriod>
+            void enter(std::size_t id)
+            {
+                if (depth_ < max_profiled_depth) {
+                    bool const sampled = sampledDepth_ > 0 || (ticks_[id]++ % SamplePeriod) == 0;
+                    if (sampled) {
+                        ++sampledDepth_;
+                    }
+                    stack_[depth_] = frame{ sampled ? read_cycle_counter() : 0, 0, sampled };
+                }
+                ++depth_;
+            }
+
+            template <std::size_t SamplePeriod>
+            void leave(std::size_t id, bool succeeded)
+            {
+                --depth_;
+                rule_counters & c = counters_[id];
+                bump(c.calls, 1);
+                if (!succeeded) {
+                    bump(c.backtracks, 1);
+                }
+                if (depth_ < max_profiled_depth && stack_[depth_].sampled) {
+                    // The cycles are kept unscaled.
+                    // They are scaled by calls / sampled of each rule when collected.
+                    std::uint64_t const elapsed = read_cycle_counter() - stack_[depth_].start;
+                    std::uint64_t const nested = stack_[depth_].nested;
+                    bump(c.sampled, 1);
+                    bump(c.cycles, elapsed);
+                    bump(c.self_cycles, elapsed - std::min(elapsed, nested));
+                    if (depth_ > 0 && depth_ - 1 < max_profiled_depth) {
+                        stack_[depth_ - 1].nested += elapsed;
+                    }
+                    --sampledDepth_;
+                }
+            }
+
+            static rule_profile_thread_data & current()
+            {
+                static thread_local rule_profile_thread_data data;
+                return data;
+            }
+
+            rule_counters counters_[max_profiled_rules];
+            frame stack_[max_profiled_depth];
+            std::size_t ticks_[max_profiled_rules] = {};
+            std::size_t depth_ = 0;
+            std::size_t sampledDepth_ = 0;
+        };
+
+        inline void rule_profile_registry::remove_thread(rule_profile_thread_data * data)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::size_t i = 0; i < max_profiled_rules; ++i) {
+                rule_counters const& from = data->counters_[i];
+                bump(retired_[i].calls, from.calls.load(std::memory_order_relaxed));
+                bump(retired_[i].backtracks, from.backtracks.load(std::memory_order_relaxed));
+                bump(retired_[i].sampled, from.sampled.load(std::memory_order_relaxed));
+                bump(retired_[i].cycles, from.cycles.load(std::memory_order_relaxed));
+                bump(retired_[i].self_cycles, from.self_cycles.load(std::memory_order_relaxed));
+            }
+            threads_.erase(std::remove(threads_.begin(), threads_.end(), data), threads_.end());
+        }
+
+        inline std::vector<rule_profile_entry> rule_profile_registry::collect()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<rule_profile_entry> entries(names_.size());
+            auto add = [&entries](rule_counters const* counters) {
+                for (std::size_t i = 0; i < entries.size(); ++i) {
+                    entries[i].calls += counters[i].calls.load(std::memory_order_relaxed);
+                    entries[i].backtracks += counters[i].backtracks.load(std::memory_order_relaxed);
+                    entries[i].sampled += counters[i].sampled.load(std::memory_order_relaxed);
+                    entries[i].cycles += counters[i].cycles.load(std::memory_order_relaxed);
+                    entries[i].self_cycles += counters[i].self_cycles.load(std::memory_order_relaxed);
+                }
+            };
+            add(retired_);
+            for (auto data : threads_) {
+                add(data->counters_);
+            }
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                auto & e = entries[i];
+                e.name = names_[i];
+                // estimates the total from the sampled calls of the rule.
+                if (e.sampled > 0 && e.sampled < e.calls) {
+                    double const scale = static_cast<double>(e.calls) / e.sampled;
+                    e.cycles = static_cast<std::uint64_t>(e.cycles * scale);
+                    e.self_cycles = static_cast<std::uint64_t>(e.self_cycles * scale);
+                }
+            }
+            return entries;
+        }
+
+        inline void rule_profile_registry::reset()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto clear = [](rule_counters * counters) {
+                for (std::size_t i = 0; i < max_profiled_rules; ++i) {
+                    counters[i].calls.store(0, std::memory_order_relaxed);
+                    counters[i].backtracks.store(0, std::memory_order_relaxed);
+                    counters[i].sampled.store(0, std::memory_order_relaxed);
+                    counters[i].cycles.store(0, std::memory_order_relaxed);
+                    counters[i].self_cycles.store(0, std::memory_order_relaxed);
+                }
+            };
+            clear(retired_);
+            for (auto data : threads_) {
+                clear(data->counters_);
+            }
+        }
+
+        // qi::debug handler. It's called before and after every rule invocation.
+        template <std::size_t SamplePeriod>
+        struct rule_probe
+        {
+            template <typename Iterator, typename Context, typename State>
+            void operator()(Iterator const&, Iterator const&,
+                            Context const&,
+                            State state,
+                            std::string const&) const
+            {
+                auto & data = rule_profile_thread_data::current();
+                if (state == qi::pre_parse) {
+                    data.template enter<SamplePeriod>(id_);
+                } else {
+                    data.template leave<SamplePeriod>(id_, state == qi::successful_parse);
+                }
+            }
+
+            std::size_t id_;
+        };
+    } // namespace detail
+
+    // The calls and the backtracks are always counted exactly.
+    // The cycles are read only for one of every SamplePeriod calls of each rule
+    // and for the calls nested in it, because reading the TSC twice per call
+    // is as expensive as the rule body itself for the small rules.
+    template <std::size_t SamplePeriod>
+    struct basic_rule_profiler
+    {
+        static_assert(SamplePeriod > 0, "SamplePeriod should be positive.");
+
+        template <typename Rule>
+        static void attach(Rule & r, char const * name)
+        {
+            std::size_t const id = detail::rule_profile_registry::instance().register_rule(name);
+            qi::debug(r, detail::rule_probe<SamplePeriod>{ id });
+        }
+    };
+
+    using rule_profiler = basic_rule_profiler<64>;
+    using exact_rule_profiler = basic_rule_profiler<1>;
+
+    // Attaches two policies to the same rules. The Second wraps the First.
+    template <typename First, typename Second>
+    struct rule_probes
+    {
+        template <typename Rule>
+        static void attach(Rule & r, char const * name)
+        {
+            First::attach(r, name);
+            Second::attach(r, name);
+        }
+    };
+
+    // Sums up the counters of all the threads, including the exited ones.
+    inline std::vector<rule_profile_entry> collect_rule_profile()
+    {
+        return detail::rule_profile_registry::instance().collect();
+    }
+
+    // NOTE: call this only when no profiled parsing is running.
+    inline void reset_rule_profile()
+    {
+        detail::rule_profile_registry::instance().reset();
+    }
+
+    inline void dump_rule_profile(std::ostream & os)
+    {
+        auto entries = collect_rule_profile();
+        os << std::left << std::setw(24) << "rule"
+           << std::right << std::setw(14) << "calls"
+           << std::setw(14) << "backtracks"
+           << std::setw(18) << "cycles"
+           << std::setw(18) << "self cycles"
+           << std::setw(12) << "cyc/call" << '\n';
+        for (auto const& e : entries) {
+            os << std::left << std::setw(24) << e.name
+               << std::right << std::setw(14) << e.calls
+               << std::setw(14) << e.backtracks
+               << std::setw(18) << e.cycles
+               << std::setw(18) << e.self_cycles
+               << std::setw(12) << (e.calls ? e.cycles / e.calls : 0) << '\n';
+        }
+    }
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_RULE_PROFILER_H
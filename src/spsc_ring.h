@@ -0,0 +1,120 @@
+#ifndef ALGOVISU_SPSC_RING_H
+#define ALGOVISU_SPSC_RING_H
+
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+
+namespace algovisu
+{
+    // A bounded lock-free ring of a single producer and a single consumer.
+    //
+    // The capacity is rounded up to a power of 2. Each side caches the
+    // other side's index, and reloads it only when the ring looks full or
+    // empty, so the shared cache lines move only once per a run of items.
+    //
+    // NOTE: the blocking push() and pop() spin for a while and then yield.
+    //          The producer waits in push() while the ring is full, which is
+    //          the backpressure on a stage running ahead of its consumer.
+    template <typename T>
+    class spsc_ring
+    {
+    public:
+        explicit spsc_ring(std::size_t capacity)
+            : mask_(round_up(capacity) - 1)
+            , items_(new T[mask_ + 1])
+        { }
+
+        spsc_ring(spsc_ring const&) = delete;
+        spsc_ring & operator = (spsc_ring const&) = delete;
+
+        std::size_t capacity() const { return mask_ + 1; }
+
+        bool try_push(T const& v)
+        {
+            std::size_t const head = producer_.index.load(std::memory_order_relaxed);
+            if (head - producer_.cached == capacity()) {
+                producer_.cached = consumer_.index.load(std::memory_order_acquire);
+                if (head - producer_.cached == capacity()) {
+                    return false;
+                }
+            }
+            items_[head & mask_] = v;
+            producer_.index.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T & v)
+        {
+            std::size_t const tail = consumer_.index.load(std::memory_order_relaxed);
+            if (tail == consumer_.cached) {
+                consumer_.cached = producer_.index.load(std::memory_order_acquire);
+                if (tail == consumer_.cached) {
+                    return false;
+                }
+            }
+            v = items_[tail & mask_];
+            consumer_.index.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // It returns the number of the times it had to wait.
+        std::size_t push(T const& v)
+        {
+            std::size_t waits = 0;
+            while (!try_push(v)) {
+                backoff(waits++);
+            }
+            return waits;
+        }
+
+        std::size_t pop(T & v)
+        {
+            std::size_t waits = 0;
+            while (!try_pop(v)) {
+                backoff(waits++);
+            }
+            return waits;
+        }
+
+    private:
+        static std::size_t round_up(std::size_t n)
+        {
+            std::size_t c = 1;
+            while (c < n) {
+                c <<= 1;
+            }
+            return c;
+        }
+
+        static void backoff(std::size_t waits)
+        {
+            if (waits < 64) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+                __builtin_ia32_pause();
+#endif
+            } else {
+                std::this_thread::yield();
+            }
+        }
+
+        // the own index and the cached index of the other side,
+        // on a cache line of their own.
+        struct alignas(64) side
+        {
+            std::atomic<std::size_t> index{ 0 };
+            std::size_t cached = 0;
+        };
+
+        std::size_t const mask_;
+        std::unique_ptr<T[]> items_;
+        side producer_;
+        side consumer_;
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_SPSC_RING_H
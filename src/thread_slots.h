@@ -0,0 +1,79 @@
+#ifndef ALGOVISU_THREAD_SLOTS_H
+#define ALGOVISU_THREAD_SLOTS_H
+
+
+#include <atomic>
+
+
+namespace algovisu
+{
+    // A lock-free list of per-thread data slots.
+    //
+    // Every thread acquires its own slot on the first use and writes into it
+    // without any synchronization. The readers walk the list at any time.
+    // A slot is never freed. When its thread exits, the slot is just marked as
+    // unused, with the data kept, and reused by the next new thread.
+    // So the data of the exited threads are still seen by the readers.
+    //
+    // NOTE: the Slot itself should be safe to read while its owner writes,
+    //          for example, by using relaxed atomics for the counters.
+    //          And every Slot type is expected to have a single list instance,
+    //          because the calling thread's slot is cached per Slot type.
+    template <typename Slot>
+    class thread_slots
+    {
+        struct node
+        {
+            Slot slot;
+            std::atomic<bool> inUse{ true };
+            node * next = nullptr;
+        };
+
+    public:
+        // The calling thread's slot.
+        Slot & local()
+        {
+            struct owner
+            {
+                explicit owner(thread_slots & list) : node_(list.acquire()) { }
+                ~owner() { node_->inUse.store(false, std::memory_order_release); }
+
+                node * node_;
+            };
+            static thread_local owner o(*this);
+            return o.node_->slot;
+        }
+
+        template <typename F>
+        void for_each(F f) const
+        {
+            for (node * n = head_.load(std::memory_order_acquire); n; n = n->next) {
+                f(n->slot);
+            }
+        }
+
+    private:
+        node * acquire()
+        {
+            for (node * n = head_.load(std::memory_order_acquire); n; n = n->next) {
+                bool expected = false;
+                if (!n->inUse.load(std::memory_order_relaxed)
+                        && n->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                    return n;
+                }
+            }
+            node * n = new node;
+            n->next = head_.load(std::memory_order_relaxed);
+            while (!head_.compare_exchange_weak(n->next, n,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed))
+            { }
+            return n;
+        }
+
+        std::atomic<node *> head_{ nullptr };
+    };
+} // namespace algovisu
+
+
+#endif  // ALGOVISU_THREAD_SLOTS_H
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Compares the JSON output of algovisu_bench with a baseline.
+
+    algovisu_bench --json current.json
+    bench_compare.py bench_baseline.json current.json [--threshold 0.1]
+
+A benchmark regresses when its median is slower than the baseline's by more
+than the threshold, and even its fastest repetition is slower than the
+baseline's median. The second condition keeps a noisy run from being flagged.
+The exit code is 1 if any benchmark regresses.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        doc = json.load(f)
+    return doc.get("context", {}), {b["name"]: b for b in doc["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.1,
+                        help="allowed slowdown of the median (default: 0.1 = 10%%)")
+    args = parser.parse_args()
+
+    base_context, baseline = load(args.baseline)
+    cur_context, current = load(args.current)
+    if base_context.get("build_type") != cur_context.get("build_type"):
+        print("warning: build types differ: %r vs %r"
+              % (base_context.get("build_type"), cur_context.get("build_type")))
+
+    regressions = []
+    print("%-40s %14s %14s %9s" % ("benchmark", "baseline(ns)", "current(ns)", "change"))
+    for name, cur in current.items():
+        base = baseline.get(name)
+        if base is None:
+            print("%-40s %14s %14.1f %9s" % (name, "-", cur["median_ns"], "new"))
+            continue
+        change = cur["median_ns"] / base["median_ns"] - 1.0
+        mark = ""
+        if change > args.threshold and cur["min_ns"] > base["median_ns"]:
+            mark = "  REGRESSION"
+            regressions.append(name)
+        elif change < -args.threshold and cur["median_ns"] < base["min_ns"]:
+            mark = "  improved"
+        print("%-40s %14.1f %14.1f %+8.1f%%%s"
+              % (name, base["median_ns"], cur["median_ns"], change * 100.0, mark))
+
+    for name in baseline:
+        if name not in current:
+            print("%-40s %14.1f %14s %9s" % (name, baseline[name]["median_ns"], "-", "missing"))
+
+    if regressions:
+        print("\n%d regression(s): %s" % (len(regressions), ", ".join(regressions)))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,290 @@
+#ifndef ALGOVISU_BENCH_HARNESS_H
+#define ALGOVISU_BENCH_HARNESS_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+
+#include <boost/io/ios_state.hpp>
+
+
+#ifndef ALGOVISU_BENCH_BUILD_TYPE
+    #define ALGOVISU_BENCH_BUILD_TYPE ""
+#endif
+
+
+namespace tools
+{
+    // Keeps the compiler from optimizing a benchmarked result away.
+    template <typename T>
+    inline void keep(T const& v)
+    {
+#if defined(_MSC_VER)
+        static volatile char const * sink;
+        sink = reinterpret_cast<char const volatile *>(&v);
+#else
+        asm volatile("" : : "g"(&v) : "memory");
+#endif
+    }
+
+    struct bench_options
+    {
+        std::size_t warmup = 3;             // repetitions thrown away
+        std::size_t reps = 15;              // repetitions measured
+        double minRepMs = 20.0;             // a repetition runs at least this long
+        std::string filter;                 // runs the benchmarks whose name has it
+        std::string jsonPath;               // "-" for stdout
+        bool list = false;
+
+        // --warmup N --reps N --min-time MS --filter S --json PATH --list --smoke
+        //
+        // --smoke runs every benchmark once, only to see that it works.
+        bool parse(int argc, char * argv[])
+        {
+            for (int i = 1; i < argc; ++i) {
+                std::string const arg = argv[i];
+                bool const hasValue = i + 1 < argc;
+                if (arg == "--warmup" && hasValue) {
+                    warmup = std::strtoul(argv[++i], nullptr, 10);
+                } else if (arg == "--reps" && hasValue) {
+                    reps = std::max<std::size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+                } else if (arg == "--min-time" && hasValue) {
+                    minRepMs = std::strtod(argv[++i], nullptr);
+                } else if (arg == "--filter" && hasValue) {
+                    filter = argv[++i];
+                } else if (arg == "--json" && hasValue) {
+                    jsonPath = argv[++i];
+                } else if (arg == "--list") {
+                    list = true;
+                } else if (arg == "--smoke") {
+                    warmup = 0;
+                    reps = 1;
+                    minRepMs = 0.0;
+                } else {
+                    std::cerr << "usage: " << argv[0]
+                              << " [--warmup N] [--reps N] [--min-time MS] [--filter S]"
+                                 " [--json PATH] [--list] [--smoke]\n";
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    // The statistics of the repetitions, in nanoseconds per iteration.
+    struct bench_result
+    {
+        std::string name;
+        std::uint64_t iterations = 0;       // per repetition
+        std::uint64_t items = 0;            // per iteration
+        std::uint64_t bytes = 0;            // per iteration
+        std::vector<double> samples;
+
+        double min = 0, median = 0, mean = 0, stddev = 0, p90 = 0, max = 0;
+
+        void summarize()
+        {
+            std::vector<double> s = samples;
+            std::sort(s.begin(), s.end());
+            auto rank = [&s](double q) {
+                std::size_t const r = static_cast<std::size_t>(std::ceil(q * double(s.size())));
+                return s[std::min(s.size() - 1, r ? r - 1 : 0)];
+            };
+            min = s.front();
+            max = s.back();
+            median = s.size() % 2 ? s[s.size() / 2] : (s[s.size() / 2 - 1] + s[s.size() / 2]) / 2.0;
+            p90 = rank(0.9);
+            double sum = 0;
+            for (double v : s) {
+                sum += v;
+            }
+            mean = sum / double(s.size());
+            double var = 0;
+            for (double v : s) {
+                var += (v - mean) * (v - mean);
+            }
+            stddev = s.size() > 1 ? std::sqrt(var / double(s.size() - 1)) : 0.0;
+        }
+    };
+
+    // Registers and runs the benchmarks.
+    //
+    // A benchmark body runs one iteration. The iterations per repetition are
+    // calibrated once so that a repetition takes minRepMs, and every
+    // repetition is timed as a whole. The results are printed at the end.
+    class bench_runner
+    {
+    public:
+        using body_t = std::function<void()>;
+
+        // items and bytes are the amount of the work of an iteration,
+        // to report the throughputs.
+        void add(std::string name, std::uint64_t items, std::uint64_t bytes, body_t body)
+        {
+            benches_.push_back(bench{ std::move(name), items, bytes, std::move(body) });
+        }
+
+        int run(bench_options const& options, std::ostream & os = std::cout)
+        {
+            if (options.list) {
+                for (auto const& b : benches_) {
+                    os << b.name << '\n';
+                }
+                return 0;
+            }
+
+            os << std::left << std::setw(40) << "benchmark"
+               << std::right << std::setw(14) << "median(ns)"
+               << std::setw(14) << "min(ns)"
+               << std::setw(10) << "cv(%)"
+               << std::setw(14) << "ns/item"
+               << std::setw(12) << "MB/s" << '\n';
+
+            std::vector<bench const *> selected;
+            std::vector<bench_result> results;
+            for (auto const& b : benches_) {
+                if (b.name.find(options.filter) != std::string::npos) {
+                    selected.push_back(&b);
+                    results.push_back(calibrate(b, options));
+                }
+            }
+
+            // the repetitions are interleaved, so that a slow phase of
+            // the machine hits every benchmark instead of a few of them.
+            for (std::size_t rep = 0; rep < options.reps; ++rep) {
+                for (std::size_t i = 0; i < selected.size(); ++i) {
+                    double const ns = time_ns(*selected[i], results[i].iterations);
+                    results[i].samples.push_back(ns / double(results[i].iterations));
+                }
+            }
+            for (auto & r : results) {
+                r.summarize();
+                print(os, r);
+            }
+
+            if (!options.jsonPath.empty()) {
+                if (options.jsonPath == "-") {
+                    write_json(std::cout, options, results);
+                } else {
+                    std::ofstream ofs(options.jsonPath);
+                    if (!ofs) {
+                        std::cerr << "Couldn't open file: " << options.jsonPath << std::endl;
+                        return 1;
+                    }
+                    write_json(ofs, options, results);
+                }
+            }
+            return 0;
+        }
+
+    private:
+        struct bench
+        {
+            std::string name;
+            std::uint64_t items;
+            std::uint64_t bytes;
+            body_t body;
+        };
+
+        using clock_t = std::chrono::steady_clock;
+
+        static double time_ns(bench const& b, std::uint64_t iterations)
+        {
+            auto const start = clock_t::now();
+            for (std::uint64_t i = 0; i < iterations; ++i) {
+                b.body();
+            }
+            return std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+        }
+
+        static bench_result calibrate(bench const& b, bench_options const& options)
+        {
+            bench_result r;
+            r.name = b.name;
+            r.items = b.items;
+            r.bytes = b.bytes;
+
+            // grows the iterations until a repetition takes long enough.
+            double const minNs = options.minRepMs * 1e6;
+            std::uint64_t iterations = 1;
+            double ns = time_ns(b, iterations);
+            while (ns < minNs && iterations < (std::uint64_t(1) << 40)) {
+                iterations = ns > 0 ? std::max(iterations * 2, std::uint64_t(double(iterations) * minNs / ns))
+                                    : iterations * 2;
+                ns = time_ns(b, iterations);
+            }
+            r.iterations = iterations;
+
+            for (std::size_t i = 0; i < options.warmup; ++i) {
+                time_ns(b, iterations);
+            }
+            return r;
+        }
+
+        static void print(std::ostream & os, bench_result const& r)
+        {
+            boost::io::ios_flags_saver flagsSaver(os);
+            boost::io::ios_precision_saver precisionSaver(os);
+            double const cv = r.mean > 0 ? r.stddev / r.mean * 100.0 : 0.0;
+            os << std::left << std::setw(40) << r.name
+               << std::right << std::fixed << std::setprecision(1)
+               << std::setw(14) << r.median
+               << std::setw(14) << r.min
+               << std::setw(10) << cv
+               << std::setw(14) << std::setprecision(2) << (r.items ? r.median / double(r.items) : 0.0)
+               << std::setw(12) << std::setprecision(1) << (r.bytes ? double(r.bytes) * 1e3 / r.median : 0.0)
+               << '\n';
+        }
+
+        static void write_json(std::ostream & os,
+                               bench_options const& options,
+                               std::vector<bench_result> const& results)
+        {
+            boost::io::ios_flags_saver flagsSaver(os);
+            boost::io::ios_precision_saver precisionSaver(os);
+            os << "{\n  \"context\": {"
+               << "\"build_type\": \"" << ALGOVISU_BENCH_BUILD_TYPE << '"'
+               << ", \"warmup\": " << options.warmup
+               << ", \"reps\": " << options.reps
+               << ", \"min_rep_ms\": " << options.minRepMs
+               << "},\n  \"benchmarks\": [";
+            os << std::setprecision(10);
+            for (std::size_t i = 0; i < results.size(); ++i) {
+                auto const& r = results[i];
+                os << (i ? ",\n" : "\n")
+                   << "    {\"name\": \"" << r.name << '"'
+                   << ", \"iterations\": " << r.iterations
+                   << ", \"items\": " << r.items
+                   << ", \"bytes\": " << r.bytes
+                   << ", \"min_ns\": " << r.min
+                   << ", \"median_ns\": " << r.median
+                   << ", \"mean_ns\": " << r.mean
+                   << ", \"stddev_ns\": " << r.stddev
+                   << ", \"p90_ns\": " << r.p90
+                   << ", \"max_ns\": " << r.max
+                   << ", \"samples_ns\": [";
+                for (std::size_t j = 0; j < r.samples.size(); ++j) {
+                    os << (j ? ", " : "") << r.samples[j];
+                }
+                os << "]}";
+            }
+            os << "\n  ]\n}\n";
+        }
+
+        std::vector<bench> benches_;
+    };
+} // namespace tools
+
+
+#endif  // ALGOVISU_BENCH_HARNESS_H
@@ -0,0 +1,340 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "calc_aot.h"
+#include "calc_jit.h"
+#include "calc_column_vm.h"
+#include "calc_test_helpers.h"
+#include "calc_generator.h"
+
+#if defined(ALGOVISU_HAS_DLOPEN)
+
+#include <dirent.h>
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+
+    bool has_compiler(calc_aot_compiler const& compiler)
+    {
+        std::string const command = compiler.options().compiler + " --version > /dev/null 2>&1";
+        return std::system(command.c_str()) == 0;
+    }
+
+    std::string test_directory(char const * name)
+    {
+        char const * const tmp = std::getenv("TMPDIR");
+        return std::string(tmp && *tmp ? tmp : "/tmp") + "/" + name + "_" + std::to_string(getpid());
+    }
+
+    // Removes the files of a cached shared object, and the directory.
+    void remove_cached(std::string const& library)
+    {
+        std::string const base = library.substr(0, library.size() - 3);
+        for (char const * extension : { ".so", ".cpp", ".log" }) {
+            std::remove((base + extension).c_str());
+        }
+        rmdir(library.substr(0, library.rfind('/')).c_str());
+    }
+
+    // Some of the literals, to the columns.
+    calc_aot_expression bind_some(calc_ast const& ast, std::uint32_t columns, std::mt19937 & random)
+    {
+        calc_aot_expression e{ ast, {} };
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            if (ast.nodes[i].op == calc_op::literal && random() % 2) {
+                e.columns.push_back(calc_column_binding{ i, static_cast<std::uint32_t>(random() % columns) });
+            }
+        }
+        return e;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc aot source", "[algovisu]")
+{
+    std::string source;
+    calc_aot_source({ calc_aot_expression{ parse("1 + 2 * 3"), {} },
+                      calc_aot_expression{ parse("1 / 2"), { { 0, 0 } } } }, source);
+    REQUIRE(source.find("u64 const v3 = 0x2ull * 0x3ull;") != std::string::npos);
+    REQUIRE(source.find("u64 const v4 = 0x1ull + v3;") != std::string::npos);
+    REQUIRE(source.find("u64 const d2 = 0x2ull;") != std::string::npos);
+    REQUIRE(source.find("u64(i64(u64(c0[row])) / i64(d2))") != std::string::npos);
+    REQUIRE(source.find("static kernel_t const table[] = { kernel0, kernel1 };") != std::string::npos);
+}
+
+TEST_CASE("calc aot cache directory", "[algovisu]")
+{
+    // the default one is of the user.
+    char const * const saved = std::getenv("XDG_CACHE_HOME");
+    std::string const savedValue = saved ? saved : "";
+    setenv("XDG_CACHE_HOME", "/cache/of/user", 1);
+    REQUIRE(calc_aot_compiler().options().cacheDirectory == "/cache/of/user/algovisu_calc_aot");
+    setenv("XDG_CACHE_HOME", "relative", 1);
+    if (char const * const home = std::getenv("HOME")) {
+        REQUIRE(calc_aot_compiler().options().cacheDirectory == std::string(home) + "/.cache/algovisu_calc_aot");
+    }
+    if (saved) {
+        setenv("XDG_CACHE_HOME", savedValue.c_str(), 1);
+    } else {
+        unsetenv("XDG_CACHE_HOME");
+    }
+
+    // the directory the others can write to, or a link to one, is refused
+    // before anything is compiled or loaded.
+    std::vector<calc_aot_expression> const expressions = { { parse("1 + 2"), {} } };
+    std::string const directory = test_directory("algovisu_calc_aot_shared");
+    REQUIRE(mkdir(directory.c_str(), 0700) == 0);
+    REQUIRE(chmod(directory.c_str(), 0777) == 0);
+    calc_aot_options options;
+    options.compiler = "false";
+    options.cacheDirectory = directory;
+    calc_aot_module module;
+    REQUIRE_FALSE(calc_aot_compiler(options).build(expressions, module));
+    REQUIRE(rmdir(directory.c_str()) == 0);
+
+    std::string const link = test_directory("algovisu_calc_aot_link");
+    REQUIRE(mkdir(directory.c_str(), 0700) == 0);
+    REQUIRE(symlink(directory.c_str(), link.c_str()) == 0);
+    options.cacheDirectory = link;
+    REQUIRE_FALSE(calc_aot_compiler(options).build(expressions, module));
+    REQUIRE(std::remove(link.c_str()) == 0);
+    REQUIRE(rmdir(directory.c_str()) == 0);
+
+    // a new one is private, and the failed compile leaves no temporary file
+    // but the source and its log. The flags are not seen by the shell.
+    std::string const marker = test_directory("algovisu_calc_aot_marker");
+    options.cacheDirectory = directory;
+    options.flags = "-O2 $(touch " + marker + ")";
+    REQUIRE_FALSE(calc_aot_compiler(options).build(expressions, module));
+    REQUIRE(access(marker.c_str(), F_OK) != 0);
+    struct stat status;
+    REQUIRE(lstat(directory.c_str(), &status) == 0);
+    REQUIRE((status.st_mode & 0777) == 0700);
+    std::vector<std::string> names;
+    if (DIR * const d = opendir(directory.c_str())) {
+        while (dirent const * const entry = readdir(d)) {
+            if (entry->d_name[0] != '.') {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(d);
+    }
+    REQUIRE(names.size() == 2);
+    std::sort(names.begin(), names.end());
+    REQUIRE(names[0].size() > 4);
+    REQUIRE(names[0].substr(names[0].size() - 4) == ".cpp");
+    REQUIRE(names[1] == names[0].substr(0, names[0].size() - 4) + ".log");
+    for (std::string const& name : names) {
+        std::remove((directory + "/" + name).c_str());
+    }
+    REQUIRE(rmdir(directory.c_str()) == 0);
+}
+
+TEST_CASE("calc aot", "[algovisu]")
+{
+    calc_aot_options options;
+    options.cacheDirectory = test_directory("algovisu_calc_aot_test");
+    calc_aot_compiler compiler(options);
+    if (!has_compiler(compiler)) {
+        WARN("no " << compiler.options().compiler << " to build the kernels with");
+        return;
+    }
+
+    std::vector<calc_aot_expression> expressions = {
+        { parse("1 / 1"), { { 0, 0 }, { 1, 1 } } },
+        { parse("42"), {} },
+        { parse("8 / 0"), {} },
+        { parse("5"), { { 0, 2 } } }
+    };
+    calc_generator_options generatorOptions;
+    generatorOptions.seed = 37;
+    generatorOptions.group = 0.3;
+    calc_generator generator(generatorOptions);
+    std::mt19937 random(37);
+    std::string line;
+    for (int i = 0; i < 40; ++i) {
+        line.clear();
+        generator.next(line);
+        expressions.push_back(bind_some(parse(line), 3, random));
+    }
+
+    calc_aot_module module;
+    REQUIRE(compiler.build(expressions, module));
+    REQUIRE_FALSE(module.cached());
+    REQUIRE(module.size() == expressions.size());
+
+    // the same rows as calc_column_vm, on the columns of the edge values.
+    calc_value_t const edges[] = {
+        0, 1, -1, 2, 3, -7, std::numeric_limits<calc_value_t>::min(), std::numeric_limits<calc_value_t>::max()
+    };
+    std::size_t const rows = 300;
+    std::mt19937_64 values(41);
+    std::vector<std::vector<calc_value_t>> columns(3, std::vector<calc_value_t>(rows));
+    for (auto & c : columns) {
+        for (calc_value_t & v : c) {
+            v = values() % 4 ? static_cast<calc_value_t>(values() % 64) - 2 : edges[values() % 8];
+        }
+    }
+    calc_value_t const * pointers[] = { columns[0].data(), columns[1].data(), columns[2].data() };
+    calc_register_compiler registerCompiler;
+    calc_register_program program;
+    calc_column_vm vm;
+    std::vector<calc_value_t> expected(rows);
+    std::vector<calc_value_t> out(rows);
+    for (std::size_t k = 0; k < expressions.size(); ++k) {
+        registerCompiler.compile(expressions[k].ast, expressions[k].columns, program);
+        std::size_t const done = vm.run(program, pointers, rows, expected.data());
+        REQUIRE(module.run(k, pointers, rows, out.data()) == done);
+        for (std::size_t row = 0; row < done; ++row) {
+            REQUIRE(out[row] == expected[row]);
+        }
+    }
+    REQUIRE(module.run(1, pointers, rows, out.data()) == rows);
+    REQUIRE(out[0] == 42);
+    REQUIRE(module.run(2, pointers, rows, out.data()) == 0);
+    REQUIRE(module.run(3, pointers, rows, out.data()) == rows);
+    REQUIRE(out == columns[2]);
+
+    // the same set is loaded from the cache, and an other one isn't.
+    calc_aot_module again;
+    REQUIRE(compiler.build(expressions, again));
+    REQUIRE(again.cached());
+    REQUIRE(again.path() == module.path());
+    std::string const library = module.path();
+    module.close();
+    again.close();
+    remove_cached(library);
+}
+
+// The time of a job of 64 expressions over a quarter million rows each,
+// with the compile step, by the interpreters, the jit and the aot kernels.
+TEST_CASE("calc aot job", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+    auto since = [](clock_t::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+    };
+
+    calc_aot_options options;
+    options.cacheDirectory = test_directory("algovisu_calc_aot_bench");
+    calc_aot_compiler compiler(options);
+    if (!has_compiler(compiler)) {
+        WARN("no " << compiler.options().compiler << " to build the kernels with");
+        return;
+    }
+
+    std::size_t const rows = 1 << 18;
+    std::mt19937_64 values(43);
+    std::vector<std::vector<calc_value_t>> columns(4, std::vector<calc_value_t>(rows));
+    for (auto & c : columns) {
+        for (calc_value_t & v : c) {
+            v = static_cast<calc_value_t>(values() % 1000) + 1;
+        }
+    }
+    calc_value_t const * pointers[] = { columns[0].data(), columns[1].data(), columns[2].data(), columns[3].data() };
+
+    // no division, so every row is evaluated.
+    calc_generator_options generatorOptions;
+    generatorOptions.seed = 47;
+    generatorOptions.opWeights = { { 1, 1, 1, 0 } };
+    generatorOptions.minTokens = 20;
+    generatorOptions.maxTokens = 120;
+    calc_generator generator(generatorOptions);
+    std::mt19937 random(47);
+    std::vector<calc_aot_expression> expressions;
+    std::size_t nodes = 0;
+    std::string line;
+    for (int i = 0; i < 64; ++i) {
+        line.clear();
+        generator.next(line);
+        expressions.push_back(bind_some(parse(line), 4, random));
+        nodes += expressions.back().ast.size();
+    }
+    std::printf("%zu expressions of %zu nodes, %zu rows each\n", expressions.size(), nodes, rows);
+
+    std::vector<calc_value_t> out(rows);
+    calc_value_t check = 0;
+    auto report = [&](char const * name, double compileMs, double totalMs) {
+        std::printf("  %-20s %9.1f ms, compile %8.1f ms, %7.1f M rows/s (%lld)\n", name, totalMs, compileMs,
+                    double(rows * expressions.size()) / (totalMs - compileMs) / 1000, (long long)check);
+    };
+
+    {
+        auto const start = clock_t::now();
+        calc_register_compiler registerCompiler;
+        std::vector<calc_register_program> programs(expressions.size());
+        for (std::size_t k = 0; k < expressions.size(); ++k) {
+            registerCompiler.compile(expressions[k].ast, expressions[k].columns, programs[k]);
+        }
+        double const compileMs = since(start);
+        check = 0;
+        calc_register_vm vm;
+        for (calc_register_program const& program : programs) {
+            for (std::size_t row = 0; row < rows; ++row) {
+                vm.run(program, pointers, row, out[row]);
+            }
+            check += out[rows - 1];
+        }
+        report("register vm by row", compileMs, since(start));
+    }
+    {
+        auto const start = clock_t::now();
+        calc_register_compiler registerCompiler;
+        std::vector<calc_register_program> programs(expressions.size());
+        for (std::size_t k = 0; k < expressions.size(); ++k) {
+            registerCompiler.compile(expressions[k].ast, expressions[k].columns, programs[k]);
+        }
+        double const compileMs = since(start);
+        check = 0;
+        calc_column_vm vm;
+        for (calc_register_program const& program : programs) {
+            vm.run(program, pointers, rows, out.data());
+            check += out[rows - 1];
+        }
+        report("column vm", compileMs, since(start));
+    }
+#if defined(ALGOVISU_HAS_CALC_JIT)
+    {
+        auto const start = clock_t::now();
+        calc_jit jit;
+        std::vector<calc_jit_kernel> kernels(expressions.size());
+        for (std::size_t k = 0; k < expressions.size(); ++k) {
+            jit.compile(expressions[k].ast, expressions[k].columns, kernels[k]);
+        }
+        double const compileMs = since(start);
+        check = 0;
+        for (calc_jit_kernel const& kernel : kernels) {
+            kernel.run(pointers, rows, out.data());
+            check += out[rows - 1];
+        }
+        report("jit", compileMs, since(start));
+    }
+#endif
+    std::string library;
+    for (char const * name : { "aot, compiled", "aot, cached" }) {
+        auto const start = clock_t::now();
+        calc_aot_module module;
+        REQUIRE(compiler.build(expressions, module));
+        double const compileMs = since(start);
+        check = 0;
+        for (std::size_t k = 0; k < module.size(); ++k) {
+            module.run(k, pointers, rows, out.data());
+            check += out[rows - 1];
+        }
+        report(name, compileMs, since(start));
+        library = module.path();
+    }
+    remove_cached(library);
+}
+
+#endif
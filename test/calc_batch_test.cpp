@@ -0,0 +1,69 @@
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#include "calc_batch.h"
+#include "calc_generator.h"
+#include "calc_pipeline.h"
+
+
+TEST_CASE("calc batch executor keeps the order of the input", "[algovisu]")
+{
+    using namespace algovisu;
+
+    calc_generator_options generatorOptions;
+    generatorOptions.invalid = 0.1;
+    std::string input;
+    calc_generator(generatorOptions).generate(200000, input);
+    // the blank lines, a line longer than a batch and no newline at the end.
+    input += "\n   \n";
+    for (int i = 0; i < 100; ++i) {
+        input += "1 + ";
+    }
+    input += "1\n7 $ 2\n2 * 3";
+
+    std::string expected;
+    calc_pipeline<> pipeline;
+    std::istringstream lines(input);
+    for (std::string line; std::getline(lines, line); ) {
+        calc_value_t result = 0;
+        if (line.find_first_not_of(" ") == std::string::npos) {
+            continue;
+        }
+        expected += pipeline.run(line, result) ? std::to_string(result) : "error";
+        expected += '\n';
+    }
+
+    std::vector<calc_batch_options> modes(5);
+    modes[0].stages.clear();                                        // serial
+    modes[2].stages = { { batch_lex, 2 }, { batch_parse, 3 },
+                        { batch_evaluate | batch_format, 2 } };
+    modes[3].stages = { { batch_all, 3 } };                         // data parallel
+    modes[4].stages = { { batch_lex | batch_parse, 2 }, { batch_evaluate, 1 }, { batch_format, 3 } };
+    modes[4].ringCapacity = 1;
+    modes[4].batches = 3;
+    for (auto & options : modes) {
+        options.batchBytes = 300;
+        calc_batch_executor<> executor(options);
+        for (int run = 0; run < 2; ++run) {
+            std::istringstream in(input);
+            std::ostringstream out;
+            std::uint64_t const expressions = executor.run(in, out);
+            REQUIRE(out.str() == expected);
+            REQUIRE(expressions == std::uint64_t(std::count(expected.begin(), expected.end(), '\n')));
+        }
+
+        auto const stages = executor.utilization();
+        REQUIRE(stages.size() == options.stages.size() + 2);
+        REQUIRE(stages.front().name == "read");
+        REQUIRE(stages.back().name == "write");
+        for (auto const& stage : stages) {
+            REQUIRE(stage.batches > input.size() / 300 / 2);
+            REQUIRE(stage.utilization() > 0.0);
+            REQUIRE(stage.utilization() <= 1.0);
+        }
+    }
+}
@@ -0,0 +1,306 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "calc_pipeline.h"
+#include "calc_generator.h"
+#include "calc_output.h"
+#include "debug_utility.h"
+#include "bench_harness.h"
+
+
+namespace
+{
+    using namespace algovisu;
+
+    using lexer_impl_t = lex::lexertl::lexer<>;
+    using lexer_def_t = calc_token<lexer_impl_t>;
+
+    // The shapes of the generated expressions.
+    //
+    //  flat: a long chain of + and -
+    //  product: a long chain of * and /
+    //  nested: + and - in the groups nested up to 32 levels
+    //  mixed: +, - and * in the groups nested up to 8 levels
+    //
+    // NOTE: only product divides, by the literals. A long expression almost
+    //          always has a group of zero, like (3 / 5), to divide by.
+    enum class corpus_shape
+    {
+        flat,
+        product,
+        nested,
+        mixed
+    };
+
+    char const * to_string(corpus_shape shape)
+    {
+        static char const * const names[] = { "flat", "product", "nested", "mixed" };
+        return names[static_cast<int>(shape)];
+    }
+
+    calc_generator_options corpus_options(corpus_shape shape, std::size_t tokens, std::uint64_t seed)
+    {
+        calc_generator_options options;
+        options.seed = seed;
+        options.minTokens = tokens;
+        options.maxTokens = tokens;
+        switch (shape) {
+            case corpus_shape::flat:
+                options.group = 0.0;
+                options.opWeights = { { 1, 1, 0, 0 } };
+                break;
+            case corpus_shape::product:
+                options.group = 0.0;
+                options.opWeights = { { 0, 0, 1, 1 } };
+                break;
+            case corpus_shape::nested:
+                options.group = 0.3;
+                options.maxDepth = 32;
+                options.opWeights = { { 1, 1, 0, 0 } };
+                break;
+            case corpus_shape::mixed:
+                options.opWeights = { { 1, 1, 1, 0 } };
+                break;
+        }
+        return options;
+    }
+
+    // The lines of the default generator options, `bytes` long in total.
+    std::string make_corpus_lines(std::size_t bytes)
+    {
+        std::string s;
+        calc_generator generator;
+        generator.generate(bytes, s);
+        return s;
+    }
+
+    std::vector<std::string> split_lines(std::string const& s)
+    {
+        std::vector<std::string> lines;
+        std::size_t first = 0;
+        for (std::size_t i = 0; i < s.size(); ++i) {
+            if (s[i] == '\n') {
+                lines.emplace_back(s, first, i - first);
+                first = i + 1;
+            }
+        }
+        return lines;
+    }
+
+    std::string write_temp_file(std::string const& name, std::string const& content)
+    {
+        // the time in the name keeps the concurrent runs apart.
+        static auto const stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+        std::string const path = (std::getenv("TMPDIR") ? std::string(std::getenv("TMPDIR")) : "/tmp")
+                                    + "/algovisu_bench_" + std::to_string(stamp) + "_" + name + ".txt";
+        std::ofstream ofs(path, std::ios::binary);
+        ofs.write(content.data(), static_cast<std::streamsize>(content.size()));
+        return path;
+    }
+
+    // The state shared by the micro benchmarks of an expression.
+    struct micro_case
+    {
+        std::string input;
+        lexer_def_t tokens;
+        calc_grammar<lexer_def_t> grammar{ tokens };
+        calc_buffer_grammar<lexer_def_t> bufferGrammar{ tokens };
+        calc_token_buffer<lexer_def_t> buffer;
+        calc_ast ast;
+        calc_evaluator evaluator;
+    };
+
+    void add_micro_benchmarks(tools::bench_runner & runner,
+                              std::vector<std::unique_ptr<micro_case>> & cases,
+                              corpus_shape shape,
+                              std::size_t tokens)
+    {
+        cases.emplace_back(new micro_case);
+        micro_case & c = *cases.back();
+
+        // prepares the buffer and the AST for the later stages.
+        // the seed is changed until the expression can be evaluated.
+        for (std::uint64_t seed = 1; ; ++seed) {
+            if (seed > 100) {
+                std::cerr << "no valid corpus: " << to_string(shape) << '\n';
+                std::exit(1);
+            }
+            c.input.clear();
+            calc_generator(corpus_options(shape, tokens, seed)).next(c.input);
+            c.buffer.clear();
+            c.ast.clear();
+            calc_value_t result = 0;
+            if (lex_calc(c.tokens, c.input.data(), c.input.data() + c.input.size(), c.buffer)
+                    && parse_calc(c.bufferGrammar, c.buffer, c.ast)
+                    && c.evaluator.evaluate(c.ast, result)) {
+                break;
+            }
+        }
+        char const * first = c.input.data();
+        char const * last = first + c.input.size();
+
+        std::string const suffix = std::string("/") + to_string(shape) + "/" + std::to_string(tokens);
+        std::uint64_t const bytes = c.input.size();
+
+        runner.add("lex" + suffix, c.buffer.size(), bytes, [&c, first, last] {
+            c.buffer.clear();
+            bool const r = lex_calc(c.tokens, first, last, c.buffer);
+            tools::keep(r);
+        });
+
+        runner.add("grammar" + suffix, c.buffer.size(), bytes, [&c, first, last] {
+            char const * pBegin = first;
+            auto iter = c.tokens.begin(pBegin, last);
+            auto end = c.tokens.end();
+            bool const r = qi::phrase_parse(iter, end, c.grammar, qi::in_state("WS")[c.tokens.self]);
+            tools::keep(r);
+        });
+
+        runner.add("parse" + suffix, c.buffer.size(), 0, [&c] {
+            c.ast.clear();
+            bool const r = parse_calc(c.bufferGrammar, c.buffer, c.ast);
+            tools::keep(r);
+        });
+
+        runner.add("evaluate" + suffix, c.ast.size(), 0, [&c] {
+            calc_value_t result = 0;
+            bool const r = c.evaluator.evaluate(c.ast, result);
+            tools::keep(r);
+            tools::keep(result);
+        });
+    }
+}   // un-named namespace
+
+
+// micro: lex, grammar(recognition only), parse(to the AST) and evaluate
+//          of an expression for every shape and size.
+// macro: calc_generator, read_from_file and the whole pipeline over
+//          the lines of a corpus.
+// output: the results of the corpus by iostream, std::to_string and
+//          calc_result_writer.
+int main(int argc, char * argv[])
+{
+    tools::bench_options options;
+    if (!options.parse(argc, argv)) {
+        return 2;
+    }
+
+    tools::bench_runner runner;
+
+    std::vector<std::unique_ptr<micro_case>> cases;
+    for (corpus_shape shape : { corpus_shape::flat, corpus_shape::product,
+                                corpus_shape::nested, corpus_shape::mixed }) {
+        for (std::size_t tokens : { 16, 1024, 65536 }) {
+            add_micro_benchmarks(runner, cases, shape, tokens);
+        }
+    }
+
+    std::string generated;
+    runner.add("generate/lines/4096k", 1, std::size_t(4) << 20, [&generated] {
+        generated.clear();
+        calc_generator generator;
+        generator.generate(std::size_t(4) << 20, generated);
+        tools::keep(generated);
+    });
+
+    std::vector<std::string> paths;
+    for (std::size_t bytes : { std::size_t(64) << 10, std::size_t(4) << 20 }) {
+        std::string const corpus = make_corpus_lines(bytes);
+        std::string const name = std::to_string(bytes >> 10) + "k";
+        std::string const path = write_temp_file(name, corpus);
+        paths.push_back(path);
+
+        runner.add("read_from_file/" + name, 1, corpus.size(), [path] {
+            std::string const s = read_from_file(path.c_str());
+            tools::keep(s);
+        });
+    }
+
+    std::string const corpus = make_corpus_lines(std::size_t(4) << 20);
+    auto const lines = split_lines(corpus);
+    calc_pipeline<> pipeline;
+
+    runner.add("pipeline/lines/4096k", lines.size(), corpus.size(), [&lines, &pipeline] {
+        calc_value_t result = 0;
+        for (auto const& line : lines) {
+            pipeline.run(line, result);
+        }
+        tools::keep(result);
+    });
+
+    // the same corpus, read from the file.
+    std::string const path = paths.back();
+    runner.add("pipeline/file/4096k", lines.size(), corpus.size(), [path, &pipeline] {
+        std::string const s = pipeline.read(path.c_str());
+        calc_value_t result = 0;
+        char const * first = s.data();
+        for (char const * p = first; p != s.data() + s.size(); ++p) {
+            if (*p == '\n') {
+                pipeline.run(first, p, result);
+                first = p + 1;
+            }
+        }
+        tools::keep(result);
+    });
+
+    // the results of the corpus, and the output size of them.
+    std::vector<calc_value_t> results;
+    std::size_t outputBytes = 0;
+    for (auto const& line : lines) {
+        calc_value_t result = 0;
+        if (pipeline.run(line, result)) {
+            results.push_back(result);
+            outputBytes += std::to_string(result).size() + 1;
+        }
+    }
+
+    std::ostringstream oss;
+    runner.add("output/iostream/4096k", results.size(), outputBytes, [&results, &oss] {
+        oss.str(std::string());
+        for (calc_value_t v : results) {
+            oss << v << '\n';
+        }
+        tools::keep(oss);
+    });
+
+    std::string output;
+    runner.add("output/to_string/4096k", results.size(), outputBytes, [&results, &output] {
+        output.clear();
+        for (calc_value_t v : results) {
+            output += std::to_string(v);
+            output += '\n';
+        }
+        tools::keep(output);
+    });
+
+    struct null_sink
+    {
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                tools::keep(blocks[i].data);
+            }
+            return true;
+        }
+    };
+    null_sink sink;
+    runner.add("output/digit_pairs/4096k", results.size(), outputBytes, [&results, &sink] {
+        calc_result_writer<null_sink> writer(sink, 256 * 1024);
+        for (calc_value_t v : results) {
+            writer.value(v);
+        }
+    });
+
+    int const r = runner.run(options);
+    for (auto const& p : paths) {
+        std::remove(p.c_str());
+    }
+    return r;
+}
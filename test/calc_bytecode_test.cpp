@@ -0,0 +1,70 @@
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+
+#include "calc_bytecode.h"
+#include "calc_pipeline.h"
+#include "calc_generator.h"
+
+
+TEST_CASE("calc bytecode", "[algovisu]")
+{
+    using namespace algovisu;
+
+    calc_pipeline<> pipeline;
+    calc_program program;
+    calc_vm vm;
+    calc_value_t result = 0;
+
+    // the operands in order, and the stack as high as the nesting.
+    REQUIRE(pipeline.lex("1 + 2 * 3", "1 + 2 * 3" + 9));
+    REQUIRE(pipeline.parse());
+    compile_calc(pipeline.ast(), program);
+    REQUIRE(program.size() == 5);
+    REQUIRE(program.code[0].op == calc_opcode::push);
+    REQUIRE(program.code[0].value == 1);
+    REQUIRE(program.code[2].value == 3);
+    REQUIRE(program.code[3].op == calc_opcode::mul);
+    REQUIRE(program.code[4].op == calc_opcode::add);
+    REQUIRE(program.stackDepth == 3);
+    REQUIRE(vm.run(program, result));
+    REQUIRE(result == 7);
+
+    REQUIRE(pipeline.run(std::string("7 / (3 - 3)"), result) == false);
+    compile_calc(pipeline.ast(), program);
+    REQUIRE(vm.run(program, result) == false);
+
+    calc_program empty;
+    REQUIRE(vm.run(empty, result) == false);
+
+    // the same results as the evaluator.
+    calc_generator_options options;
+    options.seed = 11;
+    options.group = 0.3;
+    calc_generator generator(options);
+    std::string line;
+    for (int i = 0; i < 2000; ++i) {
+        line.clear();
+        generator.next(line);
+        calc_value_t expected = 0;
+        bool const ok = pipeline.run(line, expected);
+        compile_calc(pipeline.ast(), program);
+        calc_value_t actual = 0;
+        REQUIRE(vm.run(program, actual) == ok);
+        if (ok) {
+            REQUIRE(actual == expected);
+        }
+    }
+
+    // a chain, which the compiler walks without the recursion.
+    std::string chain = "1";
+    for (int i = 0; i < 200000; ++i) {
+        chain += "-1";
+    }
+    REQUIRE(pipeline.run(chain, result));
+    compile_calc(pipeline.ast(), program);
+    REQUIRE(program.stackDepth == 2);
+    REQUIRE(vm.run(program, result));
+    REQUIRE(result == -199999);
+}
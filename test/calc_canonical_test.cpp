@@ -0,0 +1,278 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+#include "calc_canonical.h"
+#include "calc_printer.h"
+#include "calc_stream.h"
+#include "calc_bytecode.h"
+#include "calc_generator.h"
+#include "calc_code_cache.h"
+
+
+namespace
+{
+    using namespace algovisu;
+
+    struct string_sink
+    {
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                s.append(blocks[i].data, blocks[i].size);
+            }
+            return true;
+        }
+
+        std::string s;
+    };
+
+    std::vector<calc_ast> parse_lines(std::string const& input)
+    {
+        std::vector<calc_ast> asts;
+        calc_push_parser parser;
+        auto on_expression = [&asts](calc_ast const& ast, bool ok) {
+            if (ok) {
+                asts.push_back(ast);
+            }
+        };
+        parser.push(input.data(), input.data() + input.size(), on_expression);
+        parser.finish(on_expression);
+        return asts;
+    }
+
+    calc_ast parse(std::string const& text)
+    {
+        auto asts = parse_lines(text);
+        REQUIRE(asts.size() == 1);
+        return asts[0];
+    }
+
+    std::string print(calc_ast const& ast)
+    {
+        string_sink sink;
+        {
+            calc_printer<string_sink> printer(sink);
+            printer.print(ast);
+        }
+        return sink.s;
+    }
+
+    // the same results, or the same failure.
+    void require_same_value(calc_ast const& a, calc_ast const& b)
+    {
+        calc_value_t x = 0;
+        calc_value_t y = 0;
+        bool const ok = evaluate(a, x);
+        REQUIRE(evaluate(b, y) == ok);
+        if (ok) {
+            REQUIRE(x == y);
+        }
+    }
+
+    // The operands of + and * swapped at random, which are the same expression.
+    void shuffle_operands(calc_ast & ast, std::uint64_t & x)
+    {
+        for (calc_node & node : ast.nodes) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            if (calc_is_commutative(node.op) && (x & 1)) {
+                std::swap(node.lhs, node.rhs);
+            }
+        }
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc canonical form", "[algovisu]")
+{
+    calc_canonicalizer canonicalizer;
+    calc_ast a, b;
+
+    std::vector<std::pair<char const *, char const *>> const same{
+        { "1 + 2", "2+1" },
+        { "(1 + 2) + 3", "1 + (2 + 3)" },
+        { "2 * 3 * (4 - 1)", "(4 - 1) * 3 * 2" },
+        { "2 * 3 * (4 - 1)", "6 * (4 - 1)" },
+        { "(7 - 1) * (2 - 1) * 1", "(2 - 1) * (7 - 1)" },
+        { "(7 / 2) + 0 + (1 - 1)", "(1 - 1) + 7 / 2" },
+        { "(7 / 2) + 0 + 0", "0 + 7 / 2" },
+        { "(1 + 2) * (5 / 0)", "3 * (5 / 0)" },
+        { "(8 - 1) * (9 - 2) + (8 / 4)", "8 / 4 + (9 - 2) * (8 - 1)" },
+        { "18446744073709551615 * 5", "18446744073709551611 * 1 + 0" },    // -1 * 5 is -5
+        { "2 + 1 + 5", "8" }
+    };
+    for (auto const& c : same) {
+        calc_ast const x = parse(c.first);
+        calc_ast const y = parse(c.second);
+        std::uint64_t const hx = canonicalizer.canonicalize(x, a);
+        std::uint64_t const hy = canonicalizer.canonicalize(y, b);
+        INFO(c.first << " : " << c.second);
+        REQUIRE(hx == hy);
+        REQUIRE(print(a) == print(b));
+        require_same_value(x, a);
+        require_same_value(y, b);
+    }
+    REQUIRE(print(a) == "8");
+
+    std::vector<std::pair<char const *, char const *>> const different{
+        { "5 - 3", "3 - 5" },
+        { "6 / 3", "3 / 6" },
+        { "1 + 2 * 3", "(1 + 2) * 3" },
+        { "(9 - 1) - 2", "9 - (1 - 2)" },
+        { "(5 - 4) * 2", "(5 - 4) * 3" },
+        { "(7 - 1) * 1", "7 - 1" }
+    };
+    for (auto const& c : different) {
+        INFO(c.first << " : " << c.second);
+        REQUIRE(canonicalizer.canonicalize(parse(c.first), a) != canonicalizer.canonicalize(parse(c.second), b));
+    }
+}
+
+TEST_CASE("calc canonical form of the shuffled", "[algovisu]")
+{
+    calc_generator_options options;
+    options.seed = 9;
+    options.group = 0.3;
+    options.maxDigits = 2;
+    std::string input;
+    calc_generator(options).generate(200000, input);
+    auto asts = parse_lines(input);
+    REQUIRE(asts.size() > 500);
+
+    calc_canonicalizer canonicalizer;
+    calc_ast canonical, shuffled, again;
+    std::uint64_t x = 1;
+    for (auto & ast : asts) {
+        std::uint64_t const h = canonicalizer.canonicalize(ast, canonical);
+        require_same_value(ast, canonical);
+
+        // idempotent.
+        REQUIRE(canonicalizer.canonicalize(canonical, again) == h);
+        REQUIRE(print(again) == print(canonical));
+
+        shuffled = ast;
+        shuffle_operands(shuffled, x);
+        REQUIRE(canonicalizer.canonicalize(shuffled, again) == h);
+        REQUIRE(print(again) == print(canonical));
+    }
+
+    // the long chains without the recursion.
+    std::string chain = "(2-1)";
+    for (int i = 0; i < 300000; ++i) {
+        chain += i % 2 ? "+(2-1)" : "+3";
+    }
+    calc_ast const ast = parse(chain);
+    canonicalizer.canonicalize(ast, canonical);
+    REQUIRE(canonical.size() == 150001 * 3 + 1 + 150001);  // (2-1) x 150001, a literal, and + x 150001
+    require_same_value(ast, canonical);
+}
+
+// NOTE: the hit rates are of a cache with no limit, so 1 - distinct / total.
+TEST_CASE("calc canonical hit rate", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    calc_canonicalizer canonicalizer;
+    calc_ast canonical;
+
+    auto report = [](char const * name, std::size_t distinct, std::size_t total) {
+        std::printf("    %-20s %9zu distinct, hit rate %5.1f%%\n",
+                    name, distinct, 100.0 * (1.0 - double(distinct) / double(total)));
+    };
+
+    auto count_keys = [&](std::vector<std::string> const& lines) {
+        std::unordered_set<std::string> raw, blank, printed;
+        std::unordered_set<std::uint64_t> canonicals;
+        std::string text;
+        std::string joined;
+        for (auto const& line : lines) {
+            raw.insert(line);
+            calc_normalize_text(line.data(), line.data() + line.size(), text);
+            blank.insert(text);
+            joined += line;
+            joined += '\n';
+        }
+        for (auto const& ast : parse_lines(joined)) {
+            printed.insert(print(ast));
+            canonicals.insert(canonicalizer.canonicalize(ast, canonical));
+        }
+        report("raw bytes", raw.size(), lines.size());
+        report("without blanks", blank.size(), lines.size());
+        report("printed", printed.size(), lines.size());
+        report("canonical", canonicals.size(), lines.size());
+    };
+
+    // the short expressions, which repeat by themselves.
+    {
+        calc_generator_options options;
+        options.maxTokens = 7;
+        options.maxDigits = 1;
+        options.group = 0.2;
+        calc_generator generator(options);
+        std::vector<std::string> lines(500000);
+        for (auto & line : lines) {
+            generator.next(line);
+        }
+        std::cout << "short expressions, " << lines.size() << " lines\n";
+        count_keys(lines);
+    }
+
+    // the requests of a hot set, with the operands in any order.
+    {
+        calc_generator_options options;
+        options.maxTokens = 30;
+        std::string input;
+        calc_generator(options).generate(1 << 20, input);
+        auto const hot = parse_lines(input);
+        std::vector<std::string> lines(200000);
+        std::uint64_t x = 7;
+        calc_ast shuffled;
+        for (auto & line : lines) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            shuffled = hot[x % hot.size()];
+            shuffle_operands(shuffled, x);
+            line = print(shuffled);
+        }
+        std::cout << "requests of " << hot.size() << " expressions in any order, " << lines.size() << " lines\n";
+        count_keys(lines);
+    }
+
+    // the cost per node, against the compiler.
+    {
+        std::string input;
+        calc_generator().generate(std::size_t(10) << 20, input);
+        auto const asts = parse_lines(input);
+        std::size_t nodes = 0;
+        for (auto const& ast : asts) {
+            nodes += ast.size();
+        }
+        for (int round = 0; round < 2; ++round) {
+            auto start = clock_t::now();
+            std::uint64_t sum = 0;
+            for (auto const& ast : asts) {
+                sum += canonicalizer.canonicalize(ast, canonical);
+            }
+            double const canonicalNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+
+            calc_compiler compiler;
+            calc_program program;
+            start = clock_t::now();
+            for (auto const& ast : asts) {
+                compiler.compile(ast, program);
+                sum += program.size();
+            }
+            double const compileNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+            std::printf("%zu nodes: canonicalize %.1f ns/node, compile %.1f ns/node (%llu)\n",
+                        nodes, canonicalNs / double(nodes), compileNs / double(nodes),
+                        static_cast<unsigned long long>(sum % 10));
+        }
+    }
+}
@@ -0,0 +1,289 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "calc_code_cache.h"
+#include "calc_pipeline.h"
+#include "calc_generator.h"
+#include "cycle_clock.h"
+#include "latency_histogram.h"
+
+
+TEST_CASE("calc text hash", "[algovisu]")
+{
+    using namespace algovisu;
+
+    // the reference vectors of SipHash-2-4-128, with the key 00 01 .. 0f.
+    std::uint64_t const k0 = 0x0706050403020100ull;
+    std::uint64_t const k1 = 0x0f0e0d0c0b0a0908ull;
+    calc_hash128 const h0 = siphash128("", 0, k0, k1);
+    REQUIRE(h0.lo == 0xe6a825ba047f81a3ull);
+    REQUIRE(h0.hi == 0x930255c71472f66dull);
+    unsigned char const one = 0;
+    calc_hash128 const h1 = siphash128(&one, 1, k0, k1);
+    REQUIRE(h1.lo == 0x44af996bd8c187daull);
+
+    std::string a, b;
+    calc_normalize_text(" 1 +\t2 ", " 1 +\t2 " + 7, a);
+    calc_normalize_text("1+2", "1+2" + 3, b);
+    REQUIRE(a == "1+2");
+    REQUIRE(calc_text_hash(a.data(), a.size()) == calc_text_hash(b.data(), b.size()));
+    REQUIRE(calc_text_hash("1+2", 3) != calc_text_hash("2+1", 3));
+
+    // the literals apart aren't the one literal.
+    calc_normalize_text("1 2", "1 2" + 3, a);
+    calc_normalize_text("12", "12" + 2, b);
+    REQUIRE(a == "1 2");
+    REQUIRE(calc_text_hash(a.data(), a.size()) != calc_text_hash(b.data(), b.size()));
+    std::string const spaced = " 1 \t 0 *( 2 ) ";
+    calc_normalize_text(spaced.data(), spaced.data() + spaced.size(), a);
+    REQUIRE(a == "1 0*(2)");
+}
+
+#if defined(ALGOVISU_HAS_MMAP)
+namespace
+{
+    using namespace algovisu;
+
+    std::string cache_path(char const * name)
+    {
+        return std::string(P_tmpdir) + "/algovisu_" + name + "_" + std::to_string(::getpid());
+    }
+
+    calc_program compile_text(calc_pipeline<> & pipeline, std::string const& text)
+    {
+        calc_program program;
+        if (pipeline.lex(text.data(), text.data() + text.size()) && pipeline.parse()) {
+            compile_calc(pipeline.ast(), program);
+        }
+        return program;
+    }
+
+    calc_value_t run_view(calc_vm & vm, calc_code_view const& view)
+    {
+        calc_value_t result = 0;
+        REQUIRE(vm.run(view.code, view.size, view.stackDepth, result));
+        return result;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc code cache", "[algovisu]")
+{
+    std::string const path = cache_path("code_cache_test");
+    std::remove(path.c_str());
+
+    calc_pipeline<> pipeline;
+    calc_vm vm;
+    std::vector<std::string> texts;
+    std::vector<calc_value_t> values;
+    calc_generator_options options;
+    options.seed = 3;
+    options.opWeights = { { 1, 1, 1, 0 } };
+    calc_generator generator(options);
+    for (int i = 0; i < 3000; ++i) {
+        std::string line;
+        generator.next(line);
+        std::string text;
+        calc_normalize_text(line.data(), line.data() + line.size(), text);
+        calc_value_t v = 0;
+        REQUIRE(pipeline.run(line, v));
+        texts.push_back(text);
+        values.push_back(v);
+    }
+
+    calc_code_view view;
+    {
+        calc_code_cache writer;
+        REQUIRE(writer.open(path.c_str(), true));
+        REQUIRE(writer.size() == 0);
+        for (std::size_t i = 0; i < 2000; ++i) {
+            REQUIRE(writer.append(texts[i].data(), texts[i].size(), compile_text(pipeline, texts[i])));
+        }
+        REQUIRE(writer.append(texts[0].data(), texts[0].size(), compile_text(pipeline, texts[0])));
+        REQUIRE(writer.size() <= 2000);
+        for (std::size_t i = 0; i < 2000; ++i) {
+            REQUIRE(writer.find(texts[i].data(), texts[i].size(), view));
+            REQUIRE(run_view(vm, view) == values[i]);
+        }
+        REQUIRE_FALSE(writer.find(texts[2500].data(), texts[2500].size(), view));
+
+        // a single writer at a time.
+        calc_code_cache second;
+        REQUIRE_FALSE(second.open(path.c_str(), true));
+
+        // a reader sees the appends after it's opened by refresh().
+        calc_code_cache reader;
+        REQUIRE(reader.open(path.c_str(), false));
+        REQUIRE(reader.size() == writer.size());
+        REQUIRE_FALSE(reader.append(texts[2500].data(), texts[2500].size(), compile_text(pipeline, texts[2500])));
+        for (std::size_t i = 2000; i < 2500; ++i) {
+            REQUIRE(writer.append(texts[i].data(), texts[i].size(), compile_text(pipeline, texts[i])));
+        }
+        REQUIRE(writer.sync());
+        REQUIRE_FALSE(reader.find(texts[2400].data(), texts[2400].size(), view));
+        REQUIRE(reader.refresh());
+        REQUIRE(reader.size() == writer.size());
+        REQUIRE(reader.find(texts[2400].data(), texts[2400].size(), view));
+        REQUIRE(run_view(vm, view) == values[2400]);
+    }
+
+    // reopened, with a torn record at the end like a crash in an append.
+    std::uint64_t validSize = 0;
+    std::size_t entries = 0;
+    {
+        calc_code_cache reader;
+        REQUIRE(reader.open(path.c_str(), false));
+        validSize = reader.file_size();
+        entries = reader.size();
+    }
+    {
+        std::ofstream ofs(path, std::ios::binary | std::ios::app);
+        std::string const torn(100, '\x01');
+        ofs.write(torn.data(), static_cast<std::streamsize>(torn.size()));
+    }
+    {
+        calc_code_cache reader;
+        REQUIRE(reader.open(path.c_str(), false));
+        REQUIRE(reader.size() == entries);
+        REQUIRE(reader.file_size() == validSize);
+        for (std::size_t i = 0; i < 2500; i += 7) {
+            REQUIRE(reader.find(texts[i].data(), texts[i].size(), view));
+            REQUIRE(run_view(vm, view) == values[i]);
+        }
+    }
+    {
+        // the writer cuts off the torn tail, and appends after the valid ones.
+        calc_code_cache writer;
+        REQUIRE(writer.open(path.c_str(), true));
+        REQUIRE(writer.size() == entries);
+        for (std::size_t i = 2500; i < 3000; ++i) {
+            REQUIRE(writer.append(texts[i].data(), texts[i].size(), compile_text(pipeline, texts[i])));
+        }
+    }
+    {
+        calc_code_cache reader;
+        REQUIRE(reader.open(path.c_str(), false));
+        for (std::size_t i = 0; i < 3000; ++i) {
+            REQUIRE(reader.find(texts[i].data(), texts[i].size(), view));
+            REQUIRE(run_view(vm, view) == values[i]);
+        }
+    }
+
+    // not a cache file.
+    {
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        ofs << "1 + 2 * 3 + 4 + 5 + 6\n";
+    }
+    calc_code_cache cache;
+    REQUIRE_FALSE(cache.open(path.c_str(), false));
+    REQUIRE_FALSE(cache.open(path.c_str(), true));
+    std::remove(path.c_str());
+}
+
+// The batch of the distinct expressions is run 3 times: without the cache,
+// into an empty cache, and from the cache reopened as a later run would.
+TEST_CASE("calc code cache warm run", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::string const path = cache_path("code_cache_bench");
+    std::remove(path.c_str());
+
+    std::vector<std::string> lines;
+    calc_generator generator;
+    std::size_t bytes = 0;
+    for (int i = 0; i < 50000; ++i) {
+        std::string line;
+        generator.next(line);
+        bytes += line.size() + 1;
+        lines.push_back(std::move(line));
+    }
+    std::cout << lines.size() << " expressions, " << bytes / 1024 << " KB, repeated 4 times\n";
+
+    auto report = [bytes](char const * name, clock_t::duration d, calc_value_t sum) {
+        double const seconds = std::chrono::duration<double>(d).count();
+        std::cout << name << ": " << seconds * 1000.0 << " ms, "
+                  << bytes * 4 / seconds / 1e6 << " MB/s (" << sum << ")\n";
+    };
+
+    calc_pipeline<> pipeline;
+    calc_program program;
+    calc_vm vm;
+    std::string text;
+
+    auto start = clock_t::now();
+    calc_value_t sum = 0;
+    for (int round = 0; round < 4; ++round) {
+        for (auto const& line : lines) {
+            calc_value_t v = 0;
+            if (pipeline.run(line, v)) {
+                sum += v;
+            }
+        }
+    }
+    report("no cache", clock_t::now() - start, sum);
+
+    auto run_cached = [&](calc_code_cache & cache, latency_histogram & hits) {
+        calc_value_t total = 0;
+        for (int round = 0; round < 4; ++round) {
+            for (auto const& line : lines) {
+                calc_value_t v = 0;
+                calc_code_view view;
+                std::uint64_t const t0 = read_cycle_counter();
+                calc_normalize_text(line.data(), line.data() + line.size(), text);
+                bool const hit = cache.find(text.data(), text.size(), view);
+                if (hit) {
+                    hits.record(read_cycle_counter() - t0);
+                    if (vm.run(view.code, view.size, view.stackDepth, v)) {
+                        total += v;
+                    }
+                    continue;
+                }
+                if (pipeline.lex(line.data(), line.data() + line.size()) && pipeline.parse()) {
+                    compile_calc(pipeline.ast(), program);
+                    cache.append(text.data(), text.size(), program);
+                    if (vm.run(program, v)) {
+                        total += v;
+                    }
+                }
+            }
+        }
+        return total;
+    };
+
+    latency_histogram coldHits;
+    {
+        calc_code_cache cache;
+        REQUIRE(cache.open(path.c_str(), true));
+        start = clock_t::now();
+        sum = run_cached(cache, coldHits);
+        report("cold cache", clock_t::now() - start, sum);
+        std::cout << "    " << cache.size() << " entries, " << cache.file_size() / 1024 << " KB\n";
+    }
+
+    latency_histogram warmHits;
+    {
+        start = clock_t::now();
+        calc_code_cache cache;
+        REQUIRE(cache.open(path.c_str(), false));
+        auto const opened = clock_t::now();
+        sum = run_cached(cache, warmHits);
+        report("warm cache", clock_t::now() - start, sum);
+        std::cout << "    opened in "
+                  << std::chrono::duration<double>(opened - start).count() * 1000.0 << " ms\n";
+    }
+
+    // the hit path: the normalization, the hash and the probe.
+    dump_latency_text_header(std::cout);
+    latency_summary summary;
+    summary.merge(warmHits);
+    dump_latency_text(std::cout, "hit", summary, cycles_per_nanosecond());
+    std::remove(path.c_str());
+}
+#endif
@@ -0,0 +1,115 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "calc_column_vm.h"
+#include "calc_test_helpers.h"
+#include "calc_generator.h"
+
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+}   // un-named namespace
+
+
+TEST_CASE("calc column vm", "[algovisu]")
+{
+    calc_register_compiler compiler;
+    calc_register_program program;
+    calc_column_vm vm;
+    calc_register_vm rowVm;
+
+    // a * 3 - b / a, of 1000 rows, with a zero in the row 700.
+    std::size_t const rows = 1000;
+    std::vector<calc_value_t> a(rows);
+    std::vector<calc_value_t> b(rows);
+    for (std::size_t i = 0; i < rows; ++i) {
+        a[i] = static_cast<calc_value_t>(i) - 500;
+        b[i] = static_cast<calc_value_t>(i * i);
+    }
+    a[500] = std::numeric_limits<calc_value_t>::min();
+    b[500] = -1;
+    a[700] = 0;
+    calc_value_t const * columns[] = { a.data(), b.data() };
+
+    // the nodes are a 3 * b a / -.
+    calc_ast const ast = parse("1 * 3 - 1 / 1");
+    compiler.compile(ast, { { 0, 0 }, { 3, 1 }, { 4, 0 } }, program);
+    REQUIRE(std::count_if(program.code.begin(), program.code.end(), [](calc_register_instruction const& in) {
+        return in.op == calc_register_opcode::column;
+    }) == 3);
+
+    std::vector<calc_value_t> out(rows);
+    REQUIRE(vm.run(program, columns, rows, out.data()) == 700);
+    for (std::size_t row = 0; row < 700; ++row) {
+        calc_value_t expected = 0;
+        REQUIRE(rowVm.run(program, columns, row, expected));
+        REQUIRE(out[row] == expected);
+        if (row != 500) {
+            REQUIRE(expected == a[row] * 3 - b[row] / a[row]);
+        }
+    }
+    REQUIRE_FALSE(rowVm.run(program, columns, 700, out[700]));
+    REQUIRE(vm.run(program, columns, 700, out.data()) == 700);
+    REQUIRE(vm.run(program, columns, 0, out.data()) == 0);
+
+    // a column alone.
+    compiler.compile(parse("5"), { { 0, 1 } }, program);
+    REQUIRE(vm.run(program, columns, rows, out.data()) == rows);
+    REQUIRE(out == b);
+}
+
+TEST_CASE("calc column vm same as by row", "[algovisu]")
+{
+    calc_generator_options options;
+    options.seed = 29;
+    options.group = 0.3;
+    calc_generator generator(options);
+    std::mt19937_64 random(29);
+    std::size_t const rows = 600;
+    std::vector<std::vector<calc_value_t>> columns(3, std::vector<calc_value_t>(rows));
+    calc_value_t const * pointers[] = { columns[0].data(), columns[1].data(), columns[2].data() };
+    calc_register_program program;
+    calc_column_vm vm;
+    calc_register_vm rowVm;
+    calc_register_vm switchVm(calc_dispatch::switch_loop);
+    std::vector<calc_value_t> out(rows);
+    std::string line;
+    for (int i = 0; i < 200; ++i) {
+        for (auto & c : columns) {
+            for (calc_value_t & v : c) {
+                v = random() % 8 ? static_cast<calc_value_t>(random() % 64) - 2 : static_cast<calc_value_t>(random());
+            }
+        }
+        line.clear();
+        generator.next(line);
+        calc_ast const ast = parse(line);
+        std::vector<calc_column_binding> bindings;
+        for (std::uint32_t n = 0; n < ast.size(); ++n) {
+            if (ast.nodes[n].op == calc_op::literal && random() % 2) {
+                bindings.push_back(calc_column_binding{ n, static_cast<std::uint32_t>(random() % 3) });
+            }
+        }
+        calc_register_compiler compiler(1 + i % 4);
+        compiler.compile(ast, bindings, program);
+        std::size_t const done = vm.run(program, pointers, rows, out.data());
+        for (std::size_t row = 0; row < done; ++row) {
+            calc_value_t expected = 0;
+            REQUIRE(rowVm.run(program, pointers, row, expected));
+            REQUIRE(out[row] == expected);
+            REQUIRE(switchVm.run(program, pointers, row, expected));
+            REQUIRE(out[row] == expected);
+        }
+        if (done < rows) {
+            calc_value_t unused;
+            REQUIRE_FALSE(rowVm.run(program, pointers, done, unused));
+            REQUIRE_FALSE(switchVm.run(program, pointers, done, unused));
+        }
+    }
+}
@@ -0,0 +1,211 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+
+#include "calc_coroutine.h"
+#include "calc_generator.h"
+#include "latency_histogram.h"
+
+
+namespace
+{
+    struct stream_results
+    {
+        std::vector<algovisu::calc_stream_event_kind> kinds;
+        std::vector<algovisu::calc_value_t> values;
+        std::size_t inputs = 0;
+        std::size_t pauses = 0;
+    };
+
+    // Feeds the input in chunks whenever the task asks for it.
+    stream_results run_stream(std::string const& s, std::size_t chunk, std::size_t budget)
+    {
+        using namespace algovisu;
+
+        stream_results results;
+        calc_stream_input input;
+        auto task = calc_stream(input, budget);
+        std::size_t fed = 0;
+        while (task.resume()) {
+            auto const& e = task.event();
+            switch (e.kind) {
+                case calc_stream_event_kind::need_input:
+                    ++results.inputs;
+                    if (fed == s.size()) {
+                        input.close();
+                    } else {
+                        std::size_t const n = std::min(chunk, s.size() - fed);
+                        input.feed(s.data() + fed, s.data() + fed + n);
+                        fed += n;
+                    }
+                    break;
+                case calc_stream_event_kind::paused:
+                    ++results.pauses;
+                    break;
+                default:
+                    results.kinds.push_back(e.kind);
+                    results.values.push_back(e.value);
+                    REQUIRE(e.ast != nullptr);
+                    break;
+            }
+        }
+        return results;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc stream coroutine", "[algovisu]")
+{
+    using namespace algovisu;
+    using kind = calc_stream_event_kind;
+
+    std::string const s = "1 + 2 * 3\n1 +\n\n(4 - 6) * 10\n7 / 0\n100";
+    for (std::size_t chunk : { 1, 3, 1000 }) {
+        for (std::size_t budget : { std::size_t(1), std::size_t(2), std::size_t(1000) }) {
+            auto const results = run_stream(s, chunk, budget);
+            REQUIRE(results.kinds == std::vector<kind>({ kind::value, kind::parse_error, kind::value,
+                                                         kind::eval_error, kind::value }));
+            REQUIRE(results.values[0] == 7);
+            REQUIRE(results.values[2] == -20);
+            REQUIRE(results.values[4] == 100);
+            REQUIRE(results.inputs == (s.size() + chunk - 1) / chunk + 1);
+            REQUIRE((budget < 1000) == (results.pauses > 0));
+        }
+    }
+
+    // the same values as the push parser and the evaluator
+    calc_generator_options options;
+    options.invalid = 0.1;
+    std::string input;
+    calc_generator(options).generate(100000, input);
+    std::vector<calc_value_t> expected;
+    calc_push_parser parser;
+    calc_evaluator evaluator;
+    auto on_expression = [&](calc_ast const& ast, bool ok) {
+        calc_value_t result = 0;
+        if (ok && evaluator.evaluate(ast, result)) {
+            expected.push_back(result);
+        }
+    };
+    parser.push(input.data(), input.data() + input.size(), on_expression);
+    parser.finish(on_expression);
+
+    auto const results = run_stream(input, 4096, 64);
+    std::vector<calc_value_t> values;
+    for (std::size_t i = 0; i < results.kinds.size(); ++i) {
+        if (results.kinds[i] == kind::value) {
+            values.push_back(results.values[i]);
+        }
+    }
+    REQUIRE(values == expected);
+}
+
+TEST_CASE("calc stream budget splits a huge expression", "[algovisu]")
+{
+    using namespace algovisu;
+
+    // 100001 literals, so 200001 nodes to evaluate
+    std::string s = "1";
+    for (int i = 0; i < 100000; ++i) {
+        s += " + 1";
+    }
+    auto const results = run_stream(s, s.size(), 1000);
+    REQUIRE(results.values == std::vector<calc_value_t>({ 100001 }));
+    REQUIRE(results.inputs == 2);
+    // ~200 pushes and ~200 slices of the evaluation
+    REQUIRE(results.pauses >= 390);
+    REQUIRE(results.pauses <= 410);
+}
+
+// An event loop resumes the small and the huge streams round robin.
+// The scheduling latency of a small stream is the time it waits for the
+// others between its own turns.
+TEST_CASE("calc stream scheduling latency", "[.][benchmark]")
+{
+    using namespace algovisu;
+    using clock_t = std::chrono::steady_clock;
+
+    calc_generator_options smallOptions;
+    smallOptions.maxTokens = 20;
+    std::vector<std::string> smalls(8);
+    for (std::size_t i = 0; i < smalls.size(); ++i) {
+        smallOptions.seed = i + 1;
+        calc_generator(smallOptions).generate(256 * 1024, smalls[i]);
+    }
+    calc_generator_options hugeOptions;
+    hugeOptions.minTokens = hugeOptions.maxTokens = 1000000;
+    hugeOptions.opWeights = { { 1, 1, 1, 0 } };
+    std::string huge;
+    calc_generator(hugeOptions).next(huge);
+    std::cout << "8 x 256 KB of small expressions, and a " << huge.size() / 1024
+              << " KB expression, fed at once.\n";
+    dump_latency_text_header(std::cout);
+
+    struct source
+    {
+        source(std::string const& s, std::size_t budget, bool small)
+            : text(s)
+            , task(calc_stream(input, budget))
+            , small(small)
+        { }
+
+        std::string const& text;
+        calc_stream_input input;
+        calc_stream_task task;
+        clock_t::time_point last;
+        bool small;
+        bool fed = false;
+        bool done = false;
+    };
+
+    for (std::size_t budget : { std::size_t(0), std::size_t(65536), std::size_t(4096), std::size_t(256) }) {
+        std::vector<std::unique_ptr<source>> sources;
+        std::size_t const b = budget ? budget : std::numeric_limits<std::size_t>::max();
+        sources.push_back(std::make_unique<source>(huge, b, false));
+        for (auto const& s : smalls) {
+            sources.push_back(std::make_unique<source>(s, b, true));
+        }
+
+        latency_histogram waits;
+        std::size_t active = sources.size();
+        auto const start = clock_t::now();
+        while (active > 0) {
+            for (auto & src : sources) {
+                if (src->done) {
+                    continue;
+                }
+                auto const now = clock_t::now();
+                if (src->small && src->last != clock_t::time_point()) {
+                    waits.record(static_cast<std::uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(now - src->last).count()));
+                }
+                if (!src->task.resume()) {
+                    src->done = true;
+                    --active;
+                    continue;
+                }
+                if (src->task.event().kind == calc_stream_event_kind::need_input) {
+                    if (src->fed) {
+                        src->input.close();
+                    } else {
+                        src->input.feed(src->text.data(), src->text.data() + src->text.size());
+                        src->fed = true;
+                    }
+                }
+                src->last = clock_t::now();
+            }
+        }
+        double const seconds = std::chrono::duration<double>(clock_t::now() - start).count();
+
+        latency_summary summary;
+        summary.merge(waits);
+        std::string const name = budget ? "budget " + std::to_string(budget) : "unlimited";
+        dump_latency_text(std::cout, name.c_str(), summary);
+        std::cout << "    total " << seconds * 1000.0 << " ms\n";
+    }
+}
@@ -0,0 +1,232 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "calc_document.h"
+#include "calc_pipeline.h"
+#include "calc_generator.h"
+#include "cycle_clock.h"
+#include "latency_histogram.h"
+
+
+namespace
+{
+    using namespace algovisu;
+
+    // The document is the same as the text lexed and parsed from scratch.
+    void require_same(calc_document<> const& document, calc_pipeline<> & pipeline)
+    {
+        std::string const& text = document.text();
+        bool const lexed = pipeline.lex(text.data(), text.data() + text.size());
+        bool const ok = lexed && pipeline.parse();
+        INFO(text);
+        REQUIRE(document.valid() == ok);
+        if (!ok) {
+            return;
+        }
+        auto const& buffer = pipeline.token_buffer();
+        auto const& tokens = document.tokens();
+        REQUIRE(tokens.size() == buffer.size());
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            REQUIRE(tokens[i].offset == buffer[i].value().begin() - text.data());
+            REQUIRE(tokens[i].size == buffer[i].value().size());
+            if (tokens[i].kind == '0') {
+                REQUIRE(document.ast().nodes[tokens[i].node].op == calc_op::literal);
+            }
+        }
+        calc_ast const& ast = pipeline.ast();
+        REQUIRE(document.ast().size() == ast.size());
+        for (std::size_t i = 0; i < ast.size(); ++i) {
+            calc_node const& x = document.ast().nodes[i];
+            calc_node const& y = ast.nodes[i];
+            REQUIRE(x.op == y.op);
+            if (x.op == calc_op::literal) {
+                REQUIRE(x.value == y.value);
+            } else {
+                REQUIRE(x.lhs == y.lhs);
+                REQUIRE(x.rhs == y.rhs);
+            }
+        }
+    }
+
+    std::uint64_t next_random(std::uint64_t & x)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc document edits", "[algovisu]")
+{
+    calc_pipeline<> pipeline;
+    calc_document<> document;
+    REQUIRE(document.assign("1 + 2 * 3 - (4 - 5) * 6"));
+    require_same(document, pipeline);
+    REQUIRE(document.last_edit().full);
+
+    struct step
+    {
+        std::size_t offset;
+        std::size_t count;
+        char const * text;
+        char const * expected;
+        bool valid;
+        std::size_t reparsedTokens;
+    };
+    step const steps[] = {
+        { 4, 1, "7", "1 + 7 * 3 - (4 - 5) * 6", true, 1 },         // a factor
+        { 5, 0, "0", "1 + 70 * 3 - (4 - 5) * 6", true, 1 },
+        { 9, 0, "  ", "1 + 70 *   3 - (4 - 5) * 6", true, 0 },      // the white spaces only
+        { 18, 1, "+", "1 + 70 *   3 - (4 + 5) * 6", true, 3 },      // the terms in the parentheses
+        { 7, 1, "+", "1 + 70 +   3 - (4 + 5) * 6", true, 4 },       // "+ 70 + 3"
+        { 0, 0, "9", "91 + 70 +   3 - (4 + 5) * 6", true, 1 },
+        { 16, 0, "(", "91 + 70 +   3 - ((4 + 5) * 6", false, 0 },
+        { 16, 1, "", "91 + 70 +   3 - (4 + 5) * 6", true, 13 },     // from scratch
+        { 22, 1, "", "91 + 70 +   3 - (4 + 5 * 6", false, 0 },
+        { 22, 0, ")", "91 + 70 +   3 - (4 + 5) * 6", true, 13 },
+        { 17, 0, "4 * 2 + ", "91 + 70 +   3 - (4 * 2 + 4 + 5) * 6", true, 5 },   // "4 * 2 + 4"
+        { 0, 35, "", "", false, 0 },
+        { 0, 0, "42", "42", true, 1 }
+    };
+    for (step const& s : steps) {
+        INFO(s.expected);
+        REQUIRE(document.edit(s.offset, s.count, std::string(s.text)) == s.valid);
+        REQUIRE(document.text() == s.expected);
+        require_same(document, pipeline);
+        if (s.valid) {
+            REQUIRE(document.last_edit().reparsedTokens == s.reparsedTokens);
+        }
+    }
+}
+
+TEST_CASE("calc document random edits", "[algovisu]")
+{
+    calc_generator_options options;
+    options.seed = 21;
+    options.minTokens = 1000;
+    options.maxTokens = 1000;
+    options.group = 0.2;
+    std::string text;
+    calc_generator(options).next(text);
+
+    calc_pipeline<> pipeline;
+    calc_document<> document;
+    document.assign(text);
+    require_same(document, pipeline);
+
+    // mostly the digits, to keep it valid for a while.
+    char const alphabet[] = "0123456789012345678901234567890123456789+-*/() ";
+    std::uint64_t x = 11;
+    std::size_t valid = 0;
+    std::size_t incremental = 0;
+    for (int k = 0; k < 1500; ++k) {
+        std::string const& current = document.text();
+        std::size_t const offset = next_random(x) % (current.size() + 1);
+        std::size_t const count = std::min<std::size_t>(next_random(x) % 3, current.size() - offset);
+        std::string inserted(next_random(x) % 3, ' ');
+        for (char & c : inserted) {
+            c = alphabet[next_random(x) % (sizeof(alphabet) - 1)];
+        }
+        document.edit(offset, count, inserted);
+        require_same(document, pipeline);
+        valid += document.valid();
+        incremental += document.valid() && !document.last_edit().full;
+        if (!document.valid() && next_random(x) % 4 == 0) {
+            // back to a valid one now and then.
+            document.assign(text);
+        }
+    }
+    REQUIRE(valid > 250);
+    REQUIRE(incremental > 200);
+}
+
+// A one character edit of a 10MB expression, against lexing and parsing it again.
+TEST_CASE("calc document edit latency", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    calc_generator_options options;
+    options.minTokens = 5000000;
+    options.maxTokens = 5000000;
+    options.group = 0.1;
+    options.opWeights = { { 1, 1, 1, 0 } };
+    std::string text;
+    calc_generator(options).next(text);
+
+    calc_document<> document;
+    auto start = clock_t::now();
+    REQUIRE(document.assign(text));
+    double const fullMs = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+
+    calc_pipeline<> pipeline;
+    start = clock_t::now();
+    REQUIRE(pipeline.lex(text.data(), text.data() + text.size()));
+    REQUIRE(pipeline.parse());
+    double const reparseMs = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+    std::printf("%zu bytes, %zu tokens, %zu nodes: assign %.0f ms, lex and parse %.0f ms\n",
+                text.size(), document.tokens().size(), document.ast().size(), fullMs, reparseMs);
+
+    double const cyclesPerNs = cycles_per_nanosecond();
+    std::uint64_t x = 3;
+    // a random token of the kind, and its offset.
+    auto pick = [&](char kind) {
+        auto const& tokens = document.tokens();
+        for (;;) {
+            calc_document_token const& t = tokens[next_random(x) % tokens.size()];
+            if (t.kind == kind && (kind != '0' || document.text()[t.offset] != '0')) {
+                return t;
+            }
+        }
+    };
+    struct edit_kind
+    {
+        char const * name;
+        char kind;
+    };
+    edit_kind const kinds[] = {
+        { "digit", '0' },           // a digit replaced
+        { "insert", '1' },          // a digit inserted
+        { "operator", '+' },        // + to -
+        { "space", ' ' }            // a space inserted
+    };
+    dump_latency_text_header(std::cout);
+    for (edit_kind const& e : kinds) {
+        latency_histogram latency;
+        std::size_t reparsed = 0;
+        std::size_t const edits = 2000;
+        for (std::size_t k = 0; k < edits; ++k) {
+            std::size_t offset, count;
+            char c;
+            switch (e.kind) {
+                case '0': offset = pick('0').offset; count = 1; c = char('1' + next_random(x) % 9); break;
+                case '1': { auto const t = pick('0'); offset = t.offset + t.size; count = 0; c = '5'; break; }
+                case '+': offset = pick('+').offset; count = 1; c = '-'; break;
+                default: offset = pick('0').offset; count = 0; c = ' '; break;
+            }
+            std::uint64_t const begin = read_cycle_counter();
+            bool const ok = document.edit(offset, count, &c, &c + 1);
+            latency.record(read_cycle_counter() - begin);
+            REQUIRE(ok);
+            reparsed += document.last_edit().reparsedTokens;
+        }
+        latency_summary summary;
+        summary.merge(latency);
+        dump_latency_text(std::cout, e.name, summary, cyclesPerNs);
+        std::printf("    %.1f tokens reparsed per edit\n", double(reparsed) / double(edits));
+    }
+
+    // the same ast as parsed from scratch.
+    REQUIRE(pipeline.lex(document.text().data(), document.text().data() + document.text().size()));
+    REQUIRE(pipeline.parse());
+    REQUIRE(pipeline.ast().size() == document.ast().size());
+    calc_value_t a = 0, b = 0;
+    REQUIRE(evaluate(pipeline.ast(), a) == evaluate(document.ast(), b));
+    REQUIRE(a == b);
+}
@@ -0,0 +1,150 @@
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include "calc_generator.h"
+#include "calc_pipeline.h"
+
+
+namespace
+{
+    std::vector<std::string> lines_of(std::string const& s)
+    {
+        std::vector<std::string> lines;
+        std::istringstream iss(s);
+        for (std::string line; std::getline(iss, line); ) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    std::size_t depth_of(std::string const& s)
+    {
+        std::size_t depth = 0, maxDepth = 0;
+        for (char c : s) {
+            if (c == '(') {
+                maxDepth = std::max(maxDepth, ++depth);
+            } else if (c == ')') {
+                --depth;
+            }
+        }
+        return maxDepth;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc generator is reproducible", "[algovisu]")
+{
+    using namespace algovisu;
+
+    calc_generator_options options;
+    options.seed = 42;
+    options.invalid = 0.1;
+    options.repetition = 0.2;
+
+    std::string a, b;
+    std::uint64_t const n = calc_generator(options).generate(100000, a);
+    REQUIRE(n == a.size());
+    calc_generator(options).generate(100000, b);
+    REQUIRE(a.size() >= 100000);
+    REQUIRE(a == b);
+
+    // the chunks of a stream are the same bytes.
+    std::ostringstream oss;
+    calc_generator(options).generate(100000, oss);
+    REQUIRE(oss.str() == a);
+
+    std::string c;
+    options.seed = 43;
+    calc_generator(options).generate(100000, c);
+    REQUIRE(a != c);
+
+    // pinned, so that a change of the output is not made by accident.
+    std::string first;
+    calc_generator_options pinned;
+    pinned.minTokens = 5;
+    pinned.maxTokens = 5;
+    calc_generator(pinned).next(first);
+    REQUIRE(first == "983/83 * 856");
+}
+
+TEST_CASE("calc generator knobs", "[algovisu]")
+{
+    using namespace algovisu;
+
+    calc_pipeline<> pipeline;
+    calc_value_t result = 0;
+
+    calc_generator_options options;
+    options.group = 0.4;
+    options.maxDepth = 5;
+    options.minDigits = 4;
+    options.maxDigits = 4;
+    calc_generator generator(options);
+    for (int i = 0; i < 200; ++i) {
+        std::string s;
+        REQUIRE(generator.next(s));
+        REQUIRE(depth_of(s) <= 5);
+        REQUIRE(pipeline.lex(s.data(), s.data() + s.size()));
+        REQUIRE(pipeline.parse());
+        std::size_t tokens = pipeline.token_buffer().size();
+        REQUIRE(tokens >= 3);
+        REQUIRE(tokens <= 200);
+        for (auto const& t : pipeline.token_buffer()) {
+            if (t.id() != '+' && t.id() != '-' && t.id() != '*' && t.id() != '/'
+                    && t.id() != '(' && t.id() != ')') {
+                REQUIRE(t.value().size() == 4);
+            }
+        }
+    }
+
+    // only + without blanks
+    options = calc_generator_options();
+    options.opWeights = { { 1, 0, 0, 0 } };
+    options.whitespace = 0.0;
+    options.group = 0.0;
+    std::string s;
+    calc_generator(options).generate(10000, s);
+    REQUIRE(s.find_first_not_of("0123456789+\n") == std::string::npos);
+    for (auto const& line : lines_of(s)) {
+        REQUIRE(pipeline.run(line, result));
+    }
+
+    // no tokens asked for is a literal.
+    options = calc_generator_options();
+    options.minTokens = 0;
+    options.maxTokens = 0;
+    options.minDigits = 20;
+    options.maxDigits = 20;
+    options.whitespace = 1.0;
+    calc_generator single(options);
+    for (int i = 0; i < 100; ++i) {
+        std::string e;
+        REQUIRE(single.next(e));
+        REQUIRE(e.size() == 20);
+        REQUIRE(e.find_first_not_of("0123456789") == std::string::npos);
+    }
+
+    // every expression is broken
+    options = calc_generator_options();
+    options.invalid = 1.0;
+    calc_generator broken(options);
+    for (int i = 0; i < 200; ++i) {
+        std::string e;
+        REQUIRE_FALSE(broken.next(e));
+        REQUIRE_FALSE(pipeline.run(e, result));
+    }
+
+    // every expression but the first is a repeated one.
+    options = calc_generator_options();
+    options.repetition = 1.0;
+    s.clear();
+    calc_generator(options).generate(10000, s);
+    auto const lines = lines_of(s);
+    REQUIRE(lines.size() > 1);
+    for (auto const& line : lines) {
+        REQUIRE(line == lines.front());
+    }
+}
@@ -0,0 +1,314 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "calc_graph_emitter.h"
+#include "calc_test_helpers.h"
+
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+    using tools::make_tree;
+
+    struct string_sink
+    {
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                s.append(blocks[i].data, blocks[i].size);
+            }
+            return true;
+        }
+
+        std::string s;
+    };
+
+    std::size_t count_of(std::string const& s, std::string const& what)
+    {
+        std::size_t n = 0;
+        for (std::size_t i = s.find(what); i != std::string::npos; i = s.find(what, i + 1)) {
+            ++n;
+        }
+        return n;
+    }
+
+    // The nodes and the edges in the viewport, by looking at every one.
+    calc_emit_stats visible(calc_ast const& ast, calc_tree_layout const& layout, calc_viewport const& v)
+    {
+        calc_emit_stats stats;
+        double const left = v.left - 0.5, right = v.right() + 0.5;
+        double const top = v.top - 0.5, bottom = v.bottom() + 0.5;
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            double const x = layout.x(i);
+            double const depth = layout.depth(i);
+            if (x >= left && x <= right && depth >= top && depth <= bottom) {
+                ++stats.nodes;
+            }
+            calc_node const& node = ast.nodes[i];
+            if (node.op == calc_op::literal) {
+                continue;
+            }
+            for (std::uint32_t child : { node.lhs, node.rhs }) {
+                double const cx = layout.x(child);
+                if (std::max(x, cx) >= left && std::min(x, cx) <= right && depth + 1 >= top && depth <= bottom) {
+                    ++stats.edges;
+                }
+            }
+        }
+        return stats;
+    }
+
+    // in KB, or 0 if it's unknown.
+    long peak_rss_kb()
+    {
+#if defined(__unix__)
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+#elif defined(__APPLE__)
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024;
+#else
+        return 0;
+#endif
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc graph emitter", "[algovisu]")
+{
+    calc_ast ast = parse("1 + 2");
+    calc_tree_layout layout;
+    layout.layout(ast);
+
+    string_sink sink;
+    {
+        calc_graph_emitter<string_sink> emitter(sink, 16);
+        emitter.dot(ast);
+        REQUIRE(emitter.flush());
+        REQUIRE(emitter.stats().nodes == 3);
+        REQUIRE(emitter.stats().edges == 2);
+    }
+    REQUIRE(sink.s == "digraph calc {\nnode [shape=plaintext];\n"
+                      "n0 [label=\"1\"];\nn1 [label=\"2\"];\nn2 [label=\"+\"];\nn2 -> n0;\nn2 -> n1;\n}\n");
+
+    // at the pixels of the viewport, with the y up for neato.
+    calc_viewport viewport;
+    viewport.left = -1;
+    viewport.top = -1;
+    viewport.scale = 10;
+    sink.s.clear();
+    {
+        calc_graph_emitter<string_sink> emitter(sink);
+        emitter.dot(ast, layout, viewport);
+    }
+    REQUIRE(sink.s == "digraph calc {\nnode [shape=plaintext];\n"
+                      "n2 [label=\"+\",pos=\"10,-10!\"];\nn2 -> n0;\nn2 -> n1;\n"
+                      "n0 [label=\"1\",pos=\"5,-20!\"];\nn1 [label=\"2\",pos=\"15,-20!\"];\n}\n");
+
+    // the root above the viewport is declared for its edges.
+    viewport.top = 0.6;
+    sink.s.clear();
+    {
+        calc_graph_emitter<string_sink> emitter(sink);
+        emitter.dot(ast, layout, viewport);
+        REQUIRE(emitter.stats().nodes == 2);
+        REQUIRE(emitter.stats().edges == 2);
+    }
+    REQUIRE(sink.s == "digraph calc {\nnode [shape=plaintext];\n"
+                      "n2 [label=\"+\",pos=\"10,6!\"];\nn2 -> n0;\nn2 -> n1;\n"
+                      "n0 [label=\"1\",pos=\"5,-4!\"];\nn1 [label=\"2\",pos=\"15,-4!\"];\n}\n");
+
+    ast = parse("(1 * 2 - 3) + (4 - 5 * 6)");
+    layout.layout(ast);
+    viewport = fit_calc_viewport(ast, layout, 400, 300);
+    REQUIRE(viewport.scale == 75);      // 4 levels in 300 pixels
+    sink.s.clear();
+    {
+        calc_graph_emitter<string_sink> emitter(sink);
+        emitter.svg(ast, layout, viewport);
+        REQUIRE(emitter.stats().nodes == 11);
+        REQUIRE(emitter.stats().edges == 10);
+        REQUIRE(emitter.stats().culled == 0);
+    }
+    REQUIRE(sink.s.compare(0, 4, "<svg") == 0);
+    REQUIRE(sink.s.compare(sink.s.size() - 7, 7, "</svg>\n") == 0);
+    REQUIRE(count_of(sink.s, "<circle") == 11);
+    REQUIRE(count_of(sink.s, "<text") == 11);
+    REQUIRE(count_of(sink.s, "M") == 10);
+    REQUIRE(sink.s.find(">*</text>") != std::string::npos);
+}
+
+TEST_CASE("calc graph emitter viewport", "[algovisu]")
+{
+    calc_ast const ast = make_tree(20000, 3);
+    calc_tree_layout layout;
+    layout.layout(ast);
+    string_sink sink;
+    calc_graph_emitter<string_sink> emitter(sink);
+
+    // the culled subtrees hide no node in the viewport.
+    std::uint64_t x = 5;
+    for (int i = 0; i < 50; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        calc_viewport viewport;
+        viewport.scale = 4 + double(x % 40);
+        viewport.left = layout.x(static_cast<std::uint32_t>(x % ast.size())) - double((x >> 8) % 50);
+        viewport.top = double((x >> 16) % layout.height(ast.root()));
+        sink.s.clear();
+        emitter.svg(ast, layout, viewport);
+        emitter.flush();
+        calc_emit_stats const expected = visible(ast, layout, viewport);
+        INFO(i);
+        REQUIRE(emitter.stats().nodes == expected.nodes);
+        REQUIRE(emitter.stats().edges == expected.edges);
+        REQUIRE(emitter.stats().summaries == 0);
+        REQUIRE(count_of(sink.s, "<circle") == expected.nodes);
+
+        // every end of an edge is declared with its position, for neato -n.
+        viewport.minPixels = double(x >> 24 & 7);
+        sink.s.clear();
+        emitter.dot(ast, layout, viewport);
+        emitter.flush();
+        REQUIRE(count_of(sink.s, " [") == count_of(sink.s, ",pos=\"") + 1);     // and the node defaults.
+        std::vector<bool> declared(ast.size());
+        std::vector<std::pair<unsigned long, unsigned long>> edges;
+        for (std::size_t at = sink.s.find('\n'); at + 1 < sink.s.size(); at = sink.s.find('\n', at + 1)) {
+            unsigned long from = 0, to = 0;
+            char const * const line = sink.s.c_str() + at + 1;
+            if (std::sscanf(line, "n%lu -> n%lu;", &from, &to) == 2) {
+                edges.emplace_back(from, to);
+            } else if (std::sscanf(line, "n%lu [", &from) == 1) {
+                declared[from] = true;
+            }
+        }
+        REQUIRE(edges.size() == emitter.stats().edges);
+        for (auto const& e : edges) {
+            REQUIRE(declared[e.first]);
+            REQUIRE(declared[e.second]);
+        }
+    }
+
+    // the narrow subtrees as one shape each, and every node in one or another.
+    calc_viewport viewport = fit_calc_viewport(ast, layout, 1920, 1080);
+    sink.s.clear();
+    emitter.svg(ast, layout, viewport);
+    emitter.flush();
+    std::size_t const full = sink.s.size();
+    REQUIRE(emitter.stats().nodes == ast.size());
+
+    viewport.minPixels = 4;
+    sink.s.clear();
+    emitter.svg(ast, layout, viewport);
+    emitter.flush();
+    calc_emit_stats const stats = emitter.stats();
+    REQUIRE(stats.summaries > 0);
+    REQUIRE(stats.culled == 0);
+    REQUIRE(stats.nodes + stats.summarized == ast.size());
+    REQUIRE(count_of(sink.s, "<title>") == stats.summaries);
+    REQUIRE(sink.s.size() * 2 < full);
+
+    // a chain of 1M nodes, with no recursion.
+    std::string chain = "1";
+    for (int i = 0; i < 500000; ++i) {
+        chain += "+2";
+    }
+    calc_ast const deep = parse(chain);
+    layout.layout(deep);
+    viewport = fit_calc_viewport(deep, layout, 1920, 1080);
+    sink.s.clear();
+    emitter.svg(deep, layout, viewport);
+    emitter.flush();
+    REQUIRE(emitter.stats().nodes == deep.size());
+    REQUIRE(emitter.stats().edges == deep.size() - 1);
+}
+
+#if defined(ALGOVISU_HAS_WRITEV)
+// The throughput of writing a tree of 10M nodes to a file, and the peak
+// RSS on the way, against the document built in a string.
+TEST_CASE("calc graph emitter throughput", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    struct counting_sink
+    {
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                bytes += blocks[i].size;
+            }
+            return sink.write(blocks, count);
+        }
+
+        fd_output_sink sink;
+        std::uint64_t bytes;
+    };
+
+    calc_ast const ast = make_tree(5000000, 7);
+    calc_tree_layout layout;
+    layout.layout(ast);
+    std::printf("%zu nodes, peak RSS %ld MB with the ast and the layout\n", ast.size(), peak_rss_kb() / 1024);
+
+    calc_viewport const fit = fit_calc_viewport(ast, layout, 1920, 1080);
+    calc_viewport lod = fit;
+    lod.minPixels = 2;
+    calc_viewport window;
+    window.left = layout.x(static_cast<std::uint32_t>(ast.size() / 2));
+    window.top = layout.depth(static_cast<std::uint32_t>(ast.size() / 2));
+
+    std::FILE * file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    counting_sink sink{ fd_output_sink(fileno(file)), 0 };
+    calc_graph_emitter<counting_sink> emitter(sink);
+
+    auto run = [&](char const * name, auto && emit) {
+        long const rssBefore = peak_rss_kb();
+        sink.bytes = 0;
+        auto const start = clock_t::now();
+        emit();
+        REQUIRE(emitter.flush());
+        double const ms = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+        calc_emit_stats const& stats = emitter.stats();
+        std::printf("%-12s %9.1f ms %9.1f MB %7.1f MB/s %7.1f ns/node, %9llu nodes %9llu summaries, "
+                    "peak RSS +%ld MB\n",
+                    name, ms, double(sink.bytes) / 1e6, double(sink.bytes) / 1e3 / ms,
+                    ms * 1e6 / double(ast.size()), (unsigned long long)stats.nodes,
+                    (unsigned long long)stats.summaries, (peak_rss_kb() - rssBefore) / 1024);
+        REQUIRE(std::fseek(file, 0, SEEK_SET) == 0);
+        REQUIRE(ftruncate(fileno(file), 0) == 0);
+    };
+    // the first one allocates the bounds.
+    run("dot", [&] { emitter.dot(ast); });
+    run("dot layout", [&] { emitter.dot(ast, layout, fit); });
+    run("svg", [&] { emitter.svg(ast, layout, fit); });
+    run("svg lod 2px", [&] { emitter.svg(ast, layout, lod); });
+    run("svg window", [&] { emitter.svg(ast, layout, window); });
+    std::fclose(file);
+
+    // the whole document in memory.
+    long const rssBefore = peak_rss_kb();
+    auto const start = clock_t::now();
+    string_sink strings;
+    {
+        calc_graph_emitter<string_sink> inMemory(strings);
+        inMemory.svg(ast, layout, fit);
+    }
+    double const ms = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+    std::printf("%-12s %9.1f ms %9.1f MB %7.1f MB/s, peak RSS +%ld MB\n", "svg string", ms,
+                double(strings.s.size()) / 1e6, double(strings.s.size()) / 1e3 / ms,
+                (peak_rss_kb() - rssBefore) / 1024);
+}
+#endif
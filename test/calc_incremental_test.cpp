@@ -0,0 +1,255 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "calc_incremental.h"
+#include "calc_stream.h"
+#include "calc_generator.h"
+#include "cycle_clock.h"
+#include "latency_histogram.h"
+
+
+namespace
+{
+    using namespace algovisu;
+
+    std::vector<calc_ast> parse_lines(std::string const& input)
+    {
+        std::vector<calc_ast> asts;
+        calc_push_parser parser;
+        auto on_expression = [&asts](calc_ast const& ast, bool ok) {
+            if (ok) {
+                asts.push_back(ast);
+            }
+        };
+        parser.push(input.data(), input.data() + input.size(), on_expression);
+        parser.finish(on_expression);
+        return asts;
+    }
+
+    // The values of all the nodes from scratch, with a failed division as 0.
+    // It returns the number of the failed ones.
+    std::size_t node_values(calc_ast const& ast, std::vector<calc_value_t> & values)
+    {
+        values.resize(ast.size());
+        std::size_t failures = 0;
+        for (std::size_t i = 0; i < ast.size(); ++i) {
+            calc_node const& node = ast.nodes[i];
+            if (node.op == calc_op::literal) {
+                values[i] = node.value;
+            } else if (!calc_apply(node.op, values[node.lhs], values[node.rhs], values[i])) {
+                values[i] = 0;
+                ++failures;
+            }
+        }
+        return failures;
+    }
+
+    void require_same(calc_incremental_evaluator const& evaluator, calc_ast const& ast)
+    {
+        std::vector<calc_value_t> values;
+        std::size_t const failures = node_values(ast, values);
+        REQUIRE(evaluator.valid() == (failures == 0));
+        calc_value_t v = 0;
+        REQUIRE(evaluate(ast, v) == evaluator.valid());
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            REQUIRE(evaluator.value(i) == values[i]);
+        }
+        if (evaluator.valid()) {
+            REQUIRE(evaluator.result() == v);
+        }
+    }
+
+    std::vector<std::uint32_t> literals_of(calc_ast const& ast)
+    {
+        std::vector<std::uint32_t> literals;
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            if (ast.nodes[i].op == calc_op::literal) {
+                literals.push_back(i);
+            }
+        }
+        return literals;
+    }
+
+    std::uint64_t next_random(std::uint64_t & x)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    }
+
+    // a single expression of about the tokens.
+    calc_ast make_expression(std::size_t tokens, double group, std::array<unsigned, 4> opWeights)
+    {
+        calc_generator_options options;
+        options.minTokens = tokens;
+        options.maxTokens = tokens;
+        options.group = group;
+        options.opWeights = opWeights;
+        std::string text;
+        calc_generator(options).next(text);
+        auto asts = parse_lines(text);
+        REQUIRE(asts.size() == 1);
+        return asts[0];
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc incremental evaluation", "[algovisu]")
+{
+    auto asts = parse_lines("1 - (2 - 3) * 4 / (5 - 5) + 6 * (7 + 8 * 9)\n"
+                            "7\n"
+                            "(1 - 2) - (3 - (4 - 5))\n");
+    REQUIRE(asts.size() == 3);
+
+    calc_incremental_evaluator evaluator;
+    {
+        calc_ast & ast = asts[0];
+        REQUIRE_FALSE(evaluator.build(ast));
+        require_same(evaluator, ast);
+        // 5 - 5 is 5 - 1, then.
+        REQUIRE(ast.nodes[7].op == calc_op::literal);
+        REQUIRE(ast.nodes[7].value == 5);
+        REQUIRE(evaluator.set_literal(7, 1));
+        REQUIRE(ast.nodes[7].value == 1);
+        require_same(evaluator, ast);
+        REQUIRE(evaluator.result() == 1 - (2 - 3) * 4 / (5 - 1) + 6 * (7 + 8 * 9));
+        REQUIRE_FALSE(evaluator.set_literal(7, 5));
+        require_same(evaluator, ast);
+    }
+    {
+        calc_ast & ast = asts[1];
+        REQUIRE(evaluator.build(ast));
+        REQUIRE(evaluator.result() == 7);
+        REQUIRE(evaluator.set_literal(0, 8));
+        REQUIRE(evaluator.result() == 8);
+        REQUIRE(evaluator.group_count() == 0);
+    }
+    {
+        // only a literal can be set.
+        calc_ast & ast = asts[2];
+        REQUIRE(evaluator.build(ast));
+        calc_op const op = ast.nodes[ast.root()].op;
+        REQUIRE_FALSE(evaluator.set_literal(ast.root(), 42));
+        REQUIRE(ast.nodes[ast.root()].op == op);
+        REQUIRE_FALSE(evaluator.set_literal(static_cast<std::uint32_t>(ast.size()), 42));
+        require_same(evaluator, ast);
+    }
+    {
+        calc_ast empty;
+        REQUIRE_FALSE(evaluator.build(empty));
+        REQUIRE_FALSE(evaluator.valid());
+        REQUIRE(evaluator.result() == 0);
+        REQUIRE_FALSE(evaluator.set_literal(0, 1));
+    }
+    {
+        // a single group, with the signs of the nested ones.
+        calc_ast & ast = asts[2];
+        REQUIRE(evaluator.build(ast));
+        REQUIRE(evaluator.group_count() == 1);
+        REQUIRE(evaluator.term_count() == 5);
+        require_same(evaluator, ast);
+        for (std::uint32_t i : literals_of(ast)) {
+            evaluator.set_literal(i, ast.nodes[i].value * 10);
+            require_same(evaluator, ast);
+        }
+        REQUIRE(evaluator.result() == (10 - 20) - (30 - (40 - 50)));
+    }
+}
+
+TEST_CASE("calc incremental evaluation of the edits", "[algovisu]")
+{
+    calc_generator_options options;
+    options.seed = 17;
+    options.maxTokens = 80;
+    options.group = 0.3;
+    options.maxDigits = 1;
+    std::string input;
+    calc_generator(options).generate(100000, input);
+    auto asts = parse_lines(input);
+    REQUIRE(asts.size() > 500);
+
+    calc_incremental_evaluator evaluator;
+    std::uint64_t x = 3;
+    for (auto & ast : asts) {
+        evaluator.build(ast);
+        require_same(evaluator, ast);
+        auto const literals = literals_of(ast);
+        for (int k = 0; k < 10; ++k) {
+            std::uint32_t const node = literals[next_random(x) % literals.size()];
+            // zeros often, for the divisions.
+            calc_value_t const value = static_cast<calc_value_t>(next_random(x) % 4 == 0 ? 0 : x % 100);
+            evaluator.set_literal(node, value);
+            require_same(evaluator, ast);
+        }
+    }
+
+    // the long chains, with no recursion.
+    calc_ast ast = make_expression(200000, 0.05, { { 1, 1, 1, 1 } });
+    REQUIRE(ast.size() > 150000);
+    evaluator.build(ast);
+    require_same(evaluator, ast);
+    auto const literals = literals_of(ast);
+    for (int k = 0; k < 1000; ++k) {
+        std::uint32_t const node = literals[next_random(x) % literals.size()];
+        evaluator.set_literal(node, static_cast<calc_value_t>(next_random(x) % 10));
+    }
+    require_same(evaluator, ast);
+}
+
+// The latency of an edit of a literal at random, against evaluating it again.
+TEST_CASE("calc incremental evaluation latency", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    struct shape
+    {
+        char const * name;
+        double group;
+        std::array<unsigned, 4> opWeights;
+    };
+    shape const shapes[] = {
+        { "+ - chain", 0.0, { { 1, 1, 0, 0 } } },
+        { "+ - * groups", 0.1, { { 1, 1, 1, 0 } } },
+        { "+ - * / groups", 0.1, { { 1, 1, 1, 1 } } }
+    };
+
+    double const cyclesPerNs = cycles_per_nanosecond();
+    for (shape const& s : shapes) {
+        calc_ast ast = make_expression(1000000, s.group, s.opWeights);
+        calc_incremental_evaluator evaluator;
+        auto start = clock_t::now();
+        evaluator.build(ast);
+        double const buildMs = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+        start = clock_t::now();
+        calc_value_t v = 0;
+        bool const ok = evaluate(ast, v);
+        double const evaluateMs = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+
+        auto const literals = literals_of(ast);
+        latency_histogram latency;
+        std::uint64_t x = 5;
+        for (int k = 0; k < 200000; ++k) {
+            std::uint32_t const node = literals[next_random(x) % literals.size()];
+            calc_value_t const value = static_cast<calc_value_t>(next_random(x) % 9 + 1);
+            std::uint64_t const begin = read_cycle_counter();
+            evaluator.set_literal(node, value);
+            latency.record(read_cycle_counter() - begin);
+        }
+        REQUIRE(evaluate(ast, v) == evaluator.valid());
+        if (evaluator.valid()) {
+            REQUIRE(evaluator.result() == v);
+        }
+        latency_summary summary;
+        summary.merge(latency);
+        std::printf("%s, %zu nodes, %zu groups: build %.1f ms, evaluate %.1f ms%s\n",
+                    s.name, ast.size(), evaluator.group_count(), buildMs, evaluateMs, ok ? "" : " (failed)");
+        dump_latency_text_header(std::cout);
+        dump_latency_text(std::cout, "update", summary, cyclesPerNs);
+    }
+}
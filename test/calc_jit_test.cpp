@@ -0,0 +1,261 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "calc_jit.h"
+#include "calc_column_vm.h"
+#include "calc_bytecode.h"
+#include "calc_test_helpers.h"
+#include "calc_generator.h"
+
+#if defined(ALGOVISU_HAS_CALC_JIT)
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+
+    // The literals of the ast, bound to the columns in turn.
+    std::vector<calc_column_binding> bind_literals(calc_ast const& ast, std::uint32_t columns)
+    {
+        std::vector<calc_column_binding> bindings;
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            if (ast.nodes[i].op == calc_op::literal) {
+                bindings.push_back(calc_column_binding{ i, static_cast<std::uint32_t>(bindings.size() % columns) });
+            }
+        }
+        return bindings;
+    }
+
+    // The rows by calc_vm, with the literals set to the columns row by row.
+    std::size_t reference(calc_ast ast, std::vector<calc_column_binding> const& bindings,
+                          std::vector<std::vector<calc_value_t>> const& columns, std::size_t rows,
+                          std::vector<calc_value_t> & out)
+    {
+        calc_program program;
+        calc_vm vm;
+        out.resize(rows);
+        for (std::size_t row = 0; row < rows; ++row) {
+            for (calc_column_binding const& b : bindings) {
+                ast.nodes[b.node].value = columns[b.column][row];
+            }
+            compile_calc(ast, program);
+            if (!vm.run(program, out[row])) {
+                return row;
+            }
+        }
+        return rows;
+    }
+
+    std::vector<calc_value_t const *> pointers(std::vector<std::vector<calc_value_t>> const& columns)
+    {
+        std::vector<calc_value_t const *> p;
+        for (auto const& c : columns) {
+            p.push_back(c.data());
+        }
+        return p;
+    }
+
+    // The kernel gives the same rows as the reference.
+    void check(calc_ast const& ast, std::vector<calc_column_binding> const& bindings,
+               std::vector<std::vector<calc_value_t>> const& columns, std::size_t rows)
+    {
+        std::vector<calc_value_t> expected;
+        std::size_t const done = reference(ast, bindings, columns, rows, expected);
+        calc_jit jit;
+        calc_jit_kernel kernel;
+        REQUIRE(jit.compile(ast, bindings, kernel));
+        std::vector<calc_value_t> out(rows);
+        REQUIRE(kernel.run(pointers(columns).data(), rows, out.data()) == done);
+        for (std::size_t row = 0; row < done; ++row) {
+            REQUIRE(out[row] == expected[row]);
+        }
+    }
+
+    calc_value_t const edges[] = {
+        0, 1, -1, 2, -2, 7, std::numeric_limits<calc_value_t>::min(), std::numeric_limits<calc_value_t>::max(),
+        std::numeric_limits<std::int32_t>::min(), std::numeric_limits<std::int32_t>::max(), 0x123456789ll
+    };
+
+    std::vector<std::vector<calc_value_t>> random_columns(std::size_t count, std::size_t rows, std::uint32_t seed)
+    {
+        std::mt19937_64 random(seed);
+        std::vector<std::vector<calc_value_t>> columns(count, std::vector<calc_value_t>(rows));
+        for (auto & c : columns) {
+            for (calc_value_t & v : c) {
+                switch (random() % 4) {
+                    case 0: v = edges[random() % (sizeof(edges) / sizeof(edges[0]))]; break;
+                    case 1: v = static_cast<calc_value_t>(random()); break;
+                    default: v = static_cast<calc_value_t>(random() % 2001) - 1000; break;
+                }
+            }
+        }
+        return columns;
+    }
+
+    std::uint32_t add_complete(calc_ast & ast, unsigned depth, std::mt19937 & random)
+    {
+        if (depth == 0) {
+            return ast.add_literal(0);
+        }
+        std::uint32_t const lhs = add_complete(ast, depth - 1, random);
+        std::uint32_t const rhs = add_complete(ast, depth - 1, random);
+        return ast.add_operator(static_cast<calc_op>(random() % 3 + 1), lhs, rhs);
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc jit", "[algovisu]")
+{
+    calc_jit jit;
+    calc_jit_kernel kernel;
+
+    // no columns, the same value for every row.
+    REQUIRE(jit.compile(parse("1 + 2 * 3"), kernel));
+    REQUIRE_FALSE(kernel.empty());
+    std::vector<calc_value_t> out(4);
+    REQUIRE(kernel.run(nullptr, 4, out.data()) == 4);
+    REQUIRE(out == (std::vector<calc_value_t>{ 7, 7, 7, 7 }));
+    REQUIRE(kernel.run(nullptr, 0, out.data()) == 0);
+    REQUIRE(jit.compile(parse("8 / 0"), kernel));
+    REQUIRE(kernel.run(nullptr, 4, out.data()) == 0);
+    REQUIRE_FALSE(jit.compile(calc_ast{}, kernel));
+    REQUIRE(kernel.empty());
+
+    // a / b, and a division by zero in the row 3.
+    calc_value_t const lowest = std::numeric_limits<calc_value_t>::min();
+    std::vector<std::vector<calc_value_t>> columns = {
+        { 7, -7, lowest, 5, 1 },
+        { 2, 2, -1, 0, 1 }
+    };
+    calc_ast const ast = parse("1 / 1");
+    std::vector<calc_column_binding> const bindings = { { 0, 0 }, { 1, 1 } };
+    REQUIRE(jit.compile(ast, bindings, kernel));
+    REQUIRE(kernel.run(pointers(columns).data(), 5, out.data()) == 3);
+    REQUIRE(out[0] == 3);
+    REQUIRE(out[1] == -3);
+    REQUIRE(out[2] == lowest);
+    check(ast, bindings, columns, 5);
+
+    // the literals of every size and sign, on both sides.
+    for (char const * text : { "0 - 1", "0 / 1", "1 - 0", "1 / 0", "0 * 12345678901", "12345678901 - 0",
+                               "0 + 12345678901", "0 / 12345678901", "0 - 9 / 0", "(0 - 1) * 3" }) {
+        calc_ast const t = parse(text);
+        for (calc_column_binding const& b : bind_literals(t, 2)) {
+            check(t, { b }, random_columns(2, 64, 3), 64);
+        }
+    }
+    for (calc_value_t divisor : edges) {
+        calc_ast t;
+        t.add_operator(calc_op::div, t.add_literal(0), t.add_literal(divisor));
+        check(t, { { 0, 0 } }, random_columns(1, 64, 5), 64);
+        t.nodes[0].value = divisor;
+        check(t, { { 1, 0 } }, random_columns(1, 64, 6), 64);
+    }
+}
+
+TEST_CASE("calc jit same as calc_vm", "[algovisu]")
+{
+    calc_generator_options options;
+    options.seed = 23;
+    options.group = 0.3;
+    calc_generator generator(options);
+    std::mt19937 random(23);
+    std::string line;
+    for (int i = 0; i < 300; ++i) {
+        line.clear();
+        generator.next(line);
+        calc_ast const ast = parse(line);
+        // some of the literals, to 3 columns.
+        std::vector<calc_column_binding> bindings;
+        for (calc_column_binding const& b : bind_literals(ast, 3)) {
+            if (random() % 2) {
+                bindings.push_back(b);
+            }
+        }
+        check(ast, bindings, random_columns(3, 40, i), 40);
+    }
+
+    // a complete tree needs more than the 6 registers, and spills.
+    std::mt19937 ops(9);
+    calc_ast ast;
+    add_complete(ast, 9, ops);
+    calc_jit jit;
+    calc_jit_kernel kernel;
+    std::vector<calc_column_binding> const bindings = bind_literals(ast, 5);
+    REQUIRE(jit.compile(ast, bindings, kernel));
+    REQUIRE(jit.program().spillSlots > 0);
+    check(ast, bindings, random_columns(5, 100, 1), 100);
+}
+
+// The compile latency, and the rows per second of the kernels, calc_column_vm
+// and calc_register_vm by the row, over a million rows.
+TEST_CASE("calc jit throughput", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+    std::size_t const rows = 1 << 20;
+    auto columns = random_columns(4, rows, 11);
+    for (auto & c : columns) {
+        for (calc_value_t & v : c) {
+            v = v % 1000 + 1001;    // no division by zero.
+        }
+    }
+    std::vector<calc_value_t const *> const p = pointers(columns);
+
+    calc_generator_options options;
+    options.seed = 31;
+    options.opWeights = { { 1, 1, 1, 0 } };
+    options.minTokens = 60;
+    options.maxTokens = 80;
+    calc_generator generator(options);
+    std::string generated;
+    generator.next(generated);
+
+    char const * const texts[] = { "1 + 2 * 3", "(1 - 2) * (3 + 7) / 4", generated.c_str() };
+    for (char const * text : texts) {
+        calc_ast const ast = parse(text);
+        std::vector<calc_column_binding> const bindings = bind_literals(ast, 4);
+
+        auto best = [](auto && run) {
+            double ns = 1e300;
+            for (int r = 0; r < 5; ++r) {
+                auto const start = clock_t::now();
+                run();
+                ns = std::min(ns, std::chrono::duration<double, std::nano>(clock_t::now() - start).count());
+            }
+            return ns;
+        };
+
+        calc_jit jit;
+        calc_jit_kernel kernel;
+        double const compileNs = best([&] { jit.compile(ast, bindings, kernel); });
+        std::vector<calc_value_t> out(rows);
+        std::vector<calc_value_t> expected(rows);
+
+        calc_register_program const& program = jit.program();
+        calc_register_vm rowVm;
+        double const rowNs = best([&] {
+            for (std::size_t row = 0; row < rows; ++row) {
+                rowVm.run(program, p.data(), row, expected[row]);
+            }
+        });
+        calc_column_vm columnVm;
+        double const columnNs = best([&] { columnVm.run(program, p.data(), rows, out.data()); });
+        REQUIRE(out == expected);
+        double const jitNs = best([&] { kernel.run(p.data(), rows, out.data()); });
+        REQUIRE(out == expected);
+
+        std::printf("%zu nodes, %zu instructions, %zu bytes of code compiled in %.1f us\n",
+                    ast.size(), program.size(), kernel.code_size(), compileNs / 1000);
+        std::printf("  register vm by row %8.1f M rows/s\n", rows / rowNs * 1000);
+        std::printf("  column vm          %8.1f M rows/s\n", rows / columnNs * 1000);
+        std::printf("  jit                %8.1f M rows/s\n", rows / jitNs * 1000);
+    }
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include "calc_output.h"
+
+
+TEST_CASE("calc value formatting", "[algovisu]")
+{
+    using namespace algovisu;
+
+    std::vector<calc_value_t> values{
+        0, 1, -1, 9, 10, 99, 100, 101, 999, 1000, 12345, -12345, 100000000,
+        std::numeric_limits<calc_value_t>::max(),
+        std::numeric_limits<calc_value_t>::min(),
+        std::numeric_limits<calc_value_t>::min() + 1
+    };
+    for (calc_value_t v = 1; v < std::numeric_limits<calc_value_t>::max() / 10; v *= 10) {
+        values.push_back(v - 1);
+        values.push_back(v);
+        values.push_back(-v);
+    }
+    for (calc_value_t v : values) {
+        char buffer[calc_value_max_chars + 1];
+        char * const end = format_calc_value(buffer, v);
+        REQUIRE(std::string(buffer, end) == std::to_string(v));
+    }
+}
+
+TEST_CASE("calc result writer", "[algovisu]")
+{
+    using namespace algovisu;
+
+    std::ostringstream oss;
+    std::string expected;
+    {
+        ostream_output_sink sink(oss);
+        // a small buffer, to be flushed many times.
+        calc_result_writer<ostream_output_sink> writer(sink, 50);
+        for (calc_value_t v = -1000; v <= 1000; v += 7) {
+            if (v % 3 == 0) {
+                writer.error();
+                expected += "error\n";
+            } else {
+                writer.value(v * 1000003);
+                expected += std::to_string(v * 1000003) + '\n';
+            }
+        }
+        REQUIRE(writer.good());
+    }   // flushed by the destructor
+    REQUIRE(oss.str() == expected);
+
+#if defined(ALGOVISU_HAS_WRITEV)
+    // the blocks in order, by writev.
+    std::FILE * file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    fd_output_sink sink(fileno(file));
+    std::vector<std::string> strings{ "abc", "", "defg", std::string(100000, 'x'), "h" };
+    std::vector<calc_output_block> blocks;
+    std::string all;
+    for (auto const& s : strings) {
+        blocks.push_back(calc_output_block{ s.data(), s.size() });
+        all += s;
+    }
+    REQUIRE(sink.write(blocks.data(), blocks.size()));
+    std::rewind(file);
+    std::string read(all.size() + 1, '\0');
+    read.resize(std::fread(&read[0], 1, read.size(), file));
+    std::fclose(file);
+    REQUIRE(read == all);
+#endif
+}
@@ -0,0 +1,206 @@
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <limits>
+#include <sstream>
+#include <iostream>
+
+#include "calc_pipeline.h"
+
+
+namespace
+{
+    using lexer_impl_t = algovisu::lex::lexertl::lexer<>;
+    using lexer_def_t = algovisu::calc_token<lexer_impl_t>;
+
+    std::vector<std::string> make_expressions(std::size_t count)
+    {
+        std::vector<std::string> expressions;
+        std::uint32_t seed = 12345;
+        auto next = [&seed] { seed = seed * 1103515245 + 12345; return (seed >> 16) & 0x7fff; };
+        for (std::size_t i = 0; i < count; ++i) {
+            std::string s = std::to_string(next() % 1000 + 1);
+            std::size_t const terms = next() % 50 + 1;
+            for (std::size_t j = 0; j < terms; ++j) {
+                s += " +-*/"[next() % 4 + 1];
+                s += (next() % 2) ? " (" + std::to_string(next() % 100 + 1) + " + 7)" : std::to_string(next() % 100 + 1);
+            }
+            expressions.push_back(std::move(s));
+        }
+        return expressions;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc token buffer", "[algovisu]")
+{
+    using namespace algovisu;
+
+    lexer_def_t tokens;
+    calc_token_buffer<lexer_def_t> buffer;
+
+    std::string s = " 10 +(20-5)\n*7 /  2 ";
+    REQUIRE(lex_calc(tokens, s.data(), s.data() + s.size(), buffer));
+
+    // the white spaces are not in the buffer.
+    REQUIRE(buffer.size() == 11);
+    REQUIRE(buffer[0].id() == 65536);
+    REQUIRE(std::string(buffer[0].value().begin(), buffer[0].value().end()) == "10");
+    REQUIRE(buffer[1].id() == '+');
+    REQUIRE(buffer[4].id() == '-');
+    REQUIRE(buffer[7].id() == '*');
+    REQUIRE(std::string(buffer[10].value().begin(), buffer[10].value().end()) == "2");
+
+    buffer.clear();
+    s = "1 + $";
+    REQUIRE_FALSE(lex_calc(tokens, s.data(), s.data() + s.size(), buffer));
+}
+
+TEST_CASE("calc buffer grammar builds the AST", "[algovisu]")
+{
+    using namespace algovisu;
+
+    lexer_def_t tokens;
+    calc_buffer_grammar<lexer_def_t> grammar{ tokens };
+    calc_token_buffer<lexer_def_t> buffer;
+    calc_ast ast;
+
+    std::string s = "1 - 2 * (3 + 4)";
+    REQUIRE(lex_calc(tokens, s.data(), s.data() + s.size(), buffer));
+    REQUIRE(parse_calc(grammar, buffer, ast));
+
+    // post-order: 1 2 3 4 + * -
+    REQUIRE(ast.size() == 7);
+    REQUIRE(ast.nodes[0].value == 1);
+    REQUIRE(ast.nodes[3].value == 4);
+    REQUIRE(ast.nodes[4].op == calc_op::add);
+    REQUIRE(ast.nodes[4].lhs == 2);
+    REQUIRE(ast.nodes[4].rhs == 3);
+    REQUIRE(ast.nodes[5].op == calc_op::mul);
+    REQUIRE(ast.nodes[5].lhs == 1);
+    REQUIRE(ast.nodes[5].rhs == 4);
+    REQUIRE(ast.nodes[6].op == calc_op::sub);
+    REQUIRE(ast.nodes[6].lhs == 0);
+    REQUIRE(ast.nodes[6].rhs == 5);
+    REQUIRE(ast.root() == 6);
+
+    // the operators are left associative.
+    ast.clear();
+    buffer.clear();
+    s = "8 / 4 / 2";
+    REQUIRE(lex_calc(tokens, s.data(), s.data() + s.size(), buffer));
+    REQUIRE(parse_calc(grammar, buffer, ast));
+
+    calc_value_t result = 0;
+    REQUIRE(evaluate(ast, result));
+    REQUIRE(result == 1);
+
+    // the whole token buffer should be matched.
+    for (char const * bad : { "1 +", "(1", "1 2", ")", "01" }) {
+        ast.clear();
+        buffer.clear();
+        std::string b = bad;
+        REQUIRE(lex_calc(tokens, b.data(), b.data() + b.size(), buffer));
+        REQUIRE_FALSE(parse_calc(grammar, buffer, ast));
+    }
+}
+
+TEST_CASE("calc evaluation", "[algovisu]")
+{
+    using namespace algovisu;
+
+    calc_pipeline<> pipeline;
+    calc_value_t result = 0;
+
+    REQUIRE(pipeline.run("10+(20-5)*7/2", result));
+    REQUIRE(result == 62);
+
+    REQUIRE(pipeline.run("10 * (20 + 5) - 10 / 2", result));
+    REQUIRE(result == 245);
+
+    REQUIRE(pipeline.run("7 - 10 / 4", result));
+    REQUIRE(result == 5);
+
+    REQUIRE(pipeline.run("0 - 7 / 2", result));     // truncated toward zero
+    REQUIRE(result == -3);
+
+    // wrapping around
+    REQUIRE(pipeline.run("9223372036854775807 + 1", result));
+    REQUIRE(result == std::numeric_limits<calc_value_t>::min());
+
+    REQUIRE_FALSE(pipeline.run("1 / (2 - 2)", result));
+    REQUIRE_FALSE(pipeline.run("1 + ", result));
+
+    calc_value_t v = 0;
+    REQUIRE(calc_apply(calc_op::div, std::numeric_limits<calc_value_t>::min(), -1, v));
+    REQUIRE(v == std::numeric_limits<calc_value_t>::min());
+}
+
+TEST_CASE("calc stage latency", "[algovisu]")
+{
+    using namespace algovisu;
+
+    reset_stage_latency();
+
+    calc_pipeline<calc_instruments<stage_latency_timer>> pipeline;
+    calc_value_t result = 0;
+    for (int i = 0; i < 10; ++i) {
+        REQUIRE(pipeline.run("10 * (20 + 5) - 10 / 2", result));
+    }
+    REQUIRE_FALSE(pipeline.run("1 $ 2", result));     // only lexed
+
+    auto summaries = collect_stage_latency();
+    REQUIRE(summaries[size_t(calc_stage::read)].count() == 0);
+    REQUIRE(summaries[size_t(calc_stage::lex)].count() == 11);
+    REQUIRE(summaries[size_t(calc_stage::parse)].count() == 10);
+    REQUIRE(summaries[size_t(calc_stage::evaluate)].count() == 10);
+    REQUIRE(summaries[size_t(calc_stage::parse)].min() > 0);
+
+    std::ostringstream text;
+    dump_stage_latency_text(text);
+    REQUIRE(text.str().find("evaluate") != std::string::npos);
+
+    std::ostringstream json;
+    dump_stage_latency_json(json);
+    REQUIRE(json.str().find("{\"read\":{\"count\":0,") == 0);
+    REQUIRE(json.str().find("\"lex\":{\"count\":11,") != std::string::npos);
+}
+
+TEST_CASE("calc stage latency overhead", "[.][benchmark]")
+{
+    using namespace algovisu;
+
+    auto const expressions = make_expressions(2000);
+
+    calc_pipeline<> plain;
+    calc_pipeline<calc_instruments<stage_latency_timer>> timed;
+
+    using clock_t = std::chrono::steady_clock;
+    auto measure = [&](auto & pipeline) {
+        calc_value_t result = 0;
+        auto start = clock_t::now();
+        for (auto const& s : expressions) {
+            pipeline.run(s, result);
+        }
+        return clock_t::now() - start;
+    };
+
+    // the runs are interleaved to cancel out the noise of the machine.
+    measure(plain);
+    measure(timed);
+    auto plainBest = clock_t::duration::max();
+    auto timedBest = clock_t::duration::max();
+    for (int i = 0; i < 30; ++i) {
+        plainBest = std::min(plainBest, measure(plain));
+        timedBest = std::min(timedBest, measure(timed));
+    }
+    double const plainUs = std::chrono::duration<double, std::micro>(plainBest).count();
+    double const timedUs = std::chrono::duration<double, std::micro>(timedBest).count();
+
+    std::cout << "plain: " << plainUs << " us, "
+              << "timed: " << timedUs << " us, "
+              << "overhead: " << (timedUs / plainUs - 1.0) * 100.0 << " %\n";
+    dump_stage_latency_text(std::cout);
+}
@@ -0,0 +1,203 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "calc_printer.h"
+#include "calc_karma.h"
+#include "calc_stream.h"
+#include "calc_generator.h"
+
+
+namespace
+{
+    using namespace algovisu;
+
+    struct string_sink
+    {
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                s.append(blocks[i].data, blocks[i].size);
+            }
+            return true;
+        }
+
+        std::string s;
+    };
+
+    // the ASTs of the lines, the failed ones skipped.
+    std::vector<calc_ast> parse_lines(std::string const& input)
+    {
+        std::vector<calc_ast> asts;
+        calc_push_parser parser;
+        auto on_expression = [&asts](calc_ast const& ast, bool ok) {
+            if (ok) {
+                asts.push_back(ast);
+            }
+        };
+        parser.push(input.data(), input.data() + input.size(), on_expression);
+        parser.finish(on_expression);
+        return asts;
+    }
+
+    std::string print(calc_ast const& ast)
+    {
+        string_sink sink;
+        {
+            calc_printer<string_sink> printer(sink, 16);
+            printer.print(ast);
+        }
+        return sink.s;
+    }
+
+    std::string print_by_karma(calc_ast const& ast)
+    {
+        std::string s;
+        std::back_insert_iterator<std::string> out(s);
+        calc_karma_grammar<std::back_insert_iterator<std::string>> g;
+        REQUIRE(karma::generate(out, g.of(ast)));
+        return s;
+    }
+
+    bool same_tree(calc_ast const& a, calc_ast const& b)
+    {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            calc_node const& x = a.nodes[i];
+            calc_node const& y = b.nodes[i];
+            if (x.op != y.op || x.lhs != y.lhs || x.rhs != y.rhs || x.value != y.value) {
+                return false;
+            }
+        }
+        return true;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc printer minimal parentheses", "[algovisu]")
+{
+    std::vector<std::pair<char const *, char const *>> const cases{
+        { " 1 +  2 ", "1+2" },
+        { "((1))", "1" },
+        { "(1 + 2) * 3", "(1+2)*3" },
+        { "1 + (2 + 3)", "1+(2+3)" },
+        { "(1 + 2) + 3", "1+2+3" },
+        { "1 - (2 * 3)", "1-2*3" },
+        { "(1 * 2) + 3", "1*2+3" },
+        { "1 / (2 * 3)", "1/(2*3)" },
+        { "(1 / 2) * 3", "1/2*3" },
+        { "(1 - 2) - (3 - (4 - 5))", "1-2-(3-(4-5))" },
+        { "9223372036854775808 * 2", "9223372036854775808*2" }     // a wrapped literal
+    };
+    for (auto const& c : cases) {
+        std::string const input(c.first);
+        auto const asts = parse_lines(input);
+        REQUIRE(asts.size() == 1);
+        REQUIRE(print(asts[0]) == c.second);
+        REQUIRE(print_by_karma(asts[0]) == c.second);
+    }
+}
+
+TEST_CASE("calc printer round trip", "[algovisu]")
+{
+    calc_generator_options options;
+    options.group = 0.4;
+    options.seed = 5;
+    std::string input;
+    calc_generator(options).generate(100000, input);
+    auto const asts = parse_lines(input);
+    REQUIRE(asts.size() > 100);
+
+    // the same tree is parsed back from the text.
+    string_sink sink;
+    {
+        calc_printer<string_sink> printer(sink, 1024);
+        for (auto const& ast : asts) {
+            printer.print(ast);
+            printer.put('\n');
+        }
+    }
+    auto const parsed = parse_lines(sink.s);
+    REQUIRE(parsed.size() == asts.size());
+    for (std::size_t i = 0; i < asts.size(); ++i) {
+        REQUIRE(same_tree(parsed[i], asts[i]));
+    }
+
+    for (std::size_t i = 0; i < asts.size(); i += 10) {
+        REQUIRE(print_by_karma(asts[i]) == print(asts[i]));
+    }
+
+    // a chain deeper than the recursion could go
+    std::string chain = "1";
+    for (int i = 0; i < 1000000; ++i) {
+        chain += "-1";
+    }
+    auto const deep = parse_lines(chain);
+    REQUIRE(deep.size() == 1);
+    REQUIRE(print(deep[0]) == chain);
+}
+
+TEST_CASE("calc printer throughput", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    // the trees of a 14 MB corpus, printed 10 times for ~100 MB of the text
+    // without the blanks.
+    std::string input;
+    calc_generator().generate(std::size_t(14) << 20, input);
+    auto const asts = parse_lines(input);
+    input = std::string();
+
+    struct null_sink
+    {
+        bool write(calc_output_block const * blocks, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i) {
+                bytes += blocks[i].size;
+            }
+            return true;
+        }
+
+        std::size_t bytes = 0;
+    };
+
+    auto report = [](char const * name, clock_t::duration d, std::size_t bytes) {
+        double const seconds = std::chrono::duration<double>(d).count();
+        std::cout << name << ": " << bytes / 1000000 << " MB, " << seconds << " s, "
+                  << bytes / seconds / 1e6 << " MB/s\n";
+    };
+
+    for (int round = 0; round < 2; ++round) {
+        null_sink handSink;
+        auto start = clock_t::now();
+        {
+            calc_printer<null_sink> printer(handSink);
+            for (int i = 0; i < 10; ++i) {
+                for (auto const& ast : asts) {
+                    printer.print(ast);
+                    printer.put('\n');
+                }
+            }
+        }
+        report("calc_printer", clock_t::now() - start, handSink.bytes);
+
+        null_sink karmaSink;
+        start = clock_t::now();
+        {
+            calc_output_buffer<null_sink> buffer(karmaSink, 64 * 1024);
+            calc_output_iterator<null_sink> out(buffer);
+            calc_karma_grammar<calc_output_iterator<null_sink>> g;
+            for (int i = 0; i < 10; ++i) {
+                for (auto const& ast : asts) {
+                    karma::generate(out, g.of(ast) << karma::lit('\n'));
+                }
+            }
+        }
+        report("calc_karma_grammar", clock_t::now() - start, karmaSink.bytes);
+    }
+}
@@ -0,0 +1,265 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include "calc_program_cache.h"
+#include "calc_pipeline.h"
+#include "calc_generator.h"
+#include "cycle_clock.h"
+#include "latency_histogram.h"
+
+
+namespace
+{
+    using namespace algovisu;
+
+    struct expression
+    {
+        std::string text;
+        calc_program program;
+        calc_value_t value;
+    };
+
+    // The valid expressions without the division, with their programs.
+    std::vector<expression> make_expressions(std::size_t count, std::uint64_t seed, std::size_t maxTokens)
+    {
+        calc_generator_options options;
+        options.seed = seed;
+        options.maxTokens = maxTokens;
+        options.opWeights = { { 1, 1, 1, 0 } };
+        calc_generator generator(options);
+        calc_pipeline<> pipeline;
+        std::vector<expression> expressions(count);
+        for (auto & e : expressions) {
+            generator.next(e.text);
+            REQUIRE(pipeline.run(e.text, e.value));
+            compile_calc(pipeline.ast(), e.program);
+        }
+        return expressions;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc program cache", "[algovisu]")
+{
+    auto const expressions = make_expressions(4000, 7, 40);
+    calc_vm vm;
+    calc_value_t result = 0;
+
+    calc_program_cache_options options;
+    options.shards = 4;
+    options.expectedEntries = 1024;
+    options.budgetBytes = 1 << 20;
+    calc_program_cache cache(options);
+
+    {
+        calc_program_cache::read_scope scope;
+        REQUIRE(cache.find("1+2", 3) == nullptr);
+        calc_program program;
+        program.code.push_back(calc_instruction{ calc_opcode::push, 1 });
+        program.stackDepth = 1;
+        calc_cached_program const * p = cache.insert("1", 1, program);
+        REQUIRE(p != nullptr);
+        REQUIRE(p->key == "1");
+        REQUIRE(cache.find("1", 1) == p);
+        // the first one stays.
+        REQUIRE(cache.insert("1", 1, calc_program()) == p);
+        REQUIRE(cache.find("1 ", 2) == nullptr);
+    }
+
+    // within the budget, the all are kept.
+    for (std::size_t i = 0; i < 1000; ++i) {
+        calc_program_cache::read_scope scope;
+        REQUIRE(cache.insert(expressions[i].text.data(), expressions[i].text.size(), expressions[i].program));
+    }
+    for (std::size_t i = 0; i < 1000; ++i) {
+        calc_program_cache::read_scope scope;
+        calc_cached_program const * p = cache.find(expressions[i].text.data(), expressions[i].text.size());
+        REQUIRE(p != nullptr);
+        REQUIRE(vm.run(p->program, result));
+        REQUIRE(result == expressions[i].value);
+    }
+    REQUIRE(cache.stats().entries == 1001);
+    REQUIRE(cache.stats().evictions == 0);
+
+    // over the budget, the ones hit are kept, and the one-off ones evicted.
+    for (std::size_t i = 1000; i < 4000; ++i) {
+        calc_program_cache::read_scope scope;
+        for (std::size_t j = 0; j < 200; j += 10) {
+            REQUIRE(cache.find(expressions[j].text.data(), expressions[j].text.size()) != nullptr);
+        }
+        REQUIRE(cache.insert(expressions[i].text.data(), expressions[i].text.size(), expressions[i].program));
+    }
+    calc_program_cache_stats const stats = cache.stats();
+    REQUIRE(stats.evictions > 0);
+    REQUIRE(stats.bytes <= options.budgetBytes);
+    REQUIRE(stats.retired < 64 * options.shards);
+    calc_program_cache::read_scope scope;
+    for (std::size_t j = 0; j < 200; j += 10) {
+        REQUIRE(cache.find(expressions[j].text.data(), expressions[j].text.size()) != nullptr);
+    }
+
+    // larger than a shard.
+    calc_program huge;
+    huge.code.resize(options.budgetBytes / options.shards / sizeof(calc_instruction));
+    REQUIRE(cache.insert("huge", 4, huge) == nullptr);
+}
+
+TEST_CASE("calc program cache concurrency", "[algovisu]")
+{
+    auto const expressions = make_expressions(3000, 8, 40);
+
+    calc_program_cache_options options;
+    options.shards = 8;
+    options.expectedEntries = 1024;
+    options.budgetBytes = 1 << 20;      // a third or so of them, to evict all the time.
+    calc_program_cache cache(options);
+
+    std::atomic<std::size_t> wrong{ 0 };
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t] {
+            calc_vm vm;
+            std::uint64_t x = t + 1;
+            for (int i = 0; i < 20000; ++i) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                expression const& e = expressions[x % expressions.size()];
+                calc_program_cache::read_scope scope;
+                calc_cached_program const * p = cache.find(e.text.data(), e.text.size());
+                if (!p) {
+                    p = cache.insert(e.text.data(), e.text.size(), e.program);
+                }
+                calc_value_t result = 0;
+                if (!p || p->key != e.text || !vm.run(p->program, result) || result != e.value) {
+                    ++wrong;
+                }
+            }
+        });
+    }
+    for (auto & t : threads) {
+        t.join();
+    }
+    REQUIRE(wrong == 0);
+    REQUIRE(cache.stats().evictions > 0);
+    REQUIRE(cache.stats().bytes <= options.budgetBytes);
+}
+
+// The hot set of 50k expressions is cached first, and then the requests are
+// served from it, or compiled and inserted on a miss, by 1 to 64 threads.
+TEST_CASE("calc program cache scaling", "[.][benchmark]")
+{
+    std::size_t const hotCount = 50000;
+    std::size_t const requests = 200000;
+    auto const hot = make_expressions(hotCount, 1, 60);
+    calc_generator_options missOptions;
+    missOptions.seed = 2;
+    missOptions.maxTokens = 60;
+    missOptions.opWeights = { { 1, 1, 1, 0 } };
+    calc_generator missGenerator(missOptions);
+    std::vector<std::string> misses(requests);
+    for (auto & m : misses) {
+        missGenerator.next(m);
+    }
+    std::size_t hotBytes = 0;
+    for (auto const& e : hot) {
+        hotBytes += sizeof(calc_cached_program) + e.text.capacity()
+                    + e.program.code.capacity() * sizeof(calc_instruction);
+    }
+    std::cout << hotCount << " hot expressions, " << hotBytes / 1024 << " KB cached, "
+              << requests << " requests per run\n";
+
+    // a pipeline per thread, made here for the token ids.
+    std::vector<std::unique_ptr<calc_pipeline<>>> pipelines;
+    for (int i = 0; i < 64; ++i) {
+        pipelines.push_back(std::make_unique<calc_pipeline<>>());
+        calc_value_t v;
+        pipelines.back()->run(std::string("1+1"), v);
+    }
+
+    double const cyclesPerNs = cycles_per_nanosecond();
+    std::printf("%-6s %8s %10s %10s %10s %10s %10s %10s\n", "hits", "threads", "Mreq/s", "hit%",
+                "hit p50", "hit p99", "miss p50", "miss p99");
+    for (double hitRatio : { 0.5, 0.8, 0.95, 0.99 }) {
+        for (unsigned threadCount : { 1u, 2u, 4u, 8u, 16u, 32u, 64u }) {
+            calc_program_cache_options options;
+            options.budgetBytes = hotBytes * 3 / 2;
+            options.expectedEntries = hotCount * 2;
+            calc_program_cache cache(options);
+            for (auto const& e : hot) {
+                calc_program_cache::read_scope scope;
+                cache.insert(e.text.data(), e.text.size(), e.program);
+            }
+
+            std::atomic<std::size_t> nextMiss{ 0 };
+            std::vector<latency_histogram> hitLatency(threadCount);
+            std::vector<latency_histogram> missLatency(threadCount);
+            std::uint64_t const threshold = static_cast<std::uint64_t>(hitRatio * 1000000);
+            auto work = [&](unsigned t) {
+                calc_pipeline<> & pipeline = *pipelines[t];
+                calc_vm vm;
+                calc_program program;
+                std::uint64_t x = t * 7919 + 1;
+                auto next = [&x] {
+                    x ^= x << 13;
+                    x ^= x >> 7;
+                    x ^= x << 17;
+                    return x;
+                };
+                for (std::size_t i = t; i < requests; i += threadCount) {
+                    std::string const * text;
+                    if (next() % 1000000 < threshold) {
+                        text = &hot[next() % hotCount].text;
+                    } else {
+                        text = &misses[nextMiss.fetch_add(1, std::memory_order_relaxed)];
+                    }
+                    std::uint64_t const start = read_cycle_counter();
+                    calc_value_t v = 0;
+                    calc_program_cache::read_scope scope;
+                    calc_cached_program const * p = cache.find(text->data(), text->size());
+                    if (p) {
+                        vm.run(p->program, v);
+                        hitLatency[t].record(read_cycle_counter() - start);
+                        continue;
+                    }
+                    if (pipeline.lex(text->data(), text->data() + text->size()) && pipeline.parse()) {
+                        compile_calc(pipeline.ast(), program);
+                        p = cache.insert(text->data(), text->size(), std::move(program));
+                        if (p) {
+                            vm.run(p->program, v);
+                        }
+                    }
+                    missLatency[t].record(read_cycle_counter() - start);
+                }
+            };
+
+            auto const begin = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < threadCount; ++t) {
+                threads.emplace_back(work, t);
+            }
+            for (auto & t : threads) {
+                t.join();
+            }
+            double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            latency_summary hits, missed;
+            for (unsigned t = 0; t < threadCount; ++t) {
+                hits.merge(hitLatency[t]);
+                missed.merge(missLatency[t]);
+            }
+            std::printf("%-6.2f %8u %10.2f %10.1f %10.0f %10.0f %10.0f %10.0f\n",
+                        hitRatio, threadCount, requests / seconds / 1e6,
+                        100.0 * double(hits.count()) / double(requests),
+                        double(hits.percentile(0.5)) / cyclesPerNs, double(hits.percentile(0.99)) / cyclesPerNs,
+                        double(missed.percentile(0.5)) / cyclesPerNs, double(missed.percentile(0.99)) / cyclesPerNs);
+        }
+    }
+}
@@ -0,0 +1,312 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "calc_register_vm.h"
+#include "calc_bytecode.h"
+#include "calc_threaded_vm.h"
+#include "calc_pipeline.h"
+#include "calc_test_helpers.h"
+#include "calc_generator.h"
+
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+
+    // 1 - 2 - 3 - ..., or 1 - (2 - (3 - ...)).
+    calc_ast chain(std::uint32_t literals, bool leftDeep)
+    {
+        calc_ast ast;
+        if (leftDeep) {
+            std::uint32_t top = ast.add_literal(1);
+            for (std::uint32_t i = 2; i <= literals; ++i) {
+                std::uint32_t const rhs = ast.add_literal(i);
+                top = ast.add_operator(calc_op::sub, top, rhs);
+            }
+            return ast;
+        }
+        std::uint32_t top = ast.add_literal(literals);
+        for (std::uint32_t i = literals - 1; i > 0; --i) {
+            std::uint32_t const lhs = ast.add_literal(i);
+            top = ast.add_operator(calc_op::sub, lhs, top);
+        }
+        return ast;
+    }
+
+    // A complete tree of the random operators but the division.
+    std::uint32_t add_balanced(calc_ast & ast, unsigned depth, std::mt19937 & random)
+    {
+        if (depth == 0) {
+            return ast.add_literal(static_cast<calc_value_t>(random() % 9 + 1));
+        }
+        std::uint32_t const lhs = add_balanced(ast, depth - 1, random);
+        std::uint32_t const rhs = add_balanced(ast, depth - 1, random);
+        return ast.add_operator(static_cast<calc_op>(random() % 3 + 1), lhs, rhs);
+    }
+
+    calc_ast balanced(unsigned depth, std::uint32_t seed)
+    {
+        std::mt19937 random(seed);
+        calc_ast ast;
+        add_balanced(ast, depth, random);
+        return ast;
+    }
+
+    std::size_t count(calc_register_program const& program, calc_register_opcode op)
+    {
+        std::size_t n = 0;
+        for (calc_register_instruction const& in : program.code) {
+            n += in.op == op;
+        }
+        return n;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc register vm", "[algovisu]")
+{
+    calc_register_compiler compiler;
+    calc_register_program program;
+    calc_register_vm vm;
+    calc_value_t result = 0;
+
+    // load 2, mul_imm 3, add_imm 1. The product is evaluated first.
+    compiler.compile(parse("1 + 2 * 3"), program);
+    REQUIRE(program.size() == 3);
+    REQUIRE(program.code[0].op == calc_register_opcode::load);
+    REQUIRE(program.code[1].op == calc_register_opcode::mul_imm);
+    REQUIRE(program.code[2].op == calc_register_opcode::add_imm);
+    REQUIRE(program.registers == 1);
+    REQUIRE(vm.run(program, result));
+    REQUIRE(result == 7);
+
+    compiler.compile(parse("10 - 2 * 3"), program);
+    REQUIRE(program.code.back().op == calc_register_opcode::imm_sub);
+    REQUIRE(vm.run(program, result));
+    REQUIRE(result == 4);
+    compiler.compile(parse("(1 + 2) * (3 - 4) / (0 - 1)"), program);
+    REQUIRE(vm.run(program, result));
+    REQUIRE(result == 3);
+    compiler.compile(parse("42"), program);
+    REQUIRE(program.size() == 1);
+    REQUIRE(vm.run(program, result));
+    REQUIRE(result == 42);
+
+    // a division by zero, by a literal, or not.
+    compiler.compile(parse("8 / 0"), program);
+    REQUIRE_FALSE(vm.run(program, result));
+    compiler.compile(parse("8 / (1 - 1)"), program);
+    REQUIRE_FALSE(vm.run(program, result));
+
+    compiler.compile(calc_ast{}, program);
+    REQUIRE(program.empty());
+    REQUIRE_FALSE(vm.run(program, result));
+}
+
+TEST_CASE("calc register vm same as calc_vm", "[algovisu]")
+{
+    calc_generator_options options;
+    options.seed = 17;
+    options.group = 0.3;
+    calc_generator generator(options);
+    calc_pipeline<> pipeline;
+    calc_program stack;
+    calc_register_program program;
+    calc_vm reference;
+    calc_register_vm vms[] = { calc_register_vm(calc_dispatch::threaded), calc_register_vm(calc_dispatch::switch_loop) };
+    calc_register_compiler compilers[] = {
+        calc_register_compiler(1), calc_register_compiler(2), calc_register_compiler(3), calc_register_compiler()
+    };
+    std::size_t spills = 0;
+    std::string line;
+    for (int i = 0; i < 2000; ++i) {
+        line.clear();
+        generator.next(line);
+        calc_value_t result;
+        pipeline.run(line, result);
+        compile_calc(pipeline.ast(), stack);
+        calc_value_t expected = 0;
+        bool const ok = reference.run(stack, expected);
+        for (calc_register_compiler & compiler : compilers) {
+            compiler.compile(pipeline.ast(), program);
+            REQUIRE(program.registers <= compiler.registers() + 2);
+            spills += count(program, calc_register_opcode::spill);
+            for (calc_register_vm & vm : vms) {
+                calc_value_t actual = 0;
+                REQUIRE(vm.run(program, actual) == ok);
+                REQUIRE((!ok || actual == expected));
+            }
+        }
+    }
+    REQUIRE(spills > 0);
+    REQUIRE(vms[1].dispatch() == calc_dispatch::switch_loop);
+}
+
+TEST_CASE("calc register vm deep and wide", "[algovisu]")
+{
+    calc_register_compiler compiler;
+    calc_register_program program;
+    calc_register_vm vm;
+    calc_register_vm switchVm(calc_dispatch::switch_loop);
+    calc_program stack;
+    calc_vm reference;
+    calc_value_t result = 0;
+    calc_value_t expected = 0;
+
+    // a chain needs a register whichever side it leans to, and an instruction per an operator.
+    for (bool leftDeep : { true, false }) {
+        calc_ast const ast = chain(200000, leftDeep);
+        compiler.compile(ast, program);
+        REQUIRE(program.size() == 200000);
+        REQUIRE(program.registers == 1);
+        REQUIRE(program.spillSlots == 0);
+        compile_calc(ast, stack);
+        REQUIRE(reference.run(stack, expected));
+        REQUIRE(vm.run(program, result));
+        REQUIRE(result == expected);
+        REQUIRE(switchVm.run(program, result));
+        REQUIRE(result == expected);
+    }
+
+    // a complete tree of the depth 12 needs 12 registers, and spills with less.
+    calc_ast const ast = balanced(12, 5);
+    compile_calc(ast, stack);
+    REQUIRE(reference.run(stack, expected));
+    for (std::uint32_t registers : { 16u, 12u, 11u, 4u, 1u }) {
+        calc_register_compiler small(registers);
+        small.compile(ast, program);
+        REQUIRE((count(program, calc_register_opcode::spill) == 0) == (registers >= 12));
+        REQUIRE(count(program, calc_register_opcode::spill) == count(program, calc_register_opcode::reload));
+        REQUIRE(vm.run(program, result));
+        REQUIRE(result == expected);
+        REQUIRE(switchVm.run(program, result));
+        REQUIRE(result == expected);
+    }
+}
+
+// The instructions and the ns per an operator of the stack and the register
+// machine code, on the deep and the wide expressions, and a generated corpus.
+TEST_CASE("calc register vm throughput", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    auto bench = [](char const * name, std::vector<calc_ast> const& asts) {
+        std::vector<calc_program> stacks(asts.size());
+        std::vector<calc_threaded_program> threaded(asts.size());
+        std::vector<calc_register_program> registers(asts.size());
+        std::vector<calc_register_program> small(asts.size());
+        calc_threaded_vm threadedVm;
+        calc_register_compiler compiler;
+        calc_register_compiler smallCompiler(4);
+        std::size_t operators = 0;
+        std::size_t stackSize = 0;
+        std::size_t threadedSize = 0;
+        std::size_t registerSize = 0;
+        std::size_t smallSize = 0;
+        std::size_t smallSpills = 0;
+        for (std::size_t i = 0; i < asts.size(); ++i) {
+            operators += asts[i].size() / 2;
+            compile_calc(asts[i], stacks[i]);
+            threadedVm.translate(stacks[i], threaded[i]);
+            compiler.compile(asts[i], registers[i]);
+            smallCompiler.compile(asts[i], small[i]);
+            stackSize += stacks[i].size();
+            threadedSize += threaded[i].code.size();
+            registerSize += registers[i].size();
+            smallSize += small[i].size();
+            smallSpills += count(small[i], calc_register_opcode::spill);
+        }
+
+        auto measure = [&](char const * vmName, std::size_t instructions, auto && run) {
+            calc_value_t sum = 0;
+            run(sum);
+            double best = 1e300;
+            for (int r = 0; r < 5; ++r) {
+                auto const start = clock_t::now();
+                run(sum);
+                best = std::min(best, std::chrono::duration<double, std::nano>(clock_t::now() - start).count());
+            }
+            std::printf("  %-20s %9zu instructions, %5.2f per op, %6.2f ns/op (%lld)\n", vmName, instructions,
+                        double(instructions) / double(operators), best / double(operators), (long long)sum);
+        };
+
+        std::printf("%s: %zu expressions, %zu operators\n", name, asts.size(), operators);
+        calc_vm stackVm;
+        measure("calc_vm", stackSize, [&](calc_value_t & sum) {
+            for (calc_program const& p : stacks) {
+                calc_value_t v = 0;
+                stackVm.run(p, v);
+                sum += v;
+            }
+        });
+        measure("threaded+super", threadedSize, [&](calc_value_t & sum) {
+            for (calc_threaded_program const& p : threaded) {
+                calc_value_t v = 0;
+                threadedVm.run(p, v);
+                sum += v;
+            }
+        });
+        calc_register_vm vm;
+        measure("register, 16", registerSize, [&](calc_value_t & sum) {
+            for (calc_register_program const& p : registers) {
+                calc_value_t v = 0;
+                vm.run(p, v);
+                sum += v;
+            }
+        });
+        calc_register_vm switchVm(calc_dispatch::switch_loop);
+        measure("register, 16, switch", registerSize, [&](calc_value_t & sum) {
+            for (calc_register_program const& p : registers) {
+                calc_value_t v = 0;
+                switchVm.run(p, v);
+                sum += v;
+            }
+        });
+        measure("register, 4", smallSize, [&](calc_value_t & sum) {
+            for (calc_register_program const& p : small) {
+                calc_value_t v = 0;
+                vm.run(p, v);
+                sum += v;
+            }
+        });
+        std::printf("  %zu spills with 4 registers\n", smallSpills);
+    };
+
+    std::vector<calc_ast> asts;
+    for (bool leftDeep : { true, false }) {
+        asts.clear();
+        for (int i = 0; i < 4; ++i) {
+            asts.push_back(chain(1000000, leftDeep));
+        }
+        bench(leftDeep ? "deep, to the left" : "deep, to the right", asts);
+    }
+
+    asts.clear();
+    for (std::uint32_t i = 0; i < 4; ++i) {
+        asts.push_back(balanced(20, i));
+    }
+    bench("wide, complete of the depth 20", asts);
+
+    calc_generator_options options;
+    options.seed = 7;
+    calc_generator generator(options);
+    calc_pipeline<> pipeline;
+    asts.clear();
+    std::size_t nodes = 0;
+    std::string line;
+    while (nodes < 8000000) {
+        line.clear();
+        generator.next(line);
+        calc_value_t v;
+        pipeline.run(line, v);
+        asts.push_back(pipeline.ast());
+        nodes += asts.back().size();
+    }
+    bench("generated", asts);
+}
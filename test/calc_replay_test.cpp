@@ -0,0 +1,238 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "calc_replay.h"
+#include "calc_test_helpers.h"
+#include "cycle_clock.h"
+#include "latency_histogram.h"
+
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+    using tools::make_tree;
+
+    // The operand stacks after every step, by a plain evaluation.
+    std::vector<std::vector<calc_value_t>> stacks_of(calc_ast const& ast)
+    {
+        std::vector<std::vector<calc_value_t>> stacks(1);
+        std::vector<calc_value_t> stack;
+        for (calc_node const& node : ast.nodes) {
+            if (node.op == calc_op::literal) {
+                stack.push_back(node.value);
+                continue;
+            }
+            calc_value_t const rhs = stack.back();
+            stack.pop_back();
+            if (!calc_apply(node.op, stack.back(), rhs, stack.back())) {
+                break;
+            }
+            stacks.push_back(stack);
+        }
+        return stacks;
+    }
+
+    // The stack of the replay, with the literals before the next step.
+    std::vector<calc_value_t> stack_of(calc_replay const& replay)
+    {
+        std::vector<calc_value_t> stack(replay.depth());
+        for (std::size_t i = 0; i < stack.size(); ++i) {
+            stack[i] = replay.operand(i);
+        }
+        return stack;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc replay", "[algovisu]")
+{
+    calc_ast const ast = parse("1 + 2 * (3 - 4) / 5 - 6 * 7");
+    calc_evaluator evaluator;
+    calc_value_t result = 0;
+    REQUIRE(evaluator.evaluate(ast, result));
+
+    calc_replay_options options;
+    options.interval = 2;
+    calc_replay replay(options);
+    REQUIRE(replay.build(ast));
+    REQUIRE(replay.step_count() == 6);
+    REQUIRE(replay.checkpoint_count() > 2);
+
+    calc_step s;
+    for (std::uint64_t pass = 0; pass < 2; ++pass) {
+        std::uint64_t n = 0;
+        std::uint32_t last = 0;
+        while (replay.next(s)) {
+            calc_node const& node = ast.nodes[s.node];
+            REQUIRE(s.node >= last);
+            REQUIRE(s.op == node.op);
+            REQUIRE(s.lhs == evaluator.value(node.lhs));
+            REQUIRE(s.rhs == evaluator.value(node.rhs));
+            REQUIRE(s.result == evaluator.value(s.node));
+            last = s.node;
+            ++n;
+        }
+        REQUIRE(n == 6);
+        REQUIRE(s.result == result);
+        REQUIRE(replay.depth() == 1);
+        REQUIRE(replay.operand(0) == result);
+        REQUIRE(replay.seek(0));
+    }
+
+    // backward.
+    REQUIRE(replay.seek(4));
+    REQUIRE(replay.next(s));
+    REQUIRE(s.op == calc_op::mul);
+    REQUIRE(s.result == 42);
+    REQUIRE(replay.seek(1));
+    REQUIRE(replay.depth() == 3);   // 1, 2, 3 - 4
+    REQUIRE(replay.operand(2) == -1);
+    REQUIRE_FALSE(replay.seek(7));
+
+    // a division by zero ends the steps.
+    calc_ast const failed = parse("1 + 2 * (3 / (4 - 4)) + 5");
+    REQUIRE_FALSE(replay.build(failed));
+    REQUIRE_FALSE(replay.valid());
+    REQUIRE(replay.step_count() == 1);
+    REQUIRE(replay.next(s));
+    REQUIRE(s.op == calc_op::sub);
+    REQUIRE_FALSE(replay.next(s));
+    REQUIRE(replay.seek(0));
+    REQUIRE(replay.next(s));
+    REQUIRE(s.result == 0);
+}
+
+TEST_CASE("calc replay at random", "[algovisu]")
+{
+    calc_ast const ast = make_tree(20000, 3);
+    auto const stacks = stacks_of(ast);
+    REQUIRE(stacks.size() == 20001);
+
+    // so few checkpoints that they're thinned.
+    calc_replay_options options;
+    options.interval = 16;
+    options.maxCheckpoints = 64;
+    calc_replay replay(options);
+    REQUIRE(replay.build(ast));
+    REQUIRE(replay.step_count() == 20000);
+    REQUIRE(replay.interval() > 16);
+    REQUIRE(replay.checkpoint_count() <= 64);
+
+    std::uint64_t x = 5;
+    std::size_t maxReplayed = 0;
+    for (int i = 0; i < 3000; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        std::uint64_t const step = x % (replay.step_count() + 1);
+        REQUIRE(replay.seek(step));
+        REQUIRE(replay.position() == step);
+        maxReplayed = std::max(maxReplayed, replay.last_replayed());
+        // the literals before the next step are not pushed yet.
+        std::vector<calc_value_t> stack = stack_of(replay);
+        REQUIRE(stack == stacks[step]);
+        calc_step s;
+        if (step < replay.step_count()) {
+            REQUIRE(replay.next(s));
+            stack = stack_of(replay);
+            REQUIRE(stack == stacks[step + 1]);
+        }
+    }
+    REQUIRE(maxReplayed <= replay.interval() + 64);
+
+    // the bottom of a deep stack is shared.
+    calc_ast deep;
+    std::size_t const depth = 100000;
+    for (std::size_t i = 0; i < depth; ++i) {
+        deep.add_literal(calc_value_t(i));
+    }
+    for (std::uint32_t i = 1; i < depth; ++i) {
+        deep.add_operator(calc_op::add, static_cast<std::uint32_t>(depth - 1 - i), deep.root());
+    }
+    options.interval = 1000;
+    options.maxCheckpoints = 4096;
+    calc_replay deepReplay(options);
+    REQUIRE(deepReplay.build(deep));
+    // every 1000 steps, as the literals are pushed by the first step.
+    REQUIRE(deepReplay.checkpoint_count() == 101);
+    // 50 times of the whole stack without the sharing.
+    REQUIRE(deepReplay.memory_bytes() < depth * sizeof(calc_value_t) * 4);
+    REQUIRE(deepReplay.seek(depth - 1));
+    REQUIRE(deepReplay.depth() == 1);
+    REQUIRE(deepReplay.operand(0) == calc_value_t(depth * (depth - 1) / 2));
+    REQUIRE(deepReplay.seek(10));
+    REQUIRE(deepReplay.depth() == depth - 10);
+    REQUIRE(deepReplay.operand(depth - 11) == calc_value_t(depth - 11 + depth - 10 + depth - 9 + depth - 8
+                                                         + depth - 7 + depth - 6 + depth - 5 + depth - 4
+                                                         + depth - 3 + depth - 2 + depth - 1));
+}
+
+// The latency of seeking a step at random, and of a step back, against
+// the memory of the checkpoints, by the intervals.
+TEST_CASE("calc replay seek latency", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::size_t const stepCount = 10000000;
+    calc_ast const ast = make_tree(stepCount, 7);
+    double const cyclesPerNs = cycles_per_nanosecond();
+    double const astMb = double(ast.size() * sizeof(calc_node)) / double(1 << 20);
+    std::printf("%zu steps, %zu nodes, ast %.1f MB\n", stepCount, ast.size(), astMb);
+
+    struct config
+    {
+        std::size_t interval;
+        std::size_t maxCheckpoints;
+    };
+    config const configs[] = {
+        { 64, SIZE_MAX }, { 256, SIZE_MAX }, { 1024, SIZE_MAX }, { 4096, SIZE_MAX }, { 16384, SIZE_MAX },
+        { 64, 4096 }, { 64, 1024 }
+    };
+    for (config const& c : configs) {
+        calc_replay_options options;
+        options.interval = c.interval;
+        options.maxCheckpoints = c.maxCheckpoints;
+        calc_replay replay(options);
+        auto const start = clock_t::now();
+        REQUIRE(replay.build(ast));
+        double const buildNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+
+        latency_histogram seek, back;
+        std::uint64_t x = 11;
+        for (int i = 0; i < 100000; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            std::uint64_t const step = x % stepCount;
+            std::uint64_t const begin = read_cycle_counter();
+            replay.seek(step);
+            seek.record(read_cycle_counter() - begin);
+        }
+        // scrubbing backward a step at a time.
+        replay.seek(stepCount / 2);
+        for (int i = 0; i < 100000; ++i) {
+            std::uint64_t const begin = read_cycle_counter();
+            replay.seek(replay.position() - 1);
+            back.record(read_cycle_counter() - begin);
+        }
+
+        std::printf("\ninterval %zu -> %zu, %zu checkpoints, %.1f MB (%.0f%% of the ast), build %.1f ns/node\n",
+                    c.interval, replay.interval(), replay.checkpoint_count(),
+                    double(replay.memory_bytes()) / double(1 << 20),
+                    100.0 * double(replay.memory_bytes()) / double(1 << 20) / astMb,
+                    buildNs / double(ast.size()));
+        dump_latency_text_header(std::cout);
+        latency_summary summary;
+        summary.merge(seek);
+        dump_latency_text(std::cout, "seek", summary, cyclesPerNs);
+        latency_summary backSummary;
+        backSummary.merge(back);
+        dump_latency_text(std::cout, "step back", backSummary, cyclesPerNs);
+    }
+}
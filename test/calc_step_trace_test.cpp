@@ -0,0 +1,145 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "calc_step_trace.h"
+#include "calc_test_helpers.h"
+
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+    using tools::make_tree;
+
+    std::size_t operator_count(calc_ast const& ast)
+    {
+        std::size_t n = 0;
+        for (auto const& node : ast.nodes) {
+            n += node.op != calc_op::literal;
+        }
+        return n;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc step trace", "[algovisu]")
+{
+    calc_step_buffer & steps = local_step_trace();
+    steps.reserve(1024);
+
+    basic_calc_evaluator<calc_step_recorder> evaluator;
+    calc_value_t result = 0;
+    calc_ast const ast = parse("1 + 2 * (3 - 4) / 5 - 6 * 7");
+    REQUIRE(evaluator.evaluate(ast, result));
+    REQUIRE(result == 1 + 2 * (3 - 4) / 5 - 6 * 7);
+#if !defined(ALGOVISU_NO_STEP_TRACE)
+    REQUIRE(steps.size() == operator_count(ast));
+    REQUIRE(steps.dropped() == 0);
+    calc_step_decoder decoder(ast);
+    for (std::size_t i = 0; i < steps.size(); ++i) {
+        calc_step const s = decoder.decode(steps.data()[i]);
+        calc_node const& node = ast.nodes[s.node];
+        REQUIRE(s.op == node.op);
+        REQUIRE(s.lhs == evaluator.value(node.lhs));
+        REQUIRE(s.rhs == evaluator.value(node.rhs));
+        REQUIRE(s.result == evaluator.value(s.node));
+        calc_value_t r = 0;
+        REQUIRE(calc_apply(s.op, s.lhs, s.rhs, r));
+        REQUIRE(r == s.result);
+    }
+    REQUIRE(decoder.decode(steps.data()[steps.size() - 1]).result == result);
+
+    // up to the failed step, which is not recorded.
+    steps.clear();
+    REQUIRE_FALSE(evaluator.evaluate(parse("(1 + 2) * 3 + 4 / (5 - 5) + 6"), result));
+    REQUIRE(steps.size() == 3);
+    REQUIRE(steps.data()[2].op() == calc_op::sub);
+    REQUIRE(steps.data()[2].result() == 0);
+
+    // the negative results, and the ones over 32 bits.
+    steps.clear();
+    REQUIRE(evaluator.evaluate(parse("1 - 5000000000 * 3"), result));
+    REQUIRE(steps.size() == 2);
+    REQUIRE(steps.data()[0].result() == 15000000000);
+    REQUIRE(steps.data()[1].result() == 1 - 15000000000);
+
+    // over the capacity.
+    steps.reserve(4);
+    REQUIRE(evaluator.evaluate(ast, result));
+    REQUIRE(steps.size() == 4);
+    REQUIRE(steps.dropped() == operator_count(ast) - 4);
+
+    // the buffers of the other threads, which may be reused by the later ones.
+    configure_step_trace(1 << 16);
+    std::vector<std::thread> threads;
+    std::vector<std::size_t> recorded(4);
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([t, &recorded] {
+            std::size_t const before = local_step_trace().size();
+            basic_calc_evaluator<calc_step_recorder> e;
+            calc_value_t v = 0;
+            e.evaluate(make_tree(1000 * (t + 1), t + 1), v);
+            recorded[t] = local_step_trace().size() - before;
+        });
+    }
+    for (auto & t : threads) {
+        t.join();
+    }
+    for (int t = 0; t < 4; ++t) {
+        REQUIRE(recorded[t] == std::size_t(1000 * (t + 1)));
+    }
+    std::size_t total = 0;
+    for_each_step_trace([&total](calc_step_buffer const& b) {
+        total += b.size();
+    });
+    REQUIRE(total >= 4 + 1000 + 2000 + 3000 + 4000);
+
+    // a node index over the 29 bits is dropped, not recorded as an other op.
+    steps.reserve(8);
+    steps.push(calc_step_record::max_node, calc_op::div, 1);
+    steps.push(calc_step_record::max_node + 1, calc_op::add, 2);
+    REQUIRE(steps.size() == 1);
+    REQUIRE(steps.dropped() == 1);
+    REQUIRE(steps.data()[0].node() == calc_step_record::max_node);
+    REQUIRE(steps.data()[0].op() == calc_op::div);
+    steps.reserve(1 << 20);
+#endif
+}
+
+// The evaluation of 10M steps, with and without the recording.
+TEST_CASE("calc step trace overhead", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::size_t const stepCount = 10000000;
+    calc_step_buffer & steps = local_step_trace();
+    steps.reserve(stepCount);
+
+    for (int round = 0; round < 4; ++round) {
+        bool const chain = round % 2 == 0;
+        calc_ast const ast = make_tree(stepCount, 7, chain);
+        basic_calc_evaluator<> plain;
+        basic_calc_evaluator<calc_step_recorder> recorded;
+        calc_value_t a = 0, b = 0;
+        plain.evaluate(ast, a);
+        recorded.evaluate(ast, b);
+        REQUIRE(a == b);
+
+        auto start = clock_t::now();
+        plain.evaluate(ast, a);
+        double const plainNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+        steps.clear();
+        start = clock_t::now();
+        recorded.evaluate(ast, b);
+        double const recordedNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+        REQUIRE(steps.size() == stepCount);
+        std::printf("%-6s %zu steps: %.2f ns/step, recorded %.2f ns/step (%.2fx), %zu bytes/step\n",
+                    chain ? "chain" : "tree", stepCount, plainNs / stepCount, recordedNs / stepCount, recordedNs / plainNs,
+                    sizeof(calc_step_record));
+    }
+}
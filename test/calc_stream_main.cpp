@@ -0,0 +1,243 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/resource.h>
+#endif
+
+#include "calc_stream.h"
+#include "calc_evaluator.h"
+#include "calc_generator.h"
+#include "calc_batch.h"
+
+
+// Streams the calc expressions through calc_push_parser,
+// or through calc_batch_executor by --mode.
+//
+//  algovisu_stream --generate 10G | algovisu_stream
+//  algovisu_stream --mode pipelined --input calc.txt --output results.txt
+//
+//  --generate SIZE     writes SIZE bytes of calc_generator lines to stdout.
+//  --seed N            the seed of --generate.
+//  --invalid P         the ratio of the invalid expressions of --generate.
+//  --chunk SIZE        reads stdin in the chunks of SIZE bytes.(64K)
+//  --mode MODE         stream, serial, pipelined or parallel.(stream)
+//  --threads N         the workers of the parallel mode.(hardware threads)
+//  --input FILE        the input of the batch modes.(stdin)
+//  --output FILE       the results of the batch modes.(discarded)
+//
+// The SIZE can have a K, M or G suffix.
+namespace
+{
+    std::uint64_t parse_size(char const * s)
+    {
+        char * end = nullptr;
+        std::uint64_t v = std::strtoull(s, &end, 10);
+        switch (*end) {
+            case 'K': case 'k': v <<= 10; break;
+            case 'M': case 'm': v <<= 20; break;
+            case 'G': case 'g': v <<= 30; break;
+            default: break;
+        }
+        return v;
+    }
+
+    // in KB, or 0 if it's unknown.
+    long peak_rss_kb()
+    {
+#if defined(__unix__)
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+#elif defined(__APPLE__)
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024;
+#else
+        return 0;
+#endif
+    }
+
+    int generate(std::uint64_t bytes, algovisu::calc_generator_options const& options)
+    {
+        algovisu::calc_generator generator(options);
+        generator.generate_chunks(bytes, [](char const * data, std::size_t size) {
+            std::fwrite(data, 1, size, stdout);
+        });
+        return std::fflush(stdout) == 0 ? 0 : 1;
+    }
+
+    int run_batch(std::string const& mode, std::size_t threads,
+                  std::string const& input, std::string const& output)
+    {
+        using namespace algovisu;
+
+        calc_batch_options options;
+        if (mode == "serial") {
+            options.stages.clear();
+        } else if (mode == "parallel") {
+            options.stages = { { batch_all, threads } };
+        } else if (mode != "pipelined") {
+            std::cerr << "unknown mode: " << mode << '\n';
+            return 2;
+        }
+
+        std::ifstream file;
+        if (!input.empty()) {
+            file.open(input, std::ios::binary);
+        }
+        std::istream & in = input.empty() ? std::cin : file;
+        if (!in) {
+            std::cerr << "can't open the input: " << input << '\n';
+            return 1;
+        }
+
+        calc_batch_executor<> executor(options);
+        auto const start = std::chrono::steady_clock::now();
+        std::uint64_t expressions = 0;
+        if (output.empty()) {
+            std::ostream discarded(nullptr);
+            expressions = executor.run(in, discarded);
+        } else {
+#if defined(ALGOVISU_HAS_WRITEV)
+            int const fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                std::cerr << "can't open the output: " << output << '\n';
+                return 1;
+            }
+            fd_output_sink sink(fd);
+            expressions = executor.run_with_sink(in, sink);
+            ::close(fd);
+#else
+            std::ofstream results(output, std::ios::binary);
+            expressions = executor.run(in, results);
+#endif
+            if (!executor.output_good()) {
+                std::cerr << "can't write the output: " << output << '\n';
+                return 1;
+            }
+        }
+        double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::uint64_t bytes = 0;
+        if (!input.empty()) {
+            file.clear();
+            bytes = static_cast<std::uint64_t>(file.seekg(0, std::ios::end).tellg());
+        }
+
+        std::cout << "mode: " << mode << '\n'
+                  << "expressions: " << expressions << '\n'
+                  << "seconds: " << seconds << '\n';
+        if (bytes) {
+            std::cout << "throughput: " << double(bytes) / seconds / 1e6 << " MB/s\n";
+        }
+        std::cout << "peak memory: " << peak_rss_kb() << " KB\n" << std::flush;
+        std::printf("%-26s %7s %9s %11s %12s %12s %12s\n",
+                    "stage", "workers", "batches", "busy(ms)", "in-wait(ms)", "out-wait(ms)", "utilization");
+        double const cyclesPerMs = cycles_per_nanosecond() * 1e6;
+        for (auto const& u : executor.utilization()) {
+            std::printf("%-26s %7zu %9llu %11.1f %12.1f %12.1f %11.1f%%\n",
+                        u.name.c_str(), u.workers, static_cast<unsigned long long>(u.batches),
+                        u.busyCycles / cyclesPerMs, u.inputWaitCycles / cyclesPerMs,
+                        u.outputWaitCycles / cyclesPerMs, u.utilization() * 100.0);
+        }
+        return 0;
+    }
+
+    int parse(std::size_t chunkSize)
+    {
+        using namespace algovisu;
+
+        std::vector<char> chunk(chunkSize);
+        calc_push_parser parser;
+        calc_evaluator evaluator;
+
+        std::uint64_t bytes = 0;
+        std::uint64_t expressions = 0;
+        std::uint64_t failed = 0;
+        std::uint64_t unevaluated = 0;
+        std::uint64_t checksum = 0;
+        auto on_expression = [&](calc_ast const& ast, bool ok) {
+            ++expressions;
+            calc_value_t result = 0;
+            if (!ok) {
+                ++failed;
+            } else if (!evaluator.evaluate(ast, result)) {
+                ++unevaluated;
+            } else {
+                checksum = checksum * 31 + static_cast<std::uint64_t>(result);
+            }
+        };
+
+        auto const start = std::chrono::steady_clock::now();
+        for (;;) {
+            std::size_t const n = std::fread(chunk.data(), 1, chunk.size(), stdin);
+            if (n == 0) {
+                break;
+            }
+            bytes += n;
+            parser.push(chunk.data(), chunk.data() + n, on_expression);
+        }
+        parser.finish(on_expression);
+        double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "bytes: " << bytes << '\n'
+                  << "expressions: " << expressions
+                  << " (failed to parse: " << failed << ", to evaluate: " << unevaluated << ")\n"
+                  << "checksum: " << checksum << '\n'
+                  << "seconds: " << seconds << '\n'
+                  << "throughput: " << double(bytes) / seconds / 1e6 << " MB/s\n"
+                  << "peak memory: " << peak_rss_kb() << " KB\n";
+        return 0;
+    }
+}   // un-named namespace
+
+
+int main(int argc, char * argv[])
+{
+    algovisu::calc_generator_options options;
+    std::uint64_t generateBytes = 0;
+    std::size_t chunkSize = 64 * 1024;
+    std::string mode = "stream";
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string input, output;
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "missing the value of " << arg << '\n';
+            return 2;
+        }
+        if (arg == "--generate") {
+            generateBytes = parse_size(argv[++i]);
+        } else if (arg == "--seed") {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--invalid") {
+            options.invalid = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--chunk") {
+            chunkSize = std::max<std::size_t>(1, parse_size(argv[++i]));
+        } else if (arg == "--mode") {
+            mode = argv[++i];
+        } else if (arg == "--threads") {
+            threads = std::max<std::size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--input") {
+            input = argv[++i];
+        } else if (arg == "--output") {
+            output = argv[++i];
+        } else {
+            std::cerr << "unknown option: " << arg << '\n';
+            return 2;
+        }
+    }
+    if (generateBytes) {
+        return generate(generateBytes, options);
+    }
+    return mode == "stream" ? parse(chunkSize) : run_batch(mode, threads, input, output);
+}
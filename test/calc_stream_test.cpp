@@ -0,0 +1,121 @@
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "calc_stream.h"
+#include "calc_generator.h"
+#include "calc_pipeline.h"
+
+
+namespace
+{
+    struct stream_result
+    {
+        bool ok;
+        std::vector<algovisu::calc_node> nodes;
+    };
+
+    bool same_nodes(std::vector<algovisu::calc_node> const& a, std::vector<algovisu::calc_node> const& b)
+    {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](auto const& x, auto const& y) {
+            return x.op == y.op && x.lhs == y.lhs && x.rhs == y.rhs && x.value == y.value;
+        });
+    }
+
+    // Pushes the input in the chunks of the given sizes, round robin.
+    std::vector<stream_result> push_in_chunks(std::string const& input, std::vector<std::size_t> const& sizes)
+    {
+        using namespace algovisu;
+
+        std::vector<stream_result> results;
+        auto on_expression = [&results](calc_ast const& ast, bool ok) {
+            results.push_back(stream_result{ ok, ast.nodes });
+        };
+
+        calc_push_parser parser;
+        char const * p = input.data();
+        char const * const end = p + input.size();
+        for (std::size_t i = 0; p != end; ++i) {
+            char const * const last = p + std::min<std::size_t>(sizes[i % sizes.size()], end - p);
+            REQUIRE(parser.push(p, last, on_expression) == last);
+            p = last;
+        }
+        parser.finish(on_expression);
+        return results;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc push parser", "[algovisu]")
+{
+    using namespace algovisu;
+
+    // the tokens split across the chunks.
+    auto results = push_in_chunks("12345 + 6\n(1 - 2) * 30\n\n  \n7 / 0", { 3, 1, 2 });
+    REQUIRE(results.size() == 3);
+    REQUIRE(results[0].ok);
+    REQUIRE(results[0].nodes.size() == 3);
+    REQUIRE(results[0].nodes[0].value == 12345);
+    REQUIRE(results[0].nodes[2].op == calc_op::add);
+    REQUIRE(results[1].ok);
+    REQUIRE(results[1].nodes.size() == 5);
+    REQUIRE(results[1].nodes[4].op == calc_op::mul);
+    REQUIRE(results[2].ok);     // without the last newline
+
+    for (char const * bad : { "1 +", "(1", "1 2", ")", "01", "1 $ 2", "()", "1 + * 2" }) {
+        results = push_in_chunks(std::string(bad) + "\n2 * 3\n", { 1 });
+        REQUIRE(results.size() == 2);
+        REQUIRE_FALSE(results[0].ok);
+        REQUIRE(results[1].ok);     // recovered at the newline
+        REQUIRE(results[1].nodes.size() == 3);
+    }
+
+    // the budget
+    calc_push_parser parser;
+    std::size_t count = 0;
+    auto on_expression = [&count](calc_ast const&, bool ok) { count += ok; };
+    std::string const s = "1 + 2\n3 * 4\n";
+    char const * p = parser.push(s.data(), s.data() + s.size(), on_expression, 2);
+    REQUIRE(p != s.data() + s.size());
+    REQUIRE(count == 0);
+    REQUIRE(parser.pending_tokens() == 2);
+    p = parser.push(p, s.data() + s.size(), on_expression);
+    REQUIRE(p == s.data() + s.size());
+    REQUIRE(count == 2);
+}
+
+TEST_CASE("calc push parser builds the same AST as calc grammar", "[algovisu]")
+{
+    using namespace algovisu;
+
+    calc_generator_options options;
+    options.seed = 7;
+    options.group = 0.3;
+    options.invalid = 0.2;
+    std::string input;
+    calc_generator(options).generate(200000, input);
+
+    std::vector<stream_result> expected;
+    calc_pipeline<> pipeline;
+    std::size_t first = 0;
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        if (input[i] == '\n') {
+            bool const ok = pipeline.lex(input.data() + first, input.data() + i) && pipeline.parse();
+            expected.push_back(stream_result{ ok, pipeline.ast().nodes });
+            first = i + 1;
+        }
+    }
+
+    for (auto const& sizes : std::vector<std::vector<std::size_t>>{ { 65536 }, { 4096, 7, 1, 333 }, { 1 } }) {
+        auto const results = push_in_chunks(input, sizes);
+        REQUIRE(results.size() == expected.size());
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            REQUIRE(results[i].ok == expected[i].ok);
+            if (results[i].ok) {
+                REQUIRE(same_nodes(results[i].nodes, expected[i].nodes));
+            }
+        }
+    }
+}
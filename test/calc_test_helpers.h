@@ -0,0 +1,57 @@
+#ifndef ALGOVISU_CALC_TEST_HELPERS_H
+#define ALGOVISU_CALC_TEST_HELPERS_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "calc_pipeline.h"
+
+
+namespace tools
+{
+    // Lexes and parses text. The test fails if it's not an expression,
+    // but it may still fail to evaluate, like a division by zero.
+    inline algovisu::calc_ast parse(std::string const& text)
+    {
+        algovisu::calc_pipeline<> pipeline;
+        INFO(text);
+        REQUIRE(pipeline.lex(text.data(), text.data() + text.size()));
+        REQUIRE(pipeline.parse());
+        return pipeline.ast();
+    }
+
+    // A random post-ordered tree of + - and * with steps operators,
+    // or a literal for no step. It's made with no parsing from the seed x.
+    // A chain is to the left, like a long expression with no parentheses.
+    inline algovisu::calc_ast make_tree(std::size_t steps, std::uint64_t x, bool chain = false)
+    {
+        using namespace algovisu;
+
+        calc_ast ast;
+        ast.nodes.reserve(steps * 2 + 1);
+        std::vector<std::uint32_t> operands;
+        std::size_t made = 0;
+        while (made < steps || operands.size() != 1) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            if (operands.size() < 2 || (!chain && made + operands.size() <= steps && x % 2)) {
+                operands.push_back(ast.add_literal(static_cast<calc_value_t>(x % 1000)));
+                continue;
+            }
+            std::uint32_t const rhs = operands.back();
+            operands.pop_back();
+            operands.back() = ast.add_operator(calc_op(1 + (x >> 8) % 3), operands.back(), rhs);
+            ++made;
+        }
+        return ast;
+    }
+} // namespace tools
+
+
+#endif  // ALGOVISU_CALC_TEST_HELPERS_H
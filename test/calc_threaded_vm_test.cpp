@@ -0,0 +1,178 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "calc_threaded_vm.h"
+#include "calc_pipeline.h"
+#include "calc_generator.h"
+#include "perf_counters.h"
+
+
+namespace
+{
+    using namespace algovisu;
+
+    calc_program compile(std::string const& text)
+    {
+        calc_pipeline<> pipeline;
+        calc_value_t v;
+        pipeline.run(text, v);
+        calc_program program;
+        compile_calc(pipeline.ast(), program);
+        return program;
+    }
+
+    calc_threaded_vm const variants[] = {
+        calc_threaded_vm(calc_dispatch::switch_loop, false),
+        calc_threaded_vm(calc_dispatch::switch_loop, true),
+        calc_threaded_vm(calc_dispatch::threaded, false),
+        calc_threaded_vm(calc_dispatch::threaded, true)
+    };
+}   // un-named namespace
+
+
+TEST_CASE("calc threaded vm", "[algovisu]")
+{
+    calc_threaded_program threaded;
+    calc_value_t result = 0;
+    for (calc_threaded_vm vm : variants) {
+        // push push push_mul_add end, or push push push mul add end.
+        vm.translate(compile("1 + 2 * 3"), threaded);
+        REQUIRE(threaded.code.size() == (vm.superinstructions() ? 4 : 6));
+        REQUIRE(vm.run(threaded, result));
+        REQUIRE(result == 7);
+        vm.translate(compile("1 - 2 * 3 * 4 / 5 + 6"), threaded);
+        REQUIRE(vm.run(threaded, result));
+        REQUIRE(result == 3);
+        vm.translate(compile("(1 + 2) * (3 - 4) / (0 - 1)"), threaded);
+        REQUIRE(vm.run(threaded, result));
+        REQUIRE(result == 3);
+
+        // a division by zero, by a literal, or not.
+        vm.translate(compile("8 / 0"), threaded);
+        REQUIRE_FALSE(vm.run(threaded, result));
+        vm.translate(compile("8 / (1 - 1)"), threaded);
+        REQUIRE_FALSE(vm.run(threaded, result));
+
+        calc_threaded_program empty;
+        vm.translate(calc_program{}, empty);
+        REQUIRE(empty.empty());
+        REQUIRE_FALSE(vm.run(empty, result));
+    }
+    REQUIRE(variants[0].dispatch() == calc_dispatch::switch_loop);
+
+    // the same results as calc_vm.
+    calc_generator_options options;
+    options.seed = 13;
+    options.group = 0.3;
+    calc_generator generator(options);
+    calc_pipeline<> pipeline;
+    calc_program program;
+    calc_vm reference;
+    std::string line;
+    for (int i = 0; i < 2000; ++i) {
+        line.clear();
+        generator.next(line);
+        pipeline.run(line, result);
+        compile_calc(pipeline.ast(), program);
+        calc_value_t expected = 0;
+        bool const ok = reference.run(program, expected);
+        for (calc_threaded_vm vm : variants) {
+            vm.translate(program, threaded);
+            calc_value_t actual = 0;
+            REQUIRE(vm.run(threaded, actual) == ok);
+            REQUIRE((!ok || actual == expected));
+        }
+    }
+
+    // a chain.
+    std::string chain = "1";
+    for (int i = 0; i < 200000; ++i) {
+        chain += "-1*1";
+    }
+    for (calc_threaded_vm vm : variants) {
+        vm.translate(compile(chain), threaded);
+        REQUIRE(vm.run(threaded, result));
+        REQUIRE(result == -199999);
+    }
+}
+
+// The ns per an instruction of calc_vm, and the branch misses, of every
+// dispatch, on the programs of a generated corpus.
+TEST_CASE("calc threaded vm dispatch", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    calc_generator_options options;
+    options.seed = 7;
+    calc_generator generator(options);
+    calc_pipeline<> pipeline;
+    std::vector<calc_program> programs;
+    std::size_t ops = 0;
+    std::string line;
+    while (ops < 4000000) {
+        line.clear();
+        generator.next(line);
+        calc_value_t v;
+        pipeline.run(line, v);
+        programs.emplace_back();
+        compile_calc(pipeline.ast(), programs.back());
+        ops += programs.back().size();
+    }
+    std::printf("%zu programs, %zu instructions\n", programs.size(), ops);
+
+    perf_counters counters;
+    auto measure = [&](char const * name, std::size_t dispatched, auto && run) {
+        calc_value_t sum = 0;
+        run(sum);
+        double best = 1e300;
+        perf_counts counts;
+        for (int r = 0; r < 5; ++r) {
+            counters.start();
+            auto const start = clock_t::now();
+            run(sum);
+            double const ns = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+            perf_counts const c = counters.stop();
+            if (ns < best) {
+                best = ns;
+                counts = c;
+            }
+        }
+        char misses[32] = "n/a";
+        if (counters.available()) {
+            std::snprintf(misses, sizeof(misses), "%.2f%% %.3f/op", counts.branch_miss_rate() * 100,
+                          double(counts.branchMisses) / double(ops));
+        }
+        std::printf("%-24s %6.2f ns/op, %5.2f dispatches/op, branch misses %s (%lld)\n",
+                    name, best / double(ops), double(dispatched) / double(ops), misses, (long long)sum);
+    };
+
+    calc_vm reference;
+    measure("calc_vm", ops, [&](calc_value_t & sum) {
+        for (calc_program const& p : programs) {
+            calc_value_t v = 0;
+            reference.run(p, v);
+            sum += v;
+        }
+    });
+    char const * const names[] = { "switch", "switch+super", "threaded", "threaded+super" };
+    for (std::size_t k = 0; k < 4; ++k) {
+        calc_threaded_vm vm = variants[k];
+        std::vector<calc_threaded_program> threaded(programs.size());
+        std::size_t dispatched = 0;
+        for (std::size_t i = 0; i < programs.size(); ++i) {
+            vm.translate(programs[i], threaded[i]);
+            dispatched += threaded[i].code.size();
+        }
+        measure(names[k], dispatched, [&](calc_value_t & sum) {
+            for (calc_threaded_program const& p : threaded) {
+                calc_value_t v = 0;
+                vm.run(p, v);
+                sum += v;
+            }
+        });
+    }
+}
@@ -0,0 +1,344 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "calc_trace_file.h"
+#include "cycle_clock.h"
+#include "latency_histogram.h"
+
+
+#if defined(ALGOVISU_HAS_MMAP)
+namespace
+{
+    using namespace algovisu;
+
+    std::string trace_path(char const * name)
+    {
+        return std::string(P_tmpdir) + "/algovisu_" + name + "_" + std::to_string(::getpid());
+    }
+
+    // The steps of the evaluations of the random trees, recorded.
+    std::vector<calc_step_record> make_steps(std::size_t steps, std::size_t treeSteps, std::uint64_t x)
+    {
+        std::vector<calc_step_record> records;
+        records.reserve(steps);
+        std::vector<calc_value_t> operands;
+        while (records.size() < steps) {
+            // a tree of its own, from the node 0.
+            std::uint32_t node = 0;
+            operands.clear();
+            for (std::size_t made = 0; made < treeSteps && records.size() < steps; ) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                if (operands.size() < 2 || x % 2) {
+                    operands.push_back(static_cast<calc_value_t>(x % 1000));
+                    ++node;
+                    continue;
+                }
+                calc_value_t const rhs = operands.back();
+                operands.pop_back();
+                calc_op const op = calc_op(1 + (x >> 8) % 3);
+                calc_apply(op, operands.back(), rhs, operands.back());
+                records.push_back(calc_step_record::make(node++, op, operands.back()));
+                ++made;
+            }
+        }
+        return records;
+    }
+
+    bool same(calc_step_record const& a, calc_step_record const& b)
+    {
+        return a.nodeOp == b.nodeOp && a.resultLo == b.resultLo && a.resultHi == b.resultHi;
+    }
+
+    std::vector<unsigned char> read_file(std::string const& path)
+    {
+        std::vector<unsigned char> bytes;
+        if (FILE * f = std::fopen(path.c_str(), "rb")) {
+            unsigned char buffer[4096];
+            for (std::size_t n; (n = std::fread(buffer, 1, sizeof(buffer), f)) > 0; ) {
+                bytes.insert(bytes.end(), buffer, buffer + n);
+            }
+            std::fclose(f);
+        }
+        return bytes;
+    }
+
+    std::uint64_t read_file_size(std::string const& path)
+    {
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+    }
+
+    void write_file(std::string const& path, unsigned char const * p, std::size_t n)
+    {
+        FILE * f = std::fopen(path.c_str(), "wb");
+        REQUIRE(f);
+        REQUIRE(std::fwrite(p, 1, n, f) == n);
+        std::fclose(f);
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc trace file", "[algovisu]")
+{
+    std::string const path = trace_path("trace_file");
+    std::vector<calc_step_record> steps = make_steps(100000, 3000, 5);
+    // the wide results, the negative ones and the same ones.
+    for (std::size_t i = 0; i < 300; ++i) {
+        steps[i + 100] = calc_step_record::make(7, calc_op::mul, calc_value_t(i * 0x0123456789abcdefull));
+        steps[i + 500] = calc_step_record::make(9, calc_op::sub, -calc_value_t(i));
+        steps[i + 900] = calc_step_record::make(11, calc_op::add, 42);
+    }
+
+    // the block of 1000 steps, so there's a short one at the end.
+    std::size_t const blockSteps = 1000;
+    {
+        calc_trace_writer writer;
+        REQUIRE(writer.open(path.c_str(), blockSteps));
+        REQUIRE(writer.append(steps.data(), 12345));
+        for (std::size_t i = 12345; i < 12400; ++i) {
+            REQUIRE(writer.append(steps[i]));
+        }
+        REQUIRE(writer.append(steps.data() + 12400, steps.size() - 12400 - 7));
+        REQUIRE(writer.size() == steps.size() - 7);
+        REQUIRE(writer.close());
+        REQUIRE(writer.size() == 0);
+    }
+    steps.resize(steps.size() - 7);
+    REQUIRE(read_file_size(path) < steps.size() * sizeof(calc_step_record));
+
+    calc_trace_reader reader;
+    REQUIRE(reader.open(path.c_str()));
+    REQUIRE(reader.complete());
+    REQUIRE(reader.size() == steps.size());
+    REQUIRE(reader.block_count() == (steps.size() + blockSteps - 1) / blockSteps);
+
+    // the first different step of read from the step, or the count.
+    std::vector<calc_step_record> read(steps.size());
+    auto mismatch = [&](std::uint64_t step, std::size_t count) {
+        std::size_t i = 0;
+        while (i < count && same(read[i], steps[step + i])) {
+            ++i;
+        }
+        return i;
+    };
+    REQUIRE(reader.read(0, read.size() + 10, read.data()) == steps.size());
+    REQUIRE(mismatch(0, steps.size()) == steps.size());
+
+    // at random.
+    std::uint64_t x = 3;
+    calc_step_record r;
+    for (int i = 0; i < 5000; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        std::uint64_t const step = x % steps.size();
+        REQUIRE(reader.read(step, r));
+        REQUIRE(same(r, steps[step]));
+        std::size_t const count = x >> 40 & 2047;
+        std::size_t const n = reader.read(step, count, read.data());
+        REQUIRE(n == std::min<std::size_t>(count, steps.size() - step));
+        REQUIRE(mismatch(step, n) == n);
+    }
+    REQUIRE_FALSE(reader.read(steps.size(), r));
+    reader.close();
+
+    // an empty trace.
+    {
+        calc_trace_writer writer;
+        REQUIRE(writer.open(path.c_str()));
+    }
+    REQUIRE(reader.open(path.c_str()));
+    REQUIRE(reader.complete());
+    REQUIRE(reader.size() == 0);
+    REQUIRE_FALSE(reader.read(0, r));
+    reader.close();
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("calc trace file corrupted", "[algovisu]")
+{
+    std::string const path = trace_path("trace_corrupted");
+    std::vector<calc_step_record> const steps = make_steps(50000, 1000, 9);
+    std::size_t const blockSteps = 512;
+    {
+        calc_trace_writer writer;
+        REQUIRE(writer.open(path.c_str(), blockSteps));
+        REQUIRE(writer.append(steps.data(), steps.size()));
+    }
+    std::vector<unsigned char> const bytes = read_file(path);
+    calc_trace_reader reader;
+    calc_step_record r;
+    std::vector<calc_step_record> read(4);
+
+    // a flipped bit fails its block only.
+    {
+        std::vector<unsigned char> flipped = bytes;
+        flipped[bytes.size() / 2] ^= 0x10;
+        write_file(path, flipped.data(), flipped.size());
+        REQUIRE(reader.open(path.c_str()));
+        REQUIRE(reader.complete());
+        std::size_t failed = 0;
+        for (std::size_t step = 0; step < steps.size(); ++step) {
+            if (reader.read(step, r)) {
+                REQUIRE(same(r, steps[step]));
+            } else {
+                ++failed;
+            }
+        }
+        REQUIRE(failed == blockSteps);
+        reader.close();
+    }
+
+    // cut by a crash, without the trailer.
+    for (std::size_t cut : { std::size_t(16), bytes.size() / 3, bytes.size() / 2 + 5, bytes.size() - 1 }) {
+        INFO(cut);
+        write_file(path, bytes.data(), cut);
+        REQUIRE(reader.open(path.c_str()));
+        REQUIRE_FALSE(reader.complete());
+        REQUIRE(reader.size() <= steps.size());
+        if (cut == bytes.size() - 1) {
+            REQUIRE(reader.size() == steps.size());
+        }
+        REQUIRE(reader.size() + 2 * blockSteps > (cut - 16) / (bytes.size() - 16.0) * steps.size());
+        for (std::size_t step = 0; step < reader.size(); ++step) {
+            REQUIRE(reader.read(step, r));
+            REQUIRE(same(r, steps[step]));
+        }
+        REQUIRE_FALSE(reader.read(reader.size(), r));
+        reader.close();
+    }
+
+    // a trailer of the steps the blocks don't have, though checksummed, is
+    // not trusted, and the blocks are found as if it was missing. The steps
+    // over the last block's count are not read.
+    for (std::uint64_t more : { std::uint64_t(1), std::uint64_t(blockSteps), std::uint64_t(1) << 40 }) {
+        INFO(more);
+        std::vector<unsigned char> wrong = bytes;
+        unsigned char * const tail = wrong.data() + wrong.size() - sizeof(detail::trace_file_trailer);
+        detail::trace_file_trailer t;
+        std::memcpy(&t, tail, sizeof(t));
+        t.stepCount += more;
+        std::size_t const indexBytes = static_cast<std::size_t>(wrong.size() - sizeof(t) - t.indexOffset);
+        std::memcpy(tail, &t, sizeof(t));
+        t.checksum = detail::trace_checksum(wrong.data() + t.indexOffset,
+                                            indexBytes + offsetof(detail::trace_file_trailer, checksum));
+        std::memcpy(tail, &t, sizeof(t));
+        write_file(path, wrong.data(), wrong.size());
+        REQUIRE(reader.open(path.c_str()));
+        REQUIRE(reader.complete() == (more == 1));
+        REQUIRE(reader.size() == steps.size() + (more == 1));
+        REQUIRE_FALSE(reader.read(steps.size(), r));
+        REQUIRE(reader.read(steps.size() - 2, 4, read.data()) == 2);
+        REQUIRE(reader.read(steps.size() - 1, r));
+        REQUIRE(same(r, steps.back()));
+        reader.close();
+    }
+
+    // not a trace file.
+    write_file(path, bytes.data() + 8, bytes.size() - 8);
+    REQUIRE_FALSE(reader.open(path.c_str()));
+    REQUIRE_FALSE(reader.open((path + ".none").c_str()));
+
+    // a block too large for its 32-bit size.
+    calc_trace_writer writer;
+    REQUIRE_FALSE(writer.open(path.c_str(), 400000000));
+    REQUIRE_FALSE(writer.is_open());
+
+    std::remove(path.c_str());
+}
+
+// The throughput of writing a 10 GB trace, and the latency of seeking a
+// step in it at random, which is mostly of the page faults.
+// ALGOVISU_TRACE_FILE_BYTES sets the size, and the file is in P_tmpdir.
+TEST_CASE("calc trace file seek latency", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    std::uint64_t targetBytes = std::uint64_t(10) << 30;
+    if (char const * s = std::getenv("ALGOVISU_TRACE_FILE_BYTES")) {
+        targetBytes = std::strtoull(s, nullptr, 10);
+    }
+    std::string const path = trace_path("trace_bench");
+    std::vector<calc_step_record> const steps = make_steps(std::size_t(1) << 24, std::size_t(1) << 20, 7);
+
+    calc_trace_writer writer;
+    REQUIRE(writer.open(path.c_str()));
+    auto start = clock_t::now();
+    while (writer.file_size() < targetBytes) {
+        REQUIRE(writer.append(steps.data(), steps.size()));
+    }
+    std::uint64_t const stepCount = writer.size();
+    REQUIRE(writer.close());
+    double const writeSeconds = std::chrono::duration<double>(clock_t::now() - start).count();
+    std::uint64_t const fileBytes = read_file_size(path);
+    std::printf("write: %llu steps, %.2f GB in %.1f s, %.0f MB/s, %.1f Msteps/s, %.2f bytes/step (raw %zu)\n",
+                static_cast<unsigned long long>(stepCount), double(fileBytes) / double(1 << 30), writeSeconds,
+                double(fileBytes) / writeSeconds / double(1 << 20), double(stepCount) / writeSeconds / 1e6,
+                double(fileBytes) / double(stepCount), sizeof(calc_step_record));
+
+    double const cyclesPerNs = cycles_per_nanosecond();
+    calc_trace_reader reader;
+    start = clock_t::now();
+    REQUIRE(reader.open(path.c_str()));
+    std::printf("open: %.1f us\n", std::chrono::duration<double, std::micro>(clock_t::now() - start).count());
+    REQUIRE(reader.size() == stepCount);
+
+    std::uint64_t x = 11;
+    calc_step_record r;
+    auto seek = [&](latency_histogram & latency, std::uint64_t range, int count) {
+        for (int i = 0; i < count; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            std::uint64_t const step = x % range;
+            std::uint64_t const begin = read_cycle_counter();
+            bool const ok = reader.read(step, r);
+            latency.record(read_cycle_counter() - begin);
+            REQUIRE(ok);
+            REQUIRE(same(r, steps[step % steps.size()]));
+        }
+    };
+    latency_histogram cold, warm, sameBlock;
+    seek(cold, stepCount, 20000);                   // the first touches, over the whole file.
+    seek(warm, std::uint64_t(1) << 20, 200000);      // verified and in the page cache.
+    for (int i = 0; i < 200000; ++i) {
+        std::uint64_t const step = (std::uint64_t(1) << 20) + (i * 7 % 4096);
+        std::uint64_t const begin = read_cycle_counter();
+        reader.read(step, r);
+        sameBlock.record(read_cycle_counter() - begin);
+    }
+    dump_latency_text_header(std::cout);
+    auto dump = [&](char const * name, latency_histogram const& h) {
+        latency_summary summary;
+        summary.merge(h);
+        dump_latency_text(std::cout, name, summary, cyclesPerNs);
+    };
+    dump("cold seek", cold);
+    dump("warm seek", warm);
+    dump("same block", sameBlock);
+
+    // the sequential decoding.
+    std::vector<calc_step_record> out(std::size_t(1) << 20);
+    start = clock_t::now();
+    std::uint64_t read = 0;
+    for (std::uint64_t step = 0; step < std::min<std::uint64_t>(stepCount, std::uint64_t(1) << 28); step += out.size()) {
+        read += reader.read(step, out.size(), out.data());
+    }
+    double const readSeconds = std::chrono::duration<double>(clock_t::now() - start).count();
+    std::printf("sequential read: %.1f Msteps/s\n", double(read) / readSeconds / 1e6);
+
+    reader.close();
+    std::remove(path.c_str());
+}
+#endif
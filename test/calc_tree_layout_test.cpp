@@ -0,0 +1,221 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "calc_tree_layout.h"
+#include "calc_test_helpers.h"
+
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+    using tools::make_tree;
+
+    // The subtree at root replaced by another tree.
+    calc_ast replace_subtree(calc_ast const& ast, std::uint32_t first, std::uint32_t root, calc_ast const& sub)
+    {
+        std::uint32_t const oldEnd = root + 1;
+        std::uint32_t const newEnd = first + static_cast<std::uint32_t>(sub.size());
+        calc_ast result;
+        result.nodes.assign(ast.nodes.begin(), ast.nodes.begin() + first);
+        for (calc_node node : sub.nodes) {
+            node.lhs += first;
+            node.rhs += first;
+            result.nodes.push_back(node);
+        }
+        for (std::size_t i = oldEnd; i < ast.size(); ++i) {
+            calc_node node = ast.nodes[i];
+            if (node.op != calc_op::literal) {
+                node.lhs = node.lhs >= oldEnd - 1 ? node.lhs + newEnd - oldEnd : node.lhs;
+                node.rhs = node.rhs >= oldEnd - 1 ? node.rhs + newEnd - oldEnd : node.rhs;
+            }
+            result.nodes.push_back(node);
+        }
+        return result;
+    }
+
+    // The first node of the subtree at root.
+    std::uint32_t first_of(calc_ast const& ast, std::uint32_t root)
+    {
+        while (ast.nodes[root].op != calc_op::literal) {
+            root = ast.nodes[root].lhs;
+        }
+        return root;
+    }
+
+    // Every parent at the middle of its children, one level above, and the
+    // nodes of a level in order and apart by the separation at least.
+    void require_tidy(calc_ast const& ast, calc_tree_layout const& layout)
+    {
+        std::vector<double> last;
+        bool tidy = true;
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            calc_node const& node = ast.nodes[i];
+            std::uint32_t const depth = layout.depth(i);
+            if (node.op != calc_op::literal) {
+                tidy = tidy && layout.depth(node.lhs) == depth + 1 && layout.depth(node.rhs) == depth + 1
+                            && std::abs(layout.x(i) * 2 - layout.x(node.lhs) - layout.x(node.rhs)) < 1e-6;
+            }
+            // the nodes of a level are post-ordered from the left.
+            if (depth >= last.size()) {
+                last.resize(depth + 1, -1e300);
+            }
+            tidy = tidy && layout.x(i) - last[depth] >= layout.separation() - 1e-6;
+            last[depth] = layout.x(i);
+        }
+        REQUIRE(tidy);
+        REQUIRE(layout.x(ast.root()) == 0);
+        REQUIRE(layout.depth(ast.root()) == 0);
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc tree layout", "[algovisu]")
+{
+    calc_tree_layout layout;
+    calc_ast ast = parse("1 + 2");
+    layout.layout(ast);
+    REQUIRE(layout.x(0) == -0.5);
+    REQUIRE(layout.x(1) == 0.5);
+    REQUIRE(layout.depth(1) == 1);
+    REQUIRE(layout.height(2) == 1);
+
+    // the subtrees as near as the contours allow.
+    ast = parse("(1 * 2 - 3) + (4 - 5 * 6)");
+    layout.layout(ast);
+    require_tidy(ast, layout);
+    REQUIRE(layout.x(4) == -1);         // the left -
+    REQUIRE(layout.x(9) == 1);          // the right -
+    REQUIRE(layout.x(2) == -1.5);       // the left *
+    REQUIRE(layout.x(3) == -0.5);       // 3 and 4 are apart by the separation
+    REQUIRE(layout.x(5) == 0.5);
+    REQUIRE(layout.x(8) == 1.5);        // the right *
+    REQUIRE(layout.x(1) == -1);
+    REQUIRE(layout.x(6) == 1);
+    REQUIRE(layout.depth(1) == 3);
+    REQUIRE(layout.depth(6) == 3);
+
+    // a shorter subtree's contour goes on along the taller one's, by a thread.
+    ast = parse("((1 + 2) + 3) + (4 + (5 + (6 + 7)))");
+    layout.layout(ast);
+    require_tidy(ast, layout);
+    ast = parse("(1 + (2 + (3 + (4 + 5)))) + ((6 + 7) + 8)");
+    layout.layout(ast);
+    require_tidy(ast, layout);
+
+    for (std::uint64_t seed = 1; seed < 50; ++seed) {
+        ast = make_tree(seed * 37, seed);
+        layout.layout(ast);
+        require_tidy(ast, layout);
+    }
+
+    // a chain of 1M nodes, with no recursion.
+    std::string chain = "1";
+    for (int i = 0; i < 500000; ++i) {
+        chain += "+2";
+    }
+    ast = parse(chain);
+    layout.layout(ast);
+    require_tidy(ast, layout);
+    REQUIRE(layout.height(ast.root()) == 500000);
+}
+
+TEST_CASE("calc tree layout update", "[algovisu]")
+{
+    calc_tree_layout layout, fresh;
+    calc_ast ast = make_tree(5000, 3);
+    layout.layout(ast);
+
+    std::uint64_t x = 9;
+    for (int i = 0; i < 300; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        std::uint32_t const root = static_cast<std::uint32_t>(x % ast.size());
+        std::uint32_t const first = first_of(ast, root);
+        // the subtrees of about the same size, or not.
+        std::size_t const oldSteps = (root - first) / 2;
+        std::size_t const steps = i % 3 == 0 ? oldSteps : (x >> 20) % 40;
+        calc_ast const sub = make_tree(steps, x >> 8);
+        ast = replace_subtree(ast, first, root, sub);
+        layout.update(ast, first, root + 1, first + static_cast<std::uint32_t>(sub.size()));
+
+        fresh.layout(ast);
+        bool same = true;
+        for (std::uint32_t j = 0; j < ast.size(); ++j) {
+            same = same && std::abs(layout.x(j) - fresh.x(j)) < 1e-6 && layout.depth(j) == fresh.depth(j)
+                        && layout.height(j) == fresh.height(j);
+        }
+        INFO(i);
+        REQUIRE(same);
+    }
+    require_tidy(ast, layout);
+}
+
+// The layout time by the size, and of an update of a small subtree.
+TEST_CASE("calc tree layout float bounds", "[algovisu]")
+{
+    // the half units are lost to the rounding to the nearest from 2^22.
+    double const x = 4194304.75;
+    REQUIRE(static_cast<float>(x + 0.5) < x + 0.5);
+    REQUIRE(calc_float_above(x + 0.5) == 4194305.5f);
+    REQUIRE(calc_float_below(x - 0.5) == 4194304.0f);
+
+    std::uint64_t seed = 11;
+    for (int i = 0; i < 10000; ++i) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        double const v = static_cast<double>(seed % (std::uint64_t(1) << 34)) / 4 - (std::uint64_t(1) << 31);
+        float const below = calc_float_below(v);
+        float const above = calc_float_above(v);
+        REQUIRE(below <= v);
+        REQUIRE(above >= v);
+        REQUIRE(std::nextafter(below, std::numeric_limits<float>::infinity()) > v);
+        REQUIRE(std::nextafter(above, -std::numeric_limits<float>::infinity()) < v);
+    }
+}
+
+TEST_CASE("calc tree layout time", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    calc_tree_layout layout;
+    for (std::size_t steps = 500; steps <= 5000000; steps *= 10) {
+        calc_ast ast = make_tree(steps, 7);
+        layout.layout(ast);
+        int const rounds = steps < 500000 ? 100 : 3;
+        auto start = clock_t::now();
+        for (int r = 0; r < rounds; ++r) {
+            layout.layout(ast);
+        }
+        double const layoutNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count() / rounds;
+
+        // a subtree of 15 nodes in the middle, of the same size and of another.
+        std::uint32_t root = static_cast<std::uint32_t>(ast.size() / 2);
+        while (ast.nodes[root].op == calc_op::literal || root - first_of(ast, root) < 14) {
+            ++root;
+        }
+        std::uint32_t first = first_of(ast, root);
+        calc_ast const sub = make_tree((root - first) / 2, 3);
+        ast = replace_subtree(ast, first, root, sub);
+        start = clock_t::now();
+        layout.update(ast, first, root + 1, first + static_cast<std::uint32_t>(sub.size()));
+        double const sameNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+        calc_ast const larger = make_tree(sub.size(), 5);
+        root = first + static_cast<std::uint32_t>(sub.size()) - 1;
+        ast = replace_subtree(ast, first, root, larger);
+        start = clock_t::now();
+        layout.update(ast, first, root + 1, first + static_cast<std::uint32_t>(larger.size()));
+        double const largerNs = std::chrono::duration<double, std::nano>(clock_t::now() - start).count();
+
+        std::printf("%9zu nodes: layout %10.3f ms, %5.1f ns/node; update %8.1f us, resized %8.1f us\n",
+                    ast.size(), layoutNs / 1e6, layoutNs / double(ast.size()), sameNs / 1e3, largerNs / 1e3);
+    }
+}
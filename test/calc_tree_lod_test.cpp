@@ -0,0 +1,244 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "calc_tree_lod.h"
+#include "calc_test_helpers.h"
+#include "cycle_clock.h"
+#include "latency_histogram.h"
+
+
+namespace
+{
+    using namespace algovisu;
+    using tools::parse;
+    using tools::make_tree;
+
+    // the parents of the nodes, or none for the root.
+    std::vector<std::uint32_t> parents_of(calc_ast const& ast)
+    {
+        std::vector<std::uint32_t> parents(ast.size(), calc_lod_item::none);
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            if (ast.nodes[i].op != calc_op::literal) {
+                parents[ast.nodes[i].lhs] = parents[ast.nodes[i].rhs] = i;
+            }
+        }
+        return parents;
+    }
+
+    bool inside(calc_tree_layout const& layout, calc_viewport const& v, std::uint32_t i)
+    {
+        double const x = layout.x(i);
+        double const depth = layout.depth(i);
+        return x >= v.left - 0.5 && x <= v.right() + 0.5 && depth >= v.top - 0.5 && depth <= v.bottom() + 0.5;
+    }
+
+    // The nodes in the viewport, by looking at every one.
+    std::size_t visible(calc_ast const& ast, calc_tree_layout const& layout, calc_viewport const& v)
+    {
+        std::size_t n = 0;
+        for (std::uint32_t i = 0; i < ast.size(); ++i) {
+            n += inside(layout, v, i);
+        }
+        return n;
+    }
+}   // un-named namespace
+
+
+TEST_CASE("calc tree lod", "[algovisu]")
+{
+    calc_ast const ast = parse("(1 * 2 - 3) + (4 - 5 * 6)");
+    calc_tree_layout layout;
+    layout.layout(ast);
+    calc_tree_lod lod;
+    lod.build(ast, layout);
+
+    calc_subtree_summary s = lod.summary(ast.root());
+    REQUIRE(s.count == 11);
+    REQUIRE(s.depth == 0);
+    REQUIRE(s.height == 3);
+    REQUIRE(s.ops == (std::array<std::uint32_t, 4>{ 1, 2, 2, 0 }));
+    REQUIRE(s.minLiteral == 1);
+    REQUIRE(s.maxLiteral == 6);
+    REQUIRE(s.minX == -2.5);        // the half units around 1 and 6
+    REQUIRE(s.maxX == 2.5);
+    s = lod.summary(4);             // 1 * 2 - 3
+    REQUIRE(s.count == 5);
+    REQUIRE(s.depth == 1);
+    REQUIRE(s.ops == (std::array<std::uint32_t, 4>{ 0, 1, 1, 0 }));
+    REQUIRE(s.maxLiteral == 3);
+    s = lod.summary(5);
+    REQUIRE(s.count == 1);
+    REQUIRE(s.height == 0);
+    REQUIRE(s.minLiteral == 4);
+
+    // every node, the parents first.
+    auto const parents = parents_of(ast);
+    std::vector<calc_lod_item> items;
+    calc_viewport viewport = fit_calc_viewport(ast, layout, 400, 300);
+    lod.query(viewport, 100, items);
+    REQUIRE(items.size() == 11);
+    std::vector<bool> seen(ast.size());
+    for (calc_lod_item const& item : items) {
+        REQUIRE_FALSE(item.summary);
+        REQUIRE(item.parent == parents[item.node]);
+        REQUIRE((item.parent == calc_lod_item::none || seen[item.parent]));
+        seen[item.node] = true;
+    }
+
+    // the widest subtrees are expanded first.
+    lod.query(viewport, 5, items);
+    REQUIRE(items.size() == 5);
+    REQUIRE(items[0].node == ast.root());
+    REQUIRE_FALSE(items[0].summary);
+    std::size_t summaries = 0;
+    for (calc_lod_item const& item : items) {
+        summaries += item.summary;
+    }
+    REQUIRE(summaries == 2);
+
+    // the subtrees of the root are 3 units wide.
+    viewport.minPixels = viewport.scale * 3.5;
+    lod.query(viewport, 100, items);
+    REQUIRE(items.size() == 3);
+    REQUIRE(items[1].summary);
+    REQUIRE(items[2].summary);
+
+    viewport.left = 10;
+    lod.query(viewport, 100, items);
+    REQUIRE(items.empty());
+}
+
+TEST_CASE("calc tree lod query", "[algovisu]")
+{
+    calc_ast const ast = make_tree(20000, 3);
+    calc_tree_layout layout;
+    layout.layout(ast);
+    calc_tree_lod lod;
+    lod.build(ast, layout);
+    auto const parents = parents_of(ast);
+    std::vector<calc_lod_item> items;
+
+    // the culled subtrees hide no node in the viewport.
+    std::uint64_t x = 5;
+    for (int i = 0; i < 50; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        calc_viewport viewport;
+        viewport.scale = 4 + double(x % 40);
+        viewport.left = layout.x(static_cast<std::uint32_t>(x % ast.size())) - double((x >> 8) % 50);
+        viewport.top = double((x >> 16) % layout.height(ast.root()));
+        lod.query(viewport, ast.size(), items);
+        bool parented = true;
+        for (calc_lod_item const& item : items) {
+            parented = parented && !item.summary && item.parent == parents[item.node];
+        }
+        INFO(i);
+        REQUIRE(items.size() == visible(ast, layout, viewport));
+        REQUIRE(parented);
+
+        // the narrowest ancestors above the viewport are the summaries.
+        viewport.minPixels = 40;
+        lod.query(viewport, ast.size(), items);
+        std::vector<bool> covered(ast.size());
+        bool widest = true;
+        for (calc_lod_item const& item : items) {
+            calc_subtree_summary const s = lod.summary(item.node);
+            std::uint32_t const first = item.summary ? item.node + 1 - s.count : item.node;
+            for (std::uint32_t j = first; j <= item.node; ++j) {
+                covered[j] = true;
+            }
+            if (item.summary && item.parent != calc_lod_item::none) {
+                calc_subtree_summary const p = lod.summary(item.parent);
+                widest = widest && (s.maxX - s.minX) * viewport.scale < 40 && (p.maxX - p.minX) * viewport.scale >= 40;
+            }
+        }
+        bool all = true;
+        for (std::uint32_t j = 0; j < ast.size(); ++j) {
+            all = all && (!inside(layout, viewport, j) || covered[j]);
+        }
+        REQUIRE(widest);
+        REQUIRE(all);
+    }
+
+    // every node is drawn, or in a summary, within the items.
+    calc_viewport viewport = fit_calc_viewport(ast, layout, 1920, 1080);
+    for (std::size_t maxItems : { 1, 2, 3, 10, 100, 1000, 10000 }) {
+        lod.query(viewport, maxItems, items);
+        std::size_t nodes = 0;
+        for (calc_lod_item const& item : items) {
+            nodes += item.summary ? lod.summary(item.node).count : 1;
+        }
+        INFO(maxItems);
+        REQUIRE(items.size() <= maxItems);
+        REQUIRE(items.size() + 3 > std::min(maxItems, ast.size()));
+        REQUIRE(nodes == ast.size());
+    }
+    viewport.minPixels = 4;
+    lod.query(viewport, ast.size(), items);
+    std::size_t nodes = 0;
+    for (calc_lod_item const& item : items) {
+        calc_subtree_summary const s = lod.summary(item.node);
+        nodes += item.summary ? s.count : 1;
+        REQUIRE((!item.summary || (s.maxX - s.minX) * viewport.scale < 4));
+    }
+    REQUIRE(nodes == ast.size());
+    REQUIRE(items.size() < ast.size() / 2);
+}
+
+// The query latency by the zoom on 10M nodes, with the items and the
+// subtrees expanded.
+TEST_CASE("calc tree lod query latency", "[.][benchmark]")
+{
+    using clock_t = std::chrono::steady_clock;
+
+    calc_ast const ast = make_tree(5000000, 7);
+    calc_tree_layout layout;
+    layout.layout(ast);
+    calc_tree_lod lod;
+    auto const start = clock_t::now();
+    lod.build(ast, layout);
+    double const buildMs = std::chrono::duration<double, std::milli>(clock_t::now() - start).count();
+    std::printf("%zu nodes, height %u, build %.1f ms, %.1f MB\n", ast.size(), layout.height(ast.root()), buildMs,
+                double(lod.memory_bytes()) / double(1 << 20));
+
+    double const cyclesPerNs = cycles_per_nanosecond();
+    calc_viewport const fit = fit_calc_viewport(ast, layout, 1920, 1080);
+    std::vector<calc_lod_item> items;
+    dump_latency_text_header(std::cout);
+    for (double scale : { fit.scale, 0.05, 1.0, 4.0, 24.0 }) {
+        latency_histogram h;
+        std::size_t maxItemCount = 0, maxExpanded = 0;
+        std::uint64_t x = 11;
+        for (int i = 0; i < 2000; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            // around a node at random.
+            calc_viewport viewport = fit;
+            viewport.scale = scale;
+            viewport.minPixels = 4;
+            std::uint32_t const node = static_cast<std::uint32_t>(x % ast.size());
+            if (scale != fit.scale) {
+                viewport.left = layout.x(node) - viewport.width / scale / 2;
+                viewport.top = layout.depth(node) - viewport.height / scale / 2;
+            }
+            std::uint64_t const begin = read_cycle_counter();
+            lod.query(viewport, 10000, items);
+            h.record(read_cycle_counter() - begin);
+            maxItemCount = std::max(maxItemCount, items.size());
+            maxExpanded = std::max(maxExpanded, lod.last_expanded());
+        }
+        latency_summary summary;
+        summary.merge(h);
+        char name[64];
+        std::snprintf(name, sizeof(name), "%g px/unit", scale);
+        dump_latency_text(std::cout, name, summary, cyclesPerNs);
+        std::printf("    items %zu, expanded %zu at most\n", maxItemCount, maxExpanded);
+    }
+}
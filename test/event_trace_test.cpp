@@ -0,0 +1,238 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+
+#include "event_trace.h"
+#include "calc_trace.h"
+
+
+namespace
+{
+    // Traces 10 events in a new thread with a 4 events buffer.
+    std::vector<algovisu::trace_record> trace_in_small_buffer(algovisu::trace_overflow overflow)
+    {
+        using namespace algovisu;
+
+        std::uint16_t const name = trace_name("overflow");
+        std::uint32_t tid = 0;
+
+        configure_trace(4, overflow);
+        std::thread t([&] {
+            for (std::uint32_t i = 0; i < 10; ++i) {
+                trace_event(name, trace_phase::begin, i);
+            }
+            tid = detail::local_trace_ring().tid();
+        });
+        t.join();
+        configure_trace(std::size_t(1) << 20, trace_overflow::drop_newest);
+
+        for (auto & thread : drain_trace()) {
+            if (thread.tid == tid) {
+                return thread.records;
+            }
+        }
+        return {};
+    }
+}   // un-named namespace
+
+
+TEST_CASE("trace buffer overflow", "[algovisu]")
+{
+    using namespace algovisu;
+
+    drain_trace();
+
+    std::uint64_t dropped = trace_dropped_events();
+    auto records = trace_in_small_buffer(trace_overflow::drop_newest);
+    REQUIRE(records.size() == 4);
+    REQUIRE(records.front().arg == 0);
+    REQUIRE(records.back().arg == 3);
+    REQUIRE(trace_dropped_events() - dropped == 6);
+
+    dropped = trace_dropped_events();
+    records = trace_in_small_buffer(trace_overflow::drop_oldest);
+    REQUIRE(records.size() == 4);
+    REQUIRE(records.front().arg == 6);
+    REQUIRE(records.back().arg == 9);
+    REQUIRE(trace_dropped_events() - dropped == 6);
+
+    for (std::size_t i = 1; i < records.size(); ++i) {
+        REQUIRE(records[i - 1].ts <= records[i].ts);
+    }
+}
+
+TEST_CASE("trace spans of the calc pipeline", "[algovisu]")
+{
+    using namespace algovisu;
+
+    drain_trace();
+
+    calc_pipeline<calc_instruments<stage_tracer, rule_tracer, step_tracer>> pipeline;
+    calc_value_t result = 0;
+    REQUIRE(pipeline.run("1 - 2 * 3", result));
+    REQUIRE(result == -5);
+
+    auto threads = drain_trace();
+    REQUIRE(threads.size() == 1);
+
+    std::vector<std::string> names;
+    int depth = 0;
+    for (auto const& r : threads[0].records) {
+        if (r.phase == trace_phase::begin) {
+            names.push_back(trace_name_of(r.name));
+            ++depth;
+        } else {
+            --depth;
+        }
+        REQUIRE(depth >= 0);
+    }
+    REQUIRE(depth == 0);
+    REQUIRE(names.front() == "lex");
+    REQUIRE(names[1] == "parse");
+    REQUIRE(names[2] == "additive_expr_");
+    REQUIRE(names[names.size() - 3] == "evaluate");
+    REQUIRE(names[names.size() - 2] == "mul");      // node 3
+    REQUIRE(names.back() == "sub");                 // node 4
+    REQUIRE(threads[0].records[threads[0].records.size() - 2].arg == 4);   // the end of "sub"
+
+    std::ostringstream json;
+    write_trace_json(json, threads);
+    REQUIRE(json.str().find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0);
+    REQUIRE(json.str().find("{\"name\":\"lex\",\"ph\":\"B\",\"ts\":0.000,\"pid\":1,") != std::string::npos);
+    REQUIRE(json.str().find("{\"name\":\"mul\",\"ph\":\"E\",") != std::string::npos);
+    REQUIRE(json.str().find("\"args\":{\"arg\":4}") != std::string::npos);
+
+    std::ostringstream proto;
+    write_trace_perfetto(proto, threads);
+    std::string const bytes = proto.str();
+    REQUIRE(bytes.size() > 0);
+    REQUIRE(bytes[0] == 0x0a);      // Trace.packet, length delimited
+    REQUIRE(bytes.find("additive_expr_") != std::string::npos);
+
+    // drained
+    REQUIRE(drain_trace().empty());
+}
+
+TEST_CASE("trace names are escaped in the JSON", "[algovisu]")
+{
+    using namespace algovisu;
+
+    drain_trace();
+
+    std::uint16_t const name = trace_name("say \"hi\"\\\n\x01");
+    std::thread t([&] {
+        trace_span span(name);
+    });
+    t.join();
+
+    std::ostringstream json;
+    write_trace_json(json, drain_trace());
+    REQUIRE(json.str().find("{\"name\":\"say \\\"hi\\\"\\\\\\n\\u0001\",\"ph\":\"B\",") != std::string::npos);
+    REQUIRE(json.str().find("\\u0001\",\"ph\":\"E\",") != std::string::npos);
+}
+
+TEST_CASE("trace timestamps keep the nanoseconds", "[algovisu]")
+{
+    using namespace algovisu;
+
+    // a span of 0.5us, 1.5s after the first event.
+    double const cyclesPerUs = cycles_per_nanosecond() * 1000.0;
+    std::uint64_t const base = 1000;
+    auto at = [&](double us) { return base + static_cast<std::uint64_t>(std::llround(us * cyclesPerUs)); };
+    std::uint16_t const name = trace_name("late");
+    std::vector<trace_thread_events> threads = { { 7, {
+        trace_record{ base, name, trace_phase::begin, 0 },
+        trace_record{ base, name, trace_phase::end, 0 },
+        trace_record{ at(1500000.25), name, trace_phase::begin, 0 },
+        trace_record{ at(1500000.75), name, trace_phase::end, 0 }
+    } } };
+
+    // the stream is left as it was.
+    std::ostringstream json;
+    json << std::scientific << std::setprecision(2);
+    write_trace_json(json, threads);
+    json << 0.5;
+
+    REQUIRE(json.str() ==
+            "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"name\":\"late\",\"ph\":\"B\",\"ts\":0.000,\"pid\":1,\"tid\":7},\n"
+            "{\"name\":\"late\",\"ph\":\"E\",\"ts\":0.000,\"pid\":1,\"tid\":7},\n"
+            "{\"name\":\"late\",\"ph\":\"B\",\"ts\":1500000.250,\"pid\":1,\"tid\":7},\n"
+            "{\"name\":\"late\",\"ph\":\"E\",\"ts\":1500000.750,\"pid\":1,\"tid\":7}\n"
+            "]}\n"
+            "5.00e-01");
+}
+
+TEST_CASE("trace span cost", "[.][benchmark]")
+{
+    using namespace algovisu;
+
+    configure_trace(std::size_t(1) << 16, trace_overflow::drop_oldest);
+    std::uint16_t const name = trace_name("span");
+
+    using clock_t = std::chrono::steady_clock;
+    std::size_t const spans = 1000000;
+    auto best = clock_t::duration::max();
+    std::thread t([&] {
+        for (int i = 0; i < 10; ++i) {
+            auto start = clock_t::now();
+            for (std::size_t j = 0; j < spans; ++j) {
+                trace_span span(name, static_cast<std::uint32_t>(j));
+            }
+            best = std::min(best, clock_t::now() - start);
+        }
+    });
+    t.join();
+    configure_trace(std::size_t(1) << 20, trace_overflow::drop_newest);
+    drain_trace();
+
+    // a span is two TSC reads and the pushes.
+    auto bestTsc = clock_t::duration::max();
+    std::uint64_t sink = 0;
+    for (int i = 0; i < 10; ++i) {
+        auto start = clock_t::now();
+        for (std::size_t j = 0; j < spans; ++j) {
+            sink += read_cycle_counter();
+        }
+        bestTsc = std::min(bestTsc, clock_t::now() - start);
+    }
+
+    double const spanNs = std::chrono::duration<double, std::nano>(best).count() / spans;
+    double const tscNs = std::chrono::duration<double, std::nano>(bestTsc).count() / spans;
+    std::cout << "trace span: " << spanNs << " ns/span, "
+              << "TSC read: " << tscNs << " ns, "
+              << "the rest: " << spanNs - 2 * tscNs << " ns"
+              << (sink ? "\n" : " \n");
+
+    // the whole pipeline with all the tracers.
+    auto measure = [](auto & pipeline, std::string const& s) {
+        calc_value_t result = 0;
+        auto start = clock_t::now();
+        for (int i = 0; i < 1000; ++i) {
+            pipeline.run(s, result);
+        }
+        return clock_t::now() - start;
+    };
+    std::string const s = "10 * (20 + 5) - 10 / 2 + (1 + 2) * (3 - 4) / 5 - 6 * 7";
+    calc_pipeline<> plain;
+    calc_pipeline<calc_instruments<stage_tracer, rule_tracer, step_tracer>> traced;
+    auto plainBest = clock_t::duration::max();
+    auto tracedBest = clock_t::duration::max();
+    for (int i = 0; i < 20; ++i) {
+        plainBest = std::min(plainBest, measure(plain, s));
+        tracedBest = std::min(tracedBest, measure(traced, s));
+        drain_trace();
+    }
+    double const plainUs = std::chrono::duration<double, std::micro>(plainBest).count();
+    double const tracedUs = std::chrono::duration<double, std::micro>(tracedBest).count();
+    std::cout << "plain: " << plainUs << " us, "
+              << "traced: " << tracedUs << " us, "
+              << "overhead: " << (tracedUs / plainUs - 1.0) * 100.0 << " %\n";
+}
@@ -0,0 +1,105 @@
+#include "catch.hpp"
+
+#include <thread>
+#include <sstream>
+
+#include "latency_histogram.h"
+#include "thread_slots.h"
+
+
+TEST_CASE("latency buckets", "[algovisu]")
+{
+    using namespace algovisu;
+
+    // the small values have their own buckets.
+    for (std::uint64_t v = 0; v < latency_buckets::sub_bucket_count; ++v) {
+        REQUIRE(latency_buckets::index_of(v) == v);
+    }
+
+    REQUIRE(latency_buckets::index_of(32) == 32);
+    REQUIRE(latency_buckets::index_of(63) == 63);
+    REQUIRE(latency_buckets::index_of(64) == 64);
+    REQUIRE(latency_buckets::index_of(65) == 64);   // 64 and 65 share a bucket.
+    REQUIRE(latency_buckets::index_of(~std::uint64_t(0)) == latency_buckets::count - 1);
+
+    // every value is in the range of its bucket, within ~3% error.
+    for (std::uint64_t v : { 1ull, 100ull, 1000ull, 123456ull, 987654321ull, 1ull << 40 }) {
+        std::size_t const i = latency_buckets::index_of(v);
+        REQUIRE(latency_buckets::lower_bound_of(i) <= v);
+        REQUIRE(latency_buckets::upper_bound_of(i) >= v);
+        REQUIRE(latency_buckets::upper_bound_of(i) - latency_buckets::lower_bound_of(i) <= v / 32);
+        REQUIRE(latency_buckets::lower_bound_of(i + 1) == latency_buckets::upper_bound_of(i) + 1);
+    }
+}
+
+TEST_CASE("latency histogram percentiles", "[algovisu]")
+{
+    using namespace algovisu;
+
+    latency_histogram h;
+    for (std::uint64_t v = 1; v <= 1000; ++v) {
+        h.record(v);
+    }
+
+    latency_summary s;
+    s.merge(h);
+
+    REQUIRE(s.count() == 1000);
+    REQUIRE(s.min() == 1);
+    REQUIRE(s.max() == 1000);
+    REQUIRE(s.mean() == Approx(500.5));
+
+    REQUIRE(s.percentile(0.5) >= 500);
+    REQUIRE(s.percentile(0.5) <= 500 + 500 / 32);
+    REQUIRE(s.percentile(0.99) >= 990);
+    REQUIRE(s.percentile(1.0) == 1000);
+
+    h.reset();
+    latency_summary empty;
+    empty.merge(h);
+    REQUIRE(empty.count() == 0);
+    REQUIRE(empty.percentile(0.5) == 0);
+
+    std::ostringstream oss;
+    dump_latency_json(oss, s);
+    REQUIRE(oss.str().find("\"count\":1000") != std::string::npos);
+    REQUIRE(oss.str().find("\"buckets\":[[1,1,1],") != std::string::npos);
+}
+
+TEST_CASE("thread slots keep the data of exited threads", "[algovisu]")
+{
+    using namespace algovisu;
+
+    struct counter_slot
+    {
+        latency_histogram h;
+    };
+
+    static auto & slots = *new thread_slots<counter_slot>;
+
+    auto work = [](std::uint64_t v) {
+        for (int i = 0; i < 100; ++i) {
+            slots.local().h.record(v);
+        }
+    };
+
+    std::thread t1(work, 10);
+    std::thread t2(work, 20);
+    t1.join();
+    t2.join();
+    work(30);
+
+    latency_summary s;
+    slots.for_each([&s](counter_slot const& slot) { s.merge(slot.h); });
+
+    REQUIRE(s.count() == 300);
+    REQUIRE(s.min() == 10);
+    REQUIRE(s.max() == 30);
+    REQUIRE(s.sum() == 100 * (10 + 20 + 30));
+
+    // the slots of the exited threads are reused,
+    // so there are no more slots than the threads running at the same time.
+    std::size_t slotCount = 0;
+    slots.for_each([&slotCount](counter_slot const&) { ++slotCount; });
+    REQUIRE(slotCount <= 2);
+}
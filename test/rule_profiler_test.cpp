@@ -0,0 +1,224 @@
+#include "catch.hpp"
+
+#include <string>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+
+#include "calculator.h"
+#include "rule_profiler.h"
+#include "debug_utility.h"
+
+
+namespace
+{
+    using lexer_impl_t = algovisu::lex::lexertl::lexer<>;
+    using lexer_def_t = algovisu::calc_token<lexer_impl_t>;
+
+    template <typename Grammar>
+    bool parse_with(lexer_def_t const& tokens, Grammar const& calc, std::string const& s)
+    {
+        char const * pBegin = s.data();
+        char const * pEnd = pBegin + s.size();
+
+        auto tokenBegin = tokens.begin(pBegin, pEnd);
+        auto tokenEnd = tokens.end();
+
+        return tools::test_phrase_parser(
+                    tokenBegin, tokenEnd,
+                    calc,
+                    algovisu::qi::in_state("WS")[tokens.self]
+               );
+    }
+
+    algovisu::rule_profile_entry find_entry(std::string const& name)
+    {
+        for (auto const& e : algovisu::collect_rule_profile()) {
+            if (e.name == name) {
+                return e;
+            }
+        }
+        return {};
+    }
+}   // un-named namespace
+
+
+TEST_CASE("disabled rule profiler is the plain grammar", "[algovisu]")
+{
+    using namespace algovisu;
+
+    // the profiled rules are registered, so the disabled ones would be seen.
+    {
+        lexer_def_t tokens;
+        calc_grammar<lexer_def_t, exact_rule_profiler> calc{ tokens };
+        REQUIRE(parse_with(tokens, calc, "1 + 2"));
+    }
+    reset_rule_profile();
+
+    // nothing is counted for no_rule_profiler.
+    lexer_def_t tokens;
+    calc_grammar<lexer_def_t, no_rule_profiler> calc{ tokens };
+    REQUIRE(parse_with(tokens, calc, "10 * (20 + 5) - 10 / 2"));
+    REQUIRE_FALSE(parse_with(tokens, calc, "10 * (20 + "));
+    auto const entries = collect_rule_profile();
+    REQUIRE_FALSE(entries.empty());
+    for (auto const& e : entries) {
+        REQUIRE(e.calls == 0);
+        REQUIRE(e.backtracks == 0);
+        REQUIRE(e.cycles == 0);
+    }
+}
+
+TEST_CASE("rule profiler counts rule calls", "[algovisu]")
+{
+    using namespace algovisu;
+
+    lexer_def_t tokens;
+    calc_grammar<lexer_def_t, exact_rule_profiler> calc{ tokens };
+
+    reset_rule_profile();
+
+    REQUIRE(parse_with(tokens, calc, "10 * (20 + 5) - 10 / 2"));
+
+    auto additive = find_entry("additive_expr_");
+    auto multiplicative = find_entry("multiplicative_expr_");
+    auto factor = find_entry("factor_");
+
+    REQUIRE(additive.calls == 2);       // the whole expression and (20 + 5)
+    REQUIRE(multiplicative.calls == 4); // 10 * (20 + 5), 20, 5 and 10 / 2
+    REQUIRE(factor.calls == 6);
+
+    REQUIRE(additive.backtracks == 0);
+    REQUIRE(multiplicative.backtracks == 0);
+    REQUIRE(factor.backtracks == 0);
+
+    // the nested rules are included in the outer rule's cycles.
+    REQUIRE(additive.cycles >= multiplicative.self_cycles);
+    REQUIRE(additive.cycles >= additive.self_cycles);
+
+    //==========================================================================
+    // the dangling '+' makes multiplicative_expr_ and its factor_ fail.
+    reset_rule_profile();
+
+    REQUIRE_FALSE(parse_with(tokens, calc, "1 +"));
+
+    REQUIRE(find_entry("factor_").calls == 2);
+    REQUIRE(find_entry("factor_").backtracks == 1);
+    REQUIRE(find_entry("multiplicative_expr_").backtracks == 1);
+    REQUIRE(find_entry("additive_expr_").backtracks == 0);    // the '+' is just not consumed.
+}
+
+TEST_CASE("rule profiler keeps the counters of exited threads", "[algovisu]")
+{
+    using namespace algovisu;
+
+    lexer_def_t tokens;
+    calc_grammar<lexer_def_t, rule_profiler> calc{ tokens };
+
+    reset_rule_profile();
+
+    std::thread worker([&] {
+        parse_with(tokens, calc, "1 + 2");
+    });
+    worker.join();
+
+    REQUIRE(parse_with(tokens, calc, "3"));
+
+    REQUIRE(find_entry("factor_").calls == 3);
+
+    std::ostringstream oss;
+    dump_rule_profile(oss);
+    REQUIRE(oss.str().find("multiplicative_expr_") != std::string::npos);
+}
+
+TEST_CASE("sampled rule profiler estimates the exact profile", "[algovisu]")
+{
+    using namespace algovisu;
+
+    std::string s = "1";
+    for (int i = 0; i < 2000; ++i) {
+        s += " + 1";
+    }
+
+    lexer_def_t tokens;
+    calc_grammar<lexer_def_t, rule_profiler> sampled{ tokens };
+    calc_grammar<lexer_def_t, exact_rule_profiler> exact{ tokens };
+
+    auto profile = [&](auto const& calc) {
+        reset_rule_profile();
+        for (int i = 0; i < 50; ++i) {
+            parse_with(tokens, calc, s);
+        }
+        return collect_rule_profile();
+    };
+    auto selfRatio = [](rule_profile_entry const& e) {
+        return static_cast<double>(e.self_cycles) / e.cycles;
+    };
+
+    auto const exactProfile = profile(exact);
+    auto const sampledProfile = profile(sampled);
+    REQUIRE(exactProfile.size() == sampledProfile.size());
+
+    for (std::size_t i = 0; i < exactProfile.size(); ++i) {
+        auto const& e = exactProfile[i];
+        auto const& p = sampledProfile[i];
+        INFO(p.name);
+
+        REQUIRE(p.calls == e.calls);
+        REQUIRE(e.sampled == e.calls);
+        REQUIRE(p.sampled > 0);
+        REQUIRE(p.self_cycles <= p.cycles);
+
+        // the timer noise of a shared machine is allowed for.
+        REQUIRE(selfRatio(p) == Approx(selfRatio(e)).epsilon(0.25));
+        REQUIRE(static_cast<double>(p.cycles) == Approx(static_cast<double>(e.cycles)).epsilon(0.5));
+
+        // the rules calling the other rules have their own time apart from them.
+        if (p.name != "factor_") {
+            REQUIRE(p.sampled < p.calls);
+            REQUIRE(p.self_cycles < p.cycles);
+        }
+    }
+}
+
+TEST_CASE("rule profiler overhead", "[.][benchmark]")
+{
+    using namespace algovisu;
+
+    std::string s;
+    for (int i = 0; i < 2000; ++i) {
+        s += "(12 + 345) * 6 - 78 / (9 + 10) + ";
+    }
+    s += "1";
+
+    lexer_def_t tokens;
+    calc_grammar<lexer_def_t> plain{ tokens };
+    calc_grammar<lexer_def_t, rule_profiler> profiled{ tokens };
+    calc_grammar<lexer_def_t, exact_rule_profiler> exact{ tokens };
+
+    auto measure = [&](auto const& calc) {
+        using clock_t = std::chrono::steady_clock;
+        for (int i = 0; i < 5; ++i) {    // warm up
+            parse_with(tokens, calc, s);
+        }
+        auto best = clock_t::duration::max();
+        for (int i = 0; i < 30; ++i) {
+            auto start = clock_t::now();
+            parse_with(tokens, calc, s);
+            best = std::min(best, clock_t::now() - start);
+        }
+        return std::chrono::duration<double, std::micro>(best).count();
+    };
+
+    double const plainUs = measure(plain);
+    double const profiledUs = measure(profiled);
+    double const exactUs = measure(exact);
+
+    std::cout << "plain: " << plainUs << " us\n"
+              << "sampled: " << profiledUs << " us, "
+              << "overhead: " << (profiledUs / plainUs - 1.0) * 100.0 << " %\n"
+              << "exact: " << exactUs << " us, "
+              << "overhead: " << (exactUs / plainUs - 1.0) * 100.0 << " %\n";
+    dump_rule_profile(std::cout);
+}
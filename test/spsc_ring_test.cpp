@@ -0,0 +1,45 @@
+#include "catch.hpp"
+
+#include <cstdint>
+#include <thread>
+
+#include "spsc_ring.h"
+
+
+TEST_CASE("spsc ring", "[algovisu]")
+{
+    using namespace algovisu;
+
+    spsc_ring<int> ring(3);
+    REQUIRE(ring.capacity() == 4);
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(ring.try_push(i));
+    }
+    REQUIRE_FALSE(ring.try_push(4));
+    int v = -1;
+    REQUIRE(ring.try_pop(v));
+    REQUIRE(v == 0);
+    REQUIRE(ring.try_push(4));
+    for (int i = 1; i <= 4; ++i) {
+        REQUIRE(ring.try_pop(v));
+        REQUIRE(v == i);
+    }
+    REQUIRE_FALSE(ring.try_pop(v));
+
+    // in order through a small ring, with the producer blocked on the full ring.
+    spsc_ring<std::uint64_t> small(2);
+    std::uint64_t const n = 100000;
+    std::thread producer([&] {
+        for (std::uint64_t i = 0; i < n; ++i) {
+            small.push(i);
+        }
+    });
+    bool ordered = true;
+    for (std::uint64_t i = 0; i < n; ++i) {
+        std::uint64_t x = 0;
+        small.pop(x);
+        ordered = ordered && (x == i);
+    }
+    producer.join();
+    REQUIRE(ordered);
+}